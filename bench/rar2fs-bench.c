@@ -0,0 +1,284 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+/*
+ * Micro benchmark driver used by 'make bench'. Each sub-command performs
+ * a single measurement against a mounted file system and prints the result
+ * as a plain number on stdout, see run-bench.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#define SEQ_BLOCK (128 * 1024)
+#define MAX_NAMES 4096
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static double now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!
+ *****************************************************************************
+ * Read a file from start to end and return MB/s.
+ ****************************************************************************/
+static int bench_seq(const char *file)
+{
+        static char buf[SEQ_BLOCK];
+        double t0 = now();
+        off_t total = 0;
+        ssize_t n;
+        int fd;
+
+        fd = open(file, O_RDONLY);
+        if (fd == -1)
+                return -errno;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+                total += n;
+        close(fd);
+        if (n < 0)
+                return -EIO;
+        printf("%.2f\n", total / (now() - t0) / 1e6);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Issue 'count' reads of 'bs' bytes at random offsets and return MB/s.
+ * The sequence of offsets is fixed to make runs comparable.
+ ****************************************************************************/
+static int bench_rand(const char *file, int count, size_t bs)
+{
+        unsigned int seed = 69;
+        struct stat st;
+        off_t total = 0;
+        double t0;
+        char *buf;
+        int fd;
+        int i;
+
+        fd = open(file, O_RDONLY);
+        if (fd == -1)
+                return -errno;
+        if (fstat(fd, &st) == -1 || st.st_size <= (off_t)bs) {
+                close(fd);
+                return -EINVAL;
+        }
+        buf = malloc(bs);
+        if (!buf) {
+                close(fd);
+                return -ENOMEM;
+        }
+        t0 = now();
+        for (i = 0; i < count; i++) {
+                off_t off = ((off_t)rand_r(&seed) * RAND_MAX + rand_r(&seed)) %
+                                (st.st_size - bs);
+                ssize_t n = pread(fd, buf, bs, off);
+                if (n < 0)
+                        break;
+                total += n;
+        }
+        free(buf);
+        close(fd);
+        if (i < count)
+                return -EIO;
+        printf("%.2f\n", total / (now() - t0) / 1e6);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * List 'dir' once and return the time it took in ms.
+ ****************************************************************************/
+static int bench_readdir(const char *dir)
+{
+        double t0 = now();
+        DIR *dp = opendir(dir);
+        int n = 0;
+
+        if (!dp)
+                return -errno;
+        while (readdir(dp))
+                ++n;
+        closedir(dp);
+        printf("%.3f\n", (now() - t0) * 1e3);
+        return n ? 0 : -ENOENT;
+}
+
+/*!
+ *****************************************************************************
+ * Stat every entry of 'dir' for 'count' rounds and return ops/s.
+ ****************************************************************************/
+static int bench_getattr(const char *dir, int count)
+{
+        char *names[MAX_NAMES];
+        char path[4096];
+        struct dirent *ep;
+        struct stat st;
+        int n = 0;
+        long ops = 0;
+        double t0;
+        int i;
+        int j;
+        DIR *dp;
+
+        dp = opendir(dir);
+        if (!dp)
+                return -errno;
+        while ((ep = readdir(dp)) && n < MAX_NAMES) {
+                if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, ".."))
+                        continue;
+                names[n] = strdup(ep->d_name);
+                if (names[n])
+                        ++n;
+        }
+        closedir(dp);
+        if (!n)
+                return -ENOENT;
+
+        t0 = now();
+        for (i = 0; i < count; i++) {
+                for (j = 0; j < n; j++) {
+                        snprintf(path, sizeof(path), "%s/%s", dir, names[j]);
+                        if (!lstat(path, &st))
+                                ++ops;
+                }
+        }
+        printf("%.0f\n", ops / (now() - t0));
+        for (j = 0; j < n; j++)
+                free(names[j]);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Open and close 'file' 'count' times and return the mean latency in us.
+ ****************************************************************************/
+static int bench_open(const char *file, int count)
+{
+        double t0 = now();
+        int i;
+
+        for (i = 0; i < count; i++) {
+                int fd = open(file, O_RDONLY);
+                if (fd == -1)
+                        return -errno;
+                close(fd);
+        }
+        printf("%.1f\n", (now() - t0) / count * 1e6);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Print the value of counter 'name' as exported by the mount at 'root'.
+ ****************************************************************************/
+static int bench_metric(const char *root, const char *name)
+{
+        static char buf[65536];
+        char key[256];
+        ssize_t n;
+        char *p;
+
+        n = getxattr(root, "user.rar2fs.metrics", buf, sizeof(buf) - 1);
+        if (n == -1)
+                return -errno;
+        buf[n] = 0;
+        snprintf(key, sizeof(key), "\nrar2fs_%s ", name);
+        p = strstr(buf, key);
+        if (!p)
+                return -ENOENT;
+        printf("%llu\n", strtoull(p + strlen(key), NULL, 10));
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void usage(const char *prog)
+{
+        fprintf(stderr, "Usage: %s seq FILE\n"
+                        "       %s rand FILE COUNT BLOCKSIZE\n"
+                        "       %s readdir DIR\n"
+                        "       %s getattr DIR ROUNDS\n"
+                        "       %s open FILE COUNT\n"
+                        "       %s metric ROOT NAME\n",
+                        prog, prog, prog, prog, prog, prog);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int main(int argc, char *argv[])
+{
+        int res;
+
+        if (argc < 3) {
+                usage(argv[0]);
+                return 2;
+        }
+        if (!strcmp(argv[1], "seq"))
+                res = bench_seq(argv[2]);
+        else if (!strcmp(argv[1], "rand") && argc == 5)
+                res = bench_rand(argv[2], atoi(argv[3]), atol(argv[4]));
+        else if (!strcmp(argv[1], "readdir"))
+                res = bench_readdir(argv[2]);
+        else if (!strcmp(argv[1], "getattr") && argc == 4)
+                res = bench_getattr(argv[2], atoi(argv[3]));
+        else if (!strcmp(argv[1], "open") && argc == 4)
+                res = bench_open(argv[2], atoi(argv[3]));
+        else if (!strcmp(argv[1], "metric") && argc == 4)
+                res = bench_metric(argv[2], argv[3]);
+        else {
+                usage(argv[0]);
+                return 2;
+        }
+        if (res) {
+                fprintf(stderr, "%s %s: %s\n", argv[1], argv[2],
+                        strerror(-res));
+                return 1;
+        }
+        return 0;
+}
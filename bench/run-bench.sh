@@ -0,0 +1,167 @@
+#!/bin/sh
+#
+# Benchmark suite for rar2fs, normally started through 'make bench'.
+#
+# Usage: run-bench.sh RAR2FS BENCH [OUTPUT]
+#
+# Synthetic archives are created using rar(1) in a scratch directory,
+# which is then mounted. Results are written to OUTPUT (default
+# bench-results.json) as a JSON array of {case, metric, value, unit}
+# records. The following environment variables are honoured:
+#
+#   BENCH_SIZE     payload size in MiB (default 64)
+#   BENCH_DIR      scratch directory (default: a new one below TMPDIR)
+#   BENCH_OPTS     extra options passed to rar2fs
+#
+# Exits with 77 (skipped) if rar(1) or fusermount is not available and
+# with 1 if sequential reads of a multi-volume file did not trigger any
+# volume prefetch or if a member of a nested archive did not read back
+# unchanged.
+
+RAR2FS=${1:?rar2fs binary missing}
+BENCH=${2:?benchmark driver missing}
+OUT=${3:-bench-results.json}
+SIZE=${BENCH_SIZE:-64}
+
+RAR=$(command -v rar)
+FUSERMOUNT=$(command -v fusermount3 || command -v fusermount)
+if [ -z "$RAR" ] || [ -z "$FUSERMOUNT" ]; then
+        echo "rar and fusermount are required to run the benchmarks" >&2
+        exit 77
+fi
+case "$BENCH" in /*) ;; *) BENCH=$(pwd)/$BENCH ;; esac
+case "$RAR2FS" in /*) ;; *) RAR2FS=$(pwd)/$RAR2FS ;; esac
+case "$OUT" in /*) ;; *) OUT=$(pwd)/$OUT ;; esac
+
+WORK=${BENCH_DIR:-$(mktemp -d "${TMPDIR:-/tmp}/rar2fs-bench.XXXXXX")}
+SRC=$WORK/src
+MNT=$WORK/mnt
+mkdir -p "$SRC" "$MNT" "$WORK/data" || exit 1
+
+cleanup()
+{
+        "$FUSERMOUNT" -u "$MNT" 2>/dev/null
+        [ -z "$BENCH_DIR" ] && rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+#
+# Payloads: random data does not compress, text does
+#
+echo "generating ${SIZE}MiB payloads in $WORK"
+dd if=/dev/urandom of="$WORK/data/random.bin" bs=1048576 count="$SIZE" \
+        2>/dev/null || exit 1
+i=0
+while [ $i -lt 256 ]; do
+        seq -f "line %.0f of a highly compressible benchmark payload" \
+                $((i * 20000)) $((i * 20000 + 19999))
+        i=$((i + 1))
+done | head -c $((SIZE * 1048576)) > "$WORK/data/text.txt"
+mkdir -p "$WORK/data/small"
+i=0
+while [ $i -lt 200 ]; do
+        head -c 65536 "$WORK/data/text.txt" > "$WORK/data/small/f$i.txt"
+        i=$((i + 1))
+done
+
+mkrar()
+{
+        name=$1; shift
+        mkdir -p "$SRC/$name"
+        (cd "$WORK/data" && "$RAR" a -idq -ep1 "$@" "$SRC/$name/$name.rar") ||
+                exit 1
+}
+
+echo "creating archives"
+mkrar stored -m0 random.bin
+mkrar compressed -m3 text.txt
+mkrar solid -m3 -s small
+mkrar rNN -m0 -v16m -vn random.bin
+mkrar partN -m0 -v16m random.bin
+mkrar encrypted -m0 -psecret random.bin
+(cd "$WORK/data" && "$RAR" a -idq -m0 "$WORK/inner.rar" text.txt) || exit 1
+mkdir -p "$SRC/nested"
+(cd "$WORK" && "$RAR" a -idq -m0 "$SRC/nested/nested.rar" inner.rar) || exit 1
+# Compressed member inside a stored nested archive, which can not be read
+# through the header-only image and must be extracted instead
+mkdir -p "$WORK/mixed"
+(cd "$WORK/data" && "$RAR" a -idq -m3 "$WORK/mixed/inner.rar" text.txt) ||
+        exit 1
+mkdir -p "$SRC/nestedmix"
+(cd "$WORK/mixed" && "$RAR" a -idq -m0 "$SRC/nestedmix/nestedmix.rar" \
+        inner.rar) || exit 1
+printf '[/encrypted/encrypted.rar]\n\tpassword = "secret"\n' \
+        > "$SRC/.rarconfig"
+
+#
+# Results
+#
+first=1
+echo "[" > "$OUT"
+record()
+{
+        [ -n "$4" ] || return
+        [ $first -eq 0 ] && echo "," >> "$OUT"
+        first=0
+        printf '  {"case": "%s", "metric": "%s", "value": %s, "unit": "%s"}' \
+                "$1" "$2" "$4" "$3" >> "$OUT"
+        printf '%-12s %-16s %12s %s\n' "$1" "$2" "$4" "$3"
+}
+
+mount_fs()
+{
+        "$RAR2FS" --recursive $BENCH_OPTS "$SRC" "$MNT" || exit 1
+        i=0
+        while [ $i -lt 50 ] && ! mountpoint -q "$MNT" 2>/dev/null; do
+                sleep 0.1
+                i=$((i + 1))
+        done
+}
+
+umount_fs()
+{
+        "$FUSERMOUNT" -u "$MNT"
+        sleep 0.2
+}
+
+status=0
+for c in stored compressed solid rNN partN encrypted nested nestedmix; do
+        # Cold: first access after mount
+        mount_fs
+        record $c readdir_cold ms "$("$BENCH" readdir "$MNT/$c")"
+        record $c readdir_warm ms "$("$BENCH" readdir "$MNT/$c")"
+        record $c getattr ops/s "$("$BENCH" getattr "$MNT/$c" 100)"
+        f=$(ls "$MNT/$c" | grep -v '\.rar$' | head -n 1)
+        [ -d "$MNT/$c/$f" ] && f=$f/$(ls "$MNT/$c/$f" | head -n 1)
+        record $c open us "$("$BENCH" open "$MNT/$c/$f" 50)"
+        p0=$("$BENCH" metric "$MNT" raw_prefetch_total 2>/dev/null)
+        record $c seq_read MB/s "$("$BENCH" seq "$MNT/$c/$f")"
+        # Sequential reads of stored multi-volume files open the next
+        # volume ahead of the reader, see __raw_readahead()
+        case $c in
+        rNN|partN)
+                p1=$("$BENCH" metric "$MNT" raw_prefetch_total 2>/dev/null)
+                record $c raw_prefetch count "$((${p1:-0} - ${p0:-0}))"
+                if [ "${p1:-0}" -le "${p0:-0}" ]; then
+                        echo "$c: no volume was prefetched" >&2
+                        status=1
+                fi
+                ;;
+        esac
+        # Members of nested archives must read back unchanged
+        case $c in
+        nested|nestedmix)
+                if ! cmp -s "$MNT/$c/$f" "$WORK/data/text.txt"; then
+                        echo "$c: $f does not match its source" >&2
+                        status=1
+                fi
+                ;;
+        esac
+        record $c rand_read MB/s "$("$BENCH" rand "$MNT/$c/$f" 200 65536)"
+        umount_fs
+done
+
+echo "" >> "$OUT"
+echo "]" >> "$OUT"
+echo "results written to $OUT"
+exit $status
@@ -0,0 +1,388 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "blkcache.h"
+
+#define BLKCACHE_SZ 4096
+
+/*
+ * The cache is an in-memory index of block files stored below 'cache_dir'.
+ * Block files are named after a running id, never after their key, making
+ * the index the only authority of what a file contains. Previous contents
+ * of the directory are discarded at init.
+ */
+struct blkcache_entry {
+        const char *key;        /* owned by the hash table */
+        uint64_t id;
+        size_t size;
+        struct blkcache_entry *prev;
+        struct blkcache_entry *next;
+};
+
+static void *ht = NULL;
+static pthread_mutex_t blkcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+static size_t cache_budget = 0;
+static size_t cache_used = 0;
+static uint64_t next_id = 0;
+
+/* LRU list, most recently used first */
+static struct blkcache_entry *lru_head = NULL;
+static struct blkcache_entry *lru_tail = NULL;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__alloc()
+{
+        return calloc(1, sizeof(struct blkcache_entry));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_unlink(struct blkcache_entry *e)
+{
+        if (e->prev)
+                e->prev->next = e->next;
+        else
+                lru_head = e->next;
+        if (e->next)
+                e->next->prev = e->prev;
+        else
+                lru_tail = e->prev;
+        e->prev = e->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_push(struct blkcache_entry *e)
+{
+        e->prev = NULL;
+        e->next = lru_head;
+        if (lru_head)
+                lru_head->prev = e;
+        lru_head = e;
+        if (!lru_tail)
+                lru_tail = e;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __block_name(char *name, size_t len, uint64_t id)
+{
+        snprintf(name, len, "%s/%016" PRIx64 ".blk", cache_dir, id);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __block_key(char *bkey, size_t len, const char *key, uint64_t idx)
+{
+        snprintf(bkey, len, "%s#%" PRIu64, key, idx);
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with blkcache_lock held.
+ ****************************************************************************/
+static void __evict(size_t needed)
+{
+        char name[PATH_MAX];
+
+        while (lru_tail && cache_used + needed > cache_budget) {
+                struct blkcache_entry *e = lru_tail;
+                __lru_unlink(e);
+                cache_used -= e->size;
+                __block_name(name, sizeof(name), e->id);
+                (void)unlink(name);
+                printd(4, "blkcache: evicted %s\n", e->key);
+                hashtable_entry_delete(ht, e->key);
+        }
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __purge_dir()
+{
+        char name[PATH_MAX];
+        DIR *dp = opendir(cache_dir);
+        struct dirent *ep;
+
+        if (!dp)
+                return;
+        while ((ep = readdir(dp))) {
+                size_t len = strlen(ep->d_name);
+                if (len > 4 && !strcmp(ep->d_name + len - 4, ".blk")) {
+                        snprintf(name, sizeof(name), "%s/%s", cache_dir,
+                                 ep->d_name);
+                        (void)unlink(name);
+                }
+        }
+        closedir(dp);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int blkcache_enabled()
+{
+        return ht != NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Read up to 'size' bytes at offset 'off' within block 'idx' of the file
+ * identified by 'key'. Returns the number of bytes read or -ENOENT if the
+ * block is not in the cache.
+ ****************************************************************************/
+ssize_t blkcache_get(const char *key, uint64_t idx, char *buf, size_t size,
+                off_t off)
+{
+        char bkey[PATH_MAX + 32];
+        char name[PATH_MAX];
+        struct hash_table_entry *he;
+        struct blkcache_entry *e;
+        ssize_t n;
+        int fd;
+
+        if (!ht)
+                return -ENOENT;
+
+        __block_key(bkey, sizeof(bkey), key, idx);
+        pthread_mutex_lock(&blkcache_lock);
+        he = hashtable_entry_get(ht, bkey);
+        if (!he) {
+                pthread_mutex_unlock(&blkcache_lock);
+                return -ENOENT;
+        }
+        e = he->user_data;
+        if ((size_t)off >= e->size) {
+                pthread_mutex_unlock(&blkcache_lock);
+                return 0;
+        }
+        __lru_unlink(e);
+        __lru_push(e);
+        __block_name(name, sizeof(name), e->id);
+        size = size < e->size - off ? size : e->size - off;
+        pthread_mutex_unlock(&blkcache_lock);
+
+        /* The file might be evicted meanwhile, treat that as a miss */
+        fd = open(name, O_RDONLY);
+        if (fd == -1)
+                return -ENOENT;
+        n = pread(fd, buf, size, off);
+        close(fd);
+        if (n != (ssize_t)size)
+                return -ENOENT;
+        return n;
+}
+
+/*!
+ *****************************************************************************
+ * Store a decompressed block. Only the last block of a file may be
+ * smaller than BLKCACHE_BLOCK_SZ.
+ ****************************************************************************/
+int blkcache_put(const char *key, uint64_t idx, const void *data,
+                size_t size)
+{
+        char bkey[PATH_MAX + 32];
+        char name[PATH_MAX];
+        struct hash_table_entry *he;
+        struct blkcache_entry *e;
+        uint64_t id;
+        int fd;
+
+        if (!ht || !size || size > cache_budget)
+                return -EINVAL;
+
+        __block_key(bkey, sizeof(bkey), key, idx);
+        pthread_mutex_lock(&blkcache_lock);
+        if (hashtable_entry_get(ht, bkey)) {
+                pthread_mutex_unlock(&blkcache_lock);
+                return 0;
+        }
+        id = next_id++;
+        pthread_mutex_unlock(&blkcache_lock);
+
+        __block_name(name, sizeof(name), id);
+        fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+                printd(1, "blkcache: failed to create %s: %s\n", name,
+                       strerror(errno));
+                return -errno;
+        }
+        if (write(fd, data, size) != (ssize_t)size) {
+                int err = errno ? errno : ENOSPC;
+                close(fd);
+                (void)unlink(name);
+                return -err;
+        }
+        close(fd);
+
+        pthread_mutex_lock(&blkcache_lock);
+        if (!ht || hashtable_entry_get(ht, bkey)) {
+                /* Lost a race, or cache destroyed meanwhile */
+                pthread_mutex_unlock(&blkcache_lock);
+                (void)unlink(name);
+                return 0;
+        }
+        __evict(size);
+        he = hashtable_entry_alloc(ht, bkey);
+        if (!he) {
+                pthread_mutex_unlock(&blkcache_lock);
+                (void)unlink(name);
+                return -ENOMEM;
+        }
+        e = he->user_data;
+        e->key = he->key;
+        e->id = id;
+        e->size = size;
+        __lru_push(e);
+        cache_used += size;
+        pthread_mutex_unlock(&blkcache_lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Drop blocks 0 to 'count' - 1 of the file identified by 'key'.
+ ****************************************************************************/
+void blkcache_invalidate(const char *key, uint64_t count)
+{
+        char bkey[PATH_MAX + 32];
+        char name[PATH_MAX];
+        struct hash_table_entry *he;
+        struct blkcache_entry *e;
+        uint64_t idx;
+
+        pthread_mutex_lock(&blkcache_lock);
+        for (idx = 0; ht && idx < count; idx++) {
+                __block_key(bkey, sizeof(bkey), key, idx);
+                he = hashtable_entry_get(ht, bkey);
+                if (!he)
+                        continue;
+                e = he->user_data;
+                __lru_unlink(e);
+                cache_used -= e->size;
+                __block_name(name, sizeof(name), e->id);
+                (void)unlink(name);
+                printd(4, "blkcache: invalidated %s\n", e->key);
+                hashtable_entry_delete(ht, e->key);
+        }
+        pthread_mutex_unlock(&blkcache_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int blkcache_init(const char *dir, size_t budget)
+{
+        struct hash_table_ops ops = {
+                .alloc = __alloc,
+                .free = __free,
+        };
+
+        if (!dir || !budget)
+                return 0;
+
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+                printd(1, "blkcache: cannot create %s: %s\n", dir,
+                       strerror(errno));
+                return -errno;
+        }
+        cache_dir = strdup(dir);
+        if (!cache_dir)
+                return -ENOMEM;
+        __purge_dir();
+
+        pthread_mutex_lock(&blkcache_lock);
+        cache_budget = budget;
+        cache_used = 0;
+        ht = hashtable_init(BLKCACHE_SZ, &ops);
+        pthread_mutex_unlock(&blkcache_lock);
+        if (!ht) {
+                free(cache_dir);
+                cache_dir = NULL;
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void blkcache_destroy()
+{
+        pthread_mutex_lock(&blkcache_lock);
+        if (ht) {
+                hashtable_destroy(ht);
+                ht = NULL;
+                lru_head = lru_tail = NULL;
+                cache_used = 0;
+                __purge_dir();
+        }
+        free(cache_dir);
+        cache_dir = NULL;
+        pthread_mutex_unlock(&blkcache_lock);
+}
@@ -43,13 +43,20 @@
 #include "dirname.h"
 #include "optdb.h"
 #include "common.h"
+#include "metrics.h"
 
 #define DIRCACHE_SZ 1024
+#define MAX_SUBKEY_LEVELS 32
 
-/* Hash table handle */
-static void *ht = NULL;
+/*
+ * Hash table handles, one per shard of dir_access_lock. The shard is
+ * selected by the path of an entry while its bucket is selected by the
+ * path of the parent folder, which is what allows sub-trees to be found
+ * without a full scan, see __invalidate().
+ */
+static void *ht[SHLOCK_SHARDS];
 
-pthread_rwlock_t dir_access_lock;
+struct shlock dir_access_lock;
 static struct dircache_cb user_cb;
 
 /*!
@@ -94,8 +101,11 @@ void dircache_init(struct dircache_cb *cb)
                 .free = __free,
         };
 
-        ht = hashtable_init(DIRCACHE_SZ, &ops);
-        pthread_rwlock_init(&dir_access_lock, NULL);
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                ht[i] = hashtable_init(DIRCACHE_SZ, &ops);
+        shlock_init(&dir_access_lock);
         if (cb)
                 user_cb = *cb;
 }
@@ -106,35 +116,170 @@ void dircache_init(struct dircache_cb *cb)
  ****************************************************************************/
 void dircache_destroy()
 {
-        pthread_rwlock_destroy(&dir_access_lock);
-        hashtable_destroy(ht);
-        ht = NULL;
+        int i;
+
+        shlock_destroy(&dir_access_lock);
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                hashtable_destroy(ht[i]);
+                ht[i] = NULL;
+        }
 }
 
+struct foreach_arg {
+        void (*cb)(const char *, struct dircache_entry *, void *);
+        void *arg;
+};
+
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-void dircache_invalidate(const char *path)
+static void __foreach_cb(const char *key, void *data, void *arg)
 {
-        uint32_t hash;
+        struct foreach_arg *a = arg;
+        a->cb(key, data, a->arg);
+}
 
-        if (path) {
-                char *safe_path = strdup(path);
-                if (!safe_path) {
-                        printd(1, "dircache_invalidate: strdup failed\n");
+/*!
+ *****************************************************************************
+ * Call 'cb' for every cache entry. Must be called with the lock of all
+ * shards held.
+ ****************************************************************************/
+void dircache_foreach(void (*cb)(const char *, struct dircache_entry *,
+                                 void *), void *arg)
+{
+        struct foreach_arg a = { cb, arg };
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                hashtable_foreach(ht[i], __foreach_cb, &a);
+}
+
+struct subkeys {
+        char **key;
+        int n;
+        int max;
+        int failed;
+};
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __subkeys_add(const char *key, void *arg)
+{
+        struct subkeys *sk = arg;
+
+        if (sk->n == sk->max) {
+                int max = sk->max ? sk->max * 2 : 16;
+                char **tmp = realloc(sk->key, max * sizeof(char *));
+                if (!tmp) {
+                        sk->failed = 1;
                         return;
                 }
-                char *tmp = safe_path;
-                safe_path = __gnu_dirname(safe_path);
-                hash = get_hash(safe_path, 0);
-                free(tmp);
-                hashtable_entry_delete_subkeys(ht, path, hash);
+                sk->key = tmp;
+                sk->max = max;
+        }
+        sk->key[sk->n] = strdup(key);
+        if (sk->key[sk->n])
+                ++sk->n;
+        else
+                sk->failed = 1;
+}
+
+/*!
+ *****************************************************************************
+ * Delete the entries of folder bucket 'hash' starting with 'path' from all
+ * shards, then descend into the folders just deleted. The children of a
+ * folder may be found in any shard. If 'lock' is set the lock of each
+ * shard is taken while it is updated, otherwise the caller holds the lock
+ * of all shards. Returns non-zero if the sub-tree could not be walked.
+ ****************************************************************************/
+static int __invalidate(const char *path, uint32_t hash, int level, int lock)
+{
+        struct subkeys sk = { NULL, 0, 0, 0 };
+        int res = 0;
+        int i;
+
+        if (++level > MAX_SUBKEY_LEVELS)
+                return 1;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                if (lock)
+                        shlock_wrlock_shard(&dir_access_lock, i);
+                hashtable_entry_delete_prefix_hash(ht[i], path, hash,
+                                                   __subkeys_add, &sk);
+                if (lock)
+                        shlock_unlock_shard(&dir_access_lock, i);
+        }
+        res = sk.failed;
+        for (i = 0; i < sk.n; i++) {
+                if (!res)
+                        res = __invalidate(path, get_hash(sk.key[i], 0),
+                                           level, lock);
+                free(sk.key[i]);
+        }
+        free(sk.key);
+        return res;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __invalidate_tree(const char *path, int lock)
+{
+        uint32_t hash;
+        int i;
+
+        char *safe_path = strdup(path);
+        if (!safe_path) {
+                printd(1, "dircache_invalidate: strdup failed\n");
+                return;
+        }
+        char *tmp = safe_path;
+        safe_path = __gnu_dirname(safe_path);
+        hash = get_hash(safe_path, 0);
+        free(tmp);
+        if (!__invalidate(path, hash, 0, lock))
+                return;
+
+        /* Back off to a linear search, slower but more "safe" */
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                if (lock)
+                        shlock_wrlock_shard(&dir_access_lock, i);
+                hashtable_entry_delete_prefix(ht[i], path);
+                if (lock)
+                        shlock_unlock_shard(&dir_access_lock, i);
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with the lock of all shards held.
+ ****************************************************************************/
+void dircache_invalidate(const char *path)
+{
+        int i;
+
+        if (path) {
+                __invalidate_tree(path, 0);
         } else {
-                hashtable_entry_delete(ht, NULL);
+                for (i = 0; i < SHLOCK_SHARDS; i++)
+                        hashtable_entry_delete(ht[i], NULL);
         }
 }
 
+/*!
+ *****************************************************************************
+ * Same as dircache_invalidate() for a non-NULL 'path' but takes the lock
+ * of one shard at a time itself. Must be called without holding the lock.
+ ****************************************************************************/
+void dircache_invalidate_tree(const char *path)
+{
+        __invalidate_tree(path, 1);
+}
+
 /*!
  *****************************************************************************
  *
@@ -156,7 +301,7 @@ struct dircache_entry *dircache_alloc(const char *path)
         safe_path = __gnu_dirname(safe_path);
         hash = get_hash(safe_path, 0);
         free(tmp);
-        hte = hashtable_entry_alloc_hash(ht, path, hash);
+        hte = hashtable_entry_alloc_hash(ht[shlock_shard(path)], path, hash);
         if (hte) {
                 e = hte->user_data;
                 ABS_ROOT(root, path);
@@ -177,7 +322,8 @@ struct dircache_entry *dircache_alloc(const char *path)
 
 /*!
  *****************************************************************************
- *
+ * Must be called with the lock of the shard holding 'path' held, which is
+ * also the case for the stale callback.
  ****************************************************************************/
 struct dircache_entry *dircache_get(const char *path)
 {
@@ -197,7 +343,8 @@ struct dircache_entry *dircache_get(const char *path)
         safe_path = __gnu_dirname(safe_path);
         hash = get_hash(safe_path, 0);
         free(tmp);
-        hte = hashtable_entry_get_hash(ht, path, hash);
+        hte = hashtable_entry_get_hash(ht[shlock_shard(path)], path,
+                                       hash);
         if (hte) {
                 e = hte->user_data;
                 if (e->ts_valid) {
@@ -211,10 +358,54 @@ struct dircache_entry *dircache_get(const char *path)
 #endif
                                 if (user_cb.stale)
                                         user_cb.stale(path);
+                                METRICS_INC(METRICS_DIRCACHE_MISS);
                                 return NULL;
                         }
                 }
+                METRICS_INC(METRICS_DIRCACHE_HIT);
                 return e;
         }
+        METRICS_INC(METRICS_DIRCACHE_MISS);
         return NULL;
 }
+
+/*!
+ *****************************************************************************
+ * Update the recorded modification time of the entry for 'path', if any,
+ * to the current one. This accepts all changes made to the directory so
+ * far. Returns 1 if an entry was found, 0 otherwise.
+ ****************************************************************************/
+int dircache_refresh(const char *path)
+{
+        struct hash_table_entry *hte;
+        struct dircache_entry *e;
+        char *root;
+        struct stat st;
+        uint32_t hash;
+
+        char *safe_path = strdup(path);
+        if (!safe_path) {
+                printd(1, "dircache_refresh: strdup failed\n");
+                return 0;
+        }
+        char *tmp = safe_path;
+        safe_path = __gnu_dirname(safe_path);
+        hash = get_hash(safe_path, 0);
+        free(tmp);
+        hte = hashtable_entry_get_hash(ht[shlock_shard(path)], path,
+                                       hash);
+        if (!hte)
+                return 0;
+        e = hte->user_data;
+        if (e->ts_valid) {
+                ABS_ROOT(root, path);
+                if (!stat(root, &st)) {
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+                        e->mtim = st.st_mtim;
+#else
+                        e->mtim.tv_sec = st.st_mtime;
+#endif
+                }
+        }
+        return 1;
+}
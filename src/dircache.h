@@ -32,8 +32,9 @@
 #include <platform.h>
 #include <time.h>
 #include "dirlist.h"
+#include "shlock.h"
 
-extern pthread_rwlock_t dir_access_lock;
+extern struct shlock dir_access_lock;
 
 struct dircache_entry {
         struct dir_entry_list dir_entry_list;
@@ -49,6 +50,10 @@ struct dircache_cb {
 struct dircache_entry *dircache_alloc(const char *path);
 struct dircache_entry *dircache_get(const char *path);
 void dircache_invalidate(const char *path);
+void dircache_invalidate_tree(const char *path);
+int dircache_refresh(const char *path);
+void dircache_foreach(void (*cb)(const char *, struct dircache_entry *,
+                                 void *), void *arg);
 void dircache_init(struct dircache_cb *cb);
 void dircache_destroy();
 
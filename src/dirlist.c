@@ -34,105 +34,140 @@
 #include "dirlist.h"
 #include "hash.h"
 
-#define DIR_LIST_HEAD_ ((void*)-1)
+#define DIR_LIST_CHUNK_SZ (16 * 1024)
+#define DIR_LIST_MIN_SZ 16
+
+struct dir_list_chunk {
+        struct dir_list_chunk *next;
+        size_t used;
+        size_t size;
+        char buf[];
+};
 
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-static inline int swap(struct dir_entry_list *A, struct dir_entry_list *B)
+static char *arena_strdup(struct dir_list_data *d, const char *s)
 {
-        int swap = strcmp(A->entry.name, B->entry.name);
-        swap = !swap ? A->entry.type > B->entry.type : swap;
-        if (swap > 0) {
-                const struct dir_entry TMP = B->entry;
-                B->entry = A->entry;
-                A->entry = TMP;
-                return 1;
+        size_t len = strlen(s) + 1;
+        struct dir_list_chunk *c = d->arena;
+
+        if (!c || c->size - c->used < len) {
+                size_t size = len > DIR_LIST_CHUNK_SZ ? len : DIR_LIST_CHUNK_SZ;
+                c = malloc(sizeof(struct dir_list_chunk) + size);
+                if (!c)
+                        return NULL;
+                c->used = 0;
+                c->size = size;
+                c->next = d->arena;
+                d->arena = c;
         }
-        return 0;
+        memcpy(c->buf + c->used, s, len);
+        c->used += len;
+        return c->buf + c->used - len;
 }
 
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-void dir_list_open(struct dir_entry_list *root)
+static void data_free(struct dir_list_data *d)
 {
-        root->next = NULL;
-        root->entry.name = NULL;
-        root->entry.head_flag = DIR_LIST_HEAD_;
+        struct dir_list_chunk *c = d->arena;
+
+        while (c) {
+                struct dir_list_chunk *tmp = c;
+                c = c->next;
+                free(tmp);
+        }
+        free(d->htab);
+        free(d->entries);
+        free(d);
 }
 
 /*!
  *****************************************************************************
- *
+ * (Re-)build the hash index used to detect duplicates in O(1) time.
  ****************************************************************************/
-void dir_list_close(struct dir_entry_list *root)
+static int data_rehash(struct dir_list_data *d, unsigned int hsize)
 {
-        /* Simple bubble sort of directory entries in alphabetical order */
-        if (root && root->next) {
-                int n;
-                struct dir_entry_list *next;
-                do {
-                        n = 0;
-                        next = root->next;
-                        while (next->next) {
-                                n += swap(next, next->next);
-                                next = next->next;
-                        }
-                } while (n != 0);       /* while swaps performed */
-
-                /* Make sure entries are unique. Duplicates will be removed. */
-                next = root->next;
-                while (next->next) {
-                        if ((next->entry.type == DIR_E_NRM || /* no hash */
-                                    next->entry.hash == next->next->entry.hash) &&
-                                    !strcmp(next->entry.name, next->next->entry.name)) {
-                                /* 
-                                 * A duplicate. Rare but possible.
-                                 * Make sure the current entry is kept marked
-                                 * as valid since regular fs entries should
-                                 * always have priority.
-                                 */
-                                next->next->entry.valid = 0;
-                        } 
-                        next = next->next;
-                }
+        uint32_t *htab = calloc(hsize, sizeof(uint32_t));
+        unsigned int i;
+
+        if (!htab) {
+                printd(1, "dir_list: calloc failed\n");
+                return -ENOMEM;
+        }
+        for (i = 0; i < d->count; i++) {
+                unsigned int h = d->entries[i].hash & (hsize - 1);
+                while (htab[h])
+                        h = (h + 1) & (hsize - 1);
+                htab[h] = i + 1;
         }
+        free(d->htab);
+        d->htab = htab;
+        d->hsize = hsize;
+        return 0;
 }
 
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-void dir_list_free(struct dir_entry_list *root)
+static struct dir_list_data *data_new(unsigned int size)
 {
-        struct dir_entry_list *next = root->next;
-        while (next) {
-                struct dir_entry_list *tmp = next;
-                next = next->next;
-                free(tmp->entry.name);
-                free(tmp);
+        struct dir_list_data *d = calloc(1, sizeof(struct dir_list_data));
+
+        if (!d) {
+                printd(1, "dir_list: calloc failed\n");
+                return NULL;
+        }
+        size = size < DIR_LIST_MIN_SZ ? DIR_LIST_MIN_SZ : size;
+        d->entries = malloc(size * sizeof(struct dir_entry));
+        if (!d->entries) {
+                free(d);
+                return NULL;
         }
+        d->size = size;
+        d->sorted = 1;
+        d->refs = 1;
+        return d;
 }
 
 /*!
  *****************************************************************************
- *
+ * Make sure 'l' owns its storage before it is modified.
  ****************************************************************************/
-static int add_entry(struct dir_entry *entry, const char *key,
-                     struct stat *st, int type, uint32_t hash)
+static int list_unshare(struct dir_entry_list *l)
 {
-        entry->name = strdup(key);
-        if (!entry->name) {
-                printd(1, "add_entry: strdup failed\n");
+        struct dir_list_data *src = l->data;
+        struct dir_list_data *d;
+        unsigned int i;
+
+        if (!src) {
+                l->data = data_new(0);
+                return l->data ? 0 : -ENOMEM;
+        }
+        if (__atomic_load_n(&src->refs, __ATOMIC_ACQUIRE) == 1)
+                return 0;
+
+        d = data_new(src->count);
+        if (!d)
                 return -ENOMEM;
+        for (i = 0; i < src->count; i++) {
+                d->entries[i] = src->entries[i];
+                d->entries[i].name = arena_strdup(d, src->entries[i].name);
+                if (!d->entries[i].name) {
+                        d->count = i;
+                        data_free(d);
+                        return -ENOMEM;
+                }
         }
-        entry->hash = hash;
-        entry->st = st;
-        entry->type = type;
-        entry->valid = 1; /* assume entry is valid */
+        d->count = src->count;
+        d->sorted = src->sorted;
+        dir_list_free(l);
+        l->data = d;
         return 0;
 }
 
@@ -140,86 +175,149 @@ static int add_entry(struct dir_entry *entry, const char *key,
  *****************************************************************************
  *
  ****************************************************************************/
-struct dir_entry_list *dir_entry_add(struct dir_entry_list *l, const char *key,
-                struct stat *st, int type)
+static int compare(const void *a, const void *b)
 {
-        struct dir_entry_list *tmp;
-        struct dir_entry_list *head = NULL;  /*  Track head for NULL list case */
-        uint32_t hash;
+        const struct dir_entry *A = a;
+        const struct dir_entry *B = b;
+        int res = strcmp(A->name, B->name);
+        return res ? res : A->type - B->type;
+}
 
-        hash = get_hash(key, 0);
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void dir_list_open(struct dir_entry_list *root)
+{
+        root->data = NULL;
+}
 
-        /*  Handle NULL list by creating new head (needed for recursive extraction) */
-        if (!l) {
-                l = malloc(sizeof(struct dir_entry_list));
-                if (!l) {
-                        printd(1, "dir_entry_add: malloc failed for head\n");
-                        return NULL;
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void dir_list_close(struct dir_entry_list *root)
+{
+        struct dir_list_data *d = root->data;
+        unsigned int i;
+
+        if (!d || d->sorted)
+                return;
+        if (list_unshare(root))
+                return;
+        d = root->data;
+
+        qsort(d->entries, d->count, sizeof(struct dir_entry), compare);
+
+        /* Make sure entries are unique. Duplicates will be removed. */
+        for (i = 1; i < d->count; i++) {
+                if (d->entries[i - 1].hash == d->entries[i].hash &&
+                    !strcmp(d->entries[i - 1].name, d->entries[i].name)) {
+                        /*
+                         * A duplicate. Rare but possible.
+                         * Make sure the current entry is kept marked
+                         * as valid since regular fs entries should
+                         * always have priority.
+                         */
+                        d->entries[i].valid = 0;
                 }
-                l->entry.head_flag = DIR_LIST_HEAD_;
-                l->next = NULL;
-                /* FIX: Save head pointer to return after creating first entry */
-                head = l;
-                goto new_with_head;
         }
 
-        if (l->entry.head_flag == DIR_LIST_HEAD_) {
-                if (!l->next)
-                        goto new;
-                l = l->next;
-        }
+        /* Entry indexes changed, rebuild the index on next insert */
+        free(d->htab);
+        d->htab = NULL;
+        d->hsize = 0;
+        d->sorted = 1;
+}
 
-        tmp = l;
-        while (l) {
-                if (hash == l->entry.hash)
-                        if (!strcmp(key, l->entry.name))
-                                return l;
-                tmp = l;
-                l = l->next;
-        }
-        l = tmp;
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void dir_list_free(struct dir_entry_list *root)
+{
+        struct dir_list_data *d = root->data;
+
+        root->data = NULL;
+        if (d && !__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL))
+                data_free(d);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+struct dir_entry *dir_entry_add_hash(struct dir_entry_list *l,
+                const char *key, struct stat *st, uint32_t hash, int type)
+{
+        struct dir_list_data *d;
+        struct dir_entry *e;
+        unsigned int h;
 
-new:
-        l->next = malloc(sizeof(struct dir_entry_list));
-        if (!l->next) {
-                printd(1, "dir_entry_add: malloc failed\n");
+        if (list_unshare(l))
                 return NULL;
-        }
-        tmp = l;  /* Save previous entry for cleanup */
-        l = l->next;
-        l->next = NULL;
-        if (add_entry(&l->entry, key, st, type, hash) != 0) {
-                free(l);
-                tmp->next = NULL;  /* Restore list */
+        d = l->data;
+
+        if (d->count * 2 >= d->hsize &&
+            data_rehash(d, d->hsize ? d->hsize * 2 : DIR_LIST_MIN_SZ * 2))
                 return NULL;
+
+        h = hash & (d->hsize - 1);
+        while (d->htab[h]) {
+                e = &d->entries[d->htab[h] - 1];
+                if (e->hash == hash && !strcmp(key, e->name)) {
+                        /* Regular fs entries always have priority */
+                        if (type < e->type) {
+                                e->type = type;
+                                e->st = st;
+                        }
+                        return e;
+                }
+                h = (h + 1) & (d->hsize - 1);
         }
-        return l;
-
-new_with_head:
-        /* FIX: Create first entry when head was just created */
-        l->next = malloc(sizeof(struct dir_entry_list));
-        if (!l->next) {
-                printd(1, "dir_entry_add: malloc failed for first entry\n");
-                free(head);
-                return NULL;
+
+        if (d->count == d->size) {
+                e = realloc(d->entries,
+                            d->size * 2 * sizeof(struct dir_entry));
+                if (!e) {
+                        printd(1, "dir_entry_add: realloc failed\n");
+                        return NULL;
+                }
+                d->entries = e;
+                d->size *= 2;
         }
-        tmp = l;  /* Save head pointer */
-        l = l->next;
-        l->next = NULL;
-        if (add_entry(&l->entry, key, st, type, hash) != 0) {
-                free(l);
-                tmp->next = NULL;  /* Restore list */
-                free(head);
+
+        e = &d->entries[d->count];
+        e->name = arena_strdup(d, key);
+        if (!e->name) {
+                printd(1, "dir_entry_add: out of memory\n");
                 return NULL;
         }
-        /* Return HEAD pointer, not entry pointer */
-        return head;
+        e->hash = hash;
+        e->st = st;
+        e->type = type;
+        e->valid = 1; /* assume entry is valid */
+        d->htab[h] = ++d->count;
+        if (d->count > 1 && compare(e - 1, e) > 0)
+                d->sorted = 0;
+        return e;
 }
 
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
+struct dir_entry *dir_entry_add(struct dir_entry_list *l, const char *key,
+                struct stat *st, int type)
+{
+        return dir_entry_add_hash(l, key, st, get_hash(key, 0), type);
+}
+
+/*!
+ *****************************************************************************
+ * The returned list shares the storage of 'src' and no entries are copied
+ * until either of the lists is modified.
+ ****************************************************************************/
 struct dir_entry_list *dir_list_dup(const struct dir_entry_list *src)
 {
         dir_entry_list *root = malloc(sizeof(struct dir_entry_list));
@@ -228,33 +326,9 @@ struct dir_entry_list *dir_list_dup(const struct dir_entry_list *src)
                 return NULL;
         }
 
-        dir_entry_list *l = root;
-        struct dir_entry_list *next = src->next;
-        dir_list_open(root);
-
-        while (next) {
-                l->next = malloc(sizeof(struct dir_entry_list));
-                if (!l->next) {
-                        printd(1, "dir_list_dup: malloc failed for entry\n");
-                        dir_list_free(root);
-                        free(root);
-                        return NULL;
-                }
-                l = l->next;
-                l->entry.name = strdup(next->entry.name);
-                if (!l->entry.name) {
-                        printd(1, "dir_list_dup: strdup failed\n");
-                        dir_list_free(root);
-                        free(root);
-                        return NULL;
-                }
-                l->entry.hash = next->entry.hash;
-                l->entry.type = next->entry.type;
-                l->entry.valid = next->entry.valid;
-                l->entry.st = next->entry.st;
-                next = next->next;
-        }
-        l->next = NULL;
+        root->data = src->data;
+        if (root->data)
+                __atomic_add_fetch(&root->data->refs, 1, __ATOMIC_RELAXED);
         return root;
 }
 
@@ -262,39 +336,35 @@ struct dir_entry_list *dir_list_dup(const struct dir_entry_list *src)
  *****************************************************************************
  *
  ****************************************************************************/
-struct dir_entry_list *dir_list_append(struct dir_entry_list *list1,
+int dir_list_append(struct dir_entry_list *list1,
                 const struct dir_entry_list *list2)
 {
-        /* TODO: Make sure list1/list2 are heads */
-        struct dir_entry_list *next1 = list1->next;
-        struct dir_entry_list *next2 = list2->next;
-        struct dir_entry_list *prev_next = list1;
-        while (next1) {
-                prev_next = next1;
-                next1 = next1->next;
+        unsigned int i;
+
+        if (!list2 || !dir_list_count(list2))
+                return 0;
+
+        /* Nothing to merge with, share the storage instead */
+        if (!dir_list_count(list1)) {
+                struct dir_list_data *d = list2->data;
+                __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+                dir_list_free(list1);
+                list1->data = d;
+                return 0;
         }
-        next1 = prev_next;
 
-        while (next2) {
-                next1->next = malloc(sizeof(struct dir_entry_list));
-                if (!next1->next) {
-                        printd(1, "dir_list_append: malloc failed\n");
-                        return NULL;
+        for (i = 0; i < list2->data->count; i++) {
+                const struct dir_entry *e = &list2->data->entries[i];
+                unsigned int count = dir_list_count(list1);
+                struct dir_entry *n = dir_entry_add_hash(list1, e->name,
+                                                         e->st, e->hash,
+                                                         e->type);
+                if (!n) {
+                        printd(1, "dir_list_append: out of memory\n");
+                        return -ENOMEM;
                 }
-                memcpy(next1->next, next2, sizeof(struct dir_entry_list));
-                next1 = next1->next;
-                next1->entry.name = strdup(next2->entry.name);
-                if (!next1->entry.name) {
-                        printd(1, "dir_list_append: strdup failed\n");
-                        /*
-                         * Partial list has been created. Caller must handle
-                         * potential memory leak of incomplete list.
-                         * TODO: Consider more robust cleanup
-                         */
-                        return NULL;
-                }
-                next2 = next2->next;
+                if (dir_list_count(list1) != count)
+                        n->valid = e->valid;
         }
-        return next1;
+        return 0;
 }
-
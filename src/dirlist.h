@@ -38,21 +38,33 @@
 
 typedef struct dir_entry_list dir_entry_list;
 
-__extension__
 struct dir_entry {
         char *name;
         uint32_t hash;
-        union {
-                struct stat *st;
-                void *head_flag;
-        };
+        struct stat *st;
         int type;
         int valid;
 };
 
+/*
+ * Entries are kept in one contiguous array with the names packed into a
+ * string arena. The storage is reference counted and shared between all
+ * lists created by dir_list_dup(); a shared list is copied before it is
+ * modified.
+ */
+struct dir_list_data {
+        struct dir_entry *entries;
+        unsigned int count;
+        unsigned int size;
+        uint32_t *htab;                 /* entry index + 1, 0 = free slot */
+        unsigned int hsize;
+        struct dir_list_chunk *arena;
+        int sorted;
+        int refs;
+};
+
 struct dir_entry_list {
-        struct dir_entry entry;
-        struct dir_entry_list *next;
+        struct dir_list_data *data;
 };
 
 void dir_list_open(struct dir_entry_list *root);
@@ -61,15 +73,26 @@ void dir_list_close(struct dir_entry_list *root);
 
 void dir_list_free(struct dir_entry_list *root);
 
-struct dir_entry_list *dir_entry_add_hash(struct dir_entry_list *l,
+struct dir_entry *dir_entry_add_hash(struct dir_entry_list *l,
         const char *key, struct stat *st, uint32_t hash, int type);
 
-struct dir_entry_list *dir_entry_add(struct dir_entry_list *l,
+struct dir_entry *dir_entry_add(struct dir_entry_list *l,
         const char *key, struct stat *st, int type);
 
 struct dir_entry_list *dir_list_dup(const struct dir_entry_list* src);
 
-struct dir_entry_list *dir_list_append(struct dir_entry_list* list1,
+int dir_list_append(struct dir_entry_list* list1,
         const struct dir_entry_list* list2);
 
+static inline unsigned int dir_list_count(const struct dir_entry_list *l)
+{
+        return l->data ? l->data->count : 0;
+}
+
+static inline struct dir_entry *dir_list_entry(const struct dir_entry_list *l,
+        unsigned int i)
+{
+        return &l->data->entries[i];
+}
+
 #endif
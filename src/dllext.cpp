@@ -27,6 +27,8 @@
 */
 
 #include <iostream>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "version.hpp"
 #include "rar.hpp"
 #include "dllext.hpp"
@@ -250,9 +252,10 @@ void PASCAL RARFreeArchiveDataEx(RARArchiveDataEx **NN)
   }
 }
 
-void PASCAL RARNextVolumeName(char *arch, bool oldstylevolume)
+static void NextVolumeNameEx(char *arch, size_t bufsize, bool oldstylevolume)
 {
 #if RARVER_MAJOR < 5
+  (void)bufsize;
   NextVolumeName(arch, NULL, 0, oldstylevolume);
 #elif RARVER_MAJOR >= 7
   wstring ArchiveW;
@@ -260,8 +263,7 @@ void PASCAL RARNextVolumeName(char *arch, bool oldstylevolume)
   ArchiveW.assign(arch,arch+len);
   NextVolumeName(ArchiveW,oldstylevolume);
   string NextArchive(ArchiveW.begin(),ArchiveW.end());
-  /* Safe copy with size limit based on original buffer */
-  size_t bufsize = len + 1;
+  /* Safe copy with size limit based on target buffer */
   if (NextArchive.length() >= bufsize) {
     cerr << "NextVolumeName: result too long (" << NextArchive.length()
          << " >= " << bufsize << "), truncating" << endl;
@@ -272,10 +274,15 @@ void PASCAL RARNextVolumeName(char *arch, bool oldstylevolume)
   wchar NextName[NM];
   CharToWide(arch, NextName, ASIZE(NextName));
   NextVolumeName(NextName, ASIZE(NextName), oldstylevolume);
-  WideToChar(NextName,arch,strlen(arch)+1);
+  WideToChar(NextName,arch,bufsize);
 #endif
 }
 
+void PASCAL RARNextVolumeName(char *arch, bool oldstylevolume)
+{
+  NextVolumeNameEx(arch, strlen(arch) + 1, oldstylevolume);
+}
+
 
 void PASCAL RARVolNameToFirstName(char *arch, bool oldstylevolume)
 {
@@ -308,6 +315,958 @@ void PASCAL RARVolNameToFirstName(char *arch, bool oldstylevolume)
 #endif
 }
 
+/*
+ * Header-only archive scanner.
+ *
+ * Walks the block headers of a volume using plain positional reads and
+ * never touches the packed data. This is a lot cheaper than going through
+ * RAROpenArchiveEx()/RARReadHeaderEx()/RARProcessFile() for every part of
+ * a large multipart set, in particular on slow or remote storage where
+ * each volume switch costs a full round trip. Only RAR 2.9-4.x and RAR 5.0
+ * archives starting with a marker block are handled. Anything else (SFX
+ * modules, encrypted headers, ancient formats) is reported as
+ * ERAR_UNKNOWN_FORMAT and the caller is expected to fall back to the
+ * regular library calls. Time stamps are only decoded with the precision
+ * of the basic header fields and link targets are not read at all.
+ */
+
+#define SCAN_BUF_SIZE      8192
+#define SCAN_MAX_HEADER    (2 * 1024 * 1024)
+#define SCAN_MAX_WORKERS   8
+
+struct ScanFile
+{
+  int fd;
+  off_t FileSize;
+  unsigned char *Buf;
+  size_t BufSize;
+  off_t BufPos;
+  size_t BufLen;
+};
+
+struct ScanContext
+{
+  RARSCANPROC Callback;
+  void *UserData;
+  bool Stopped;
+  RARArchiveDataEx *N;
+};
+
+static inline unsigned int ScanGet16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t ScanGet32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t ScanGet64(const unsigned char *p)
+{
+  return ScanGet32(p) | ((uint64_t)ScanGet32(p + 4) << 32);
+}
+
+// RAR 5.0 variable length integer, 7 bits per byte.
+static bool ScanGetV(const unsigned char *&p, const unsigned char *End, uint64_t *Value)
+{
+  uint64_t v = 0;
+  for (unsigned int Shift = 0; p < End && Shift < 64; Shift += 7)
+  {
+    unsigned char b = *p++;
+    v |= (uint64_t)(b & 0x7f) << Shift;
+    if (!(b & 0x80))
+    {
+      *Value = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const unsigned char *ScanRead(ScanFile *f, off_t Pos, size_t Len)
+{
+  if (Pos < 0 || Len > SCAN_MAX_HEADER || Pos + (off_t)Len > f->FileSize)
+    return NULL;
+  if (Pos >= f->BufPos && Pos + (off_t)Len <= f->BufPos + (off_t)f->BufLen)
+    return f->Buf + (Pos - f->BufPos);
+
+  size_t Want = Len > SCAN_BUF_SIZE ? Len : SCAN_BUF_SIZE;
+  if (Pos + (off_t)Want > f->FileSize)
+    Want = f->FileSize - Pos;
+  if (Want > f->BufSize)
+  {
+    unsigned char *Buf = (unsigned char *)realloc(f->Buf, Want);
+    if (!Buf)
+      return NULL;
+    f->Buf = Buf;
+    f->BufSize = Want;
+  }
+  f->BufLen = 0;
+  size_t n = 0;
+  while (n < Want)
+  {
+    ssize_t r = pread(f->fd, f->Buf + n, Want - n, Pos + n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    n += r;
+  }
+  if (n < Len)
+    return NULL;
+  f->BufPos = Pos;
+  f->BufLen = n;
+  return f->Buf;
+}
+
+static uint64_t ScanRawTime(time_t Sec, unsigned int NSec)
+{
+#if RARVER_MAJOR > 5 || (RARVER_MAJOR == 5 && RARVER_MINOR >= 50)
+  return (uint64_t)Sec * 1000000000ULL + NSec;
+#elif RARVER_MAJOR > 4
+  return (uint64_t)Sec * 10000000ULL + NSec / 100;
+#else
+  (void)Sec;
+  (void)NSec;
+  return 0;
+#endif
+}
+
+static unsigned int ScanUnixToDos(time_t t)
+{
+  struct tm tm;
+  if (!localtime_r(&t, &tm) || tm.tm_year < 80)
+    return 0;
+  return ((unsigned int)(tm.tm_year - 80) << 25) | ((tm.tm_mon + 1) << 21) |
+         (tm.tm_mday << 16) | (tm.tm_hour << 11) | (tm.tm_min << 5) |
+         (tm.tm_sec / 2);
+}
+
+static time_t ScanDosToUnix(unsigned int Dos)
+{
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_sec = (Dos & 0x1f) * 2;
+  tm.tm_min = (Dos >> 5) & 0x3f;
+  tm.tm_hour = (Dos >> 11) & 0x1f;
+  tm.tm_mday = (Dos >> 16) & 0x1f;
+  tm.tm_mon = ((Dos >> 21) & 0x0f) - 1;
+  tm.tm_year = (Dos >> 25) + 80;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+// Same algorithm as EncodeFileName::Decode() for RAR 2.9-4.x Unicode names.
+static void ScanDecodeName(const unsigned char *Name, size_t NameSize,
+                           const unsigned char *Enc, size_t EncSize,
+                           wchar_t *NameW, size_t MaxSize)
+{
+  size_t EncPos = 0, DecPos = 0;
+  unsigned int HighByte = EncPos < EncSize ? Enc[EncPos++] : 0;
+  unsigned int Flags = 0, FlagBits = 0;
+
+  while (EncPos < EncSize && DecPos < MaxSize - 1)
+  {
+    if (FlagBits == 0)
+    {
+      Flags = Enc[EncPos++];
+      FlagBits = 8;
+    }
+    switch ((Flags >> 6) & 3)
+    {
+      case 0:
+        if (EncPos >= EncSize)
+          break;
+        NameW[DecPos++] = Enc[EncPos++];
+        break;
+      case 1:
+        if (EncPos >= EncSize)
+          break;
+        NameW[DecPos++] = Enc[EncPos++] + (HighByte << 8);
+        break;
+      case 2:
+        if (EncPos + 1 >= EncSize)
+          break;
+        NameW[DecPos++] = Enc[EncPos] + (Enc[EncPos + 1] << 8);
+        EncPos += 2;
+        break;
+      case 3:
+        {
+          if (EncPos >= EncSize)
+            break;
+          unsigned int Length = Enc[EncPos++];
+          if (Length & 0x80)
+          {
+            if (EncPos >= EncSize)
+              break;
+            unsigned int Correction = Enc[EncPos++];
+            for (Length = (Length & 0x7f) + 2; Length > 0 &&
+                 DecPos < MaxSize - 1 && DecPos < NameSize; Length--, DecPos++)
+              NameW[DecPos] = ((Name[DecPos] + Correction) & 0xff) + (HighByte << 8);
+          }
+          else
+          {
+            for (Length += 2; Length > 0 && DecPos < MaxSize - 1 &&
+                 DecPos < NameSize; Length--, DecPos++)
+              NameW[DecPos] = Name[DecPos];
+          }
+        }
+        break;
+    }
+    Flags <<= 2;
+    FlagBits -= 2;
+  }
+  NameW[DecPos] = 0;
+}
+
+static void ScanSetSizes(RARArchiveDataEx *N, uint64_t Pack, uint64_t Unp)
+{
+  N->hdr.PackSize = (unsigned int)(Pack & 0xffffffff);
+  N->hdr.PackSizeHigh = (unsigned int)(Pack >> 32);
+  N->hdr.UnpSize = (unsigned int)(Unp & 0xffffffff);
+  N->hdr.UnpSizeHigh = (unsigned int)(Unp >> 32);
+}
+
+static int ScanFileHead4(const unsigned char *p, unsigned int HeadSize,
+                         unsigned int Flags, RARArchiveDataEx *N)
+{
+  unsigned int NameOff = (Flags & 0x100) ? 40 : 32;
+  if (HeadSize < NameOff)
+    return ERAR_BAD_DATA;
+  unsigned int NameSize = ScanGet16(p + 26);
+  if (NameOff + NameSize > HeadSize)
+    return ERAR_BAD_DATA;
+
+  uint64_t Pack = ScanGet32(p + 7);
+  uint64_t Unp = ScanGet32(p + 11);
+  if (Flags & 0x100)
+  {
+    Pack |= (uint64_t)ScanGet32(p + 32) << 32;
+    Unp |= (uint64_t)ScanGet32(p + 36) << 32;
+  }
+  // Unknown unpacked size is stored as all bits set.
+  if ((Flags & 0x100) && Unp == 0xffffffffffffffffULL)
+    Unp = (uint64_t)INT64NDF;
+  ScanSetSizes(N, Pack, Unp);
+
+  unsigned int HostOS = p[15];
+#if RARVER_MAJOR < 5
+  N->hdr.HostOS = HostOS;
+#else
+  N->hdr.HostOS = (HostOS == HOST_UNIX || HostOS == HOST_BEOS ||
+                   HostOS >= HOST_MAX) ? HOST_UNIX : HOST_WIN32;
+#endif
+  N->hdr.FileCRC = ScanGet32(p + 16);
+  N->hdr.FileTime = ScanGet32(p + 20);
+  N->hdr.UnpVer = p[24];
+  N->hdr.Method = p[25];
+  N->hdr.FileAttr = ScanGet32(p + 28);
+  N->RawTime.mtime = ScanRawTime(ScanDosToUnix(N->hdr.FileTime), 0);
+
+  const unsigned char *Name = p + NameOff;
+  size_t Len = strnlen((const char *)Name, NameSize);
+  if (Len >= sizeof(N->hdr.FileName))
+    Len = sizeof(N->hdr.FileName) - 1;
+  if ((Flags & 0x200) && Len < NameSize)
+  {
+    ScanDecodeName(Name, Len, Name + Len + 1, NameSize - Len - 1,
+                   N->hdr.FileNameW, ASIZE(N->hdr.FileNameW));
+    WideToChar(N->hdr.FileNameW, N->hdr.FileName, sizeof(N->hdr.FileName));
+  }
+  else
+  {
+    memcpy(N->hdr.FileName, Name, Len);
+    N->hdr.FileName[Len] = 0;
+    CharToWide(N->hdr.FileName, N->hdr.FileNameW, ASIZE(N->hdr.FileNameW));
+  }
+  for (char *s = N->hdr.FileName; *s; s++)
+    if (*s == '\\')
+      *s = '/';
+  for (wchar_t *s = N->hdr.FileNameW; *s; s++)
+    if (*s == '\\')
+      *s = '/';
+
+  N->hdr.Flags = 0;
+  if ((Flags & 0xe0) == 0xe0)
+    N->hdr.Flags |= RHDF_DIRECTORY;
+  if (Flags & 0x01)
+    N->hdr.Flags |= RHDF_SPLITBEFORE;
+  if (Flags & 0x02)
+    N->hdr.Flags |= RHDF_SPLITAFTER;
+  if (Flags & 0x04)
+    N->hdr.Flags |= RHDF_ENCRYPTED;
+  if (Flags & 0x10)
+    N->hdr.Flags |= RHDF_SOLID;
+  return ERAR_SUCCESS;
+}
+
+static int ScanRar4(ScanFile *f, RARVolumeDataEx *Vol, ScanContext *Ctx)
+{
+  RARArchiveDataEx *N = Ctx->N;
+  bool EndSeen = false;
+  bool SplitAfter = false;
+  off_t Pos = 7;
+
+  while (Pos + 7 <= f->FileSize)
+  {
+    const unsigned char *p = ScanRead(f, Pos, 7);
+    if (!p)
+      return ERAR_EREAD;
+    unsigned int Type = p[2];
+    unsigned int Flags = ScanGet16(p + 3);
+    unsigned int HeadSize = ScanGet16(p + 5);
+    if (HeadSize < 7)
+      return ERAR_BAD_DATA;
+    p = ScanRead(f, Pos, HeadSize);
+    if (!p)
+      return ERAR_EREAD;
+
+    uint64_t DataSize = 0;
+    if (Type == 0x74 || Type == 0x7a)
+    {
+      if (HeadSize < 32)
+        return ERAR_BAD_DATA;
+      DataSize = ScanGet32(p + 7);
+      if ((Flags & 0x100) && HeadSize >= 40)
+        DataSize |= (uint64_t)ScanGet32(p + 32) << 32;
+    }
+    else if (Flags & 0x8000)
+    {
+      if (HeadSize < 11)
+        return ERAR_BAD_DATA;
+      DataSize = ScanGet32(p + 7);
+    }
+
+    if (Type == 0x73)
+    {
+      // Main archive header flags map directly onto ROADF_*.
+      Vol->Flags = Flags & 0x1ff;
+      if (Flags & 0x80)
+        return ERAR_UNKNOWN_FORMAT;
+    }
+    else if (Type == 0x74)
+    {
+      memset(&N->hdr, 0, sizeof(N->hdr));
+      memset(&N->RawTime, 0, sizeof(N->RawTime));
+      int Res = ScanFileHead4(p, HeadSize, Flags, N);
+      if (Res != ERAR_SUCCESS)
+        return Res;
+      strncpy(N->hdr.ArcName, Vol->ArcName, sizeof(N->hdr.ArcName) - 1);
+      N->LinkTargetFlags = 0;
+      N->HeadSize = HeadSize;
+      N->Offset = Pos;
+      N->FileDataEnd = Pos + HeadSize + DataSize;
+      SplitAfter = (Flags & 0x02) != 0;
+      Vol->FileCount++;
+      if (Ctx->Callback && Ctx->Callback(N, Ctx->UserData))
+      {
+        Ctx->Stopped = true;
+        return ERAR_SUCCESS;
+      }
+    }
+    else if (Type == 0x7b)
+    {
+      Vol->NextVolume = (Flags & 0x01) != 0;
+      EndSeen = true;
+      break;
+    }
+    Pos += HeadSize + DataSize;
+  }
+
+  // Old archives lack the end of archive block, guess from the last file.
+  if (!EndSeen)
+    Vol->NextVolume = (Vol->Flags & ROADF_VOLUME) && SplitAfter;
+  return ERAR_SUCCESS;
+}
+
+#if RARVER_MAJOR > 4
+static int ScanFileHead5(const unsigned char *p, const unsigned char *End,
+                         const unsigned char *Extra, const unsigned char *ExtraEnd,
+                         uint64_t HeadFlags, RARArchiveDataEx *N)
+{
+  uint64_t FileFlags, Unp, Attr, CompInfo, HostOS, NameSize;
+  if (!ScanGetV(p, End, &FileFlags) || !ScanGetV(p, End, &Unp) ||
+      !ScanGetV(p, End, &Attr))
+    return ERAR_BAD_DATA;
+  time_t MTime = 0;
+  if (FileFlags & 0x2)
+  {
+    if (p + 4 > End)
+      return ERAR_BAD_DATA;
+    MTime = ScanGet32(p);
+    p += 4;
+  }
+  if (FileFlags & 0x4)
+  {
+    if (p + 4 > End)
+      return ERAR_BAD_DATA;
+    N->hdr.FileCRC = ScanGet32(p);
+    p += 4;
+  }
+  if (!ScanGetV(p, End, &CompInfo) || !ScanGetV(p, End, &HostOS) ||
+      !ScanGetV(p, End, &NameSize) || p + NameSize > End)
+    return ERAR_BAD_DATA;
+
+  if (FileFlags & 0x8)
+    Unp = (uint64_t)INT64NDF;
+  N->hdr.UnpSizeHigh = (unsigned int)(Unp >> 32);
+  N->hdr.UnpSize = (unsigned int)(Unp & 0xffffffff);
+  N->hdr.FileAttr = (unsigned int)Attr;
+  N->hdr.HostOS = HostOS == 0 ? HOST_WIN32 : HOST_UNIX;
+  N->hdr.Method = ((CompInfo >> 7) & 7) + 0x30;
+  N->hdr.UnpVer = (CompInfo & 0x3f) == 0 ? 50 : 70;
+
+  char Name[1024];
+  size_t Len = NameSize < sizeof(Name) ? NameSize : sizeof(Name) - 1;
+  memcpy(Name, p, Len);
+  Name[Len] = 0;
+  UtfToWide(Name, N->hdr.FileNameW, ASIZE(N->hdr.FileNameW));
+  // Backslash is not a path separator in RAR 5.0, see ConvertFileHeader().
+  if (HostOS == 0)
+    for (wchar_t *s = N->hdr.FileNameW; *s; s++)
+      if (*s == '\\')
+        *s = '_';
+  WideToChar(N->hdr.FileNameW, N->hdr.FileName, sizeof(N->hdr.FileName));
+
+  N->hdr.Flags = 0;
+  if (FileFlags & 0x1)
+    N->hdr.Flags |= RHDF_DIRECTORY;
+  if (HeadFlags & 0x08)
+    N->hdr.Flags |= RHDF_SPLITBEFORE;
+  if (HeadFlags & 0x10)
+    N->hdr.Flags |= RHDF_SPLITAFTER;
+  if (CompInfo & 0x40)
+    N->hdr.Flags |= RHDF_SOLID;
+
+  unsigned int NSec = 0;
+  while (Extra && Extra < ExtraEnd)
+  {
+    uint64_t Size, Type;
+    if (!ScanGetV(Extra, ExtraEnd, &Size) || Size > (uint64_t)(ExtraEnd - Extra))
+      break;
+    const unsigned char *Next = Extra + Size;
+    if (ScanGetV(Extra, Next, &Type))
+    {
+      if (Type == 1)
+      {
+        N->hdr.Flags |= RHDF_ENCRYPTED;
+      }
+      else if (Type == 3)
+      {
+        uint64_t TimeFlags;
+        if (ScanGetV(Extra, Next, &TimeFlags) && (TimeFlags & 0x2))
+        {
+          if ((TimeFlags & 0x1) && Extra + 4 <= Next)
+          {
+            MTime = ScanGet32(Extra);
+            if (TimeFlags & 0x10)
+            {
+              const unsigned char *ns = Extra + 4 * (1 +
+                        !!(TimeFlags & 0x4) + !!(TimeFlags & 0x8));
+              if (ns + 4 <= Next)
+                NSec = ScanGet32(ns) % 1000000000;
+            }
+          }
+          else if (!(TimeFlags & 0x1) && Extra + 8 <= Next)
+          {
+            uint64_t Win = ScanGet64(Extra);
+            if (Win >= 116444736000000000ULL)
+            {
+              Win -= 116444736000000000ULL;
+              MTime = Win / 10000000;
+              NSec = (Win % 10000000) * 100;
+            }
+          }
+        }
+      }
+    }
+    Extra = Next;
+  }
+  if (MTime)
+  {
+    N->hdr.FileTime = ScanUnixToDos(MTime);
+    N->RawTime.mtime = ScanRawTime(MTime, NSec);
+  }
+  return ERAR_SUCCESS;
+}
+
+static int ScanRar5(ScanFile *f, RARVolumeDataEx *Vol, ScanContext *Ctx)
+{
+  RARArchiveDataEx *N = Ctx->N;
+  bool EndSeen = false;
+  bool SplitAfter = false;
+  off_t Pos = 8;
+
+  while (Pos + 7 <= f->FileSize)
+  {
+    const unsigned char *p = ScanRead(f, Pos, 7);
+    if (!p)
+      return ERAR_EREAD;
+    const unsigned char *q = p + 4;
+    uint64_t Size;
+    if (!ScanGetV(q, p + 7, &Size) || Size == 0 || Size > SCAN_MAX_HEADER)
+      return ERAR_BAD_DATA;
+    unsigned int HeadSize = (unsigned int)(q - p + Size);
+    p = ScanRead(f, Pos, HeadSize);
+    if (!p)
+      return ERAR_EREAD;
+    q = p + (HeadSize - Size);
+    const unsigned char *End = p + HeadSize;
+
+    uint64_t Type, Flags, ExtraSize = 0, DataSize = 0;
+    if (!ScanGetV(q, End, &Type) || !ScanGetV(q, End, &Flags) ||
+        ((Flags & 0x1) && !ScanGetV(q, End, &ExtraSize)) ||
+        ((Flags & 0x2) && !ScanGetV(q, End, &DataSize)) ||
+        ExtraSize > (uint64_t)(End - q))
+      return ERAR_BAD_DATA;
+    const unsigned char *Extra = ExtraSize ? End - ExtraSize : NULL;
+
+    if (Type == 1)
+    {
+      uint64_t ArcFlags;
+      if (!ScanGetV(q, End, &ArcFlags))
+        return ERAR_BAD_DATA;
+      Vol->Flags = ROADF_NEWNUMBERING;
+      if (ArcFlags & 0x01)
+      {
+        Vol->Flags |= ROADF_VOLUME;
+        if (!(ArcFlags & 0x02))
+          Vol->Flags |= ROADF_FIRSTVOLUME;
+      }
+      if (ArcFlags & 0x04)
+        Vol->Flags |= ROADF_SOLID;
+      if (ArcFlags & 0x08)
+        Vol->Flags |= ROADF_RECOVERY;
+      if (ArcFlags & 0x10)
+        Vol->Flags |= ROADF_LOCK;
+    }
+    else if (Type == 2)
+    {
+      memset(&N->hdr, 0, sizeof(N->hdr));
+      memset(&N->RawTime, 0, sizeof(N->RawTime));
+      int Res = ScanFileHead5(q, Extra ? Extra : End, Extra, End, Flags, N);
+      if (Res != ERAR_SUCCESS)
+        return Res;
+      N->hdr.PackSize = (unsigned int)(DataSize & 0xffffffff);
+      N->hdr.PackSizeHigh = (unsigned int)(DataSize >> 32);
+      strncpy(N->hdr.ArcName, Vol->ArcName, sizeof(N->hdr.ArcName) - 1);
+      N->LinkTargetFlags = 0;
+      N->HeadSize = HeadSize;
+      N->Offset = Pos;
+      N->FileDataEnd = Pos + HeadSize + DataSize;
+      SplitAfter = (Flags & 0x10) != 0;
+      Vol->FileCount++;
+      if (Ctx->Callback && Ctx->Callback(N, Ctx->UserData))
+      {
+        Ctx->Stopped = true;
+        return ERAR_SUCCESS;
+      }
+    }
+    else if (Type == 4)
+    {
+      // Archive encryption header, everything that follows is encrypted.
+      Vol->Flags |= ROADF_ENCHEADERS;
+      return ERAR_UNKNOWN_FORMAT;
+    }
+    else if (Type == 5)
+    {
+      uint64_t EndFlags = 0;
+      ScanGetV(q, End, &EndFlags);
+      Vol->NextVolume = (EndFlags & 0x01) != 0;
+      EndSeen = true;
+      break;
+    }
+    Pos += HeadSize + DataSize;
+  }
+
+  if (!EndSeen)
+    Vol->NextVolume = (Vol->Flags & ROADF_VOLUME) && SplitAfter;
+  return ERAR_SUCCESS;
+}
+#endif
+
+static int ScanArchive(RARVolumeDataEx *Vol, ScanContext *Ctx)
+{
+  ScanFile f;
+  struct stat st;
+  int Res = ERAR_UNKNOWN_FORMAT;
+
+  Vol->Flags = 0;
+  Vol->NextVolume = 0;
+  Vol->FileCount = 0;
+  memset(&f, 0, sizeof(f));
+  f.fd = open(Vol->ArcName, O_RDONLY | O_CLOEXEC);
+  if (f.fd == -1)
+    return ERAR_EOPEN;
+  if (fstat(f.fd, &st) == -1)
+  {
+    close(f.fd);
+    return ERAR_EREAD;
+  }
+  f.FileSize = st.st_size;
+
+  const unsigned char *p = ScanRead(&f, 0, 8);
+  if (p && !memcmp(p, "Rar!\x1a\x07\x00", 7))
+    Res = ScanRar4(&f, Vol, Ctx);
+#if RARVER_MAJOR > 4
+  else if (p && !memcmp(p, "Rar!\x1a\x07\x01\x00", 8))
+    Res = ScanRar5(&f, Vol, Ctx);
+#endif
+
+  free(f.Buf);
+  close(f.fd);
+  return Res;
+}
+
+// Parts of a set are scanned by the calling thread and by as many workers
+// as the submit hook set using RARSetScanSubmitEx() hands out. Workers may
+// start late, after the caller already did all the work, so the job is
+// reference counted rather than owned by the caller.
+struct ScanJob
+{
+  RARVolumeDataEx *Vols;
+  int Count;
+  int Next;
+  int Done;
+  int Refs;
+  pthread_mutex_t Lock;
+  pthread_cond_t Cond;
+};
+
+static RARSUBMITPROC ScanSubmit = NULL;
+
+static void ScanRun(ScanJob *Job)
+{
+  RARArchiveDataEx *N = NULL;
+  int i;
+
+  while ((i = __atomic_fetch_add(&Job->Next, 1, __ATOMIC_RELAXED)) < Job->Count)
+  {
+    if (!N)
+      N = new (std::nothrow) RARArchiveDataEx;
+    if (!N)
+    {
+      Job->Vols[i].Result = ERAR_NO_MEMORY;
+    }
+    else
+    {
+      ScanContext Ctx = {NULL, NULL, false, N};
+      Job->Vols[i].Result = ScanArchive(&Job->Vols[i], &Ctx);
+    }
+    pthread_mutex_lock(&Job->Lock);
+    if (++Job->Done == Job->Count)
+      pthread_cond_signal(&Job->Cond);
+    pthread_mutex_unlock(&Job->Lock);
+  }
+  delete N;
+}
+
+static void ScanPut(ScanJob *Job)
+{
+  if (__atomic_sub_fetch(&Job->Refs, 1, __ATOMIC_ACQ_REL))
+    return;
+  pthread_mutex_destroy(&Job->Lock);
+  pthread_cond_destroy(&Job->Cond);
+  delete Job;
+}
+
+static void ScanTask(void *Arg)
+{
+  ScanJob *Job = (ScanJob *)Arg;
+
+  ScanRun(Job);
+  ScanPut(Job);
+}
+
+static int ScanParallel(RARVolumeDataEx *Vols, int Count)
+{
+  ScanJob *Job = new (std::nothrow) ScanJob;
+  int i;
+
+  if (!Job)
+    return ERAR_NO_MEMORY;
+  Job->Vols = Vols;
+  Job->Count = Count;
+  Job->Next = 0;
+  Job->Done = 0;
+  Job->Refs = 1;
+  pthread_mutex_init(&Job->Lock, NULL);
+  pthread_cond_init(&Job->Cond, NULL);
+  for (i = 0; ScanSubmit && i < SCAN_MAX_WORKERS && i < Count - 1; i++)
+  {
+    __atomic_add_fetch(&Job->Refs, 1, __ATOMIC_RELAXED);
+    if (ScanSubmit(ScanTask, Job))
+    {
+      __atomic_sub_fetch(&Job->Refs, 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+  ScanRun(Job);
+  pthread_mutex_lock(&Job->Lock);
+  while (Job->Done < Job->Count)
+    pthread_cond_wait(&Job->Cond, &Job->Lock);
+  pthread_mutex_unlock(&Job->Lock);
+  ScanPut(Job);
+  return ERAR_SUCCESS;
+}
+
+void PASCAL RARSetScanSubmitEx(RARSUBMITPROC Submit)
+{
+  ScanSubmit = Submit;
+}
+
+int PASCAL RARScanArchiveEx(struct RARVolumeDataEx *Vol, RARSCANPROC Callback, void *UserData)
+{
+  ScanContext Ctx = {Callback, UserData, false, NULL};
+
+  Ctx.N = new (std::nothrow) RARArchiveDataEx;
+  if (!Ctx.N)
+    return ERAR_NO_MEMORY;
+  Vol->Result = ScanArchive(Vol, &Ctx);
+  delete Ctx.N;
+  return Vol->Result;
+}
+
+// Append the volume following the last one in |*Vols|. Returns ERAR_EOPEN
+// if it is not present.
+static int ScanAddVolume(RARVolumeDataEx **Vols, int *n, bool OldStyle)
+{
+  RARVolumeDataEx *V = *Vols;
+  char Name[sizeof(V->ArcName)];
+
+  strcpy(Name, V[*n - 1].ArcName);
+  NextVolumeNameEx(Name, sizeof(Name), OldStyle);
+  if (access(Name, F_OK))
+    return ERAR_EOPEN;
+  if (!(*n & (*n - 1)))
+  {
+    V = (RARVolumeDataEx *)realloc(V, 2 * *n * sizeof(*V));
+    if (!V)
+      return ERAR_NO_MEMORY;
+    *Vols = V;
+  }
+  memset(&V[*n], 0, sizeof(*V));
+  strcpy(V[*n].ArcName, Name);
+  (*n)++;
+  return ERAR_SUCCESS;
+}
+
+int PASCAL RARScanVolumesEx(const char *ArcName, int OldStyle, int MaxVolumes,
+                            struct RARVolumeDataEx **Vols, int *Count,
+                            RARSCANPROC Callback, void *UserData)
+{
+  ScanContext Ctx = {Callback, UserData, false, NULL};
+  RARVolumeDataEx *V;
+  int n = 1;
+  int i;
+
+  *Vols = NULL;
+  *Count = 0;
+  if (MaxVolumes < 1)
+    MaxVolumes = 1;
+  if (strlen(ArcName) >= sizeof(V->ArcName))
+    return ERAR_SMALL_BUF;
+
+  V = (RARVolumeDataEx *)calloc(1, sizeof(RARVolumeDataEx));
+  if (!V)
+    return ERAR_NO_MEMORY;
+  Ctx.N = new (std::nothrow) RARArchiveDataEx;
+  if (!Ctx.N)
+  {
+    V[0].Result = ERAR_NO_MEMORY;
+    goto out;
+  }
+  strcpy(V[0].ArcName, ArcName);
+  V[0].Result = ScanArchive(&V[0], &Ctx);
+  if (V[0].Result != ERAR_SUCCESS)
+    goto out;
+  if (OldStyle < 0)
+    OldStyle = !(V[0].Flags & ROADF_NEWNUMBERING);
+
+  if (Callback)
+  {
+    // Entries must be reported in volume order, and callers typically
+    // stop early, so walk the parts one by one in a single pass.
+    while (V[n - 1].NextVolume && !Ctx.Stopped && n < MaxVolumes)
+    {
+      int Res = ScanAddVolume(&V, &n, OldStyle);
+      if (Res == ERAR_SUCCESS)
+        Res = ScanArchive(&V[n - 1], &Ctx);
+      if (Res != ERAR_SUCCESS)
+      {
+        V[0].Result = Res;
+        goto out;
+      }
+    }
+    goto done;
+  }
+
+  if (V[0].NextVolume)
+  {
+    // Volume names are cheap to produce, so find out what is present up
+    // front and then walk all parts in parallel.
+    while (n < MaxVolumes)
+    {
+      int Res = ScanAddVolume(&V, &n, OldStyle);
+      if (Res == ERAR_EOPEN)
+        break;
+      if (Res != ERAR_SUCCESS)
+      {
+        V[0].Result = Res;
+        goto out;
+      }
+    }
+    if (n > 1 && (V[0].Result = ScanParallel(V + 1, n - 1)) != ERAR_SUCCESS)
+      goto out;
+  }
+
+  // The set ends at the first part claiming to be the last one.
+  for (i = 0; i < n; i++)
+  {
+    if (V[i].Result != ERAR_SUCCESS)
+    {
+      V[0].Result = V[i].Result;
+      goto out;
+    }
+    if (!V[i].NextVolume)
+      break;
+  }
+  if (i == n)
+  {
+    if (n < MaxVolumes)
+    {
+      V[0].Result = ERAR_EOPEN;
+      goto out;
+    }
+    i = n - 1;
+  }
+  n = i + 1;
+
+done:
+  delete Ctx.N;
+  *Vols = V;
+  *Count = n;
+  return ERAR_SUCCESS;
+
+out:
+  delete Ctx.N;
+  i = V[0].Result;
+  free(V);
+  return i;
+}
+
+void PASCAL RARFreeVolumesEx(struct RARVolumeDataEx **Vols)
+{
+  free(*Vols);
+  *Vols = NULL;
+}
+
+// libunrar keeps the keys it derived from the password, per salt, in the
+// CryptData objects of a handle. Parking a handle instead of closing it
+// keeps those (and the password itself) around such that a later reopen
+// of the same archive can skip the key derivation altogether. Parked
+// handles are locked in memory where permitted. This covers the DataSet
+// itself, ie. the password and the keys of encrypted headers, but not the
+// keys of the file data, which live in CryptData objects allocated by
+// libunrar on its own. Locking is per page and not counted, so unlocking
+// one handle may unlock parts of another one sharing a page with it.
+int PASCAL RARParkArchiveEx(HANDLE hArcData, int Park)
+{
+  DataSet *Data = (DataSet *)hArcData;
+
+  if (!Park)
+  {
+    (void)munlock(Data, sizeof(DataSet));
+    return ERAR_SUCCESS;
+  }
+#if RARVER_MAJOR > 4
+  // Nothing worth keeping unless a password was needed
+  if (!Data->Cmd.Password.IsSet())
+    return ERAR_UNKNOWN;
+  Data->Arc.Close();
+  Data->Cmd.Callback = NULL;
+  Data->Cmd.UserData = 0;
+  // Best effort, keep the password and header keys out of swap
+  (void)mlock(Data, sizeof(DataSet));
+  return ERAR_SUCCESS;
+#else
+  return ERAR_UNKNOWN;
+#endif
+}
+
+HANDLE PASCAL RARReopenArchiveEx(HANDLE hArcData, struct RAROpenArchiveDataEx *r)
+{
+#if RARVER_MAJOR > 4
+  DataSet *Data = (DataSet *)hArcData;
+
+  r->OpenResult = 0;
+  try
+  {
+    ErrHandler.Clean();
+    Data->Cmd.DllError = 0;
+    Data->Cmd.Callback = r->Callback;
+    Data->Cmd.UserData = r->UserData;
+    Data->OpenMode = r->OpenMode;
+#if RARVER_MAJOR >= 7
+    wstring ArcName;
+    CharToWide(r->ArcName, ArcName);
+#else
+    wchar ArcName[NM];
+    CharToWide(r->ArcName, ArcName, ASIZE(ArcName));
+#endif
+    Data->Arc.Close();
+    if (!Data->Arc.Open(ArcName, FMF_OPENSHARED))
+    {
+      r->OpenResult = ERAR_EOPEN;
+      return NULL;
+    }
+    if (!Data->Arc.IsArchive(true))
+    {
+      r->OpenResult = Data->Cmd.DllError ? Data->Cmd.DllError
+                                         : ERAR_BAD_ARCHIVE;
+      return NULL;
+    }
+    r->Flags = 0;
+    if (Data->Arc.Volume)
+      r->Flags |= ROADF_VOLUME;
+    if (Data->Arc.MainComment)
+      r->Flags |= ROADF_COMMENT;
+    if (Data->Arc.Locked)
+      r->Flags |= ROADF_LOCK;
+    if (Data->Arc.Solid)
+      r->Flags |= ROADF_SOLID;
+    if (Data->Arc.NewNumbering)
+      r->Flags |= ROADF_NEWNUMBERING;
+    if (Data->Arc.Signed)
+      r->Flags |= ROADF_SIGNED;
+    if (Data->Arc.Protected)
+      r->Flags |= ROADF_RECOVERY;
+    if (Data->Arc.Encrypted)
+      r->Flags |= ROADF_ENCHEADERS;
+    if (Data->Arc.FirstVolume)
+      r->Flags |= ROADF_FIRSTVOLUME;
+    r->CmtState = r->CmtSize = 0;
+    Data->Extract.ExtractArchiveInit(Data->Arc);
+  }
+  catch (std::bad_alloc&)
+  {
+    r->OpenResult = ERAR_NO_MEMORY;
+    return NULL;
+  }
+  catch (...)
+  {
+    r->OpenResult = ERAR_BAD_ARCHIVE;
+    return NULL;
+  }
+  return hArcData;
+#else
+  (void)hArcData;
+  r->OpenResult = ERAR_UNKNOWN;
+  return NULL;
+#endif
+}
+
 #if RARVER_MAJOR > 4
 static size_t ListFileHeader(wchar *,Archive &);
 #endif
@@ -126,6 +126,15 @@ struct RARArchiveDataEx
   off_t        FileDataEnd;
 };
 
+struct RARVolumeDataEx
+{
+  char         ArcName[1024];
+  unsigned int Flags;       /* ROADF_* of the main archive header */
+  int          NextVolume;  /* set if another volume follows */
+  int          FileCount;
+  int          Result;
+};
+
 struct RARWcb
 {
   unsigned int bytes;
@@ -142,6 +151,32 @@ void         PASCAL RARNextVolumeName(char *, bool);
 void         PASCAL RARVolNameToFirstName(char *, bool);
 void         PASCAL RARGetFileInfo(HANDLE hArcData, const char *FileName, struct RARWcb *wcb);
 
+/* Header-only scanner. The callback is invoked once per file header and
+ * may return non-zero to stop the scan, in which case |Count| only covers
+ * the volumes scanned so far. A negative |OldStyle| picks the volume
+ * naming scheme from the main archive header. Without a callback the
+ * parts of a set are scanned in parallel on workers handed out by the
+ * hook set using RARSetScanSubmitEx(), which must not block but return
+ * non-zero if no worker is free. Without a hook the calling thread scans
+ * all parts. */
+typedef int (*RARSCANPROC)(RARArchiveDataEx *, void *);
+typedef int (*RARSUBMITPROC)(void (*)(void *), void *);
+void         PASCAL RARSetScanSubmitEx(RARSUBMITPROC Submit);
+int          PASCAL RARScanArchiveEx(struct RARVolumeDataEx *Vol, RARSCANPROC Callback, void *UserData);
+int          PASCAL RARScanVolumesEx(const char *ArcName, int OldStyle, int MaxVolumes,
+                                     struct RARVolumeDataEx **Vols, int *Count,
+                                     RARSCANPROC Callback, void *UserData);
+void         PASCAL RARFreeVolumesEx(struct RARVolumeDataEx **Vols);
+
+/* Parking keeps the password and derived keys of an encrypted archive
+ * handle for a later RARReopenArchiveEx(). A parked handle holds no file
+ * descriptor. RARParkArchiveEx() fails if there is nothing worth keeping.
+ * It must be called with |Park| = 0 before a parked handle is reopened
+ * or closed. On failure RARReopenArchiveEx() returns NULL and the handle
+ * must still be closed. */
+int          PASCAL RARParkArchiveEx(HANDLE hArcData, int Park);
+HANDLE       PASCAL RARReopenArchiveEx(HANDLE hArcData, struct RAROpenArchiveDataEx *ArchiveData);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,22 +37,37 @@
 #include "filecache.h"
 
 #define FILECACHE_SZ  (1024)
+#define STRPOOL_SZ  (1024)
 
-/* Hash table handle */
-static void *ht = NULL;
+/* Hash table handles, one per shard of file_access_lock */
+static void *ht[SHLOCK_SHARDS];
 
-pthread_rwlock_t file_access_lock;
+/*
+ * Pool of shared strings, see filecache_strdup(). Every entry listed from
+ * the same archive refers to the same archive path, so keeping only one
+ * copy of it saves a lot of memory for large archives. The hash table key
+ * is the string itself, the user data its reference count. The pool is
+ * split in shards selected by shlock_shard() of the string, each with its
+ * own lock, so that cloning entries of different archives does not
+ * serialize on a single mutex.
+ */
+static struct strpool_shard {
+        void *ht;
+        pthread_mutex_t lock;
+} __attribute__((aligned(64))) strpool[SHLOCK_SHARDS];
+
+struct shlock file_access_lock;
 
 #define FREE_CACHE_MEM(e)\
         do {\
-                free((e)->rar_p);\
+                filecache_strfree((e)->rar_p);\
                 free((e)->file_p);\
                 free((e)->link_target_p);\
                 (e)->link_target_p = NULL;\
                 (e)->rar_p = NULL;\
                 (e)->file_p = NULL;\
                 /* Recursive unpacking: Free nested metadata fields */ \
-                free((e)->parent_rar_p);\
+                filecache_strfree((e)->parent_rar_p);\
                 (e)->parent_rar_p = NULL;\
         } while(0)
 
@@ -83,6 +98,71 @@ static void __free(const char *key, void *data)
         free(e);
 }
 
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__strpool_alloc()
+{
+        return calloc(1, sizeof(unsigned int));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __strpool_free(const char *key, void *data)
+{
+        (void)key;
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ * Return a shared, reference counted, copy of 's'. The result must only
+ * be released using filecache_strfree(). Sets errno on failure.
+ ****************************************************************************/
+char *filecache_strdup(const char *s)
+{
+        struct strpool_shard *sp = &strpool[shlock_shard(s)];
+        struct hash_table_entry *hte;
+        char *p = NULL;
+
+        pthread_mutex_lock(&sp->lock);
+        if (sp->ht) {
+                hte = hashtable_entry_alloc(sp->ht, s);
+                if (hte) {
+                        ++*(unsigned int *)hte->user_data;
+                        p = hte->key;
+                }
+        }
+        pthread_mutex_unlock(&sp->lock);
+        if (!p)
+                errno = ENOMEM;
+        return p;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void filecache_strfree(char *s)
+{
+        struct strpool_shard *sp;
+        struct hash_table_entry *hte;
+
+        if (!s)
+                return;
+        sp = &strpool[shlock_shard(s)];
+        pthread_mutex_lock(&sp->lock);
+        if (sp->ht) {
+                hte = hashtable_entry_get(sp->ht, s);
+                if (hte && !--*(unsigned int *)hte->user_data)
+                        hashtable_entry_delete(sp->ht, s);
+        }
+        pthread_mutex_unlock(&sp->lock);
+}
+
 /*!
  *****************************************************************************
  *
@@ -90,7 +170,7 @@ static void __free(const char *key, void *data)
 struct filecache_entry *filecache_alloc(const char *path)
 {
         struct hash_table_entry *hte;
-        hte = hashtable_entry_alloc(ht, path);
+        hte = hashtable_entry_alloc(ht[shlock_shard(path)], path);
         if (hte)
                 return hte->user_data;
         return NULL;
@@ -103,19 +183,57 @@ struct filecache_entry *filecache_alloc(const char *path)
 struct filecache_entry *filecache_get(const char *path)
 {
         struct hash_table_entry *hte;
-        hte = hashtable_entry_get(ht, path);
+        hte = hashtable_entry_get(ht[shlock_shard(path)], path);
         if (hte)
                 return hte->user_data;
         return NULL;
 }
 
+struct foreach_arg {
+        void (*cb)(const char *, struct filecache_entry *, void *);
+        void *arg;
+};
+
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
+static void __foreach_cb(const char *key, void *data, void *arg)
+{
+        struct foreach_arg *a = arg;
+        a->cb(key, data, a->arg);
+}
+
+/*!
+ *****************************************************************************
+ * Call 'cb' for every cache entry. Must be called with the lock of all
+ * shards held.
+ ****************************************************************************/
+void filecache_foreach(void (*cb)(const char *, struct filecache_entry *,
+                                  void *), void *arg)
+{
+        struct foreach_arg a = { cb, arg };
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                hashtable_foreach(ht[i], __foreach_cb, &a);
+}
+
+/*!
+ *****************************************************************************
+ * Invalidating all entries ('path' is NULL) requires the lock of all
+ * shards to be held.
+ ****************************************************************************/
 void filecache_invalidate(const char *path)
 {
-        hashtable_entry_delete(ht, path);
+        int i;
+
+        if (path) {
+                hashtable_entry_delete(ht[shlock_shard(path)], path);
+                return;
+        }
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                hashtable_entry_delete(ht[i], NULL);
 }
 
 /*!
@@ -129,14 +247,14 @@ struct filecache_entry *filecache_clone(const struct filecache_entry *src)
                 memcpy(dest, src, sizeof(struct filecache_entry));
                 errno = 0;
                 if (src->rar_p)
-                        dest->rar_p = strdup(src->rar_p);
+                        dest->rar_p = filecache_strdup(src->rar_p);
                 if (src->file_p)
                         dest->file_p = strdup(src->file_p);
                 if (src->link_target_p)
                         dest->link_target_p = strdup(src->link_target_p);
                 /* Recursive unpacking: Clone nested metadata fields */
                 if (src->parent_rar_p)
-                        dest->parent_rar_p = strdup(src->parent_rar_p);
+                        dest->parent_rar_p = filecache_strdup(src->parent_rar_p);
                 if (errno != 0) {
                         filecache_freeclone(dest);
                         dest = NULL;
@@ -156,9 +274,9 @@ int filecache_copy(const struct filecache_entry *src,
         if (dest == NULL || src == NULL)
                 return -EINVAL;
 
-        free(dest->rar_p);
+        filecache_strfree(dest->rar_p);
         if (src->rar_p) {
-                dest->rar_p = strdup(src->rar_p);
+                dest->rar_p = filecache_strdup(src->rar_p);
                 if (!dest->rar_p) {
                         printd(1, "filecache_copy: strdup failed for rar_p\n");
                         return -ENOMEM;
@@ -172,7 +290,7 @@ int filecache_copy(const struct filecache_entry *src,
                 dest->file_p = strdup(src->file_p);
                 if (!dest->file_p) {
                         printd(1, "filecache_copy: strdup failed for file_p\n");
-                        free(dest->rar_p);
+                        filecache_strfree(dest->rar_p);
                         dest->rar_p = NULL;
                         return -ENOMEM;
                 }
@@ -186,7 +304,7 @@ int filecache_copy(const struct filecache_entry *src,
                 dest->link_target_p = strdup(src->link_target_p);
                 if (!dest->link_target_p) {
                         printd(1, "filecache_copy: strdup failed for link_target_p\n");
-                        free(dest->rar_p);
+                        filecache_strfree(dest->rar_p);
                         free(dest->file_p);
                         dest->rar_p = NULL;
                         dest->file_p = NULL;
@@ -207,18 +325,19 @@ int filecache_copy(const struct filecache_entry *src,
         CP_ENTRY_F(vtype);
         CP_ENTRY_F(method);
         CP_ENTRY_F(flags_uint32);
+        CP_ENTRY_F(profile_uint64);
 
         /* Recursive unpacking: Copy nested metadata fields (string fields already handled above) */
         CP_ENTRY_F(nested_depth);
         CP_ENTRY_F(hide_from_listing);
 
         /* Handle nested string fields with proper allocation */
-        free(dest->parent_rar_p);
+        filecache_strfree(dest->parent_rar_p);
         if (src->parent_rar_p) {
-                dest->parent_rar_p = strdup(src->parent_rar_p);
+                dest->parent_rar_p = filecache_strdup(src->parent_rar_p);
                 if (!dest->parent_rar_p) {
                         printd(1, "filecache_copy: strdup failed for parent_rar_p\n");
-                        free(dest->rar_p);
+                        filecache_strfree(dest->rar_p);
                         free(dest->file_p);
                         free(dest->link_target_p);
                         dest->rar_p = NULL;
@@ -255,8 +374,18 @@ void filecache_init()
                 .free = __free,
         };
 
-        ht = hashtable_init(FILECACHE_SZ, &ops);
-        pthread_rwlock_init(&file_access_lock, NULL);
+        struct hash_table_ops strpool_ops = {
+                .alloc = __strpool_alloc,
+                .free = __strpool_free,
+        };
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                pthread_mutex_init(&strpool[i].lock, NULL);
+                strpool[i].ht = hashtable_init(STRPOOL_SZ, &strpool_ops);
+                ht[i] = hashtable_init(FILECACHE_SZ, &ops);
+        }
+        shlock_init(&file_access_lock);
 }
 
 /*!
@@ -265,7 +394,18 @@ void filecache_init()
  ****************************************************************************/
 void filecache_destroy()
 {
-        pthread_rwlock_destroy(&file_access_lock);
-        hashtable_destroy(ht);
-        ht = NULL;
+        int i;
+
+        shlock_destroy(&file_access_lock);
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                hashtable_destroy(ht[i]);
+                ht[i] = NULL;
+        }
+        for (i = 0; i < SHLOCK_SHARDS; i++) {
+                pthread_mutex_lock(&strpool[i].lock);
+                hashtable_destroy(strpool[i].ht);
+                strpool[i].ht = NULL;
+                pthread_mutex_unlock(&strpool[i].lock);
+                pthread_mutex_destroy(&strpool[i].lock);
+        }
 }
@@ -32,13 +32,13 @@
 #include <platform.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include "shlock.h"
 
 __extension__
 struct filecache_entry {
         char *rar_p;
         char *file_p;
         char *link_target_p;
-        short method;                /* for getxattr() */
         struct stat stat;
         off_t offset;                /* >0: offset in rar file (raw read) */
         off_t vsize_first;           /* >0: volume file size (raw read) */
@@ -50,6 +50,7 @@ struct filecache_entry {
         short vlen;
         short vpos;
         short vtype;
+        short method;                /* for getxattr() */
         union {
                 struct {
 #ifndef WORDS_BIGENDIAN
@@ -59,11 +60,11 @@ struct filecache_entry {
                         unsigned int vsize_fixup_needed:1;
                         unsigned int encrypted:1;
                         unsigned int vsize_resolved:1;
-                        unsigned int :19;                /*  Reduced from 21 to 19 */
+                        unsigned int solid:1;
+                        unsigned int :18;
                         unsigned int detection_deferred:1; /*  Lazy RAR detection flag */
                         unsigned int is_nested_rar:1;      /*  Is this a nested RAR archive? */
                         unsigned int unresolved:1;
-                        unsigned int dry_run_done:1;
                         unsigned int check_atime:1;
                         unsigned int direct_io:1;
                         unsigned int avi_tested:1;
@@ -73,11 +74,11 @@ struct filecache_entry {
                         unsigned int avi_tested:1;
                         unsigned int direct_io:1;
                         unsigned int check_atime:1;
-                        unsigned int dry_run_done:1;
                         unsigned int unresolved:1;
                         unsigned int is_nested_rar:1;      /*  Is this a nested RAR archive? */
                         unsigned int detection_deferred:1; /*  Lazy RAR detection flag */
-                        unsigned int :19;                /*  Reduced from 21 to 19 */
+                        unsigned int :18;
+                        unsigned int solid:1;
                         unsigned int vsize_resolved:1;
                         unsigned int encrypted:1;
                         unsigned int vsize_fixup_needed:1;
@@ -96,12 +97,44 @@ struct filecache_entry {
         uint8_t hide_from_listing;      /* Hide nested RAR after unpacking (0=visible, 1=hidden) */
         uint16_t _padding;              /* Alignment padding (reserved for future use) */
         char *parent_rar_p;             /* Path to parent RAR (NULL = top-level) */
+        /*
+         * Per-archive tuning from the config file, looked up at first open.
+         * Published with a single store so that it can be filled in while
+         * holding only the read lock.
+         */
+        union {
+                struct {
+                        int16_t iob_size;       /* MiB, 0 = global */
+                        int16_t raw_readahead;  /* MiB, -1 = global */
+                        int8_t hist_size;       /* percent, -1 = global */
+                        int8_t block_cache;     /* -1 = global */
+                        int8_t direct_io;       /* -1 = global */
+                        uint8_t loaded;
+                } profile;
+                uint64_t profile_uint64;
+        };
 };
 
 #define LOCAL_FS_ENTRY ((void*)-1)
 #define LOOP_FS_ENTRY ((void*)-2)
 
-extern pthread_rwlock_t file_access_lock;
+extern struct shlock file_access_lock;
+
+/*
+ * Atomically set/clear a flag of a cache entry. This allows for simple
+ * flag updates while only holding the read lock.
+ */
+#define FILECACHE_FLAG_OP_(e, f, op, v)\
+        do {\
+                struct filecache_entry t_;\
+                t_.flags_uint32 = 0;\
+                t_.flags.f = 1;\
+                op(&(e)->flags_uint32, (v), __ATOMIC_RELAXED);\
+        } while(0)
+#define FILECACHE_FLAG_SET(e, f)\
+        FILECACHE_FLAG_OP_(e, f, __atomic_fetch_or, t_.flags_uint32)
+#define FILECACHE_FLAG_CLR(e, f)\
+        FILECACHE_FLAG_OP_(e, f, __atomic_fetch_and, ~t_.flags_uint32)
 
 struct filecache_entry *
 filecache_alloc(const char *path);
@@ -112,12 +145,22 @@ filecache_get(const char *path);
 void
 filecache_invalidate(const char *path);
 
+void
+filecache_foreach(void (*cb)(const char *, struct filecache_entry *, void *),
+                  void *arg);
+
 struct filecache_entry *
 filecache_clone(const struct filecache_entry *src);
 
 int
 filecache_copy(const struct filecache_entry *src, struct filecache_entry *dest);
 
+char *
+filecache_strdup(const char *s);
+
+void
+filecache_strfree(char *s);
+
 void
 filecache_freeclone(struct filecache_entry *dest);
 
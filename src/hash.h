@@ -38,15 +38,25 @@
  ****************************************************************************/
 static inline uint32_t get_hash(const char *s, uint32_t mask)
 {
-        /* djb2 xor variant (favored by Bernstein) */
-
-        uint32_t hash = 5381;
+        /*
+         * FNV-1a followed by the MurmurHash3 finalizer. The finalizer makes
+         * every input bit affect the low order bits used for bucket
+         * selection, which plain FNV-1a (and djb2) is weak at for keys
+         * sharing long common prefixes such as paths.
+         */
+
+        uint32_t hash = 2166136261u;
         int c;
 
-        while((c = *s++)) {
-                /* hash = hash * 33 ^ c */
-                hash = ((hash << 5) + hash) ^ c;
+        while((c = (unsigned char)*s++)) {
+                hash ^= c;
+                hash *= 16777619u;
         }
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        hash ^= hash >> 16;
         return hash & (mask - 1);
 }
 
@@ -33,12 +33,145 @@
 #include "hashtable.h"
 #include "hash.h"
 
+/*
+ * The table grows when the number of entries exceeds the number of
+ * buckets and shrinks, but never below its initial size, when it drops
+ * below 1/8 of it. Entries are moved to the new bucket array a few buckets
+ * at a time by each sub-sequent insert or delete, so no single operation
+ * pays for a full rehash. Until done, an entry is found in the old array if
+ * its bucket there has not yet been moved, and in the new array otherwise.
+ * Lookups never modify the table and are safe to run concurrently as long
+ * as the caller serializes them against inserts and deletes.
+ */
+#define REHASH_STEP 4
+
 struct hash_table {
         struct hash_table_entry *bucket;
         size_t size;
+        size_t min_size;
+        size_t count;
+        struct hash_table_entry *old;
+        size_t old_size;
+        size_t rehash_idx;
         struct hash_table_ops ops;
 };
 
+/*!
+ *****************************************************************************
+ * Return bucket currently holding entries of 'hash'.
+ ****************************************************************************/
+static inline struct hash_table_entry *__bucket(struct hash_table *ht,
+                                                uint32_t hash)
+{
+        if (ht->old) {
+                size_t i = hash & (ht->old_size - 1);
+                if (i >= ht->rehash_idx)
+                        return &ht->old[i];
+        }
+        return &ht->bucket[hash & (ht->size - 1)];
+}
+
+/*!
+ *****************************************************************************
+ * Move all entries of old bucket 'i' to the new bucket array.
+ * Returns 0 on success or -1 if a bucket could not be moved (ENOMEM), in
+ * which case it is left untouched.
+ ****************************************************************************/
+static int __rehash_bucket(struct hash_table *ht, size_t i)
+{
+        struct hash_table_entry *b = &ht->old[i];
+        struct hash_table_entry *t;
+        struct hash_table_entry *p;
+
+        if (!b->key)
+                return 0;
+
+        /*
+         * Start with the bucket itself since it is the only entry that might
+         * need a new allocation. Collision chain entries are simply relinked.
+         */
+        t = &ht->bucket[b->hash & (ht->size - 1)];
+        if (t->key) {
+                struct hash_table_entry *n = malloc(sizeof(struct hash_table_entry));
+                if (!n)
+                        return -1;
+                *n = *b;
+                n->next = t->next;
+                t->next = n;
+        } else {
+                *t = *b;
+                t->next = NULL;
+        }
+
+        p = b->next;
+        while (p) {
+                struct hash_table_entry *next = p->next;
+                t = &ht->bucket[p->hash & (ht->size - 1)];
+                if (t->key) {
+                        p->next = t->next;
+                        t->next = p;
+                } else {
+                        *t = *p;
+                        t->next = NULL;
+                        free(p);
+                }
+                p = next;
+        }
+        memset(b, 0, sizeof(struct hash_table_entry));
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __rehash_step(struct hash_table *ht)
+{
+        int n = REHASH_STEP;
+        int empty = REHASH_STEP * 16;
+
+        if (!ht->old)
+                return;
+        while (ht->rehash_idx < ht->old_size && n && empty) {
+                if (!ht->old[ht->rehash_idx].key) {
+                        --empty;
+                } else {
+                        if (__rehash_bucket(ht, ht->rehash_idx))
+                                return; /* try again later */
+                        --n;
+                }
+                ++ht->rehash_idx;
+        }
+        if (ht->rehash_idx >= ht->old_size) {
+                printd(3, "Rehash of %p to %zu buckets done\n", ht, ht->size);
+                free(ht->old);
+                ht->old = NULL;
+                ht->old_size = 0;
+                ht->rehash_idx = 0;
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Start moving entries to a bucket array of 'size' buckets.
+ ****************************************************************************/
+static void __resize(struct hash_table *ht, size_t size)
+{
+        struct hash_table_entry *bucket;
+
+        if (ht->old)
+                return; /* busy */
+        bucket = calloc(size, sizeof(struct hash_table_entry));
+        if (!bucket)
+                return;
+        printd(3, "Rehashing %p from %zu to %zu buckets\n", ht, ht->size, size);
+        ht->old = ht->bucket;
+        ht->old_size = ht->size;
+        ht->rehash_idx = 0;
+        ht->bucket = bucket;
+        ht->size = size;
+}
+
 /*!
  *****************************************************************************
  *
@@ -52,10 +185,10 @@ struct hash_table_entry *hashtable_entry_alloc(void *h, const char *key)
  *****************************************************************************
  *
  ****************************************************************************/
-struct hash_table_entry *hashtable_entry_alloc_hash(void *h, const char *key, uint32_t hash)
+static struct hash_table_entry *__entry_alloc_hash(struct hash_table *ht,
+                const char *key, uint32_t hash)
 {
-        struct hash_table *ht = h;
-        struct hash_table_entry *p = &ht->bucket[(hash & (ht->size - 1))];
+        struct hash_table_entry *p = __bucket(ht, hash);
         if (p->key) {
                 if (!strcmp(key, p->key))
                         return p;
@@ -89,6 +222,7 @@ struct hash_table_entry *hashtable_entry_alloc_hash(void *h, const char *key, ui
                         prev->next = NULL;
                         return NULL;
                 }
+                ++ht->count;
                 return p;
         }
         /* Empty bucket case */
@@ -105,9 +239,24 @@ struct hash_table_entry *hashtable_entry_alloc_hash(void *h, const char *key, ui
                 p->key = NULL;  /* Restore bucket to empty state */
                 return NULL;
         }
+        ++ht->count;
         return p;
 }
 
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+struct hash_table_entry *hashtable_entry_alloc_hash(void *h, const char *key, uint32_t hash)
+{
+        struct hash_table *ht = h;
+
+        __rehash_step(ht);
+        if (ht->count >= ht->size)
+                __resize(ht, ht->size * 2);
+        return __entry_alloc_hash(ht, key, hash);
+}
+
 /*!
  *****************************************************************************
  *
@@ -124,7 +273,7 @@ struct hash_table_entry *hashtable_entry_get(void *h, const char *key)
 struct hash_table_entry *hashtable_entry_get_hash(void *h, const char *key, uint32_t hash)
 {
         struct hash_table *ht = h;
-        struct hash_table_entry *p = &ht->bucket[hash & (ht->size - 1)];
+        struct hash_table_entry *p = __bucket(ht, hash);
         if (p->key) {
                 while (p) {
                         /*
@@ -149,7 +298,7 @@ static void hashtable_entry_delete_hash(void *h, const char *key,
                                         uint32_t hash)
 {
         struct hash_table *ht = h;
-        struct hash_table_entry *b = &ht->bucket[hash & (ht->size - 1)];
+        struct hash_table_entry *b = __bucket(ht, hash);
         struct hash_table_entry *p = b;
         printd(3, "Invalidating hash key %s in %p\n", key, ht);
 
@@ -163,6 +312,7 @@ static void hashtable_entry_delete_hash(void *h, const char *key,
                         prev->next = p->next;
                         free(p->key);
                         free(p);
+                        --ht->count;
                         /* Entry purged. We can leave now. */
                         return;
                 }
@@ -186,6 +336,36 @@ static void hashtable_entry_delete_hash(void *h, const char *key,
                         free(b->key);
                         memset(b, 0, sizeof(struct hash_table_entry));
                 }
+                --ht->count;
+        }
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __delete_all(struct hash_table *ht,
+                         struct hash_table_entry *bucket, size_t size)
+{
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                struct hash_table_entry *b = &bucket[i];
+                struct hash_table_entry *next = b->next;
+
+                /* Search collision chain */
+                while (next) {
+                        struct hash_table_entry *p = next;
+                        next = p->next;
+                        if (p->user_data)
+                                ht->ops.free(p->key, p->user_data);
+                        free(p->key);
+                        free(p);
+                }
+                if (b->user_data)
+                        ht->ops.free(b->key, b->user_data);
+                free(b->key);
+                memset(b, 0, sizeof(struct hash_table_entry));
         }
 }
 
@@ -196,30 +376,23 @@ static void hashtable_entry_delete_hash(void *h, const char *key,
 void hashtable_entry_delete(void *h, const char *key)
 {
         struct hash_table *ht = h;
-        size_t i;
 
         if (key) {
+                __rehash_step(ht);
                 hashtable_entry_delete_hash(h, key, get_hash(key, 0));
+                if (ht->size > ht->min_size && ht->count < ht->size / 8)
+                        __resize(ht, ht->size / 2);
         } else {
                 printd(3, "Invalidating all hash keys in %p\n", ht);
-                for (i = 0; i < ht->size; i++) {
-                        struct hash_table_entry *b = &ht->bucket[i];
-                        struct hash_table_entry *next = b->next;
-
-                        /* Search collision chain */
-                        while (next) {
-                                struct hash_table_entry *p = next;
-                                next = p->next;
-                                if (p->user_data)
-                                        ht->ops.free(p->key, p->user_data);
-                                free(p->key);
-                                free(p);
-                        }
-                        if (b->user_data)
-                                ht->ops.free(b->key, b->user_data);
-                        free(b->key);
-                        memset(b, 0, sizeof(struct hash_table_entry));
+                if (ht->old) {
+                        __delete_all(ht, ht->old, ht->old_size);
+                        free(ht->old);
+                        ht->old = NULL;
+                        ht->old_size = 0;
+                        ht->rehash_idx = 0;
                 }
+                __delete_all(ht, ht->bucket, ht->size);
+                ht->count = 0;
         }
 }
 
@@ -239,7 +412,7 @@ static int __hashtable_entry_delete_subkeys(void *h, const char *key,
         if (++level > MAX_SUBKEY_LEVELS)
                 return level;
 
-        p = &ht->bucket[hash & (ht->size - 1)];
+        p = __bucket(ht, hash);
         b = p;
 
         /* Search collision chain first to reduce bucket updates */
@@ -275,33 +448,30 @@ static int __hashtable_entry_delete_subkeys(void *h, const char *key,
  *****************************************************************************
  *
  ****************************************************************************/
-void hashtable_entry_delete_subkeys(void *h, const char *key, uint32_t hash)
+static void __delete_subkeys_linear(struct hash_table *ht, const char *key,
+                                    struct hash_table_entry *bucket,
+                                    size_t from, size_t size)
 {
-        struct hash_table *ht = h;
         struct hash_table_entry *p;
         struct hash_table_entry *b;
         struct hash_table_entry *n;
         size_t i;
 
-        if (!__hashtable_entry_delete_subkeys(h, key, hash, 0))
-                return;
-
-        /* Back off to a linear bucket search, slower but more "safe" */
-        for (i = 0; i < ht->size; i++) {
-                b = &ht->bucket[i];
+        for (i = from; i < size; i++) {
+                b = &bucket[i];
                 p = b;
                 /* Search collision chain first to reduce bucket updates */
                 while (p->next) {
                         n = p;
                         p = p->next;
                         if (strstr(p->key, key) == p->key) {
-                                hashtable_entry_delete_hash(h, p->key, p->hash);
+                                hashtable_entry_delete_hash(ht, p->key, p->hash);
                                 p = n;
                         }
                 }
                 /* Finally check the bucket */
                 if (b->key && (strstr(b->key, key) == b->key))
-                        hashtable_entry_delete_hash(h, b->key, b->hash);
+                        hashtable_entry_delete_hash(ht, b->key, b->hash);
         }
 }
 
@@ -309,21 +479,110 @@ void hashtable_entry_delete_subkeys(void *h, const char *key, uint32_t hash)
  *****************************************************************************
  *
  ****************************************************************************/
+void hashtable_entry_delete_subkeys(void *h, const char *key, uint32_t hash)
+{
+        struct hash_table *ht = h;
+
+        if (!__hashtable_entry_delete_subkeys(h, key, hash, 0))
+                return;
+
+        /* Back off to a linear bucket search, slower but more "safe" */
+        if (ht->old)
+                __delete_subkeys_linear(ht, key, ht->old, ht->rehash_idx,
+                                        ht->old_size);
+        __delete_subkeys_linear(ht, key, ht->bucket, 0, ht->size);
+}
+
+/*!
+ *****************************************************************************
+ * Delete the entries in bucket 'hash' that were added using 'hash' and
+ * whose key starts with 'key'. Unlike hashtable_entry_delete_subkeys() this
+ * does not descend, instead 'cb' is called with the key of each entry
+ * before it is deleted such that the caller can continue from there.
+ ****************************************************************************/
+void hashtable_entry_delete_prefix_hash(void *h, const char *key,
+                uint32_t hash, void (*cb)(const char *, void *), void *arg)
+{
+        struct hash_table *ht = h;
+        struct hash_table_entry *p;
+
+        /* Deleting relinks the chain, rescan from the start each time */
+        for (p = __bucket(ht, hash); p; ) {
+                if (p->key && p->hash == hash &&
+                                strstr(p->key, key) == p->key) {
+                        if (cb)
+                                cb(p->key, arg);
+                        hashtable_entry_delete_hash(ht, p->key, hash);
+                        p = __bucket(ht, hash);
+                        continue;
+                }
+                p = p->next;
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Delete all entries whose key starts with 'key'.
+ ****************************************************************************/
+void hashtable_entry_delete_prefix(void *h, const char *key)
+{
+        struct hash_table *ht = h;
+
+        if (ht->old)
+                __delete_subkeys_linear(ht, key, ht->old, ht->rehash_idx,
+                                        ht->old_size);
+        __delete_subkeys_linear(ht, key, ht->bucket, 0, ht->size);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __foreach(struct hash_table_entry *bucket, size_t from,
+                      size_t size, void (*cb)(const char *, void *, void *),
+                      void *arg)
+{
+        size_t i;
+
+        for (i = from; i < size; i++) {
+                struct hash_table_entry *p = &bucket[i];
+                if (!p->key)
+                        continue;
+                while (p) {
+                        cb(p->key, p->user_data, arg);
+                        p = p->next;
+                }
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Call 'cb' for every entry in the table. The table must not be modified
+ * by 'cb'.
+ ****************************************************************************/
+void hashtable_foreach(void *h, void (*cb)(const char *, void *, void *),
+                       void *arg)
+{
+        struct hash_table *ht = h;
+
+        if (ht->old)
+                __foreach(ht->old, ht->rehash_idx, ht->old_size, cb, arg);
+        __foreach(ht->bucket, 0, ht->size, cb, arg);
+}
+
+/*!
+ *****************************************************************************
+ * 'size' is the initial, and minimum, number of buckets. It is rounded up
+ * to a pow(2, n) multiple of 1024.
+ ****************************************************************************/
 void *hashtable_init(size_t size, struct hash_table_ops *ops)
 {
         struct hash_table *ht;
-        uint32_t mul;
-
-        /* Size must be a pow(2, n) multiple of 1024 */
-        mul = (size + 1023) / 1024;
-        if (mul & (mul - 1)) {
-                uint32_t pow = 1;
-                while (pow < size)
-                        pow *= 2;
-                size = 1024 << (pow + 1);
-        } else {
-                size = mul * 1024;
-        }
+        size_t pow = 1024;
+
+        while (pow < size)
+                pow *= 2;
+        size = pow;
 
         ht = malloc(sizeof(struct hash_table));
         if (ht) {
@@ -337,6 +596,7 @@ void *hashtable_init(size_t size, struct hash_table_ops *ops)
                 if (ops)
                         ht->ops = *ops;
                 ht->size = size;
+                ht->min_size = size;
         }
         return ht;
 }
@@ -53,6 +53,11 @@ struct hash_table_entry *hashtable_entry_get(void *h, const char *key);
 struct hash_table_entry *hashtable_entry_get_hash(void *h, const char *key, uint32_t hash);
 void hashtable_entry_delete(void *h, const char *key);
 void hashtable_entry_delete_subkeys(void *h, const char *key, uint32_t hash);
+void hashtable_entry_delete_prefix_hash(void *h, const char *key,
+                uint32_t hash, void (*cb)(const char *, void *), void *arg);
+void hashtable_entry_delete_prefix(void *h, const char *key);
+void hashtable_foreach(void *h, void (*cb)(const char *, void *, void *),
+                       void *arg);
 
 #endif
 
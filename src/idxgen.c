@@ -0,0 +1,767 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#include "debug.h"
+#include "hashtable.h"
+#include "index.h"
+#include "idxgen.h"
+
+#define IDXGEN_SZ 1024
+#define IDXGEN_QUEUE_MAX 4096
+#define IDXGEN_MAX_RANGES 4096
+#define IDXGEN_MAX_DATA (64 << 20)
+#define IDXGEN_SLICE (1 << 20)          /* bytes between budget checks */
+#define IDXGEN_DEPTH 4
+
+/*
+ * Players read the index of a media file before anything else, and for
+ * AVI, MKV and MP4 files that index is usually stored after the media
+ * data. A compressed file can only be read from the start, so the index
+ * is instead captured here while the whole file is decoded in the
+ * background at low priority, and written as a version 2 .r2i file. The
+ * container is walked as it streams past; everything that follows the
+ * first block of bulk media data is kept, apart from the media data
+ * itself. Only elements at the top level are considered; AVI 'ix##'
+ * chunks within 'movi' lists would split the index into one range per
+ * chunk and are left to be read from the stream.
+ */
+enum {
+        FMT_NONE,
+        FMT_RIFF,
+        FMT_EBML,
+        FMT_ISO
+};
+
+enum {
+        ACT_DESCEND,
+        ACT_CAPTURE,
+        ACT_SKIP
+};
+
+enum {
+        K_TOP,
+        K_RIFF,
+        K_SEGMENT
+};
+
+#define EBML_SEGMENT 0x18538067
+#define EBML_CLUSTER 0x1F43B675
+#define EBML_CUES    0x1C53BB6B
+#define EBML_VOID    0xEC
+
+struct idxgen {
+        int fmt;
+        int media;              /* bulk media data seen */
+        int early;              /* index precedes the media data */
+        int capture;            /* current element is kept */
+        int failed;
+        uint64_t size;
+        uint64_t pos;           /* offset of the next byte */
+        uint64_t until;         /* end of the current element */
+        int depth;
+        uint64_t end[IDXGEN_DEPTH];
+        int kind[IDXGEN_DEPTH];
+        uint8_t hdr[16];
+        int hlen;
+        struct idx_range *range;
+        uint32_t count;
+        char *data;
+        size_t used;
+        size_t alloc;
+        size_t slice;
+        uint64_t total;
+        struct timespec wall0;
+        struct timespec cpu0;
+};
+
+struct idxgen_job {
+        struct idxgen_job *next;
+        char path[1];
+};
+
+static void *seen = NULL;
+static pthread_mutex_t idxgen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idxgen_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static int running = 0;
+static struct idxgen_job *head = NULL;
+static struct idxgen_job *tail = NULL;
+static unsigned int queued = 0;
+static int (*build_cb)(const char *) = NULL;
+static int cpu_budget = 100;            /* percent of one CPU */
+static size_t io_rate = 0;              /* bytes per second, 0 = unlimited */
+static unsigned long built = 0;
+static unsigned long failed = 0;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__alloc()
+{
+        return calloc(1, sizeof(int));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static double __elapsed(clockid_t clk, const struct timespec *t0)
+{
+        struct timespec now;
+
+        clock_gettime(clk, &now);
+        return (now.tv_sec - t0->tv_sec) +
+               (now.tv_nsec - t0->tv_nsec) / 1000000000.0;
+}
+
+/*!
+ *****************************************************************************
+ * Hold back the caller until the time spent decoding so far is within
+ * the CPU budget and the amount decoded within the rate limit.
+ ****************************************************************************/
+static void __throttle(struct idxgen *g)
+{
+        double wall = __elapsed(CLOCK_MONOTONIC, &g->wall0);
+        double want = 0;
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        want = __elapsed(CLOCK_THREAD_CPUTIME_ID, &g->cpu0) * 100 / cpu_budget;
+#endif
+        if (io_rate && (double)g->total / io_rate > want)
+                want = (double)g->total / io_rate;
+        while (want > wall && __atomic_load_n(&running, __ATOMIC_RELAXED)) {
+                double d = want - wall > 0.1 ? 0.1 : want - wall;
+                struct timespec ts = {0, (long)(d * 1000000000.0)};
+                nanosleep(&ts, NULL);
+                wall = __elapsed(CLOCK_MONOTONIC, &g->wall0);
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Keep 'size' bytes at offset 'off', which is never before the end of
+ * the last range.
+ ****************************************************************************/
+static int __store(struct idxgen *g, uint64_t off, const void *p, size_t size)
+{
+        struct idx_range *r = g->count ? &g->range[g->count - 1] : NULL;
+
+        if (g->used + size > IDXGEN_MAX_DATA)
+                return -1;
+        if (!r || r->offset + r->size != off) {
+                if (g->count == IDXGEN_MAX_RANGES)
+                        return -1;
+                if (!(g->count & 63)) {
+                        void *n = realloc(g->range, (g->count + 64) *
+                                                sizeof(struct idx_range));
+                        if (!n)
+                                return -1;
+                        g->range = n;
+                }
+                r = &g->range[g->count++];
+                r->offset = off;
+                r->size = 0;
+                r->data = g->used;
+        }
+        if (g->used + size > g->alloc) {
+                size_t alloc = g->alloc ? g->alloc : IDXGEN_SLICE;
+                void *n;
+                while (alloc < g->used + size)
+                        alloc <<= 1;
+                n = realloc(g->data, alloc);
+                if (!n)
+                        return -1;
+                g->data = n;
+                g->alloc = alloc;
+        }
+        memcpy(g->data + g->used, p, size);
+        g->used += size;
+        r->size += size;
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Decode variable length integer 'p' of at most 'n' bytes. Returns its
+ * length, 0 if more bytes are needed or -1 if invalid. Element IDs keep
+ * their length marker, an element size of all ones is unknown.
+ ****************************************************************************/
+static int __vint(const uint8_t *p, int n, int id, uint64_t *v)
+{
+        uint8_t mask = 0x80;
+        int len = 1;
+        int ones;
+        int i;
+
+        if (n < 1)
+                return 0;
+        while (len <= 8 && !(p[0] & mask)) {
+                ++len;
+                mask >>= 1;
+        }
+        if (len > (id ? 4 : 8))
+                return -1;
+        if (n < len)
+                return 0;
+        *v = id ? p[0] : p[0] & (mask - 1);
+        ones = (*v == (uint64_t)(mask - 1));
+        for (i = 1; i < len; i++) {
+                *v = (*v << 8) | p[i];
+                ones = ones && p[i] == 0xff;
+        }
+        if (!id && ones)
+                *v = UINT64_MAX;
+        return len;
+}
+
+/*!
+ *****************************************************************************
+ * The element header decoders below return the length of the header in
+ * g->hdr, 0 if more bytes are needed or -1 if the data is not understood.
+ * The size of the element following the header is returned in 'size' and
+ * what to do with it in 'act', and for ACT_DESCEND also its 'kind'.
+ ****************************************************************************/
+static int __riff(struct idxgen *g, uint64_t *size, int *act, int *kind)
+{
+        const uint8_t *h = g->hdr;
+        int top = g->depth ? g->kind[g->depth - 1] : K_TOP;
+
+        if (g->hlen < 8)
+                return 0;
+        *size = (uint64_t)h[4] | h[5] << 8 | h[6] << 16 | (uint64_t)h[7] << 24;
+        *size += *size & 1;
+        if (!memcmp(h, "RIFF", 4) || !memcmp(h, "LIST", 4)) {
+                if (g->hlen < 12)
+                        return 0;
+                if (*size < 4)
+                        return -1;
+                *size -= 4;
+                *act = ACT_DESCEND;
+                if (!memcmp(h, "RIFF", 4)) {
+                        if (top != K_TOP)
+                                return -1;
+                        *kind = K_RIFF;
+                } else if (top == K_RIFF && !memcmp(h + 8, "movi", 4)) {
+                        g->media = 1;
+                        *act = ACT_SKIP;
+                } else {
+                        *act = g->media && top == K_RIFF
+                                ? ACT_CAPTURE : ACT_SKIP;
+                }
+                return 12;
+        }
+        if (top == K_TOP)
+                return -1;
+        *act = g->media ? ACT_CAPTURE : ACT_SKIP;
+        return 8;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __ebml(struct idxgen *g, uint64_t *size, int *act, int *kind)
+{
+        uint64_t id;
+        int il = __vint(g->hdr, g->hlen, 1, &id);
+        int sl;
+
+        if (il <= 0)
+                return il;
+        sl = __vint(g->hdr + il, g->hlen - il, 0, size);
+        if (sl <= 0)
+                return sl;
+        if (!g->depth) {
+                if (id == EBML_SEGMENT) {
+                        *act = ACT_DESCEND;
+                        *kind = K_SEGMENT;
+                } else {
+                        *act = ACT_SKIP;
+                }
+        } else if (id == EBML_CLUSTER) {
+                /* Index already in front of the media data */
+                if (g->early)
+                        return -1;
+                g->media = 1;
+                *act = ACT_SKIP;
+        } else if (id == EBML_VOID) {
+                *act = ACT_SKIP;
+        } else {
+                g->early |= !g->media && id == EBML_CUES;
+                *act = g->media ? ACT_CAPTURE : ACT_SKIP;
+        }
+        /* Elements of unknown size can not be stepped over */
+        if (*size == UINT64_MAX && *act != ACT_DESCEND)
+                return -1;
+        return il + sl;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __iso(struct idxgen *g, uint64_t *size, int *act, int *kind)
+{
+        const uint8_t *h = g->hdr;
+        uint64_t sz;
+        int hl = 8;
+        int i;
+
+        (void)kind;             /* touch */
+
+        if (g->hlen < 8)
+                return 0;
+        sz = (uint64_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+        if (sz == 1) {
+                if (g->hlen < 16)
+                        return 0;
+                for (sz = 0, i = 8; i < 16; i++)
+                        sz = (sz << 8) | h[i];
+                hl = 16;
+        } else if (!sz) {
+                /* Box extends to the end of the file */
+                sz = g->size - (g->pos - g->hlen);
+        }
+        if (sz < (uint64_t)hl)
+                return -1;
+        *size = sz - hl;
+        if (!memcmp(h + 4, "mdat", 4)) {
+                if (g->early)
+                        return -1;
+                g->media = 1;
+                *act = ACT_SKIP;
+        } else if (!memcmp(h + 4, "free", 4) || !memcmp(h + 4, "skip", 4)) {
+                *act = ACT_SKIP;
+        } else {
+                g->early |= !g->media && !memcmp(h + 4, "moov", 4);
+                *act = g->media ? ACT_CAPTURE : ACT_SKIP;
+        }
+        return hl;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __walk(struct idxgen *g, const uint8_t *p, size_t n)
+{
+        uint64_t size;
+        uint64_t start;
+        int act;
+        int kind = K_TOP;
+        int res;
+
+        while (n) {
+                if (g->pos < g->until) {
+                        size_t c = g->until - g->pos < n
+                                ? (size_t)(g->until - g->pos) : n;
+                        if (g->capture && __store(g, g->pos, p, c))
+                                return -1;
+                        g->pos += c;
+                        p += c;
+                        n -= c;
+                        continue;
+                }
+                while (g->depth && g->pos >= g->end[g->depth - 1])
+                        --g->depth;
+
+                g->hdr[g->hlen++] = *p++;
+                ++g->pos;
+                --n;
+                if (g->fmt == FMT_NONE) {
+                        uint8_t t[8];
+                        if (g->hlen < 8)
+                                continue;
+                        if (!memcmp(g->hdr, "RIFF", 4))
+                                g->fmt = FMT_RIFF;
+                        else if (!memcmp(g->hdr, "\x1a\x45\xdf\xa3", 4))
+                                g->fmt = FMT_EBML;
+                        else if (!memcmp(g->hdr + 4, "ftyp", 4))
+                                g->fmt = FMT_ISO;
+                        else
+                                return -1;
+                        /* Start over now that the format is known */
+                        memcpy(t, g->hdr, sizeof(t));
+                        g->hlen = 0;
+                        g->pos = 0;
+                        if (__walk(g, t, sizeof(t)))
+                                return -1;
+                        continue;
+                }
+
+                if (g->fmt == FMT_RIFF)
+                        res = __riff(g, &size, &act, &kind);
+                else if (g->fmt == FMT_EBML)
+                        res = __ebml(g, &size, &act, &kind);
+                else
+                        res = __iso(g, &size, &act, &kind);
+                if (!res && g->hlen < (int)sizeof(g->hdr))
+                        continue;
+                if (res != g->hlen)
+                        return -1;
+
+                start = g->pos - g->hlen;
+                g->hlen = 0;
+                if (act == ACT_DESCEND) {
+                        if (g->depth == IDXGEN_DEPTH)
+                                return -1;
+                        g->end[g->depth] = size == UINT64_MAX
+                                ? UINT64_MAX : start + res + size;
+                        g->kind[g->depth++] = kind;
+                        continue;
+                }
+                g->capture = act == ACT_CAPTURE;
+                g->until = start + res + size;
+                if (g->capture && __store(g, start, g->hdr, res))
+                        return -1;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Start capturing the index of a file of 'size' bytes. The data of the
+ * file is passed to idxgen_feed() from start to end.
+ ****************************************************************************/
+struct idxgen *idxgen_begin(off_t size)
+{
+        struct idxgen *g = calloc(1, sizeof(struct idxgen));
+
+        if (!g)
+                return NULL;
+        g->size = size;
+        clock_gettime(CLOCK_MONOTONIC, &g->wall0);
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &g->cpu0);
+#endif
+        return g;
+}
+
+/*!
+ *****************************************************************************
+ * Returns -1 if the caller should stop decoding, either since nothing
+ * useful will come out of it or since the generator is shutting down.
+ ****************************************************************************/
+int idxgen_feed(struct idxgen *g, const void *data, size_t size)
+{
+        if (g->failed)
+                return -1;
+        if (__walk(g, data, size)) {
+                g->failed = 1;
+                return -1;
+        }
+        g->total += size;
+        g->slice += size;
+        if (g->slice >= IDXGEN_SLICE) {
+                g->slice = 0;
+                __throttle(g);
+        }
+        if (!__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+                g->failed = 1;
+                return -1;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Write what was captured to the index file 'dest'. Returns -ENODATA if
+ * the file had nothing worth indexing. The generator is released in any
+ * case.
+ ****************************************************************************/
+int idxgen_commit(struct idxgen *g, const char *dest)
+{
+        struct idx_head head;
+        struct idx_table table;
+        size_t len = strlen(dest) + 8;
+        uint64_t data;
+        char *tmp = NULL;
+        int fd = -1;
+        int res = -ENODATA;
+        uint32_t i;
+
+        if (g->failed || g->pos != g->size || !g->count)
+                goto out;
+
+        res = -ENOMEM;
+        tmp = malloc(len);
+        if (!tmp)
+                goto out;
+        snprintf(tmp, len, "%s.XXXXXX", dest);
+        fd = mkstemp(tmp);
+        if (fd == -1) {
+                res = -errno;
+                free(tmp);
+                tmp = NULL;
+                goto out;
+        }
+        (void)fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+        data = sizeof(head) + sizeof(table) +
+               (g->count * sizeof(struct idx_range));
+        head.magic = R2I_MAGIC;
+        head.version = R2I_VERSION_2;
+        head.spare = 0;
+        head.offset = hton64(g->range[0].offset);
+        head.size = hton64(data + g->used - sizeof(head));
+        table.count = htonl(g->count);
+        table.spare = 0;
+        for (i = 0; i < g->count; i++) {
+                struct idx_range *r = &g->range[i];
+                r->offset = hton64(r->offset);
+                r->size = hton64(r->size);
+                r->data = hton64(data + r->data);
+        }
+        res = -EIO;
+        if (write(fd, &head, sizeof(head)) != sizeof(head) ||
+            write(fd, &table, sizeof(table)) != sizeof(table) ||
+            write(fd, g->range, g->count * sizeof(struct idx_range)) !=
+                        (ssize_t)(g->count * sizeof(struct idx_range)) ||
+            write(fd, g->data, g->used) != (ssize_t)g->used ||
+            fdatasync(fd) == -1)
+                goto out;
+        if (rename(tmp, dest) == -1) {
+                res = -errno;
+                goto out;
+        }
+        free(tmp);
+        tmp = NULL;
+        res = 0;
+
+out:
+        if (fd != -1)
+                close(fd);
+        if (tmp) {
+                (void)unlink(tmp);
+                free(tmp);
+        }
+        idxgen_abort(g);
+        return res;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void idxgen_abort(struct idxgen *g)
+{
+        free(g->range);
+        free(g->data);
+        free(g);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lower_priority()
+{
+#ifdef __linux__
+        /* Both apply to the calling thread only */
+        (void)setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+        /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+        (void)syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+#endif
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__worker(void *arg)
+{
+        struct idxgen_job *j;
+        int res;
+
+        (void)arg;              /* touch */
+
+        __lower_priority();
+        pthread_mutex_lock(&idxgen_lock);
+        while (running) {
+                j = head;
+                if (!j) {
+                        pthread_cond_wait(&idxgen_cond, &idxgen_lock);
+                        continue;
+                }
+                head = j->next;
+                if (!head)
+                        tail = NULL;
+                --queued;
+                pthread_mutex_unlock(&idxgen_lock);
+
+                res = build_cb(j->path);
+                printd(3, "idxgen: %s: %s\n", j->path,
+                       res ? strerror(-res) : "index created");
+                free(j);
+
+                pthread_mutex_lock(&idxgen_lock);
+                if (res)
+                        ++failed;
+                else
+                        ++built;
+        }
+        pthread_mutex_unlock(&idxgen_lock);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int idxgen_enabled()
+{
+        return __atomic_load_n(&running, __ATOMIC_RELAXED);
+}
+
+/*!
+ *****************************************************************************
+ * Queue the file at 'path' for index generation. Every path is queued at
+ * most once; build failures are not retried.
+ ****************************************************************************/
+void idxgen_queue(const char *path)
+{
+        struct idxgen_job *j;
+
+        pthread_mutex_lock(&idxgen_lock);
+        if (!running || queued >= IDXGEN_QUEUE_MAX ||
+            hashtable_entry_get(seen, path) ||
+            !hashtable_entry_alloc(seen, path))
+                goto out;
+        j = malloc(sizeof(struct idxgen_job) + strlen(path));
+        if (!j) {
+                hashtable_entry_delete(seen, path);
+                goto out;
+        }
+        strcpy(j->path, path);
+        j->next = NULL;
+        if (tail)
+                tail->next = j;
+        else
+                head = j;
+        tail = j;
+        ++queued;
+        printd(4, "idxgen: queued %s\n", path);
+        pthread_cond_signal(&idxgen_cond);
+
+out:
+        pthread_mutex_unlock(&idxgen_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Start the generator. 'cpu' is the share of one CPU in percent and
+ * 'rate' the number of bytes per second it may decode. 'build' is called
+ * from the generator thread for every queued path.
+ ****************************************************************************/
+int idxgen_init(int cpu, size_t rate, int (*build)(const char *path))
+{
+        struct hash_table_ops ops = {
+                .alloc = __alloc,
+                .free = __free,
+        };
+        int err;
+
+        if (!build || cpu <= 0)
+                return -EINVAL;
+        seen = hashtable_init(IDXGEN_SZ, &ops);
+        if (!seen)
+                return -ENOMEM;
+        cpu_budget = cpu > 100 ? 100 : cpu;
+        io_rate = rate;
+        build_cb = build;
+        running = 1;
+        err = pthread_create(&worker, NULL, __worker, NULL);
+        if (err) {
+                printd(1, "idxgen: failed to start worker: %s\n",
+                       strerror(err));
+                running = 0;
+                hashtable_destroy(seen);
+                seen = NULL;
+                return -err;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void idxgen_destroy()
+{
+        struct idxgen_job *j;
+
+        pthread_mutex_lock(&idxgen_lock);
+        if (!running) {
+                pthread_mutex_unlock(&idxgen_lock);
+                return;
+        }
+        __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+        pthread_cond_signal(&idxgen_cond);
+        pthread_mutex_unlock(&idxgen_lock);
+        pthread_join(worker, NULL);
+
+        while ((j = head)) {
+                head = j->next;
+                free(j);
+        }
+        tail = NULL;
+        queued = 0;
+        hashtable_destroy(seen);
+        seen = NULL;
+        printd(1, "idxgen: %lu indexes created, %lu files skipped\n",
+               built, failed);
+}
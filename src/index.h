@@ -34,6 +34,7 @@
 
 #define R2I_MAGIC     (htonl(0x72326900))   /* 'r2i ' */
 #define R2I_VERSION   (htons(1))
+#define R2I_VERSION_2 (htons(2))
 
 /* This is the old broken header which was used for version 0.
  * It is obsolete and no longer supported due to the lack of
@@ -64,4 +65,20 @@ struct idx_data {
         char bytes[1]; /* start of data bytes */
 };
 
+/* Version 2 describes any number of ranges of the source file. The
+ * header 'offset' is the offset of the first range and 'size' the number
+ * of bytes following the header. The header is followed by a table of
+ * ranges, sorted by offset and not overlapping, and then the range data
+ * itself. 'data' is the offset of a range's data within the index file. */
+struct idx_table {
+        uint32_t count;
+        uint32_t spare;
+};
+
+struct idx_range {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t data;
+};
+
 #endif
@@ -36,8 +36,24 @@
 size_t iob_hist_sz = 0;
 size_t iob_sz = 0;
 
-#define SPACE_LEFT(ri, wi) (IOB_SZ - SPACE_USED((ri), (wi)))
-#define SPACE_USED(ri, wi) (((wi) - (ri)) & (IOB_SZ-1))
+#define SPACE_LEFT(b, ri, wi) (IOB_BUF_SZ(b) - SPACE_USED(b, (ri), (wi)))
+#define SPACE_USED(b, ri, wi) (((wi) - (ri)) & (IOB_BUF_SZ(b) - 1))
+
+/*
+ * Released buffers are kept on a free list per (power of two) size class
+ * for re-use by sub-sequent opens. All memory, cached or in use, is
+ * accounted for in 'pool_used'. If a budget is set, cached buffers are
+ * reclaimed when an allocation would otherwise exceed it.
+ */
+#define POOL_CLASSES 24
+#define POOL_DEPTH 8
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct iob *pool[POOL_CLASSES];
+static int pool_cnt[POOL_CLASSES];
+static size_t pool_used = 0;
+static size_t pool_budget = 0;
+static int hist_pct = 50;
 
 /*!
  *****************************************************************************
@@ -46,18 +62,11 @@ size_t iob_sz = 0;
 size_t iob_write(struct iob *iob, FILE *fp, int hist)
 {
         unsigned tot = 0;
-        pthread_mutex_lock(&iob->lock);
-        unsigned int lwi = iob->wi;  /* read once */
-        unsigned int lri = iob->ri;
-        pthread_mutex_unlock(&iob->lock);
-        size_t left = SPACE_LEFT(lri, lwi) - 1;   /* -1 to avoid wi = ri */
-        if (IOB_HIST_SZ && hist == IOB_SAVE_HIST) {
-                left = left > IOB_HIST_SZ ? left - IOB_HIST_SZ : 0;
-                if (!left) {
-                        return 0; /* quick exit */
-                }
-        }
-        unsigned int chunk = IOB_SZ - lwi;   /* assume one large chunk */
+        unsigned int lwi = iob->wi;  /* owned by producer */
+        size_t left = iob_space(iob, hist);
+        if (!left)
+                return 0; /* quick exit */
+        unsigned int chunk = IOB_BUF_SZ(iob) - lwi;   /* assume one large chunk */
         chunk = chunk < left ? chunk : left; /* reconsider assumption */
         while (left > 0) {
                 size_t n = fread(iob->data_p + lwi, 1, chunk, fp);
@@ -70,17 +79,43 @@ size_t iob_write(struct iob *iob, FILE *fp, int hist)
                                 break;
                 }
                 left -= n;
-                lwi = (lwi + n) & (IOB_SZ - 1);
+                lwi = (lwi + n) & (IOB_BUF_SZ(iob) - 1);
                 tot += n;
                 chunk -= n;
                 chunk = !chunk ? left : chunk;
         }
-        pthread_mutex_lock(&iob->lock);
-        iob->wi = lwi;
-        iob->used = SPACE_USED(iob->ri, lwi); /* iob->ri might have changed */
-        pthread_mutex_unlock(&iob->lock);
-        MB();
-        iob->offset += tot;
+        IOB_STORE(iob->wi, lwi);
+        IOB_STORE(iob->offset, iob->offset + tot);
+
+        return tot;
+}
+
+/*!
+ *****************************************************************************
+ * Memory source counterpart of iob_write(). Copies as much of 'src' as
+ * currently fits and returns the number of bytes consumed. Never blocks.
+ ****************************************************************************/
+size_t iob_push(struct iob *iob, const void *src, size_t size, int hist)
+{
+        size_t tot = 0;
+        const uint8_t *s = src;
+        unsigned int lwi = iob->wi;  /* owned by producer */
+        size_t left = iob_space(iob, hist);
+        size = size < left ? size : left;
+        if (!size)
+                return 0; /* quick exit */
+        unsigned int chunk = IOB_BUF_SZ(iob) - lwi;   /* assume one large chunk */
+        chunk = chunk < size ? chunk : size; /* reconsider assumption */
+        while (size) {
+                memcpy(iob->data_p + lwi, s, chunk);
+                lwi = (lwi + chunk) & (IOB_BUF_SZ(iob) - 1);
+                tot += chunk;
+                size -= chunk;
+                s += chunk;
+                chunk = size;
+        }
+        IOB_STORE(iob->wi, lwi);
+        IOB_STORE(iob->offset, iob->offset + tot);
 
         return tot;
 }
@@ -92,57 +127,88 @@ size_t iob_write(struct iob *iob, FILE *fp, int hist)
 size_t iob_read(char *dest, struct iob *iob, size_t size, size_t off)
 {
         size_t tot = 0;
-        pthread_mutex_lock(&iob->lock);
-        unsigned int lri = iob->ri; /* read once */
-        size_t used = iob->used;
-        pthread_mutex_unlock(&iob->lock);
+        unsigned int lri = iob->ri; /* owned by consumer */
+        size_t used = SPACE_USED(iob, lri, IOB_LOAD(iob->wi));
         if (off) {
                 /* consume offset */
                 off = off < used ? off : used;
-                lri = (lri + off) & (IOB_SZ - 1);
+                lri = (lri + off) & (IOB_BUF_SZ(iob) - 1);
                 used -= off;
         }
         size = size > used ? used : size;    /* can not read more than used */
-        unsigned int chunk = IOB_SZ - lri;   /* assume one large chunk */
+        unsigned int chunk = IOB_BUF_SZ(iob) - lri;   /* assume one large chunk */
         chunk = chunk < size ? chunk : size; /* reconsider assumption */
         while (size) {
                 memcpy(dest, iob->data_p + lri, chunk);
-                lri = (lri + chunk) & (IOB_SZ - 1);
+                lri = (lri + chunk) & (IOB_BUF_SZ(iob) - 1);
                 tot += chunk;
                 size -= chunk;
                 dest += chunk;
                 chunk = size;
         }
-        pthread_mutex_lock(&iob->lock);
-        iob->ri = lri;
-        iob->used -= tot;       /* iob->used might have changed */
-        pthread_mutex_unlock(&iob->lock);
+        IOB_STORE(iob->ri, lri);
 
         return tot;
 }
 
 /*!
  *****************************************************************************
- *
+ * Copy out data from an absolute buffer position without consuming it.
+ * The caller must make sure the region is not touched by the producer,
+ * ie. it is part of the history or the producer is under control.
  ****************************************************************************/
 size_t iob_copy(char *dest, struct iob *iob, size_t size, size_t pos)
 {
         size_t tot = 0;
-        unsigned int chunk = IOB_SZ - pos;   /* assume one large chunk */
+        unsigned int chunk = IOB_BUF_SZ(iob) - pos;   /* assume one large chunk */
         chunk = chunk < size ? chunk : size; /* reconsider assumption */
-        pthread_mutex_lock(&iob->lock);
         while (size) {
                 memcpy(dest, iob->data_p + pos, chunk);
-                pos = (pos + chunk) & (IOB_SZ - 1);
+                pos = (pos + chunk) & (IOB_BUF_SZ(iob) - 1);
                 tot += chunk;
                 size -= chunk;
                 dest += chunk;
                 chunk = size;
         }
-        pthread_mutex_unlock(&iob->lock);
         return tot;
 }
 
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __class(size_t size)
+{
+        int c = 0;
+
+        size /= IOB_MIN_SZ;
+        while (size > 1 && c < POOL_CLASSES - 1) {
+                size >>= 1;
+                ++c;
+        }
+        return c;
+}
+
+/*!
+ *****************************************************************************
+ * Release cached buffers, largest first, until 'need' bytes fit within
+ * the budget. Must be called with pool_lock held.
+ ****************************************************************************/
+static void __reclaim(size_t need)
+{
+        int c;
+
+        for (c = POOL_CLASSES - 1; c >= 0; c--) {
+                while (pool[c] && pool_used + need > pool_budget) {
+                        struct iob *iob = pool[c];
+                        pool[c] = iob->next;
+                        --pool_cnt[c];
+                        pool_used -= IOB_BUF_SZ(iob);
+                        free(iob);
+                }
+        }
+}
+
 /*!
  *****************************************************************************
  *
@@ -151,8 +217,10 @@ void iob_init()
 {
         int bsz = OPT_INT(OPT_KEY_BUF_SIZE, 0);
         iob_sz = bsz ? (bsz * 1024 * 1024) : IOB_SZ_DEFAULT;
-        int hsz = OPT_SET(OPT_KEY_HIST_SIZE) ? OPT_INT(OPT_KEY_HIST_SIZE, 0) : 50;
-        iob_hist_sz = IOB_SZ * (hsz / 100.0);
+        hist_pct = OPT_SET(OPT_KEY_HIST_SIZE) ? OPT_INT(OPT_KEY_HIST_SIZE, 0) : 50;
+        iob_hist_sz = IOB_SZ * (hist_pct / 100.0);
+        pool_budget = OPT_SET(OPT_KEY_IOB_BUDGET)
+                ? (size_t)OPT_INT(OPT_KEY_IOB_BUDGET, 0) * 1024 * 1024 : 0;
 }
 
 /*!
@@ -161,35 +229,201 @@ void iob_init()
  ****************************************************************************/
 void iob_destroy()
 {
+        int c;
+
+        pthread_mutex_lock(&pool_lock);
+        for (c = 0; c < POOL_CLASSES; c++) {
+                while (pool[c]) {
+                        struct iob *iob = pool[c];
+                        pool[c] = iob->next;
+                        pool_used -= IOB_BUF_SZ(iob);
+                        free(iob);
+                }
+                pool_cnt[c] = 0;
+        }
+        pthread_mutex_unlock(&pool_lock);
 }
 
 /*!
  *****************************************************************************
- *
+ * Allocate a buffer of 'size' bytes, a power of two. Unless 'force' is
+ * set NULL is returned if the buffer does not fit within the budget.
+ * Otherwise the budget is overcommitted by a buffer of minimum size.
+ ****************************************************************************/
+static struct iob *__alloc(size_t size, int force)
+{
+        struct iob *iob;
+        int c;
+
+        pthread_mutex_lock(&pool_lock);
+        c = __class(size);
+        iob = pool[c];
+        if (iob && IOB_BUF_SZ(iob) == size) {
+                pool[c] = iob->next;
+                --pool_cnt[c];
+        } else {
+                iob = NULL;
+                if (pool_budget && pool_used + size > pool_budget)
+                        __reclaim(size);
+                if (pool_budget && pool_used + size > pool_budget) {
+                        if (!force) {
+                                pthread_mutex_unlock(&pool_lock);
+                                return NULL;
+                        }
+                        printd(1, "I/O buffer budget exhausted\n");
+                        if (size > IOB_MIN_SZ) {
+                                pthread_mutex_unlock(&pool_lock);
+                                return __alloc(IOB_MIN_SZ, force);
+                        }
+                }
+                pool_used += size;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        if (!iob) {
+                iob = malloc(sizeof(struct iob) + size);
+                if (!iob) {
+                        pthread_mutex_lock(&pool_lock);
+                        pool_used -= size;
+                        pthread_mutex_unlock(&pool_lock);
+                        return NULL;
+                }
+        }
+        memset(iob, 0, sizeof(struct iob));
+        iob->size = size;
+        iob->hist_sz = size * (hist_pct / 100.0);
+
+        return iob;
+}
+
+/*!
+ *****************************************************************************
+ * Allocate a buffer of 'size' bytes, a power of two. If 'size' is 0 a
+ * buffer of the default size is returned, which is IOB_SZ unless a
+ * memory budget is set in which case buffers start out small and are
+ * expected to grow on demand using iob_grow(). An exhausted budget does
+ * not fail the allocation but results in a buffer of minimum size.
  ****************************************************************************/
 struct iob *iob_alloc(size_t size)
+{
+        if (!size)
+                size = pool_budget && IOB_MIN_SZ < IOB_SZ ? IOB_MIN_SZ : IOB_SZ;
+        return __alloc(size, 1);
+}
+
+/*!
+ *****************************************************************************
+ * Like iob_alloc(0) but for a stream with buffers of at most 'max' bytes,
+ * a power of two, instead of IOB_SZ and with 'hist' percent of them kept
+ * as history. Zero and a negative value respectively select the defaults.
+ ****************************************************************************/
+struct iob *iob_alloc_tuned(size_t max, int hist)
 {
         struct iob *iob;
 
-        iob = calloc(1, size);
-        if (!iob)
+        if (!max)
+                max = IOB_SZ;
+        iob = iob_alloc(pool_budget && IOB_MIN_SZ < max ? IOB_MIN_SZ : max);
+        if (iob && hist >= 0)
+                iob->hist_sz = IOB_BUF_SZ(iob) * (hist / 100.0);
+        return iob;
+}
+
+/*!
+ *****************************************************************************
+ * Replace 'iob' with a buffer twice its size holding the same data, as
+ * long as it is smaller than 'max'. Returns the new buffer, or NULL if
+ * 'iob' could not grow, in which case it is left untouched. The producer
+ * must be under control by the caller.
+ ****************************************************************************/
+struct iob *iob_grow(struct iob *iob, size_t max)
+{
+        struct iob *niob;
+        size_t osz = IOB_BUF_SZ(iob);
+        size_t n;
+        off_t s;
+
+        if (osz >= max)
                 return NULL;
+        niob = __alloc(osz * 2, 0);
+        if (!niob)
+                return NULL;
+        niob->hist_sz = iob->hist_sz * 2;
 
-        pthread_mutex_init(&iob->lock, NULL);
+        /*
+         * Buffer positions are the stream offsets modulo the buffer size.
+         * Move everything still valid, ie. history and unconsumed data,
+         * to where it belongs in the new buffer. Anything before that is
+         * left over from whatever used the buffer last and must not be
+         * served as history until overwritten, see IOB_HIST_VALID().
+         */
+        n = SPACE_USED(iob, iob->ri, iob->wi);
+        niob->idx = iob->idx;
+        niob->offset = iob->offset;
+        niob->ri = (iob->offset - n) & (IOB_BUF_SZ(niob) - 1);
+        niob->wi = iob->offset & (IOB_BUF_SZ(niob) - 1);
+        n = (size_t)iob->offset < osz - 1 ? (size_t)iob->offset : osz - 1;
+        s = iob->offset - n;
+        niob->hist_base = s > iob->hist_base ? s : iob->hist_base;
+        while (n) {
+                size_t o = s & (osz - 1);
+                size_t d = s & (IOB_BUF_SZ(niob) - 1);
+                size_t chunk = osz - o;
+                chunk = chunk < n ? chunk : n;
+                chunk = chunk < IOB_BUF_SZ(niob) - d ? chunk : IOB_BUF_SZ(niob) - d;
+                memcpy(niob->data_p + d, iob->data_p + o, chunk);
+                s += chunk;
+                n -= chunk;
+        }
 
-        return iob;
+        iob_free(iob);
+        return niob;
 }
 
 /*!
  *****************************************************************************
- *
+ * Report memory held by buffers in use and buffers cached for re-use.
+ ****************************************************************************/
+void iob_get_usage(size_t *active, size_t *cached)
+{
+        size_t n = 0;
+        int c;
+
+        pthread_mutex_lock(&pool_lock);
+        for (c = 0; c < POOL_CLASSES; c++) {
+                struct iob *iob = pool[c];
+                while (iob) {
+                        n += IOB_BUF_SZ(iob);
+                        iob = iob->next;
+                }
+        }
+        *active = pool_used - n;
+        *cached = n;
+        pthread_mutex_unlock(&pool_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Return buffer to the pool.
  ****************************************************************************/
 void iob_free(struct iob *iob)
 {
-        if (iob) {
-                pthread_mutex_destroy(&iob->lock);
+        int c;
+
+        if (!iob)
+                return;
+
+        pthread_mutex_lock(&pool_lock);
+        c = __class(IOB_BUF_SZ(iob));
+        if (pool_cnt[c] < POOL_DEPTH) {
+                iob->next = pool[c];
+                pool[c] = iob;
+                ++pool_cnt[c];
+        } else {
+                pool_used -= IOB_BUF_SZ(iob);
                 free(iob);
-	}
+        }
+        pthread_mutex_unlock(&pool_lock);
 }
 
 /*!
@@ -198,10 +432,29 @@ void iob_free(struct iob *iob)
  ****************************************************************************/
 int iob_full(struct iob *iob)
 {
-        int res;
-        pthread_mutex_lock(&iob->lock);
-        res = !SPACE_LEFT(iob->ri, iob->wi);
-        pthread_mutex_unlock(&iob->lock);
-        return res;
+        return !SPACE_LEFT(iob, IOB_LOAD(iob->ri), IOB_LOAD(iob->wi));
+}
+
+/*!
+ *****************************************************************************
+ * Number of bytes not yet consumed.
+ ****************************************************************************/
+size_t iob_used(struct iob *iob)
+{
+        return SPACE_USED(iob, IOB_LOAD(iob->ri), IOB_LOAD(iob->wi));
+}
+
+/*!
+ *****************************************************************************
+ * Number of bytes that can be written without overwriting unconsumed data,
+ * or history if 'hist' is IOB_SAVE_HIST.
+ ****************************************************************************/
+size_t iob_space(struct iob *iob, int hist)
+{
+        size_t left = SPACE_LEFT(iob, IOB_LOAD(iob->ri), IOB_LOAD(iob->wi)) - 1;
+        if (IOB_BUF_HIST_SZ(iob) && hist == IOB_SAVE_HIST)
+                left = left > IOB_BUF_HIST_SZ(iob) ?
+                        left - IOB_BUF_HIST_SZ(iob) : 0;
+        return left;  /* -1 above to avoid wi = ri */
 }
 
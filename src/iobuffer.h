@@ -41,28 +41,69 @@
 #define IOB_HIST_SZ              (iob_hist_sz)
 #endif
 
+/*
+ * IOB_SZ is the maximum (and default) size of a buffer. The actual size of
+ * a specific buffer is given by IOB_BUF_SZ() and might be smaller if a
+ * memory budget is set, see iob_alloc().
+ */
+#define IOB_BUF_SZ(b)            ((b)->size)
+#define IOB_BUF_HIST_SZ(b)       ((b)->hist_sz)
+
+/*
+ * Non-zero if stream offset 'o', within IOB_BUF_HIST_SZ() of the current
+ * read position, is actually held by the buffer. After iob_grow() only the
+ * data moved from the old buffer is, until the ring wraps around.
+ */
+#define IOB_HIST_VALID(b, o)     ((off_t)(o) >= (b)->hist_base)
+
+/* Smallest buffer handed out when running under a memory budget */
+#define IOB_MIN_SZ               (256 * 1024)
+
 #define IOB_NO_HIST 0
 #define IOB_SAVE_HIST 1
 
+/*
+ * Minimum amount of free space (history excluded) before the consumer
+ * bothers to wake up the producer.
+ */
+#define IOB_WAKE_SZ(b)           ((IOB_BUF_SZ(b) - IOB_BUF_HIST_SZ(b)) / 8)
+
+/*
+ * The I/O buffer is a single-producer/single-consumer ring. The producer
+ * owns 'wi' and 'offset', the consumer owns 'ri'. Indexes are published
+ * using release semantics and picked up using acquire semantics making any
+ * data written before the update visible to the other side.
+ */
+#define IOB_LOAD(x)              __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define IOB_STORE(x, v)          __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
 struct idx_info {
         int fd;
         int mmap;
+        size_t map_size;
         struct idx_data *data_p;
+        uint32_t count;
+        struct idx_range *range;        /* host byte order */
 };
 
 struct iob {
         struct idx_info idx;
         off_t offset;
-        volatile size_t ri;
-        volatile size_t wi;
-        size_t used;
-        pthread_mutex_t lock;
+        size_t ri;
+        size_t wi;
+        size_t size;
+        size_t hist_sz;
+        off_t hist_base;        /* oldest valid stream offset */
+        struct iob *next;       /* free list linkage */
         uint8_t data_p[];
 };
 
 size_t
 iob_write(struct iob *dest, FILE *fp, int hist);
 
+size_t
+iob_push(struct iob *dest, const void *src, size_t size, int hist);
+
 size_t
 iob_read(char *dest, struct iob *src, size_t size, size_t off);
 
@@ -81,11 +122,26 @@ iob_destroy();
 struct iob *
 iob_alloc(size_t size);
 
+struct iob *
+iob_alloc_tuned(size_t max, int hist);
+
+struct iob *
+iob_grow(struct iob *iob, size_t max);
+
 void
 iob_free(struct iob *iob);
 
 int
 iob_full(struct iob *iob);
 
+size_t
+iob_used(struct iob *iob);
+
+size_t
+iob_space(struct iob *iob, int hist);
+
+void
+iob_get_usage(size_t *active, size_t *cached);
+
 #endif
 
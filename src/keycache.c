@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "debug.h"
+#include "keycache.h"
+
+#define KEYCACHE_MAX 16
+
+/*
+ * Every open of an encrypted archive normally makes libunrar derive the
+ * keys from the password again, which for RAR5 means many thousands of
+ * PBKDF2 iterations per salt. libunrar caches derived keys per handle
+ * only, so handles that needed a password are parked here instead of
+ * being closed and handed out again by the next open of the same archive
+ * in the same mode. All volumes of a set share the password and salt, so
+ * handles are kept per set rather than per volume, see __set_name(), and
+ * reopened on whichever volume is opened next. A handle is only handed out
+ * for the password it was opened with, as told by 'pw_digest', and not
+ * across a keycache_flush(). Parked handles expire after 'key_ttl' seconds
+ * and are not reused if the volume to open changed after parking.
+ */
+struct keycache_slot {
+        HANDLE hdl;
+        char *set;
+        char *arch;             /* volume last opened */
+        unsigned int mode;
+        uint64_t pw;            /* digest of the password */
+        unsigned int gen;
+        time_t mtime;
+        off_t size;
+        time_t parked;          /* wall clock */
+        time_t expires;
+};
+
+static struct keycache_slot slots[KEYCACHE_MAX];
+static pthread_mutex_t keycache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t keycache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reaper;
+static unsigned int key_ttl = 0;
+static pid_t owner = 0;
+static int running = 0;
+static unsigned int generation = 0;
+static uint64_t (*pw_digest)(const char *) = NULL;
+
+/*!
+ *****************************************************************************
+ * Must be called with keycache_lock held.
+ ****************************************************************************/
+static void __drop(struct keycache_slot *s)
+{
+        (void)RARParkArchiveEx(s->hdl, 0);
+        RARCloseArchive(s->hdl);
+        free(s->set);
+        free(s->arch);
+        memset(s, 0, sizeof(*s));
+}
+
+/*!
+ *****************************************************************************
+ * Return the name of the volume set 'arch' belongs to, ie. its name with
+ * the volume number stripped. The numbering scheme is kept as part of the
+ * name such that eg. 'a.rar' and 'a.001' are not taken as the same set.
+ ****************************************************************************/
+static char *__set_name(const char *arch)
+{
+        size_t len = strlen(arch);
+        char *s = strdup(arch);
+        char *p;
+
+        if (!s || len < 5 || s[len - 4] != '.')
+                return s;
+        p = s + len - 4;
+        if (!strcasecmp(p, ".rar")) {
+                /* name.partNN.rar */
+                while (p > s && isdigit((unsigned char)p[-1]))
+                        --p;
+                if (p != s + len - 4 && p - s > 5 &&
+                    !strncasecmp(p - 5, ".part", 5)) {
+                        *p = 0;
+                        return s;
+                }
+                strcpy(s + len - 3, "r");
+        } else if (isdigit((unsigned char)p[2]) &&
+                   isdigit((unsigned char)p[3])) {
+                /* name.rNN or name.NNN */
+                if (tolower((unsigned char)p[1]) == 'r')
+                        strcpy(p + 1, "r");
+                else if (isdigit((unsigned char)p[1]))
+                        strcpy(p + 1, "0");
+        }
+        return s;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static time_t __now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec;
+}
+
+/*!
+ *****************************************************************************
+ * Closes expired handles, returns the time of the next expiry or 0.
+ * Must be called with keycache_lock held.
+ ****************************************************************************/
+static time_t __expire(time_t now)
+{
+        time_t next = 0;
+        int i;
+
+        for (i = 0; i < KEYCACHE_MAX; i++) {
+                if (!slots[i].hdl)
+                        continue;
+                if (slots[i].expires <= now || slots[i].gen !=
+                    __atomic_load_n(&generation, __ATOMIC_RELAXED)) {
+                        printd(4, "keycache: expired %s\n", slots[i].arch);
+                        __drop(&slots[i]);
+                } else if (!next || slots[i].expires < next) {
+                        next = slots[i].expires;
+                }
+        }
+        return next;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__reaper(void *arg)
+{
+        (void)arg;              /* touch */
+
+        pthread_mutex_lock(&keycache_lock);
+        while (running) {
+                time_t next = __expire(__now());
+                if (next) {
+                        struct timespec ts;
+                        clock_gettime(CLOCK_REALTIME, &ts);
+                        ts.tv_sec += next - __now();
+                        pthread_cond_timedwait(&keycache_cond,
+                                               &keycache_lock, &ts);
+                } else {
+                        pthread_cond_wait(&keycache_cond, &keycache_lock);
+                }
+        }
+        pthread_mutex_unlock(&keycache_lock);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Keeps the lock usable in children forked by popen_().
+ ****************************************************************************/
+static void __prepare()
+{
+        pthread_mutex_lock(&keycache_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __release()
+{
+        pthread_mutex_unlock(&keycache_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Drop-in replacement for RAROpenArchiveEx().
+ ****************************************************************************/
+HANDLE keycache_open(RAROpenArchiveDataEx *d)
+{
+        struct keycache_slot s;
+        struct stat st;
+        HANDLE hdl;
+        char *set;
+        int i;
+
+        memset(&s, 0, sizeof(s));
+        if (key_ttl && d->ArcName) {
+                unsigned int gen = __atomic_load_n(&generation,
+                                                   __ATOMIC_RELAXED);
+                uint64_t pw = pw_digest ? pw_digest(d->ArcName) : 0;
+                set = __set_name(d->ArcName);
+                pthread_mutex_lock(&keycache_lock);
+                for (i = 0; set && i < KEYCACHE_MAX; i++) {
+                        if (slots[i].hdl && slots[i].mode == d->OpenMode &&
+                            slots[i].pw == pw && slots[i].gen == gen &&
+                            !strcmp(slots[i].set, set)) {
+                                s = slots[i];
+                                memset(&slots[i], 0, sizeof(slots[i]));
+                                break;
+                        }
+                }
+                pthread_mutex_unlock(&keycache_lock);
+                free(set);
+        }
+        if (s.hdl) {
+                (void)RARParkArchiveEx(s.hdl, 0);
+                /* The volume to open must be unchanged since parking */
+                if (!stat(d->ArcName, &st) && s.expires > __now() &&
+                    (strcmp(s.arch, d->ArcName) ? st.st_mtime < s.parked :
+                     s.mtime == st.st_mtime && s.size == st.st_size)) {
+                        hdl = RARReopenArchiveEx(s.hdl, d);
+                        if (hdl) {
+                                printd(4, "keycache: reused %s for %s\n",
+                                       s.arch, d->ArcName);
+                                free(s.set);
+                                free(s.arch);
+                                return hdl;
+                        }
+                }
+                RARCloseArchive(s.hdl);
+                free(s.set);
+                free(s.arch);
+        }
+        return RAROpenArchiveEx(d);
+}
+
+/*!
+ *****************************************************************************
+ * Drop-in replacement for RARCloseArchive(). 'd' must be the same as
+ * passed to keycache_open().
+ ****************************************************************************/
+void keycache_close(HANDLE hdl, const RAROpenArchiveDataEx *d)
+{
+        struct keycache_slot *s = NULL;
+        unsigned int gen;
+        struct stat st;
+        uint64_t pw;
+        char *arch;
+        char *set;
+        int i;
+
+        if (!key_ttl || getpid() != owner || !d->ArcName ||
+            stat(d->ArcName, &st) || RARParkArchiveEx(hdl, 1)) {
+                RARCloseArchive(hdl);
+                return;
+        }
+        gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+        pw = pw_digest ? pw_digest(d->ArcName) : 0;
+        arch = strdup(d->ArcName);
+        set = __set_name(d->ArcName);
+        if (!arch || !set) {
+                free(arch);
+                free(set);
+                (void)RARParkArchiveEx(hdl, 0);
+                RARCloseArchive(hdl);
+                return;
+        }
+
+        pthread_mutex_lock(&keycache_lock);
+        for (i = 0; i < KEYCACHE_MAX; i++) {
+                if (!slots[i].hdl) {
+                        if (!s)
+                                s = &slots[i];
+                } else if (slots[i].mode == d->OpenMode &&
+                           slots[i].pw == pw &&
+                           !strcmp(slots[i].set, set)) {
+                        /* Keep the most recent one only */
+                        __drop(&slots[i]);
+                        s = &slots[i];
+                        break;
+                }
+        }
+        if (!s) {
+                /* Replace the one closest to expiry */
+                s = &slots[0];
+                for (i = 1; i < KEYCACHE_MAX; i++)
+                        if (slots[i].expires < s->expires)
+                                s = &slots[i];
+                __drop(s);
+        }
+        s->hdl = hdl;
+        s->set = set;
+        s->arch = arch;
+        s->mode = d->OpenMode;
+        s->pw = pw;
+        s->gen = gen;
+        s->mtime = st.st_mtime;
+        s->size = st.st_size;
+        s->parked = time(NULL);
+        s->expires = __now() + key_ttl;
+        pthread_cond_signal(&keycache_cond);
+        pthread_mutex_unlock(&keycache_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void keycache_init(unsigned int ttl, uint64_t (*digest)(const char *))
+{
+        static int once = 0;
+        int err;
+
+        if (!ttl)
+                return;
+        pw_digest = digest;
+        if (!once) {
+                pthread_atfork(__prepare, __release, __release);
+                once = 1;
+        }
+        pthread_mutex_lock(&keycache_lock);
+        key_ttl = ttl;
+        owner = getpid();
+        running = 1;
+        pthread_mutex_unlock(&keycache_lock);
+        err = pthread_create(&reaper, NULL, __reaper, NULL);
+        if (err) {
+                printd(1, "keycache: failed to start reaper: %s\n",
+                       strerror(err));
+                pthread_mutex_lock(&keycache_lock);
+                key_ttl = 0;
+                running = 0;
+                pthread_mutex_unlock(&keycache_lock);
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Stop handing out the handles parked so far, eg. since the configured
+ * passwords may have changed. They are closed by the reaper the next time
+ * it runs. Safe to call from a signal handler.
+ ****************************************************************************/
+void keycache_flush()
+{
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void keycache_destroy()
+{
+        int i;
+
+        pthread_mutex_lock(&keycache_lock);
+        if (!running) {
+                pthread_mutex_unlock(&keycache_lock);
+                return;
+        }
+        running = 0;
+        key_ttl = 0;
+        pthread_cond_signal(&keycache_cond);
+        pthread_mutex_unlock(&keycache_lock);
+        pthread_join(reaper, NULL);
+
+        pthread_mutex_lock(&keycache_lock);
+        for (i = 0; i < KEYCACHE_MAX; i++)
+                if (slots[i].hdl)
+                        __drop(&slots[i]);
+        pthread_mutex_unlock(&keycache_lock);
+}
@@ -0,0 +1,221 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "debug.h"
+#include "iobuffer.h"
+#include "nestcache.h"
+#include "warmup.h"
+#include "metrics.h"
+
+/*
+ * All counters are updated lock-free using relaxed atomics, which means a
+ * report is not necessarily a consistent snapshot. That is fine for
+ * scraping, where only the trend matters.
+ */
+uint64_t metrics_counters[METRICS_COUNTER_END];
+
+/* Upper bounds of the latency histogram buckets (us), +Inf is implicit */
+static const uint64_t bucket_us[] = {
+        10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000,
+        1000000, 5000000
+};
+#define N_BUCKETS (sizeof(bucket_us) / sizeof(bucket_us[0]))
+
+struct histogram {
+        uint64_t bucket[N_BUCKETS + 1];
+        uint64_t sum_us;
+        uint64_t count;
+};
+
+static struct histogram op_hist[METRICS_OP_END];
+
+static const char *op_name[METRICS_OP_END] = {
+        "getattr",
+        "opendir",
+        "readdir",
+        "releasedir",
+        "open",
+        "read",
+        "release",
+        "readlink",
+        "statfs",
+        "lseek"
+};
+
+static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+} counter_info[METRICS_COUNTER_END] = {
+        { "filecache_hits_total", "counter",
+          "Path lookups served by the file cache" },
+        { "filecache_misses_total", "counter",
+          "Path lookups not found in the file cache" },
+        { "dircache_hits_total", "counter",
+          "Directory listings served by the directory cache" },
+        { "dircache_misses_total", "counter",
+          "Directory listings not found or stale in the directory cache" },
+        { "lookup_misses_total", "counter",
+          "Path lookups resolved against the source file system" },
+        { "buffer_stalls_total", "counter",
+          "Reads of compressed files that had to wait for extraction" },
+        { "long_jumps_total", "counter",
+          "Reads answered by the long jump heuristics" },
+        { "negcache_hits_total", "counter",
+          "Path lookups answered by the negative lookup cache" },
+        { "raw_prefetch_total", "counter",
+          "Volumes of stored files opened ahead of sequential readers" },
+        { "open_handles", "gauge",
+          "Files currently open" }
+};
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void metrics_op_done(enum metrics_op op, const struct timespec *start)
+{
+        struct histogram *h = &op_hist[op];
+        struct timespec now;
+        uint64_t us;
+        size_t i;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        us = (now.tv_sec - start->tv_sec) * 1000000ULL +
+                (now.tv_nsec - start->tv_nsec) / 1000;
+        for (i = 0; i < N_BUCKETS && us > bucket_us[i]; i++)
+                ;
+        __atomic_add_fetch(&h->bucket[i], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&h->sum_us, us, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __gauge(FILE *fp, const char *name, const char *help,
+                unsigned long long value)
+{
+        fprintf(fp, "# HELP rar2fs_%s %s\n", name, help);
+        fprintf(fp, "# TYPE rar2fs_%s gauge\n", name);
+        fprintf(fp, "rar2fs_%s %llu\n", name, value);
+}
+
+/*!
+ *****************************************************************************
+ * Return all metrics in the Prometheus text exposition format. The
+ * returned string must be freed by the caller.
+ ****************************************************************************/
+char *metrics_format(size_t *len)
+{
+        struct nestcache_stats ns;
+        struct warmup_stats ws;
+        size_t iob_active;
+        size_t iob_cached;
+        char *buf = NULL;
+        FILE *fp;
+        int i;
+
+        fp = open_memstream(&buf, len);
+        if (!fp)
+                return NULL;
+
+        for (i = 0; i < METRICS_COUNTER_END; i++) {
+                fprintf(fp, "# HELP rar2fs_%s %s\n", counter_info[i].name,
+                        counter_info[i].help);
+                fprintf(fp, "# TYPE rar2fs_%s %s\n", counter_info[i].name,
+                        counter_info[i].type);
+                fprintf(fp, "rar2fs_%s %llu\n", counter_info[i].name,
+                        (unsigned long long)__atomic_load_n(
+                                &metrics_counters[i], __ATOMIC_RELAXED));
+        }
+
+        iob_get_usage(&iob_active, &iob_cached);
+        __gauge(fp, "iob_active_bytes", "I/O buffer memory in use",
+                iob_active);
+        __gauge(fp, "iob_cached_bytes",
+                "I/O buffer memory kept for re-use", iob_cached);
+
+        if (nestcache_enabled()) {
+                nestcache_get_stats(&ns);
+                fprintf(fp, "# HELP rar2fs_nestcache_requests_total "
+                            "Nested archive cache lookups\n");
+                fprintf(fp, "# TYPE rar2fs_nestcache_requests_total counter\n");
+                fprintf(fp, "rar2fs_nestcache_requests_total{result=\"hit\"} %lu\n",
+                        ns.hits);
+                fprintf(fp, "rar2fs_nestcache_requests_total{result=\"miss\"} %lu\n",
+                        ns.misses);
+                __gauge(fp, "nestcache_used_bytes",
+                        "Nested archive cache disk usage", ns.used);
+        }
+
+        warmup_get_stats(&ws);
+        __gauge(fp, "warmup_running", "Cache warmup in progress",
+                ws.running);
+        __gauge(fp, "warmup_dirs_scanned", "Directories visited by warmup",
+                ws.dirs_scanned);
+
+        fprintf(fp, "# HELP rar2fs_op_duration_seconds "
+                    "Latency of FUSE operations\n");
+        fprintf(fp, "# TYPE rar2fs_op_duration_seconds histogram\n");
+        for (i = 0; i < METRICS_OP_END; i++) {
+                struct histogram *h = &op_hist[i];
+                uint64_t cum = 0;
+                size_t b;
+
+                for (b = 0; b <= N_BUCKETS; b++) {
+                        cum += __atomic_load_n(&h->bucket[b],
+                                               __ATOMIC_RELAXED);
+                        if (b < N_BUCKETS)
+                                fprintf(fp, "rar2fs_op_duration_seconds_bucket"
+                                            "{op=\"%s\",le=\"%g\"} %llu\n",
+                                        op_name[i], bucket_us[b] / 1e6,
+                                        (unsigned long long)cum);
+                        else
+                                fprintf(fp, "rar2fs_op_duration_seconds_bucket"
+                                            "{op=\"%s\",le=\"+Inf\"} %llu\n",
+                                        op_name[i], (unsigned long long)cum);
+                }
+                fprintf(fp, "rar2fs_op_duration_seconds_sum{op=\"%s\"} %.6f\n",
+                        op_name[i],
+                        __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED) / 1e6);
+                fprintf(fp, "rar2fs_op_duration_seconds_count{op=\"%s\"} %llu\n",
+                        op_name[i], (unsigned long long)cum);
+        }
+
+        if (fclose(fp)) {
+                free(buf);
+                return NULL;
+        }
+        return buf;
+}
@@ -0,0 +1,74 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <platform.h>
+#include <stdint.h>
+#include <time.h>
+
+enum metrics_counter {
+        METRICS_FILECACHE_HIT = 0,
+        METRICS_FILECACHE_MISS,
+        METRICS_DIRCACHE_HIT,
+        METRICS_DIRCACHE_MISS,
+        METRICS_LOOKUP_MISS,            /* path_lookup_miss() calls */
+        METRICS_BUFFER_STALL,           /* reads waiting for the extractor */
+        METRICS_LONG_JUMP,              /* long jump hack activations */
+        METRICS_NEGCACHE_HIT,           /* lookups of known missing paths */
+        METRICS_RAW_PREFETCH,           /* volumes opened ahead of the reader */
+        METRICS_OPEN_HANDLES,           /* gauge */
+        METRICS_COUNTER_END
+};
+
+enum metrics_op {
+        METRICS_OP_GETATTR = 0,
+        METRICS_OP_OPENDIR,
+        METRICS_OP_READDIR,
+        METRICS_OP_RELEASEDIR,
+        METRICS_OP_OPEN,
+        METRICS_OP_READ,
+        METRICS_OP_RELEASE,
+        METRICS_OP_READLINK,
+        METRICS_OP_STATFS,
+        METRICS_OP_LSEEK,
+        METRICS_OP_END
+};
+
+extern uint64_t metrics_counters[METRICS_COUNTER_END];
+
+#define METRICS_INC(c) \
+        (void)__atomic_add_fetch(&metrics_counters[(c)], 1, __ATOMIC_RELAXED)
+#define METRICS_DEC(c) \
+        (void)__atomic_sub_fetch(&metrics_counters[(c)], 1, __ATOMIC_RELAXED)
+
+void metrics_op_done(enum metrics_op op, const struct timespec *start);
+char *metrics_format(size_t *len);
+
+#endif
@@ -36,12 +36,22 @@
         (s) = alloca(len + 1); \
         strcpy((s), path);
 
+#define MAX_RANGES 16
+#define ALIGN_DOWN(x) ((x) & ~4095ULL)
+#define ALIGN_UP(x) (((x) + 4095) & ~4095ULL)
+
 typedef enum {
         M_UNKNOWN,
         M_RIFF,
-        M_EBML
+        M_EBML,
+        M_ISOBMFF
 } Mode;
 
+struct range {
+        uint64_t offset;
+        uint64_t size;
+};
+
 /*!
  *****************************************************************************
  *
@@ -156,6 +166,150 @@ static void parse_ebml(struct idx_head *h, FILE *fp, uint64_t sz)
         }
 }
 
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static uint64_t be_bytes(const unsigned char *b, int n)
+{
+        uint64_t v = 0;
+        while (n--)
+                v = (v << 8) | *b++;
+        return v;
+}
+
+/*!
+ *****************************************************************************
+ * Walk the top level boxes of an ISO base media file (MP4/MOV) and return
+ * the ranges players need to seek, ie. 'moov' and, for fragmented files,
+ * 'sidx' and 'mfra'. Ranges are page aligned and merged if they touch.
+ ****************************************************************************/
+static int parse_isobmff(struct range *r, FILE *fp, uint64_t sz)
+{
+        unsigned char b[16];
+        uint64_t pos = 0;
+        int n = 0;
+
+        while (pos + 8 <= sz && n < MAX_RANGES) {
+                uint64_t bsz;
+
+                if (fseeko(fp, pos, SEEK_SET) || fread(b, 1, 8, fp) != 8)
+                        break;
+                bsz = be_bytes(b, 4);
+                if (bsz == 1) {
+                        if (fread(b + 8, 1, 8, fp) != 8)
+                                break;
+                        bsz = be_bytes(b + 8, 8);
+                } else if (bsz == 0) {
+                        bsz = sz - pos;         /* box extends to EOF */
+                }
+                if (bsz < 8 || bsz > sz - pos)
+                        break;
+                if (!memcmp(b + 4, "moov", 4) || !memcmp(b + 4, "sidx", 4) ||
+                    !memcmp(b + 4, "mfra", 4)) {
+                        uint64_t start = ALIGN_DOWN(pos);
+                        uint64_t end = ALIGN_UP(pos + bsz);
+                        if (end > sz)
+                                end = sz;
+                        if (n && start <= r[n - 1].offset + r[n - 1].size) {
+                                r[n - 1].size = end - r[n - 1].offset;
+                        } else {
+                                r[n].offset = start;
+                                r[n].size = end - start;
+                                ++n;
+                        }
+                }
+                pos += bsz;
+        }
+
+        /* Nothing to gain if the only range is at the very beginning */
+        if (n == 1 && r[0].offset == 0)
+                return 0;
+        return n;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int is_isobmff(FILE *fp)
+{
+        unsigned char b[8];
+
+        if (fseeko(fp, 0, SEEK_SET) || fread(b, 1, 8, fp) != 8)
+                return 0;
+        return !memcmp(b + 4, "ftyp", 4) || !memcmp(b + 4, "moov", 4) ||
+               !memcmp(b + 4, "mdat", 4) || !memcmp(b + 4, "wide", 4) ||
+               !memcmp(b + 4, "free", 4) || !memcmp(b + 4, "skip", 4);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static char *map_file(int fd, size_t size);
+
+/*!
+ *****************************************************************************
+ * Write a version 2 index holding a table of ranges followed by their data.
+ ****************************************************************************/
+static int write_index_v2(const char *dest, FILE *fp, struct range *r, int n)
+{
+        struct idx_head head;
+        struct idx_table table;
+        uint64_t data = sizeof(head) + sizeof(table) +
+                        (n * sizeof(struct idx_range));
+        uint64_t total = 0;
+        int i;
+
+        for (i = 0; i < n; i++)
+                total += r[i].size;
+
+        int fd = open(dest, O_RDWR|O_CREAT, S_IREAD|S_IWRITE);
+        if (fd == -1)
+                return 1;
+
+        size_t map_size = (data + total + 4096) & ~4095;
+        char *addr = map_file(fd, map_size);
+        if (!addr) {
+                printf("Internal error %x\n", MAP_FAILED_);
+                close(fd);
+                return 1;
+        }
+
+        head.magic = R2I_MAGIC;
+        head.version = R2I_VERSION_2;
+        head.spare = 0;
+        head.offset = hton64(r[0].offset);
+        head.size = hton64(data + total - sizeof(head));
+        memcpy(addr, &head, sizeof(head));
+        table.count = htonl(n);
+        table.spare = 0;
+        memcpy(addr + sizeof(head), &table, sizeof(table));
+
+        struct idx_range *rp =
+                (struct idx_range *)(addr + sizeof(head) + sizeof(table));
+        for (i = 0; i < n; i++) {
+                rp[i].offset = hton64(r[i].offset);
+                rp[i].size = hton64(r[i].size);
+                rp[i].data = hton64(data);
+                fseeko(fp, r[i].offset, SEEK_SET);
+                if ((fread(addr + data, 1, r[i].size, fp) != r[i].size) &&
+                                ferror(fp)) {
+                        munmap(addr, map_size);
+                        close(fd);
+                        return 1;
+                }
+                data += r[i].size;
+        }
+
+        /* flush to medium */
+        msync(addr, map_size, MS_SYNC);
+        munmap(addr, map_size);
+        close(fd);
+        return 0;
+}
+
 /*!
  *****************************************************************************
  *
@@ -191,12 +345,49 @@ int main(int argn, char *argv[])
 #ifdef HAVE_SETLOCALE
         setlocale(LC_CTYPE, "");
 #endif
-        if (argn != 3) {
+        if (argn != 2 && argn != 3) {
                 printf("Usage: mkr2i <dump file> <source file>\n");
+                printf("       mkr2i <source file>\n");
                 printf("   <dump file>     AVI-Mux GUI RIFF/EBML dump file (txt)\n");
-                printf("   <source file>   RIFF(.avi)/EBML(.mkv) source file\n");
+                printf("   <source file>   RIFF(.avi)/EBML(.mkv) source file, or\n");
+                printf("                   ISO base media (.mp4/.mov) source file\n");
                 exit(0);
         }
+
+        if (argn == 2) {
+                char *src_file = argv[1];
+                char *dest;
+                struct range r[MAX_RANGES];
+                struct stat stat_src;
+                int n;
+                int ret;
+
+                FILE *fd_src = fopen(src_file, "r");
+                if (!fd_src) {
+                        printf("Failed to open source file %s\n", src_file);
+                        exit(-1);
+                }
+                if (!is_isobmff(fd_src)) {
+                        printf("Invalid source file\n");
+                        fclose(fd_src);
+                        exit(-1);
+                }
+                if (fstat(fileno(fd_src), &stat_src) == -1) {
+                        fclose(fd_src);
+                        exit(-1);
+                }
+                n = parse_isobmff(r, fd_src, stat_src.st_size);
+                if (!n) {
+                        fclose(fd_src);
+                        return 0;
+                }
+                STR_DUP(dest, src_file);
+                strcpy(&dest[strlen(dest)-4], ".r2i");
+                ret = write_index_v2(dest, fd_src, r, n);
+                fclose(fd_src);
+                return ret;
+        }
+
         char *dump = argv[1];
         char *src_file = argv[2];
 
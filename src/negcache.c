@@ -0,0 +1,307 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "negcache.h"
+#include "metrics.h"
+
+#define NEGCACHE_SZ 1024
+#define NEGCACHE_MAX_DIRS 1024
+#define NEGCACHE_DIR_NAMES 32
+
+/*
+ * Names known not to exist are grouped per parent directory so that they
+ * can be dropped together with the directory cache entry of that folder.
+ * Each directory remembers a bounded number of names, replaced in round
+ * robin order, and the number of directories is bounded by an LRU list.
+ * Entries also expire after 'ttl' seconds to catch changes made to the
+ * source folder that are not otherwise detected.
+ */
+struct negcache_name {
+        char *name;
+        uint32_t hash;
+        time_t expires;
+};
+
+struct negcache_dir {
+        const char *key;        /* owned by the hash table */
+        struct negcache_name names[NEGCACHE_DIR_NAMES];
+        unsigned int next_slot;
+        struct negcache_dir *prev;
+        struct negcache_dir *next;
+};
+
+static void *ht = NULL;
+static pthread_mutex_t negcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int cache_ttl = 0;
+static unsigned int n_dirs = 0;
+
+/* LRU list, most recently used first */
+static struct negcache_dir *lru_head = NULL;
+static struct negcache_dir *lru_tail = NULL;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_unlink(struct negcache_dir *d)
+{
+        if (d->prev)
+                d->prev->next = d->next;
+        else if (lru_head == d)
+                lru_head = d->next;
+        if (d->next)
+                d->next->prev = d->prev;
+        else if (lru_tail == d)
+                lru_tail = d->prev;
+        d->prev = d->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_push(struct negcache_dir *d)
+{
+        d->next = lru_head;
+        if (lru_head)
+                lru_head->prev = d;
+        lru_head = d;
+        if (!lru_tail)
+                lru_tail = d;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__alloc()
+{
+        return calloc(1, sizeof(struct negcache_dir));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __free(const char *key, void *data)
+{
+        struct negcache_dir *d = data;
+        int i;
+
+        (void)key;              /* touch */
+
+        if (!d)
+                return;
+        __lru_unlink(d);
+        for (i = 0; i < NEGCACHE_DIR_NAMES; i++)
+                free(d->names[i].name);
+        free(d);
+        --n_dirs;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static time_t __now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec;
+}
+
+/*!
+ *****************************************************************************
+ * Split 'path' in its parent folder and base name. The returned string
+ * holds the parent folder and must be freed by the caller.
+ ****************************************************************************/
+static char *__split(const char *path, const char **name)
+{
+        const char *s = strrchr(path, '/');
+        char *dir;
+
+        if (!s || !s[1])
+                return NULL;
+        *name = s + 1;
+        dir = s == path ? strdup("/") : strndup(path, s - path);
+        if (!dir)
+                printd(1, "negcache: strdup failed\n");
+        return dir;
+}
+
+/*!
+ *****************************************************************************
+ * A 'ttl' of 0 disables the cache.
+ ****************************************************************************/
+void negcache_init(unsigned int ttl)
+{
+        struct hash_table_ops ops = {
+                .alloc = __alloc,
+                .free = __free,
+        };
+
+        if (!ttl)
+                return;
+        ht = hashtable_init(NEGCACHE_SZ, &ops);
+        if (ht)
+                cache_ttl = ttl;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void negcache_destroy()
+{
+        pthread_mutex_lock(&negcache_lock);
+        if (ht)
+                hashtable_destroy(ht);
+        ht = NULL;
+        cache_ttl = 0;
+        pthread_mutex_unlock(&negcache_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Returns 1 if 'path' is known not to exist, 0 otherwise.
+ ****************************************************************************/
+int negcache_get(const char *path)
+{
+        struct hash_table_entry *hte;
+        const char *name;
+        uint32_t hash;
+        char *dir;
+        int found = 0;
+        int i;
+
+        if (!cache_ttl)
+                return 0;
+        dir = __split(path, &name);
+        if (!dir)
+                return 0;
+        hash = get_hash(name, 0);
+
+        pthread_mutex_lock(&negcache_lock);
+        hte = ht ? hashtable_entry_get(ht, dir) : NULL;
+        if (hte) {
+                struct negcache_dir *d = hte->user_data;
+                time_t now = __now();
+                for (i = 0; i < NEGCACHE_DIR_NAMES; i++) {
+                        struct negcache_name *n = &d->names[i];
+                        if (n->name && n->hash == hash &&
+                            n->expires > now && !strcmp(n->name, name)) {
+                                found = 1;
+                                break;
+                        }
+                }
+                if (found) {
+                        __lru_unlink(d);
+                        __lru_push(d);
+                }
+        }
+        pthread_mutex_unlock(&negcache_lock);
+        free(dir);
+
+        if (found) {
+                METRICS_INC(METRICS_NEGCACHE_HIT);
+                printd(3, "NEGHIT  %s\n", path);
+        }
+        return found;
+}
+
+/*!
+ *****************************************************************************
+ * Remember that 'path' does not exist.
+ ****************************************************************************/
+void negcache_add(const char *path)
+{
+        struct hash_table_entry *hte;
+        struct negcache_dir *d;
+        struct negcache_name *n;
+        const char *name;
+        char *dir;
+
+        if (!cache_ttl)
+                return;
+        dir = __split(path, &name);
+        if (!dir)
+                return;
+
+        pthread_mutex_lock(&negcache_lock);
+        if (!ht)
+                goto out;
+        hte = hashtable_entry_get(ht, dir);
+        if (!hte) {
+                while (n_dirs >= NEGCACHE_MAX_DIRS && lru_tail)
+                        hashtable_entry_delete(ht, lru_tail->key);
+                hte = hashtable_entry_alloc(ht, dir);
+                if (!hte || !hte->user_data)
+                        goto out;
+                d = hte->user_data;
+                d->key = hte->key;
+                ++n_dirs;
+        } else {
+                d = hte->user_data;
+                __lru_unlink(d);
+        }
+        __lru_push(d);
+
+        n = &d->names[d->next_slot];
+        d->next_slot = (d->next_slot + 1) % NEGCACHE_DIR_NAMES;
+        free(n->name);
+        n->name = strdup(name);
+        n->hash = get_hash(name, 0);
+        n->expires = __now() + cache_ttl;
+
+out:
+        pthread_mutex_unlock(&negcache_lock);
+        free(dir);
+}
+
+/*!
+ *****************************************************************************
+ * Forget every name recorded for folder 'dir', or everything if 'dir'
+ * is NULL.
+ ****************************************************************************/
+void negcache_invalidate(const char *dir)
+{
+        if (!cache_ttl)
+                return;
+        pthread_mutex_lock(&negcache_lock);
+        if (ht)
+                hashtable_entry_delete(ht, dir);
+        pthread_mutex_unlock(&negcache_lock);
+}
@@ -0,0 +1,578 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "nestcache.h"
+
+#define NESTCACHE_SZ 1024
+
+/*
+ * Extracted nested archives are stored below 'cache_dir' in files named
+ * after their fingerprint, such that identical archives found at several
+ * places share a single copy. A second table maps the location of a
+ * nested archive (parent archive, its size and mtime, and the name within
+ * the parent) to such a copy, which is what allows a lookup before any
+ * data has been extracted. Each copy keeps a list of the locations
+ * referring to it, such that these are dropped together with the copy
+ * when it is evicted.
+ */
+struct nestcache_loc;
+
+struct nestcache_copy {
+        const char *key;        /* owned by the hash table */
+        size_t size;
+        struct nestcache_copy *prev;
+        struct nestcache_copy *next;
+        struct nestcache_loc *users;
+};
+
+struct nestcache_loc {
+        const char *key;        /* owned by the hash table */
+        char copy[40];
+        struct archive_fingerprint fp;
+        struct nestcache_copy *owner;
+        struct nestcache_loc *prev;
+        struct nestcache_loc *next;
+};
+
+static void *copies = NULL;
+static void *locs = NULL;
+static pthread_mutex_t nestcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+static size_t cache_budget = 0;
+static size_t cache_used = 0;
+static void (*evict_cb)(const char *) = NULL;
+static struct nestcache_stats stats;
+
+/* LRU list, most recently used first */
+static struct nestcache_copy *lru_head = NULL;
+static struct nestcache_copy *lru_tail = NULL;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__copy_alloc()
+{
+        return calloc(1, sizeof(struct nestcache_copy));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__loc_alloc()
+{
+        return calloc(1, sizeof(struct nestcache_loc));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __loc_unlink(struct nestcache_loc *loc)
+{
+        if (!loc->owner)
+                return;
+        if (loc->prev)
+                loc->prev->next = loc->next;
+        else
+                loc->owner->users = loc->next;
+        if (loc->next)
+                loc->next->prev = loc->prev;
+        loc->owner = NULL;
+        loc->prev = loc->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __loc_link(struct nestcache_loc *loc, struct nestcache_copy *e)
+{
+        loc->owner = e;
+        loc->prev = NULL;
+        loc->next = e->users;
+        if (e->users)
+                e->users->prev = loc;
+        e->users = loc;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __copy_free(const char *key, void *data)
+{
+        struct nestcache_copy *e = data;
+
+        (void)key;              /* touch */
+        while (e->users)
+                __loc_unlink(e->users);
+        free(e);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __loc_free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        __loc_unlink(data);
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with nestcache_lock held.
+ ****************************************************************************/
+static void __drop_users(struct nestcache_copy *e)
+{
+        while (e->users) {
+                char *key = strdup(e->users->key);
+                if (!key) {
+                        /* Dropped lazily by nestcache_get() instead */
+                        __loc_unlink(e->users);
+                        continue;
+                }
+                hashtable_entry_delete(locs, key);
+                free(key);
+        }
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_unlink(struct nestcache_copy *e)
+{
+        if (e->prev)
+                e->prev->next = e->next;
+        else
+                lru_head = e->next;
+        if (e->next)
+                e->next->prev = e->prev;
+        else
+                lru_tail = e->prev;
+        e->prev = e->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_push(struct nestcache_copy *e)
+{
+        e->prev = NULL;
+        e->next = lru_head;
+        if (lru_head)
+                lru_head->prev = e;
+        lru_head = e;
+        if (!lru_tail)
+                lru_tail = e;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __copy_key(char *ckey, size_t len, const void *data, size_t size)
+{
+        snprintf(ckey, len, "%016llx-%llx",
+                 (unsigned long long)compute_content_hash(data, size),
+                 (unsigned long long)size);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __copy_name(char *name, size_t len, const char *ckey)
+{
+        snprintf(name, len, "%s/%s.nst", cache_dir, ckey);
+}
+
+/*!
+ *****************************************************************************
+ * Compare the stored copy 'ckey' with 'data'. A matching key on its own
+ * only says the hashes are equal.
+ ****************************************************************************/
+static int __copy_same(const char *ckey, const void *data, size_t size)
+{
+        char name[PATH_MAX];
+        char chunk[65536];
+        size_t off = 0;
+        int fd;
+
+        __copy_name(name, sizeof(name), ckey);
+        fd = open(name, O_RDONLY);
+        if (fd == -1)
+                return 0;
+        while (off < size) {
+                size_t len = size - off < sizeof(chunk) ?
+                                size - off : sizeof(chunk);
+                ssize_t n = pread(fd, chunk, len, off);
+                if (n <= 0 || memcmp(chunk, (const char *)data + off, n))
+                        break;
+                off += n;
+        }
+        /* Trailing data means the copy is larger than 'size' */
+        if (off == size && pread(fd, chunk, 1, off) != 0)
+                off = 0;
+        close(fd);
+        return off == size;
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with nestcache_lock held. Names of evicted copies are
+ * returned in 'evicted' (up to 'max') to be reported once the lock has
+ * been released; the copies are unlinked by then.
+ ****************************************************************************/
+static int __evict(size_t needed, char (*evicted)[PATH_MAX], int max)
+{
+        int n = 0;
+
+        while (lru_tail && n < max && cache_used + needed > cache_budget) {
+                struct nestcache_copy *e = lru_tail;
+                __lru_unlink(e);
+                cache_used -= e->size;
+                __copy_name(evicted[n], PATH_MAX, e->key);
+                (void)unlink(evicted[n]);
+                printd(3, "nestcache: evicted %s\n", e->key);
+                __drop_users(e);
+                hashtable_entry_delete(copies, e->key);
+                ++stats.evictions;
+                ++n;
+        }
+        return n;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __purge_dir()
+{
+        char name[PATH_MAX];
+        DIR *dp = opendir(cache_dir);
+        struct dirent *ep;
+
+        if (!dp)
+                return;
+        while ((ep = readdir(dp))) {
+                size_t len = strlen(ep->d_name);
+                if (len > 4 && (!strcmp(ep->d_name + len - 4, ".nst") ||
+                                !strncmp(ep->d_name, ".nst", 4))) {
+                        snprintf(name, sizeof(name), "%s/%s", cache_dir,
+                                 ep->d_name);
+                        (void)unlink(name);
+                }
+        }
+        closedir(dp);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int nestcache_enabled()
+{
+        return copies != NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Look up the copy of the nested archive at location 'key'. On a hit the
+ * path of the copy is returned in 'path' and its fingerprint in 'fp' (the
+ * mtime field is left untouched). Returns -ENOENT on a miss.
+ ****************************************************************************/
+int nestcache_get(const char *key, char *path,
+                struct archive_fingerprint *fp)
+{
+        struct hash_table_entry *he;
+        struct nestcache_loc *loc;
+        struct nestcache_copy *e;
+
+        if (!copies)
+                return -ENOENT;
+
+        pthread_mutex_lock(&nestcache_lock);
+        he = hashtable_entry_get(locs, key);
+        if (!he)
+                goto miss;
+        loc = he->user_data;
+        he = hashtable_entry_get(copies, loc->copy);
+        if (!he) {
+                /* Copy was evicted */
+                hashtable_entry_delete(locs, key);
+                goto miss;
+        }
+        e = he->user_data;
+        __lru_unlink(e);
+        __lru_push(e);
+        __copy_name(path, PATH_MAX, e->key);
+        fp->hash = loc->fp.hash;
+        fp->size = loc->fp.size;
+        ++stats.hits;
+        pthread_mutex_unlock(&nestcache_lock);
+        return 0;
+
+miss:
+        ++stats.misses;
+        pthread_mutex_unlock(&nestcache_lock);
+        return -ENOENT;
+}
+
+/*!
+ *****************************************************************************
+ * Store an extracted nested archive found at location 'key'. The path of
+ * the (possibly already existing) copy is returned in 'path'. Copies are
+ * keyed by a hash of the complete content and an existing copy is only
+ * reused if its bytes are equal to 'data'.
+ ****************************************************************************/
+int nestcache_put(const char *key, const struct archive_fingerprint *fp,
+                const void *data, size_t size, char *path)
+{
+        char ckey[40];
+        char tmp[PATH_MAX];
+        char evicted[8][PATH_MAX];
+        struct hash_table_entry *he;
+        struct nestcache_loc *loc;
+        struct nestcache_copy *e;
+        int found;
+        int n = 0;
+        int i;
+        int fd;
+
+        if (!copies || !size || size > cache_budget)
+                return -EINVAL;
+
+        __copy_key(ckey, sizeof(ckey), data, size);
+        pthread_mutex_lock(&nestcache_lock);
+        found = hashtable_entry_get(copies, ckey) != NULL;
+        pthread_mutex_unlock(&nestcache_lock);
+        if (found)
+                goto reuse;
+
+        snprintf(tmp, sizeof(tmp), "%s/.nstXXXXXX", cache_dir);
+        fd = mkstemp(tmp);
+        if (fd == -1) {
+                printd(1, "nestcache: failed to create %s: %s\n", tmp,
+                       strerror(errno));
+                return -errno;
+        }
+        if (write(fd, data, size) != (ssize_t)size) {
+                int err = errno ? errno : ENOSPC;
+                close(fd);
+                (void)unlink(tmp);
+                return -err;
+        }
+        close(fd);
+
+        pthread_mutex_lock(&nestcache_lock);
+        if (!copies) {
+                /* Cache destroyed meanwhile */
+                pthread_mutex_unlock(&nestcache_lock);
+                (void)unlink(tmp);
+                return -EINVAL;
+        }
+        if (hashtable_entry_get(copies, ckey)) {
+                /* Lost a race, the same content may already be stored */
+                pthread_mutex_unlock(&nestcache_lock);
+                (void)unlink(tmp);
+                goto reuse;
+        }
+        n = __evict(size, evicted, sizeof(evicted) / sizeof(evicted[0]));
+        if (cache_used + size > cache_budget) {
+                pthread_mutex_unlock(&nestcache_lock);
+                (void)unlink(tmp);
+                goto out;
+        }
+        __copy_name(path, PATH_MAX, ckey);
+        if (rename(tmp, path) == -1) {
+                pthread_mutex_unlock(&nestcache_lock);
+                (void)unlink(tmp);
+                goto out;
+        }
+        he = hashtable_entry_alloc(copies, ckey);
+        if (!he) {
+                pthread_mutex_unlock(&nestcache_lock);
+                (void)unlink(path);
+                goto out;
+        }
+        e = he->user_data;
+        e->key = he->key;
+        e->size = size;
+        __lru_push(e);
+        cache_used += size;
+        goto link;
+
+reuse:
+        if (!__copy_same(ckey, data, size)) {
+                /* Hash collision (or copy evicted), keep what is stored */
+                printd(3, "nestcache: %s does not match, not reused\n", ckey);
+                return -EEXIST;
+        }
+        pthread_mutex_lock(&nestcache_lock);
+        if (!copies || !hashtable_entry_get(copies, ckey)) {
+                pthread_mutex_unlock(&nestcache_lock);
+                return -ENOENT;
+        }
+
+link:
+        he = hashtable_entry_get(copies, ckey);
+        e = he->user_data;
+        __lru_unlink(e);
+        __lru_push(e);
+        __copy_name(path, PATH_MAX, ckey);
+        he = hashtable_entry_alloc(locs, key);
+        if (he) {
+                loc = he->user_data;
+                loc->key = he->key;
+                if (loc->owner != e) {
+                        /* Location now refers to another copy */
+                        __loc_unlink(loc);
+                        __loc_link(loc, e);
+                }
+                memcpy(loc->copy, ckey, sizeof(loc->copy));
+                loc->fp.hash = fp->hash;
+                loc->fp.size = fp->size;
+        }
+        pthread_mutex_unlock(&nestcache_lock);
+        for (i = 0; i < n; i++)
+                if (evict_cb)
+                        evict_cb(evicted[i]);
+        return 0;
+
+out:
+        for (i = 0; i < n; i++)
+                if (evict_cb)
+                        evict_cb(evicted[i]);
+        return -ENOSPC;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void nestcache_get_stats(struct nestcache_stats *s)
+{
+        pthread_mutex_lock(&nestcache_lock);
+        *s = stats;
+        s->used = cache_used;
+        s->budget = cache_budget;
+        pthread_mutex_unlock(&nestcache_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int nestcache_init(const char *dir, size_t budget,
+                void (*evicted)(const char *))
+{
+        struct hash_table_ops copy_ops = {
+                .alloc = __copy_alloc,
+                .free = __copy_free,
+        };
+        struct hash_table_ops loc_ops = {
+                .alloc = __loc_alloc,
+                .free = __loc_free,
+        };
+
+        if (!dir || !budget)
+                return 0;
+
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+                printd(1, "nestcache: cannot create %s: %s\n", dir,
+                       strerror(errno));
+                return -errno;
+        }
+        cache_dir = strdup(dir);
+        if (!cache_dir)
+                return -ENOMEM;
+        __purge_dir();
+
+        pthread_mutex_lock(&nestcache_lock);
+        cache_budget = budget;
+        cache_used = 0;
+        evict_cb = evicted;
+        memset(&stats, 0, sizeof(stats));
+        copies = hashtable_init(NESTCACHE_SZ, &copy_ops);
+        locs = hashtable_init(NESTCACHE_SZ, &loc_ops);
+        if (!copies || !locs) {
+                if (copies)
+                        hashtable_destroy(copies);
+                if (locs)
+                        hashtable_destroy(locs);
+                copies = locs = NULL;
+                pthread_mutex_unlock(&nestcache_lock);
+                free(cache_dir);
+                cache_dir = NULL;
+                return -ENOMEM;
+        }
+        pthread_mutex_unlock(&nestcache_lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void nestcache_destroy()
+{
+        pthread_mutex_lock(&nestcache_lock);
+        if (copies) {
+                printd(3, "nestcache: %lu hits, %lu misses, %lu evictions\n",
+                       stats.hits, stats.misses, stats.evictions);
+                hashtable_destroy(copies);
+                hashtable_destroy(locs);
+                copies = locs = NULL;
+                lru_head = lru_tail = NULL;
+                cache_used = 0;
+                __purge_dir();
+        }
+        free(cache_dir);
+        cache_dir = NULL;
+        pthread_mutex_unlock(&nestcache_lock);
+}
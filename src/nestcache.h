@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#ifndef NESTCACHE_H_
+#define NESTCACHE_H_
+
+#include <platform.h>
+#include <sys/types.h>
+#include "recursion.h"
+
+struct nestcache_stats {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        size_t used;                    /* bytes */
+        size_t budget;                  /* bytes */
+};
+
+int nestcache_init(const char *dir, size_t budget,
+                void (*evicted)(const char *));
+void nestcache_destroy();
+int nestcache_enabled();
+int nestcache_get(const char *key, char *path,
+                struct archive_fingerprint *fp);
+int nestcache_put(const char *key, const struct archive_fingerprint *fp,
+                const void *data, size_t size, char *path);
+void nestcache_get_stats(struct nestcache_stats *stats);
+
+#endif
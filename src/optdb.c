@@ -69,7 +69,26 @@ static struct opt_entry opt_entry_[] = {
         /* Recursive unpacking: Recursive RAR unpacking options */
         {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_RECURSIVE (flag) */
         {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_RECURSION_DEPTH (integer) */
-        {{NULL,}, 0, 0, 0, 0, 1}   /* OPT_KEY_MAX_UNPACK_SIZE (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_MAX_UNPACK_SIZE (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_EXTRACT_THREADS (integer) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_BLOCK_CACHE (string) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_BLOCK_CACHE_SIZE (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_IOB_BUDGET (integer) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_SNAPSHOT (string) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_SNAPSHOT_INTERVAL (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_LIST_THREADS (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_LIST_TIMEOUT (integer) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_WATCH (flag) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_NESTED_CACHE (string) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_NESTED_CACHE_SIZE (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_RAW_READAHEAD (integer) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_IO_URING (flag) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_SOLID_CACHE (string) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_SOLID_CACHE_SIZE (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_KEY_CACHE_TTL (integer) */
+        {{NULL,}, 0, 0, 0, 0, 0},  /* OPT_KEY_AUTO_INDEX (flag) */
+        {{NULL,}, 0, 0, 0, 0, 1},  /* OPT_KEY_AUTO_INDEX_CPU (integer) */
+        {{NULL,}, 0, 0, 0, 0, 1}   /* OPT_KEY_AUTO_INDEX_RATE (integer) */
 };
 
 struct opt_entry *opt_entry_p  = &opt_entry_[0];
@@ -172,6 +191,18 @@ int optdb_save(int opt, const char *s)
         case OPT_KEY_FUSE_CONGESTION_THRESHOLD:
         case OPT_KEY_RECURSION_DEPTH:       /*  integer 1-10 */
         case OPT_KEY_MAX_UNPACK_SIZE:       /*  integer bytes */
+        case OPT_KEY_EXTRACT_THREADS:
+        case OPT_KEY_BLOCK_CACHE_SIZE:
+        case OPT_KEY_IOB_BUDGET:
+        case OPT_KEY_SNAPSHOT_INTERVAL:
+        case OPT_KEY_LIST_THREADS:
+        case OPT_KEY_LIST_TIMEOUT:
+        case OPT_KEY_NESTED_CACHE_SIZE:
+        case OPT_KEY_RAW_READAHEAD:
+        case OPT_KEY_SOLID_CACHE_SIZE:
+        case OPT_KEY_KEY_CACHE_TTL:
+        case OPT_KEY_AUTO_INDEX_CPU:
+        case OPT_KEY_AUTO_INDEX_RATE:
         {
                 NO_UNUSED_RESULT strtoul(s1, &endptr, 10);
                 if (*endptr)
@@ -193,6 +224,10 @@ int optdb_save(int opt, const char *s)
                 break;
         case OPT_KEY_SRC:
         case OPT_KEY_DST:
+        case OPT_KEY_BLOCK_CACHE:
+        case OPT_KEY_SNAPSHOT:
+        case OPT_KEY_NESTED_CACHE:
+        case OPT_KEY_SOLID_CACHE:
                 CLR_OPT_(opt);
                 ADD_OPT_(opt, s1, OPT_STR_);
                 break;
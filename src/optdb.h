@@ -70,6 +70,25 @@ enum {
         OPT_KEY_RECURSIVE,                  /* Enable recursive RAR unpacking (flag) */
         OPT_KEY_RECURSION_DEPTH,            /* Maximum recursion depth (integer 1-10) */
         OPT_KEY_MAX_UNPACK_SIZE,            /* Maximum uncompressed size for nested archives (integer bytes) */
+        OPT_KEY_EXTRACT_THREADS,            /* In-process extraction workers (0 = fork) */
+        OPT_KEY_BLOCK_CACHE,                /* Decompressed block cache directory */
+        OPT_KEY_BLOCK_CACHE_SIZE,           /* Block cache size budget (MiB) */
+        OPT_KEY_IOB_BUDGET,                 /* Total I/O buffer memory budget (MiB) */
+        OPT_KEY_SNAPSHOT,                   /* Metadata snapshot file */
+        OPT_KEY_SNAPSHOT_INTERVAL,          /* Periodic snapshot interval (seconds) */
+        OPT_KEY_LIST_THREADS,               /* Archive listing workers (0 = sequential) */
+        OPT_KEY_LIST_TIMEOUT,               /* Directory listing deadline (seconds) */
+        OPT_KEY_WATCH,                      /* Watch source folder for changes (flag) */
+        OPT_KEY_NESTED_CACHE,               /* Extracted nested archive cache directory */
+        OPT_KEY_NESTED_CACHE_SIZE,          /* Nested archive cache size budget (MiB) */
+        OPT_KEY_RAW_READAHEAD,              /* Raw file readahead window (MiB) */
+        OPT_KEY_IO_URING,                   /* Use io_uring for volume reads (flag) */
+        OPT_KEY_SOLID_CACHE,                /* Solid archive sibling cache directory */
+        OPT_KEY_SOLID_CACHE_SIZE,           /* Solid archive cache size budget (MiB) */
+        OPT_KEY_KEY_CACHE_TTL,              /* Lifetime of cached archive keys (s) */
+        OPT_KEY_AUTO_INDEX,                 /* Create missing .r2i files in background (flag) */
+        OPT_KEY_AUTO_INDEX_CPU,             /* Index generator CPU budget (percent) */
+        OPT_KEY_AUTO_INDEX_RATE,            /* Index generator decode rate (MiB/s) */
         OPT_KEY_END, /* Must *always* be last key */
         OPT_KEY_LAST = (OPT_KEY_END - 1)
 };
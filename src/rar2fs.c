@@ -52,6 +52,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <poll.h>
 #ifdef HAVE_SCHED_H
 # include <sched.h>
 #endif
@@ -76,6 +77,21 @@
 #include "common.h"
 #include "dirname.h"
 #include "recursion.h"
+#include "threadpool.h"
+#include "hashtable.h"
+#include "blkcache.h"
+#include "volpool.h"
+#include "uring.h"
+#include "snapshot.h"
+#include "warmup.h"
+#include "watcher.h"
+#include "nestcache.h"
+#include "solidcache.h"
+#include "keycache.h"
+#include "timer.h"
+#include "idxgen.h"
+#include "metrics.h"
+#include "negcache.h"
 
 #define MOUNT_FOLDER  0
 #define MOUNT_ARCHIVE 1
@@ -86,6 +102,11 @@
 #define RD_SYNC_READ 3
 #define RD_ASYNC_READ 4
 
+/* In-process extraction worker state (--extract-threads) */
+#define XTR_WAIT 0x1    /* worker is blocked on a full I/O buffer */
+#define XTR_DONE 0x2    /* worker has returned from extraction */
+#define XTR_TERM 0x4    /* extraction should be aborted */
+
 /* Maximum chunk size for UnRAR callbacks (128MB) */
 #define MAX_CHUNK_SIZE (128 * 1024 * 1024)  /* 128MB */
 
@@ -97,25 +118,47 @@
 
 /*#define DEBUG_READ*/
 
-struct volume_handle {
-        FILE *fp;
-        off_t pos;
-};
-
 struct io_context {
         FILE* fp;
         off_t pos;
         struct iob *buf;
         pid_t pid;
         unsigned int seq;
-        short vno;
-        short vno_max;
         struct filecache_entry *entry_p;
         pthread_t thread;
-        pthread_mutex_t raw_read_mutex;
+        struct volpool *vp;
         pthread_mutex_t rd_req_mutex;
         pthread_cond_t rd_req_cond;
         int rd_req;
+        /* in-process extraction (--extract-threads) */
+        int inproc;
+        int xtr_state;
+        /* result of extraction, see __stream_result() */
+        int xtr_res;
+        int xtr_fd;             /* result pipe of child, -1 if none */
+        int xtr_done;           /* result of child collected */
+        int poisoned;           /* extraction failed, reads return EIO */
+        pthread_mutex_t xtr_mutex;
+        pthread_cond_t xtr_cond;
+        off_t adapt_pos;        /* stream position at last buffer resize */
+        size_t iob_max;         /* largest buffer of this stream */
+        /* shared stream, see __stream_attach() */
+        int refs;
+        char *stream_key;
+        struct io_handle *handles;      /* attached, under read_mutex */
+        pthread_mutex_t read_mutex;
+        /* decompressed block cache, see __blkcache_feed() */
+        char *bc_key;
+        uint8_t *bc_buf;
+        size_t bc_fill;
+        off_t bc_size;
+        /* sequential raw read detection, see __raw_readahead() */
+        off_t ra_next;          /* offset following the last read */
+        off_t ra_end;           /* end of advised range in volume ra_vol */
+        int ra_seq;             /* number of sequential reads */
+        int ra_vol;
+        int ra_vol_next;        /* next volume not yet prefetched */
+        size_t ra_win;          /* readahead window, 0 = off */
         /* debug */
 #ifdef DEBUG_READ
         FILE *dbg_fp;
@@ -124,6 +167,11 @@ struct io_context {
 
 struct io_handle {
         int type;
+        unsigned int seq;                       /* per handle read sequence */
+        off_t pos;                              /* type = IO_TYPE_RAR, offset
+                                                   following the last read */
+        struct io_handle *next;                 /* type = IO_TYPE_RAR, next
+                                                   handle of the stream */
 #define IO_TYPE_NRM 0
 #define IO_TYPE_RAR 1
 #define IO_TYPE_RAW 2
@@ -137,6 +185,7 @@ struct io_handle {
                 uintptr_t bits;
         } u;
         char *path;                             /* type = all */
+        struct dir_entry_list dir;              /* type = IO_TYPE_DIR */
 };
 
 #define FH_ZERO(fh)            ((fh) = 0)
@@ -166,8 +215,6 @@ static struct dir_entry_list arch_list_root;        /* internal list root */
 static struct dir_entry_list *arch_list = &arch_list_root;
 static pthread_attr_t thread_attr;
 static unsigned int rar2_ticks;
-static int fs_terminated = 0;
-static int warmup_cancelled = 0;
 static int fs_loop = 0;
 static char *fs_loop_mp_root = NULL;
 static char *fs_loop_mp_base = NULL;
@@ -175,22 +222,30 @@ static size_t fs_loop_mp_base_len = 0;
 static struct stat fs_loop_mp_stat;
 static int64_t blkdev_size = -1;
 static mode_t umask_ = 0022;
-static volatile int warmup_threads = 0;
-static pthread_mutex_t warmup_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t warmup_cond = PTHREAD_COND_INITIALIZER;
+static __thread int listed_sets = 0;
+static int snapshot_res = -ENOENT;
 static char *src_path_full = NULL;
+static struct threadpool *extract_pool = NULL;
+static struct threadpool *list_pool = NULL;
+static struct threadpool *prefetch_pool = NULL;
+static size_t raw_readahead = 0;
+
+/* Active decompression streams that may be shared by concurrent opens */
+#define STREAM_SZ 64
+static void *stream_ht = NULL;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Timeout infrastructure for UnRAR operations */
-static volatile sig_atomic_t operation_timed_out = 0;
-static pthread_mutex_t timeout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #define P_ALIGN_(a) (((a)+page_size_)&~(page_size_-1))
 
 static int extract_rar(char *arch, const char *file, void *arg);
+static int __extract_rar(char *arch, const char *file, void *arg,
+                struct io_context *op);
+static void extract_task(void *arg);
 static int get_vformat(const char *s, int t, int *l, int *p);
 static int CALLBACK list_callback_noswitch(UINT, LPARAM UserData, LPARAM, LPARAM);
 static int CALLBACK list_callback(UINT, LPARAM UserData, LPARAM, LPARAM);
-static void *warmup_task(void *data);
+static int __warmup_visit(const char *path);
 
 struct eof_cb_arg {
         off_t toff;
@@ -200,13 +255,27 @@ struct eof_cb_arg {
         char *arch;
 };
 
+struct idxgen_cb_arg {
+        struct idxgen *g;
+        char *arch;
+};
+
 struct extract_cb_arg {
         char *arch;
         void *arg;
+        struct io_context *op;
+        struct solidcache_writer *sc;
         int dry_run;
 };
 
+struct extract_job {
+        struct io_context *op;
+        char *rar_p;
+        char *file_p;
+};
+
 static int extract_index(const char *, const struct filecache_entry *, off_t);
+static int __stream_finished(struct io_context *);
 static int preload_index(struct iob *, const char *);
 
 /* Timeout wrapper function type */
@@ -336,6 +405,77 @@ static int get_seek_length(char *rar)
         return OPT_INT(OPT_KEY_SEEK_LENGTH, 0);
 }
 
+/*!
+ *****************************************************************************
+ * Look up performance property 'prop' of 'path', an archive or directory
+ * in the source folder. Apart from the path and name of 'path' itself
+ * each of its parent directories is tried, nearest first, such that the
+ * settings of a directory apply to everything below it. Returns -1 if
+ * the property is not set.
+ ****************************************************************************/
+static int get_profile_prop(const char *path, int prop)
+{
+        char *s = OPT_STR(OPT_KEY_SRC, 0);
+        const char *name;
+        char *tmp;
+        char *dir;
+        int val;
+
+        if (!path)
+                return -1;
+        if (strstr(path, s) == path)
+                path += strlen(s);
+        if (!*path)
+                path = "/";
+        val = rarconfig_getprop(int, path, prop);
+        if (val >= 0)
+                return val;
+        name = strrchr(path, '/');
+        val = rarconfig_getprop(int, name ? name + 1 : path, prop);
+        if (val >= 0)
+                return val;
+        tmp = strdup(path);
+        if (!tmp)
+                return -1;
+        dir = tmp;
+        while (val < 0 && strcmp(dir, "/")) {
+                dir = __gnu_dirname(dir);
+                val = rarconfig_getprop(int, dir, prop);
+        }
+        free(tmp);
+        return val;
+}
+
+/*!
+ *****************************************************************************
+ * Fill in the profile of 'entry_p' unless already done. Invalid settings
+ * are ignored.
+ ****************************************************************************/
+static void __get_profile(struct filecache_entry *entry_p)
+{
+        struct filecache_entry tmp;
+        int val;
+
+        if (entry_p->profile.loaded)
+                return;
+
+        tmp.profile_uint64 = 0;
+        val = get_profile_prop(entry_p->rar_p, RAR_IOB_SIZE_PROP);
+        if (val > 0 && val <= 1024 && !(val & (val - 1)))
+                tmp.profile.iob_size = val;
+        val = get_profile_prop(entry_p->rar_p, RAR_RAW_READAHEAD_PROP);
+        tmp.profile.raw_readahead = val <= 1024 ? val : -1;
+        val = get_profile_prop(entry_p->rar_p, RAR_HIST_SIZE_PROP);
+        tmp.profile.hist_size = val <= 75 ? val : -1;
+        val = get_profile_prop(entry_p->rar_p, RAR_BLOCK_CACHE_PROP);
+        tmp.profile.block_cache = val;
+        val = get_profile_prop(entry_p->rar_p, RAR_DIRECT_IO_PROP);
+        tmp.profile.direct_io = val;
+        tmp.profile.loaded = 1;
+        __atomic_store_n(&entry_p->profile_uint64, tmp.profile_uint64,
+                         __ATOMIC_RELAXED);
+}
+
 /*!
  *****************************************************************************
  *
@@ -347,9 +487,8 @@ static void __dircache_invalidate_for_file(const char *path)
                 printd(1, "__dircache_invalidate_for_file: strdup failed\n");
                 return;
         }
-        pthread_rwlock_wrlock(&dir_access_lock);
-        dircache_invalidate(__gnu_dirname(safe_path));
-        pthread_rwlock_unlock(&dir_access_lock);
+        dircache_invalidate_tree(__gnu_dirname(safe_path));
+        negcache_invalidate(safe_path);
         free(safe_path);
 }
 
@@ -359,9 +498,14 @@ static void __dircache_invalidate_for_file(const char *path)
  ****************************************************************************/
 static void __dircache_invalidate(const char *path)
 {
-        pthread_rwlock_wrlock(&dir_access_lock);
-        dircache_invalidate(path);
-        pthread_rwlock_unlock(&dir_access_lock);
+        if (path) {
+                dircache_invalidate_tree(path);
+        } else {
+                shlock_wrlock(&dir_access_lock);
+                dircache_invalidate(NULL);
+                shlock_unlock(&dir_access_lock);
+        }
+        negcache_invalidate(path);
 }
 
 /*!
@@ -373,23 +517,27 @@ __attribute__((visibility("hidden")))
 #endif
 void __handle_sigusr1()
 {
-        pthread_t t;
-
-        if (mount_type == MOUNT_FOLDER && rar2fs_mount_opts.warmup > 0) {
-                pthread_mutex_lock(&warmup_lock);
-                warmup_cancelled = 1;
-                while (warmup_threads)
-                        pthread_cond_wait(&warmup_cond, &warmup_lock);
-                pthread_mutex_unlock(&warmup_lock);
-                warmup_cancelled = 0;
-        }
+        warmup_stop();
         printd(3, "Invalidating path cache\n");
-        pthread_rwlock_wrlock(&file_access_lock);
+        shlock_wrlock(&file_access_lock);
         filecache_invalidate(NULL);
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock(&file_access_lock);
         __dircache_invalidate(NULL);
         if (mount_type == MOUNT_FOLDER && rar2fs_mount_opts.warmup > 0)
-                pthread_create(&t, NULL, warmup_task, NULL);
+                (void)warmup_start(OPT_STR(OPT_KEY_SRC, 0),
+                                   rar2fs_mount_opts.warmup, __warmup_visit);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __profile_reset(const char *path, struct filecache_entry *e,
+                void *arg)
+{
+        (void)path;             /* touch */
+        (void)arg;              /* touch */
+        __atomic_store_n(&e->profile_uint64, 0, __ATOMIC_RELAXED);
 }
 
 /*!
@@ -401,69 +549,93 @@ __attribute__((visibility("hidden")))
 #endif
 void __handle_sighup()
 {
+        /* Parked handles may hold passwords no longer configured */
+        keycache_flush();
         rarconfig_destroy();
         rarconfig_init(OPT_STR(OPT_KEY_SRC, 0),
                        OPT_STR(OPT_KEY_CONFIG, 0));
+        /* Entries cached since the path cache was invalidated may have
+         * looked up their profile in the old configuration */
+        shlock_wrlock(&file_access_lock);
+        filecache_foreach(__profile_reset, NULL);
+        shlock_unlock(&file_access_lock);
+}
+
+/*
+ * An UnRAR operation that runs past its deadline is interrupted by sending
+ * SIG_TIMEOUT to the thread running it. The handler does nothing and is
+ * installed without SA_RESTART, so a system call blocking in libunrar
+ * fails with EINTR and the operation returns an error.
+ */
+struct timeout_ctx {
+        pthread_t thread;
+        int expired;
+};
+
+static __thread volatile sig_atomic_t timeout_signalled;
+
+/*!
+ *****************************************************************************
+ * Called from the signal handler of SIG_TIMEOUT.
+ ****************************************************************************/
+void __handle_sigtimeout()
+{
+        timeout_signalled = 1;
 }
 
 /*!
  *****************************************************************************
- * Timeout alarm handler for UnRAR operations
+ * Timer callback for UnRAR operations, see __execute_with_timeout()
  ****************************************************************************/
-static void timeout_alarm_handler(int sig)
+static void __timeout_expired(void *arg)
 {
-        (void)sig;  /* touch */
-        operation_timed_out = 1;
+        struct timeout_ctx *tc = arg;
+
+        if (!pthread_kill(tc->thread, SIG_TIMEOUT))
+                __atomic_store_n(&tc->expired, 1, __ATOMIC_RELEASE);
 }
 
 /*!
  *****************************************************************************
  * Execute function with timeout protection
- * \param func Function to execute
+ * \param func Function to execute, returns 0 on success
  * \param arg Argument to pass to function
  * \param timeout_sec Timeout in seconds (0 = no timeout)
  * \param op_name Operation name for logging
- * \return Function result, or -ETIMEDOUT on timeout
+ * \return Function result, or -ETIMEDOUT if it failed after being
+ *         interrupted at the deadline
  ****************************************************************************/
 static int __execute_with_timeout(timeout_func_t func, void *arg,
                                    int timeout_sec, const char *op_name)
 {
-        struct sigaction sa, old_sa;
+        struct timer t;
+        struct timeout_ctx tc = {.thread = pthread_self()};
         int ret;
 
-        /* No timeout requested or timeout disabled */
-        if (timeout_sec <= 0) {
+        /* No timeout requested or timeout disabled. Also run untimed in
+         * forked children where there is no timer thread. */
+        timeout_signalled = 0;
+        if (timeout_sec <= 0 ||
+            timer_arm(&t, timeout_sec * 1000, __timeout_expired, &tc)) {
                 (void)op_name;  /* Suppress unused parameter warning when no timeout */
                 return func(arg);
         }
 
-        /* Setup alarm handler */
-        memset(&sa, 0, sizeof(sa));
-        sa.sa_handler = timeout_alarm_handler;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = 0;
-
-        pthread_mutex_lock(&timeout_mutex);
-        operation_timed_out = 0;
-        sigaction(SIGALRM, &sa, &old_sa);
-        alarm(timeout_sec);
-        pthread_mutex_unlock(&timeout_mutex);
-
-        /* Execute function without holding mutex */
         ret = func(arg);
 
-        /* Clean up - re-acquire mutex */
-        pthread_mutex_lock(&timeout_mutex);
-        alarm(0);
-        sigaction(SIGALRM, &old_sa, NULL);
-
-        if (operation_timed_out) {
-                printd(1, "Operation timeout: %s (exceeded %ds)\n",
-                       op_name, timeout_sec);
-                ret = -ETIMEDOUT;
+        timer_cancel(&t);
+        if (__atomic_load_n(&tc.expired, __ATOMIC_ACQUIRE)) {
+                /* Make sure the signal is not left pending to interrupt
+                 * some unrelated system call later on */
+                while (!timeout_signalled)
+                        sched_yield();
+                /* The operation may have completed just in time */
+                if (ret) {
+                        printd(1, "Operation timeout: %s (exceeded %ds)\n",
+                               op_name, timeout_sec);
+                        ret = -ETIMEDOUT;
+                }
         }
-
-        pthread_mutex_unlock(&timeout_mutex);
         return ret;
 }
 
@@ -474,10 +646,27 @@ static int __execute_with_timeout(timeout_func_t func, void *arg,
 static int __rar_open_wrapper(void *arg)
 {
         struct rar_open_args *args = arg;
-        args->result = RAROpenArchiveEx(args->arc);
+        args->result = keycache_open(args->arc);
         return args->arc->OpenResult;
 }
 
+/*!
+ *****************************************************************************
+ * Open an archive with timeout protection. Any handle returned by an
+ * open that was interrupted is closed.
+ ****************************************************************************/
+static int __rar_open_timed(struct rar_open_args *args, int timeout_sec,
+                const char *op_name)
+{
+        int ret = __execute_with_timeout(__rar_open_wrapper, args,
+                                         timeout_sec, op_name);
+        if (ret == -ETIMEDOUT && args->result) {
+                keycache_close(args->result, args->arc);
+                args->result = NULL;
+        }
+        return ret;
+}
+
 /*!
  *****************************************************************************
  *
@@ -497,17 +686,150 @@ static int __wait_thread(struct io_context *op)
  ****************************************************************************/
 static int __wake_thread(struct io_context *op, int req)
 {
+        /* Already pending, no need to signal again */
+        if (req == RD_ASYNC_READ &&
+            __atomic_load_n(&op->rd_req, __ATOMIC_ACQUIRE) == RD_ASYNC_READ)
+                return 0;
         pthread_mutex_lock(&op->rd_req_mutex);
         if (req != RD_ASYNC_READ) {
                 while (op->rd_req) /* sync */
                         pthread_cond_wait(&op->rd_req_cond, &op->rd_req_mutex);
         }
-        op->rd_req = req;
+        __atomic_store_n(&op->rd_req, req, __ATOMIC_RELEASE);
         pthread_cond_signal(&op->rd_req_cond);
         pthread_mutex_unlock(&op->rd_req_mutex);
         return 0;
 }
 
+/*!
+ *****************************************************************************
+ * Capture data just written to the I/O buffer into the block cache. This
+ * must only be called by the producer side, ie. the reader thread, an
+ * extraction worker or lread_rar() while in control of either of them.
+ * Since nothing but the producer itself can overwrite the buffer the data
+ * from 'start' is guaranteed to still be intact.
+ ****************************************************************************/
+static void __blkcache_feed(struct io_context *op, off_t start, size_t size)
+{
+        if (!op->bc_key || !size || op->poisoned)
+                return;
+        if (!op->bc_buf) {
+                op->bc_buf = malloc(BLKCACHE_BLOCK_SZ);
+                if (!op->bc_buf)
+                        return;
+        }
+        while (size) {
+                size_t chunk = BLKCACHE_BLOCK_SZ - op->bc_fill;
+                chunk = chunk < size ? chunk : size;
+                iob_copy((char *)op->bc_buf + op->bc_fill, op->buf, chunk,
+                         start & (IOB_BUF_SZ(op->buf) - 1));
+                op->bc_fill += chunk;
+                start += chunk;
+                size -= chunk;
+                /* Flush complete blocks and the tail of the file */
+                if (op->bc_fill == BLKCACHE_BLOCK_SZ || start >= op->bc_size) {
+                        (void)blkcache_put(op->bc_key,
+                                           (start - 1) / BLKCACHE_BLOCK_SZ,
+                                           op->bc_buf, op->bc_fill);
+                        op->bc_fill = 0;
+                }
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Serve a read completely from the block cache, or not at all.
+ ****************************************************************************/
+static int __blkcache_read(struct io_context *op, char *buf, size_t size,
+                off_t offset)
+{
+        size_t tot = 0;
+
+        if (!op->bc_key)
+                return -ENOENT;
+        while (tot < size) {
+                ssize_t n = blkcache_get(op->bc_key,
+                                         offset / BLKCACHE_BLOCK_SZ,
+                                         buf + tot, size - tot,
+                                         offset % BLKCACHE_BLOCK_SZ);
+                if (n <= 0)
+                        return -ENOENT;
+                tot += n;
+                offset += n;
+        }
+        return tot;
+}
+
+/*!
+ *****************************************************************************
+ * Called by an in-process extraction worker for each chunk of data.
+ * Blocks until all of the chunk is written to the I/O buffer or the
+ * extraction is aborted.
+ ****************************************************************************/
+static int __inproc_push(struct io_context *op, const uint8_t *src,
+                size_t size)
+{
+        pthread_mutex_lock(&op->xtr_mutex);
+        while (size) {
+                if (op->xtr_state & XTR_TERM) {
+                        pthread_mutex_unlock(&op->xtr_mutex);
+                        return -1;
+                }
+                off_t start = op->buf->offset;
+                size_t n = iob_push(op->buf, src, size, IOB_SAVE_HIST);
+                if (n) {
+                        __blkcache_feed(op, start, n);
+                        src += n;
+                        size -= n;
+                        pthread_cond_broadcast(&op->xtr_cond);
+                        continue;
+                }
+                op->xtr_state |= XTR_WAIT;
+                pthread_cond_broadcast(&op->xtr_cond);
+                while ((op->xtr_state & (XTR_WAIT | XTR_TERM)) == XTR_WAIT)
+                        pthread_cond_wait(&op->xtr_cond, &op->xtr_mutex);
+        }
+        pthread_mutex_unlock(&op->xtr_mutex);
+        return 1;
+}
+
+/*!
+ *****************************************************************************
+ * Let the worker fill the I/O buffer until 'target' is reached, the
+ * buffer is full or extraction is done. Must be called with xtr_mutex held.
+ ****************************************************************************/
+static void __inproc_fill(struct io_context *op, off_t target)
+{
+        op->xtr_state &= ~XTR_WAIT;
+        pthread_cond_broadcast(&op->xtr_cond);
+        while (!(op->xtr_state & (XTR_WAIT | XTR_DONE)) &&
+               IOB_LOAD(op->buf->offset) < target)
+                pthread_cond_wait(&op->xtr_cond, &op->xtr_mutex);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __inproc_sync_read(struct io_context *op, off_t target)
+{
+        pthread_mutex_lock(&op->xtr_mutex);
+        __inproc_fill(op, target);
+        pthread_mutex_unlock(&op->xtr_mutex);
+}
+
+/*!
+ *****************************************************************************
+ * In-process counterpart of RD_ASYNC_READ, ie. space was made available.
+ ****************************************************************************/
+static void __inproc_kick(struct io_context *op)
+{
+        pthread_mutex_lock(&op->xtr_mutex);
+        op->xtr_state &= ~XTR_WAIT;
+        pthread_cond_broadcast(&op->xtr_cond);
+        pthread_mutex_unlock(&op->xtr_mutex);
+}
+
 /*!
  *****************************************************************************
  *
@@ -545,6 +867,7 @@ static inline int is_nnn_vol(const char *name)
 
 #define IS_AVI(s) (!strcasecmp((s)+(strlen(s)-4), ".avi"))
 #define IS_MKV(s) (!strcasecmp((s)+(strlen(s)-4), ".mkv"))
+#define IS_MP4(s) (!strcasecmp((s)+(strlen(s)-4), ".mp4"))
 #define IS_RAR(s) (!strcasecmp((s)+(strlen(s)-4), ".rar"))
 #define IS_CBR(s) (!OPT_SET(OPT_KEY_NO_EXPAND_CBR) && \
                         !strcasecmp((s)+(strlen(s)-4), ".cbr"))
@@ -635,11 +958,13 @@ static int is_rar_magic(const char *rar_path, const char *file_path)
 #define prop_type_ wchar
 #define prop_alloc_type_ wchar_t
 #define prop_memcpy_ wmemcpy
+#define prop_strlen_ wcslen
 static wchar_t *get_password(const char *file, wchar_t *buf, size_t len)
 #else
 #define prop_type_ char
 #define prop_alloc_type_ char
 #define prop_memcpy_ memcpy
+#define prop_strlen_ strlen
 static char *get_password(const char *file, char *buf, size_t len)
 #endif
 {
@@ -668,14 +993,16 @@ static char *get_password(const char *file, char *buf, size_t len)
         password = rarconfig_getprop(prop_type_, rar,
                                 RAR_PASSWORD_PROP);
         if (password) {
-                prop_memcpy_(buf, password, len);
+                size_t n = prop_strlen_(password) + 1;
+                prop_memcpy_(buf, password, n < len ? n : len);
                 free(tmp);
                 return buf;
         }
         password = rarconfig_getprop(prop_type_, basename(rar),
                                 RAR_PASSWORD_PROP);
         if (password) {
-                prop_memcpy_(buf, password, len);
+                size_t n = prop_strlen_(password) + 1;
+                prop_memcpy_(buf, password, n < len ? n : len);
                 free(tmp);
                 return buf;
         }
@@ -774,9 +1101,31 @@ static char *get_password(const char *file, char *buf, size_t len)
         return NULL;
 }
 
+/*!
+ *****************************************************************************
+ * Digest of the password configured for 'arch', or 0 if there is none.
+ * Lets the key cache tell handles opened using another password apart.
+ ****************************************************************************/
+static uint64_t __password_digest(const char *arch)
+{
+        prop_alloc_type_ buf[MAX_PASSWORD_LEN];
+        uint64_t digest = 0;
+
+        memset(buf, 0, sizeof(buf));
+        if (get_password(arch, buf, MAX_PASSWORD_LEN - 1)) {
+                digest = compute_content_hash(buf,
+                                prop_strlen_(buf) * sizeof(buf[0]));
+                if (!digest)
+                        digest = 1;
+        }
+        memset(buf, 0, sizeof(buf));
+        return digest;
+}
+
 #undef prop_type_
 #undef prop_alloc_type_
 #undef prop_memcpy_
+#undef prop_strlen_
 
 /*!
  *****************************************************************************
@@ -829,6 +1178,7 @@ static struct filecache_entry *path_lookup_miss(const char *path, struct stat *s
         char *root;
 
         printd(3, "MISS    %s\n", path);
+        METRICS_INC(METRICS_LOOKUP_MISS);
 
         if (fs_loop) {
                   if (!strcmp(path, fs_loop_mp_root)) {
@@ -840,6 +1190,9 @@ static struct filecache_entry *path_lookup_miss(const char *path, struct stat *s
                   }
         }
 
+        if (negcache_get(path))
+                return NULL;
+
         ABS_ROOT(root, path);
 
         /* Check if the missing file can be found on the local fs */
@@ -855,23 +1208,26 @@ static struct filecache_entry *path_lookup_miss(const char *path, struct stat *s
 
 /*!
  *****************************************************************************
- * This function must always be called with an aquired rdlock but never
- * a wrlock. It is however possible that the rdlock is promoted to a wrlock.
+ * This function must always be called with an aquired rdlock of the shard
+ * holding 'path' but never a wrlock. It is however possible that the rdlock
+ * is promoted to a wrlock.
  ****************************************************************************/
 static struct filecache_entry *path_lookup(const char *path, struct stat *stbuf)
 {
         struct filecache_entry *e_p = filecache_get(path);
         struct filecache_entry *e2_p = e_p;
         if (e_p && !e_p->flags.unresolved) {
+                METRICS_INC(METRICS_FILECACHE_HIT);
                 if (stbuf)
                         memcpy(stbuf, &e_p->stat, sizeof(struct stat));
                 return e_p;
         }
+        METRICS_INC(METRICS_FILECACHE_MISS);
         e_p = path_lookup_miss(path, stbuf);
         if (!e_p) {
                 if (e2_p && e2_p->flags.unresolved) {
-                        pthread_rwlock_unlock(&file_access_lock);
-                        pthread_rwlock_wrlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, path);
+                        shlock_wrlock_key(&file_access_lock, path);
                         e2_p->flags.unresolved = 0;
                         if (stbuf)
                                 memcpy(stbuf, &e2_p->stat, sizeof(struct stat));
@@ -917,27 +1273,20 @@ static int __stop_child(pid_t pid)
 
 /*!
  *****************************************************************************
- *
+ * The result of the extraction is passed back through a second pipe,
+ * returned in 'rfd', since the exit status of children is not available
+ * (see sighandler_init()). It is written before the data pipe is closed.
  ****************************************************************************/
-static FILE *popen_(struct filecache_entry *entry_p, pid_t *cpid)
+static FILE *popen_(struct filecache_entry *entry_p, pid_t *cpid, int *rfd)
 {
         int fd = -1;
-        int pfd[2] = {-1,};
+        int pfd[2] = {-1, -1};
+        int sfd[2] = {-1, -1};
 
         pid_t pid;
         int ret;
 
-        /* For folder mounts we need to perform an additional dummy
-         * extraction attempt to avoid feeding the file descriptor
-         * with garbage data in case of wrong password or CRC errors. */
-        if (!entry_p->flags.dry_run_done && mount_type == MOUNT_FOLDER) {
-                ret = extract_rar(entry_p->rar_p, entry_p->file_p, NULL);
-                if (ret && ret != ERAR_UNKNOWN)
-                        goto error;
-                entry_p->flags.dry_run_done = 1;
-        }
-
-        if (pipe(pfd) == -1) {
+        if (pipe(pfd) == -1 || pipe(sfd) == -1) {
                 perror("pipe");
                 goto error;
         }
@@ -945,10 +1294,14 @@ static FILE *popen_(struct filecache_entry *entry_p, pid_t *cpid)
         pid = fork();
         if (pid == 0) {
                 setpgid(getpid(), 0);
-                close(pfd[0]);  /* Close unused read end */
+                close(pfd[0]);  /* Close unused read ends */
+                close(sfd[0]);
                 ret = extract_rar(entry_p->rar_p, entry_p->file_p,
                                   (void *)(uintptr_t)pfd[1]);
+                if (write(sfd[1], &ret, sizeof(ret)) == -1)
+                        perror("popen_: write");
                 close(pfd[1]);
+                close(sfd[1]);
                 _exit(ret);
         } else if (pid < 0) {
                 /* The fork failed. */
@@ -956,8 +1309,10 @@ static FILE *popen_(struct filecache_entry *entry_p, pid_t *cpid)
         }
 
         /* This is the parent process. */
-        close(pfd[1]);          /* Close unused write end */
+        close(pfd[1]);          /* Close unused write ends */
+        close(sfd[1]);
         *cpid = pid;
+        *rfd = sfd[0];
         return fdopen(pfd[0], "r");
 
 error:
@@ -967,6 +1322,10 @@ error:
                 close(pfd[0]);
         if (pfd[1] >= 0)
                 close(pfd[1]);
+        if (sfd[0] >= 0)
+                close(sfd[0]);
+        if (sfd[1] >= 0)
+                close(sfd[1]);
 
         return NULL;
 }
@@ -981,6 +1340,179 @@ static int pclose_(FILE *fp, pid_t pid)
         return __stop_child(pid);
 }
 
+/*!
+ *****************************************************************************
+ * In-process alternative to popen_(). The file is extracted by a worker
+ * from the extraction pool directly into the I/O buffer of 'op'.
+ * Returns -EBUSY if there is no idle worker, in which case the caller
+ * is expected to fall back to popen_().
+ ****************************************************************************/
+static int ipopen_(struct filecache_entry *entry_p, struct io_context *op)
+{
+        struct extract_job *job;
+        int ret;
+
+        if (!extract_pool)
+                return -ENOSYS;
+
+        job = malloc(sizeof(struct extract_job));
+        if (!job)
+                return -ENOMEM;
+        job->op = op;
+        job->rar_p = strdup(entry_p->rar_p);
+        job->file_p = strdup(entry_p->file_p);
+        if (!job->rar_p || !job->file_p) {
+                ret = -ENOMEM;
+                goto error;
+        }
+
+        pthread_mutex_init(&op->xtr_mutex, NULL);
+        pthread_cond_init(&op->xtr_cond, NULL);
+        op->xtr_state = 0;
+        op->inproc = 1;
+        ret = threadpool_trysubmit(extract_pool, extract_task, job);
+        if (!ret)
+                return 0;
+
+        op->inproc = 0;
+        pthread_cond_destroy(&op->xtr_cond);
+        pthread_mutex_destroy(&op->xtr_mutex);
+
+error:
+        free(job->rar_p);
+        free(job->file_p);
+        free(job);
+        return ret;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void ipclose_(struct io_context *op)
+{
+        pthread_mutex_lock(&op->xtr_mutex);
+        op->xtr_state |= XTR_TERM;
+        pthread_cond_broadcast(&op->xtr_cond);
+        while (!(op->xtr_state & XTR_DONE))
+                pthread_cond_wait(&op->xtr_cond, &op->xtr_mutex);
+        pthread_mutex_unlock(&op->xtr_mutex);
+        pthread_cond_destroy(&op->xtr_cond);
+        pthread_mutex_destroy(&op->xtr_mutex);
+        op->inproc = 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__stream_alloc()
+{
+        return calloc(1, sizeof(struct io_context *));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __stream_free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ * Look up an active decompression stream for 'path' and attach 'io' to it.
+ * A new reader starts at offset 0 and can thus only attach as long as the
+ * start of the file is still within the I/O buffer history, and not once
+ * the extraction has finished or failed. The history window also defines
+ * how far readers may drift apart. A reader falling further behind will
+ * see the same -EIO as for any other backward seek beyond the history, and
+ * a reader jumping ahead of it fails instead, see __stream_strands().
+ ****************************************************************************/
+static struct io_context *__stream_attach(const char *path,
+                struct io_handle *io)
+{
+        struct hash_table_entry *e;
+        struct io_context *op = NULL;
+
+        pthread_mutex_lock(&stream_lock);
+        if (stream_ht) {
+                e = hashtable_entry_get(stream_ht, path);
+                if (e) {
+                        struct io_context *s = *(struct io_context **)e->user_data;
+                        pthread_mutex_lock(&s->read_mutex);
+                        if (!s->poisoned && !__stream_finished(s) &&
+                            (size_t)s->pos <= IOB_BUF_HIST_SZ(s->buf) &&
+                            IOB_HIST_VALID(s->buf, 0)) {
+                                ++s->refs;
+                                io->pos = 0;
+                                io->next = s->handles;
+                                s->handles = io;
+                                op = s;
+                        }
+                        pthread_mutex_unlock(&s->read_mutex);
+                }
+        }
+        pthread_mutex_unlock(&stream_lock);
+        return op;
+}
+
+/*!
+ *****************************************************************************
+ * Make a freshly opened stream available to sub-sequent opens of 'path'.
+ ****************************************************************************/
+static void __stream_register(const char *path, struct io_context *op)
+{
+        struct hash_table_entry *e;
+
+        pthread_mutex_lock(&stream_lock);
+        if (stream_ht && !hashtable_entry_get(stream_ht, path)) {
+                op->stream_key = strdup(path);
+                if (op->stream_key) {
+                        e = hashtable_entry_alloc(stream_ht, path);
+                        if (e) {
+                                *(struct io_context **)e->user_data = op;
+                        } else {
+                                free(op->stream_key);
+                                op->stream_key = NULL;
+                        }
+                }
+        }
+        pthread_mutex_unlock(&stream_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Drop a reference to 'op'. Returns non-zero if this was the last
+ * reference, in which case the caller is responsible for the tear down.
+ ****************************************************************************/
+static int __stream_detach(struct io_context *op, struct io_handle *io)
+{
+        struct io_handle **p;
+        int last;
+
+        pthread_mutex_lock(&op->read_mutex);
+        for (p = &op->handles; *p; p = &(*p)->next) {
+                if (*p == io) {
+                        *p = io->next;
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&op->read_mutex);
+
+        pthread_mutex_lock(&stream_lock);
+        last = !--op->refs;
+        if (last && op->stream_key) {
+                hashtable_entry_delete(stream_ht, op->stream_key);
+                free(op->stream_key);
+                op->stream_key = NULL;
+        }
+        pthread_mutex_unlock(&stream_lock);
+        return last;
+}
+
 /* Size of file in first volume number in which it exists */
 #define VOL_FIRST_SZ (op->entry_p->vsize_first)
 
@@ -1177,7 +1709,7 @@ static int __RARVolNameToFirstName(char *arch, int vtype)
 
                 d.ArcName = (char *)arch;   /* Horrible cast! But hey... it is the API! */
                 d.UserData = (LPARAM)arch;
-                h = RAROpenArchiveEx(&d);
+                h = keycache_open(&d);
                 if (d.OpenResult) {
                         ret = -1;
                         goto out;
@@ -1195,13 +1727,14 @@ static int __RARVolNameToFirstName(char *arch, int vtype)
                         ret = -1;
                         goto out;
                 }
+                /* Keys are kept for the next volume to be tried */
+                keycache_close(h, &d);
+                h = NULL;
                 --vol;
                 int z;
                 int i;
                 for (z = 1, i = len - 1; i >= 0; i--, z *= 10)
                         arch[pos + i] = 48 + ((vol / z) % 10);
-
-                RARCloseArchive(h);
         }
 
         if (RARReadHeaderEx(h, &header))
@@ -1210,7 +1743,7 @@ static int __RARVolNameToFirstName(char *arch, int vtype)
 out:
         free(s_orig);
         if (h)
-                RARCloseArchive(h);
+                keycache_close(h, &d);
         return ret;
 }
 
@@ -1314,12 +1847,19 @@ static void check_atime(const char *path, struct filecache_entry *entry_p)
 {
         struct filecache_entry *e_p;
         struct timespec tp;
+        char *tmp;
+        char *dir;
 
         if (!OPT_SET(OPT_KEY_ATIME) && !OPT_SET(OPT_KEY_ATIME_RAR))
                 goto no_check_atime;
         if (clock_gettime(CLOCK_REALTIME, &tp))
                 goto no_check_atime;
-        pthread_rwlock_wrlock(&file_access_lock);
+        tmp = strdup(path);
+        if (!tmp)
+                goto no_check_atime;
+        /* update_atime() also updates the entry of the parent folder */
+        dir = __gnu_dirname(tmp);
+        shlock_wrlock_key2(&file_access_lock, path, dir);
         e_p = filecache_get(path);
         if (e_p) {
                 if (e_p->stat.st_atime <= e_p->stat.st_ctime &&
@@ -1329,7 +1869,8 @@ static void check_atime(const char *path, struct filecache_entry *entry_p)
                         entry_p->stat = e_p->stat;
                 }
         }
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key2(&file_access_lock, path, dir);
+        free(tmp);
 
 no_check_atime:
         entry_p->flags.check_atime = 0;
@@ -1371,128 +1912,335 @@ static void __get_vol_and_chunk_raw(struct io_context *op, off_t offset,
 
 /*!
  ****************************************************************************
- *
+ * Get path of volume 'vol' relative the first volume of the file.
  ****************************************************************************/
-static int lread_raw(char *buf, size_t size, off_t offset,
-                struct fuse_file_info *fi)
+static char *__raw_vol_name(struct io_context *op, int vol)
 {
-        FILE *fp = NULL;
-        ssize_t n = 0;
-        struct io_context *op = FH_TOCONTEXT(fi->fh);
-        size_t chunk;
-        int tot = 0;
-        int force_seek = 0;
+        if (op->entry_p->flags.multipart)
+                return get_vname(op->entry_p->vtype, op->entry_p->rar_p,
+                                 vol + op->entry_p->vno_base,
+                                 op->entry_p->vlen, op->entry_p->vpos);
+        return strdup(op->entry_p->rar_p);
+}
 
-        pthread_mutex_lock(&op->raw_read_mutex);
+/*!
+ ****************************************************************************
+ * The volume pool is shared by all files of an archive set, each of which
+ * may start in a different volume. Slots are therefore indexed by volume
+ * number within the set rather than relative the first volume of the file.
+ ****************************************************************************/
+static inline int __raw_vol_slot(struct io_context *op, int vol)
+{
+        if (op->entry_p->flags.multipart)
+                return vol + op->entry_p->vno_base;
+        return vol;
+}
 
-        op->seq++;
+/*!
+ ****************************************************************************
+ * Get descriptor of volume 'vol' relative the first volume of the file.
+ ****************************************************************************/
+static int __raw_vol_fd(struct io_context *op, int vol)
+{
+        int fd = volpool_fd(op->vp, __raw_vol_slot(op, vol));
+        char *tmp;
 
-        printd(3, "PID %05d calling %s(), seq = %d, offset=%" PRIu64 "\n",
-               getpid(), __func__, op->seq, offset);
+        if (fd >= 0)
+                return fd;
+        tmp = __raw_vol_name(op, vol);
+        if (!tmp)
+                return -EINVAL;
+        printd(3, "Opening %s\n", tmp);
+        fd = volpool_open(op->vp, __raw_vol_slot(op, vol), tmp);
+        if (fd < 0)
+                printd(1, "open: %s: %s\n", tmp, strerror(-fd));
+        free(tmp);
+        return fd;
+}
 
-        /*
-         * Handle the case when a user tries to read outside file size.
-         * This is especially important to handle here since last file in a
-         * volume usually is of much less size than the others and conseqently
-         * the chunk based calculation will not detect this.
-         */
+#define RAW_READAHEAD_DEFAULT 8         /* MiB */
+#define RAW_MAX_BATCH 4
+#define RAW_PREFETCH_BLOCK (256 * 1024)
+#define PREFETCH_THREADS 2
+
+struct raw_prefetch_job {
+        struct volpool *vp;
+        int slot;               /* see __raw_vol_slot() */
+        char *path;
+        off_t offset;
+        size_t len;
+};
+
+/*!
+ ****************************************************************************
+ * With io_uring the start of the volume is read through the ring, which
+ * also pulls it into the page cache where the kernel ignores the advice,
+ * e.g. for some network file systems.
+ ****************************************************************************/
+static void __raw_prefetch_read(struct raw_prefetch_job *job, int fd)
+{
+        struct uring_io io[RAW_MAX_BATCH];
+        off_t offset = job->offset;
+        size_t len = job->len;
+        char *buf;
+        int cnt;
+
+        buf = malloc(RAW_PREFETCH_BLOCK);
+        if (!buf)
+                return;
+        while (len) {
+                for (cnt = 0; cnt < RAW_MAX_BATCH && len; cnt++) {
+                        size_t chunk = len < RAW_PREFETCH_BLOCK ?
+                                len : RAW_PREFETCH_BLOCK;
+                        io[cnt].fd = fd;
+                        io[cnt].slot = volpool_slot(job->vp, job->slot);
+                        /* Data is thrown away, all may share one buffer */
+                        io[cnt].buf = buf;
+                        io[cnt].len = chunk;
+                        io[cnt].offset = offset;
+                        offset += chunk;
+                        len -= chunk;
+                }
+                uring_read(io, cnt);
+                if (io[cnt - 1].res != (ssize_t)io[cnt - 1].len)
+                        break;
+        }
+        free(buf);
+}
+
+/*!
+ ****************************************************************************
+ *
+ ****************************************************************************/
+static void __raw_prefetch_task(void *arg)
+{
+        struct raw_prefetch_job *job = arg;
+        int fd = volpool_fd(job->vp, job->slot);
+
+        if (fd < 0) {
+                printd(3, "Prefetching %s\n", job->path);
+                fd = volpool_open(job->vp, job->slot, job->path);
+                if (fd >= 0)
+                        METRICS_INC(METRICS_RAW_PREFETCH);
+        }
+        if (fd >= 0 && uring_enabled()) {
+                __raw_prefetch_read(job, fd);
+        } else if (fd >= 0) {
+#ifdef HAVE_POSIX_FADVISE
+                (void)posix_fadvise(fd, job->offset, job->len,
+                                    POSIX_FADV_WILLNEED);
+#endif
+        }
+        volpool_put(job->vp);
+        free(job->path);
+        free(job);
+}
+
+/*!
+ ****************************************************************************
+ * Open volume 'vol' in the background and advise the kernel about the
+ * first part of the file data in it, starting at file offset 'offset'.
+ ****************************************************************************/
+static void __raw_prefetch(struct io_context *op, int vol, off_t offset)
+{
+        struct raw_prefetch_job *job;
+        size_t chunk;
+
+        if (!prefetch_pool)
+                return;
+        job = malloc(sizeof(struct raw_prefetch_job));
+        if (!job)
+                return;
+        __get_vol_and_chunk_raw(op, offset, &vol, &chunk);
+        job->path = __raw_vol_name(op, vol);
+        if (!job->path) {
+                free(job);
+                return;
+        }
+        job->slot = __raw_vol_slot(op, vol);
+        job->offset = VOL_REAL_SZ(vol) - chunk;
+        job->len = chunk < op->ra_win ? chunk : op->ra_win;
+        job->vp = volpool_dup(op->vp);
+        if (threadpool_trysubmit(prefetch_pool, __raw_prefetch_task, job)) {
+                volpool_put(job->vp);
+                free(job->path);
+                free(job);
+        }
+}
+
+/*!
+ ****************************************************************************
+ * Sequential readers get the data following the current read advised to
+ * the kernel, 'op->ra_win' bytes at a time. When getting close to the
+ * end of a volume the next one is opened in the background so that the
+ * read crossing the volume boundary does not have to wait for it.
+ * 'src_end' is the position following the last read in volume 'vol' and
+ * 'left' the number of bytes of file data remaining in it.
+ * This is a heuristic only, concurrent reads on the same handle may at
+ * worst result in a redundant or a missing hint.
+ ****************************************************************************/
+static void __raw_readahead(struct io_context *op, int fd, int vol,
+                            off_t src_end, size_t left, off_t offset)
+{
+        if (!op->ra_win || op->ra_seq < 2)
+                return;
+
+        if (vol != op->ra_vol) {
+                op->ra_vol = vol;
+                op->ra_end = 0;
+        }
+        if (op->ra_end < src_end + (off_t)(op->ra_win / 2)) {
+                off_t start = op->ra_end > src_end ? op->ra_end : src_end;
+                off_t end = src_end + left;
+                if (end > start + (off_t)op->ra_win)
+                        end = start + op->ra_win;
+                if (end > start) {
+#ifdef HAVE_POSIX_FADVISE
+                        (void)posix_fadvise(fd, start, end - start,
+                                            POSIX_FADV_WILLNEED);
+#else
+                        (void)fd;
+#endif
+                        op->ra_end = end;
+                }
+        }
+
+        if (op->entry_p->flags.multipart && left < op->ra_win &&
+                        vol >= op->ra_vol_next &&
+                        offset + (off_t)left < op->entry_p->stat.st_size) {
+                op->ra_vol_next = vol + 1;
+                __raw_prefetch(op, vol + 1, offset + left);
+        }
+}
+
+/*!
+ ****************************************************************************
+ * Track whether the reads of 'op' are sequential, see __raw_readahead().
+ * Shared by lread_raw() and lread_raw_buf().
+ ****************************************************************************/
+static void __raw_ra_track(struct io_context *op, off_t offset, size_t size)
+{
+        /* Reads issued by kernel readahead may arrive slightly out of order */
+        if (offset >= op->ra_next - (off_t)op->ra_win &&
+                        offset <= op->ra_next + (off_t)op->ra_win) {
+                if (op->ra_seq < INT_MAX)
+                        op->ra_seq++;
+                if ((off_t)(offset + size) > op->ra_next)
+                        op->ra_next = offset + size;
+        } else {
+                op->ra_seq = 0;
+                op->ra_next = offset + size;
+        }
+}
+
+/*!
+ ****************************************************************************
+ * Volume descriptors are shared and only ever used for positional I/O so
+ * there is no need to serialize readers, not even on the same handle.
+ ****************************************************************************/
+static int lread_raw(char *buf, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+        ssize_t n = 0;
+        struct io_context *op = FH_TOCONTEXT(fi->fh);
+        size_t chunk;
+        int tot = 0;
+
+        printd(3, "PID %05d calling %s(), size=%zu, offset=%" PRIu64 "\n",
+               getpid(), __func__, size, offset);
+
+        /*
+         * Handle the case when a user tries to read outside file size.
+         * This is especially important to handle here since last file in a
+         * volume usually is of much less size than the others and conseqently
+         * the chunk based calculation will not detect this.
+         */
         if ((off_t)(offset + size) >= op->entry_p->stat.st_size) {
-                if (offset > op->entry_p->stat.st_size) {
-                        pthread_mutex_unlock(&op->raw_read_mutex);
+                if (offset > op->entry_p->stat.st_size)
                         return 0;       /* EOF */
-                }
                 size = op->entry_p->stat.st_size - offset;
         }
 
         if (op->entry_p->flags.check_atime)
                 check_atime(FH_TOPATH(fi->fh), op->entry_p);
 
-        if (!op->entry_p->flags.vsize_resolved) {
-                pthread_mutex_unlock(&op->raw_read_mutex);
+        if (!op->entry_p->flags.vsize_resolved)
                 return -EIO;
-        }
 
-        while (size) {
-                off_t src_off = 0;
-                struct volume_handle *vh = NULL;
-                if (op->entry_p->flags.multipart) {
-                        int vol;
+        __raw_ra_track(op, offset, size);
 
-                        __get_vol_and_chunk_raw(op, offset, &vol, &chunk);
-
-                        /* keep current open file */
-                        if (vol != op->vno) {
-                                /* close/open */
-                                op->vno = vol;
-                                char *tmp =
-                                    get_vname(op->entry_p->vtype,
-                                                op->entry_p->rar_p,
-                                                op->vno + op->entry_p->vno_base,
-                                                op->entry_p->vlen,
-                                                op->entry_p->vpos);
-                                if (tmp) {
-                                        printd(3, "Opening %s\n", tmp);
-                                        fp = fopen(tmp, "r");
-                                        free(tmp);
-                                        if (fp == NULL) {
-                                                perror("open");
-                                                goto read_error;
-                                        }
-                                        fclose(op->fp);
-                                        op->fp = fp;
-                                        force_seek = 1;
-                                } else {
-                                        pthread_mutex_unlock(&op->raw_read_mutex);
-                                        return -EINVAL;
-                                }
-                        } else {
-                                fp = op->fp;
-                        }
+        while (size) {
+                struct uring_io io[RAW_MAX_BATCH];
+                size_t left[RAW_MAX_BATCH];
+                int vol[RAW_MAX_BATCH];
+                size_t queued = 0;
+                int cnt;
+                int i;
 
-                        if (force_seek || offset != op->pos) {
-                                src_off = VOL_REAL_SZ(vol) - chunk;
-                                printd(3, "SEEK src_off = %" PRIu64 ", "
+                /* Queue the part of the read found in each volume so that
+                 * reads crossing volume boundaries are issued together. */
+                for (cnt = 0; cnt < RAW_MAX_BATCH && queued < size; cnt++) {
+                        off_t pos = offset + queued;
+                        size_t rem = size - queued;
+                        off_t src_off;
+                        int fd;
+
+                        vol[cnt] = 0;
+                        if (op->entry_p->flags.multipart) {
+                                __get_vol_and_chunk_raw(op, pos, &vol[cnt],
+                                                        &chunk);
+                                left[cnt] = chunk;
+                                src_off = VOL_REAL_SZ(vol[cnt]) - chunk;
+                                printd(3, "src_off = %" PRIu64 ", "
                                                 "VOL_REAL_SZ = %" PRIu64 "\n",
-                                                src_off, VOL_REAL_SZ(vol));
-                                if (fseeko(fp, src_off, SEEK_SET))
-                                        goto read_error;
-                                force_seek = 0;
+                                                src_off, VOL_REAL_SZ(vol[cnt]));
+                                printd(3, "size = %zu, chunk = %zu\n", rem,
+                                                chunk);
+                                chunk = rem < chunk ? rem : chunk;
+                        } else {
+                                chunk = rem;
+                                src_off = pos + op->entry_p->offset;
+                                left[cnt] = op->entry_p->stat.st_size - pos;
                         }
-                        printd(3, "size = %zu, chunk = %zu\n", size, chunk);
-                        chunk = size < chunk ? size : chunk;
-                } else {
-                        fp = op->fp;
-                        chunk = size;
-                        if (!offset || offset != op->pos) {
-                                src_off = offset + op->entry_p->offset;
-                                printd(3, "SEEK src_off = %" PRIu64 "\n", src_off);
-                                if (fseeko(fp, src_off, SEEK_SET))
-                                        goto read_error;
+                        fd = __raw_vol_fd(op, vol[cnt]);
+                        if (fd < 0) {
+                                /* Deal with it once preceding parts are done */
+                                if (cnt)
+                                        break;
+                                if (fd == -EINVAL)
+                                        return -EINVAL;
+                                goto read_error;
                         }
+                        io[cnt].fd = fd;
+                        io[cnt].slot = volpool_slot(op->vp,
+                                        __raw_vol_slot(op, vol[cnt]));
+                        io[cnt].buf = buf + queued;
+                        io[cnt].len = chunk;
+                        io[cnt].offset = src_off;
+                        queued += chunk;
+                }
+                uring_read(io, cnt);
+
+                for (i = 0; i < cnt; i++) {
+                        n = io[i].res;
+                        if (n < 0)
+                                goto read_error;
+                        printd(3, "Read %zd bytes from vol=%d, base=%d\n", n,
+                               vol[i], op->entry_p->vno_base);
+                        size -= n;
+                        offset += n;
+                        buf += n;
+                        tot += n;
+                        __raw_readahead(op, io[i].fd, vol[i],
+                                        io[i].offset + n, left[i] - n, offset);
+                        /* Short read, whatever follows is not contiguous */
+                        if (n != (ssize_t)io[i].len)
+                                return tot;
                 }
-                n = fread(buf, 1, chunk, fp);
-                if (ferror(fp))
-                        goto read_error;
-                printd(3, "Read %zu bytes from vol=%d, base=%d\n", n, op->vno,
-                       op->entry_p->vno_base);
-                if (n != (ssize_t)chunk)
-                        size = n;
-
-                size -= n;
-                offset += n;
-                buf += n;
-                tot += n;
-                op->pos = offset;
-                if (vh)
-                        vh->pos += n;
         }
-        pthread_mutex_unlock(&op->raw_read_mutex);
         return tot;
 
 read_error:
-        if (fp)
-                clearerr(fp);
-        pthread_mutex_unlock(&op->raw_read_mutex);
         memset(buf, 0, size);
         return tot + size;
 }
@@ -1537,6 +2285,177 @@ static int sync_thread_noread(struct io_context* op)
         return 0;
 }
 
+/*!
+ *****************************************************************************
+ * The below must be called with the reader thread (or extraction worker)
+ * under control by the caller, see sync_thread_noread().
+ ****************************************************************************/
+static int __stream_eof(struct io_context *op)
+{
+        if (op->inproc)
+                return op->xtr_state & XTR_DONE;
+        return feof(op->fp);
+}
+
+static void __iob_fill(struct io_context *op)
+{
+        off_t start = op->buf->offset;
+        size_t n = iob_write(op->buf, op->fp, IOB_SAVE_HIST);
+        __blkcache_feed(op, start, n);
+}
+
+static void __stream_fill(struct io_context *op, off_t target)
+{
+        if (op->inproc)
+                __inproc_fill(op, target);
+        else
+                __iob_fill(op);
+}
+
+#define STREAM_RESULT_WAIT 5000 /* ms */
+
+/*!
+ *****************************************************************************
+ * Returns the result of the extraction feeding 'op', or 0 if it succeeded
+ * or has not finished yet. If 'wait' is set, the extraction is given some
+ * time to finish, which is only sensible once all data has been produced.
+ ****************************************************************************/
+static int __stream_result(struct io_context *op, int wait)
+{
+        int res = 0;
+
+        if (op->inproc) {
+                pthread_mutex_lock(&op->xtr_mutex);
+                /* A worker blocked on a full buffer produced too much */
+                while (wait && !(op->xtr_state & (XTR_DONE | XTR_WAIT)))
+                        pthread_cond_wait(&op->xtr_cond, &op->xtr_mutex);
+                if (op->xtr_state & XTR_DONE)
+                        res = op->xtr_res;
+                pthread_mutex_unlock(&op->xtr_mutex);
+                return res;
+        }
+        if (op->xtr_fd != -1) {
+                struct pollfd pfd = {.fd = op->xtr_fd, .events = POLLIN};
+                if (poll(&pfd, 1, wait ? STREAM_RESULT_WAIT : 0) <= 0)
+                        return 0;
+                /* Nothing to read means the child died prematurely */
+                if (read(op->xtr_fd, &op->xtr_res, sizeof(op->xtr_res)) !=
+                                sizeof(op->xtr_res))
+                        op->xtr_res = ERAR_UNKNOWN;
+                close(op->xtr_fd);
+                op->xtr_fd = -1;
+                op->xtr_done = 1;
+        }
+        return op->xtr_res;
+}
+
+/*!
+ *****************************************************************************
+ * Returns non-zero once the extraction feeding 'op' has finished, whether
+ * it succeeded or not. Must be called with op->read_mutex held.
+ ****************************************************************************/
+static int __stream_finished(struct io_context *op)
+{
+        int done;
+
+        if (op->inproc) {
+                pthread_mutex_lock(&op->xtr_mutex);
+                done = op->xtr_state & XTR_DONE;
+                pthread_mutex_unlock(&op->xtr_mutex);
+                return done;
+        }
+        return __stream_result(op, 0) || op->xtr_done;
+}
+
+/*!
+ *****************************************************************************
+ * Block cache key of an archived file. The archive and file paths are
+ * hashed to keep the key short enough to never be truncated. Size and
+ * modification time of the archive are part of the key so that blocks
+ * of an archive replaced in place are never served again.
+ ****************************************************************************/
+static char *__block_cache_key(const struct filecache_entry *entry_p)
+{
+        struct stat st;
+        uint64_t hash;
+        size_t len;
+        char *path;
+        char *key;
+        long nsec = 0;
+
+        if (stat(entry_p->rar_p, &st))
+                return NULL;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+        nsec = st.st_mtim.tv_nsec;
+#endif
+        /* Length prefix keeps the hashed path unambiguous */
+        len = strlen(entry_p->rar_p) + strlen(entry_p->file_p) + 24;
+        path = malloc(len);
+        if (!path)
+                return NULL;
+        len = snprintf(path, len, "%zu:%s:%s", strlen(entry_p->rar_p),
+                       entry_p->rar_p, entry_p->file_p);
+        hash = compute_content_hash(path, len);
+        free(path);
+
+        key = malloc(80);
+        if (key)
+                snprintf(key, 80, "%016" PRIx64 ":%" PRIx64 ":%lld.%09ld",
+                         hash, (uint64_t)st.st_size,
+                         (long long)st.st_mtime, nsec);
+        return key;
+}
+
+/*!
+ *****************************************************************************
+ * Returns non-zero if moving the stream of 'io' forward to 'offset' would
+ * leave another handle attached to it behind the buffer history. Readers
+ * left behind are served by the block cache if there is one. Must be
+ * called with op->read_mutex held.
+ ****************************************************************************/
+static int __stream_strands(struct io_context *op, struct io_handle *io,
+                off_t offset)
+{
+        const off_t hist = IOB_BUF_HIST_SZ(op->buf);
+        struct io_handle *h;
+
+        if (op->bc_key)
+                return 0;
+        for (h = op->handles; h; h = h->next) {
+                if (h == io || h->pos >= offset)
+                        continue;
+                /* Already out of reach, nothing left to lose */
+                if (op->pos - h->pos > hist || !IOB_HIST_VALID(op->buf, h->pos))
+                        continue;
+                if (offset - h->pos > hist)
+                        return 1;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Fail all further reads of a stream whose extraction turned out to be
+ * broken. Data is served before the extraction is validated, so whatever
+ * was fed to the block cache so far is dropped as well. Otherwise later
+ * opens would be served the same data without an error.
+ ****************************************************************************/
+static void __stream_poison(struct io_context *op)
+{
+        /* Take control of reader thread or extraction worker */
+        if (op->inproc)
+                pthread_mutex_lock(&op->xtr_mutex);
+        else
+                (void)sync_thread_noread(op);
+        op->poisoned = 1;
+        if (op->bc_key)
+                blkcache_invalidate(op->bc_key,
+                                    (op->bc_size + BLKCACHE_BLOCK_SZ - 1) /
+                                    BLKCACHE_BLOCK_SZ);
+        if (op->inproc)
+                pthread_mutex_unlock(&op->xtr_mutex);
+}
+
 
 /*!
  *****************************************************************************
@@ -1545,35 +2464,60 @@ static int sync_thread_noread(struct io_context* op)
 static int lread_rar_idx(char *buf, size_t size, off_t offset,
                 struct io_context *op)
 {
+        struct idx_info *idx = &op->buf->idx;
+        struct idx_range *r = NULL;
+        uint32_t lo = 0;
+        uint32_t hi = idx->count;
+        uint64_t off;
         int res;
-        uint64_t o = ntoh64(op->buf->idx.data_p->head.offset);
-        uint64_t s = ntoh64(op->buf->idx.data_p->head.size);
-        off_t off = (offset - o);
 
-        if (off >= (off_t)s)
-                return -EIO;
+        while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if ((uint64_t)offset < idx->range[mid].offset) {
+                        hi = mid;
+                } else if ((uint64_t)offset >= idx->range[mid].offset +
+                                        idx->range[mid].size) {
+                        lo = mid + 1;
+                } else {
+                        r = &idx->range[mid];
+                        break;
+                }
+        }
+        if (!r)
+                return -ENOENT;
 
-        size = (off + size) > s
-                ? size - ((off + size) - s)
+        off = offset - r->offset;
+        size = (off + size) > r->size
+                ? r->size - off
                 : size;
         printd(3, "Copying %zu bytes from preloaded offset @ %" PRIu64 "\n",
                                                 size, offset);
-        if (op->buf->idx.mmap) {
-                memcpy(buf, op->buf->idx.data_p->bytes + off, size);
+        if (idx->mmap) {
+                memcpy(buf, (char *)idx->data_p + r->data + off, size);
                 return size;
         }
-        res = pread(op->buf->idx.fd, buf, size, off + sizeof(struct idx_head));
-        if (res == -1)
-                return -errno;
+        {
+                struct uring_io io = {
+                        .fd = idx->fd,
+                        .slot = -1,
+                        .buf = buf,
+                        .len = size,
+                        .offset = r->data + off,
+                };
+                uring_read(&io, 1);
+                if (io.res < 0)
+                        return io.res;
+                res = io.res;
+        }
         /* Detect and handle partial or zero reads */
         if (res == 0) {
                 printd(1, "pread: unexpected EOF at offset %" PRIu64 "\n",
-                       off + sizeof(struct idx_head));
+                       r->data + off);
                 return -EIO;
         }
         if (res > 0 && res < (ssize_t)size) {
-                printd(1, "pread: partial read %zd of %zu bytes at offset %" PRIu64 "\n",
-                       res, size, off + sizeof(struct idx_head));
+                printd(1, "pread: partial read %d of %zu bytes at offset %" PRIu64 "\n",
+                       res, size, r->data + off);
                 /* Return actual bytes read - caller should handle partial read */
         }
 /* This is a workaround for a misbehaving pread(2) on Cygwin (!?).
@@ -1653,26 +2597,62 @@ static void dump_buf(int seq, FILE *fp, char *buf, off_t offset, size_t size)
 }
 #endif
 
+/*!
+ *****************************************************************************
+ * Double the I/O buffer of a stream that has been read sequentially for
+ * twice its current size. Buffers only start out small when running under
+ * a memory budget, otherwise this is a no-op.
+ ****************************************************************************/
+static void __iob_adapt(struct io_context *op)
+{
+        struct iob *buf;
+
+        if (IOB_BUF_SZ(op->buf) >= op->iob_max ||
+            (op->pos - op->adapt_pos) < (off_t)(2 * IOB_BUF_SZ(op->buf)))
+                return;
+
+        /* Take control of reader thread or extraction worker */
+        if (op->inproc)
+                pthread_mutex_lock(&op->xtr_mutex);
+        else if (sync_thread_noread(op))
+                return;
+        buf = iob_grow(op->buf, op->iob_max);
+        if (buf) {
+                printd(3, "I/O buffer resized to %zu bytes\n",
+                       IOB_BUF_SZ(buf));
+                op->buf = buf;
+        }
+        op->adapt_pos = op->pos;
+        if (op->inproc)
+                pthread_mutex_unlock(&op->xtr_mutex);
+}
+
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-static int lread_rar(char *buf, size_t size, off_t offset,
+static int __lread_rar(char *buf, size_t size, off_t offset,
                 struct fuse_file_info *fi)
 {
         int n = 0;
+        struct io_handle *io = FH_TOIO(fi->fh);
         struct io_context* op = FH_TOCONTEXT(fi->fh);
+        const off_t start = offset;
 #ifdef DEBUG_READ
         char *buf_saved = buf;
         off_t offset_saved = offset;
 #endif
 
-        op->seq++;
+        io->seq++;
 
         printd(3,
                "PID %05d calling %s(), seq = %d, size=%zu, offset=%"
                PRIu64 "/%" PRIu64 "\n",
-               getpid(), __func__, op->seq, size, offset, op->pos);
+               getpid(), __func__, io->seq, size, offset, op->pos);
+
+        /* Data is served before the extraction is validated */
+        if (op->poisoned)
+                return -EIO;
 
         if ((off_t)(offset + size) >= op->entry_p->stat.st_size) {
                 size = offset < op->entry_p->stat.st_size
@@ -1685,24 +2665,42 @@ static int lread_rar(char *buf, size_t size, off_t offset,
         if (op->entry_p->flags.check_atime)
                 check_atime(FH_TOPATH(fi->fh), op->entry_p);
 
+        if (offset == op->pos)
+                __iob_adapt(op);
+
         /* Check for exception case */
         if (offset != op->pos) {
 check_idx:
-                if (op->buf->idx.data_p != MAP_FAILED &&
-                    offset >= (off_t)ntoh64(op->buf->idx.data_p->head.offset)) {
+                if (op->buf->idx.count) {
                         n = lread_rar_idx(buf, size, offset, op);
-                        goto out;
+                        /*
+                         * Index ranges may end anywhere in the file. A short
+                         * read would be taken as EOF, so the part following
+                         * the range is served by the next range or the
+                         * stream as any other read.
+                         */
+                        if (n > 0 && (size_t)n < size) {
+                                int res;
+                                io->seq--;
+                                res = __lread_rar(buf + n, size - n,
+                                                  offset + n, fi);
+                                n = res < 0 ? res : n + res;
+                        }
+                        if (n != -ENOENT)
+                                goto out;
+                        n = 0;
                 }
                 /* Check for backward read */
                 if (offset < op->pos) {
                         printd(3, "seq=%d    history access    offset=%" PRIu64
                                                 " size=%zu  op->pos=%" PRIu64
                                                 "  split=%d\n",
-                                                op->seq, offset, size,
+                                                io->seq, offset, size,
                                                 op->pos,
                                                 (offset + (off_t)size) > op->pos);
-                        if ((uint32_t)(op->pos - offset) <= IOB_HIST_SZ) {
-                                size_t pos = offset & (IOB_SZ-1);
+                        if ((uint32_t)(op->pos - offset) <= IOB_BUF_HIST_SZ(op->buf) &&
+                            IOB_HIST_VALID(op->buf, offset)) {
+                                size_t pos = offset & (IOB_BUF_SZ(op->buf) - 1);
                                 size_t chunk = (off_t)(offset + size) > op->pos
                                         ? (size_t)(op->pos - offset)
                                         : size;
@@ -1712,6 +2710,9 @@ check_idx:
                                 offset += tmp;
                                 n += tmp;
                         } else {
+                                n = __blkcache_read(op, buf, size, offset);
+                                if (n >= 0)
+                                        goto out;
                                 printd(1, "%s: Input/output error   offset=%" PRIu64
                                                         "  pos=%" PRIu64 "\n",
                                                         __func__,
@@ -1724,12 +2725,17 @@ check_idx:
                  * file is most likely a request for index information.
                  */
                 } else if ((((offset - op->pos) / (op->entry_p->stat.st_size * 1.0) * 100) > 95.0 &&
-                                op->seq < 10)) {
+                                io->seq < 10)) {
                         printd(3, "seq=%d    long jump hack1    offset=%" PRIu64 ","
                                                 " size=%zu, buf->offset=%" PRIu64 "\n",
-                                                op->seq, offset, size,
-                                                op->buf->offset);
-                        op->seq--;      /* pretend it never happened */
+                                                io->seq, offset, size,
+                                                IOB_LOAD(op->buf->offset));
+                        METRICS_INC(METRICS_LONG_JUMP);
+                        n = __blkcache_read(op, buf, size, offset);
+                        if (n >= 0)
+                                goto out;
+                        n = 0;
+                        io->seq--;      /* pretend it never happened */
 
                         /*
                          * If enabled, attempt to extract the index information
@@ -1741,27 +2747,29 @@ check_idx:
                          */
                         struct filecache_entry *e_p; /* "real" cache entry */
                         if (op->entry_p->flags.save_eof) {
-                                pthread_rwlock_wrlock(&file_access_lock);
+                                shlock_rdlock_key(&file_access_lock,
+                                                  FH_TOPATH(fi->fh));
                                 e_p = filecache_get(FH_TOPATH(fi->fh));
                                 if (e_p)
-                                        e_p->flags.save_eof = 0;
-                                pthread_rwlock_unlock(&file_access_lock);
+                                        FILECACHE_FLAG_CLR(e_p, save_eof);
+                                shlock_unlock_key(&file_access_lock,
+                                                  FH_TOPATH(fi->fh));
                                 op->entry_p->flags.save_eof = 0;
                                 if (!extract_index(FH_TOPATH(fi->fh),
                                                    op->entry_p,
                                                    offset)) {
                                         if (!preload_index(op->buf,
                                                            FH_TOPATH(fi->fh))) {
-                                                op->seq++;
+                                                io->seq++;
                                                 goto check_idx;
                                         }
                                 }
                         }
-                        pthread_rwlock_wrlock(&file_access_lock);
+                        shlock_rdlock_key(&file_access_lock, FH_TOPATH(fi->fh));
                         e_p = filecache_get(FH_TOPATH(fi->fh));
                         if (e_p)
-                                e_p->flags.direct_io = 1;
-                        pthread_rwlock_unlock(&file_access_lock);
+                                FILECACHE_FLAG_SET(e_p, direct_io);
+                        shlock_unlock_key(&file_access_lock, FH_TOPATH(fi->fh));
                         op->entry_p->flags.direct_io = 1;
                         memset(buf, 0, size);
                         n += size;
@@ -1774,20 +2782,32 @@ check_idx:
          * This should not be happening frequently. If it does it is an
          * indication that the I/O buffer is set too small.
          */
-        if ((off_t)(offset + size) > op->buf->offset) {
-                off_t offset_saved = op->buf->offset;
-                if (sync_thread_read(op))
+        if ((off_t)(offset + size) > IOB_LOAD(op->buf->offset)) {
+                off_t offset_saved = IOB_LOAD(op->buf->offset);
+                METRICS_INC(METRICS_BUFFER_STALL);
+                if (op->inproc)
+                        __inproc_sync_read(op, offset + size);
+                else if (sync_thread_read(op))
                         return -EIO;
                 /* If there is still no data assume something went wrong.
                  * I/O buffer might simply be full and cannot receive more
                  * data or otherwise most likely CRC errors or an invalid
                  * password in the case of encrypted archives.
                  */
-                if (op->buf->offset == offset_saved && !iob_full(op->buf))
+                if (IOB_LOAD(op->buf->offset) == offset_saved && !iob_full(op->buf) &&
+                    !(op->bc_key && offset >= IOB_LOAD(op->buf->offset))) {
+                        int res = __stream_result(op, 0);
+                        if (res) {
+                                printd(1, "%s: extraction failed (%d) at offset %"
+                                       PRIu64 "\n", __func__, res,
+                                       IOB_LOAD(op->buf->offset));
+                                __stream_poison(op);
+                        }
                         return -EIO;
+                }
         }
-        if ((off_t)(offset + size) > op->buf->offset) {
-                if (offset >= op->buf->offset) {
+        if ((off_t)(offset + size) > IOB_LOAD(op->buf->offset)) {
+                if (offset >= IOB_LOAD(op->buf->offset)) {
                         /*
                          * This is another hack! At this point an early read
                          * far beyond the current stream position is most
@@ -1798,20 +2818,31 @@ check_idx:
                          * direct I/O is forced from now on to not cause any
                          * fake data to propagate in sub-sequent reads.
                          * This case is very likely for multi-part AVI 2.0.
+                         * With the block cache enabled the jump is instead
+                         * served from the cache, or taken by decompressing
+                         * ahead since data passed is then not lost.
                          */
-                        if (op->seq < 25 && ((offset + size) - op->buf->offset)
-                                        > (IOB_SZ - IOB_HIST_SZ)) {
+                        if (op->bc_key) {
+                                n = __blkcache_read(op, buf, size, offset);
+                                if (n >= 0)
+                                        goto out;
+                                n = 0;
+                        } else if (io->seq < 25 && ((offset + size) - IOB_LOAD(op->buf->offset))
+                                        > (IOB_BUF_SZ(op->buf) - IOB_BUF_HIST_SZ(op->buf))) {
                                 struct filecache_entry *e_p; /* "real" cache entry */
                                 printd(3, "seq=%d    long jump hack2    offset=%" PRIu64 ","
                                                 " size=%zu, buf->offset=%" PRIu64 "\n",
-                                                op->seq, offset, size,
-                                                op->buf->offset);
-                                op->seq--;      /* pretend it never happened */
-                                pthread_rwlock_wrlock(&file_access_lock);
+                                                io->seq, offset, size,
+                                                IOB_LOAD(op->buf->offset));
+                                METRICS_INC(METRICS_LONG_JUMP);
+                                io->seq--;      /* pretend it never happened */
+                                shlock_rdlock_key(&file_access_lock,
+                                                  FH_TOPATH(fi->fh));
                                 e_p = filecache_get(FH_TOPATH(fi->fh));
                                 if (e_p)
-                                        e_p->flags.direct_io = 1;
-                                pthread_rwlock_unlock(&file_access_lock);
+                                        FILECACHE_FLAG_SET(e_p, direct_io);
+                                shlock_unlock_key(&file_access_lock,
+                                                  FH_TOPATH(fi->fh));
                                 op->entry_p->flags.direct_io = 1;
                                 memset(buf, 0, size);
                                 n += size;
@@ -1819,49 +2850,111 @@ check_idx:
                         }
                 }
 
-                /* Take control of reader thread */
-                if (sync_thread_noread(op))
+                /* One reader must not drag the others along */
+                if (op->refs > 1 && __stream_strands(op, io, offset)) {
+                        printd(3, "seq=%d    shared jump refused    offset=%"
+                                                PRIu64 ", pos=%" PRIu64 "\n",
+                                                io->seq, offset, op->pos);
+                        return -EIO;
+                }
+
+                /* Take control of reader thread or extraction worker */
+                if (op->inproc)
+                        pthread_mutex_lock(&op->xtr_mutex);
+                else if (sync_thread_noread(op))
                         return -EIO;
-                if (!feof(op->fp) && offset > op->buf->offset) {
-                        /* consume buffer */
-                        op->pos += op->buf->used;
-                        op->buf->ri = op->buf->wi;
-                        op->buf->used = 0;
-                        (void)iob_write(op->buf, op->fp, IOB_SAVE_HIST);
+                if (!__stream_eof(op) && offset > IOB_LOAD(op->buf->offset)) {
+                        /*
+                         * Consume buffer. Without the block cache this is
+                         * done only once, ie. the jump is limited to what
+                         * fits in the buffer.
+                         */
+                        off_t offset_prev;
+                        do {
+                                offset_prev = IOB_LOAD(op->buf->offset);
+                                op->pos += iob_used(op->buf);
+                                IOB_STORE(op->buf->ri, op->buf->wi);
+                                __stream_fill(op, offset + size);
+                        } while (op->bc_key && !__stream_eof(op) &&
+                                 offset > IOB_LOAD(op->buf->offset) &&
+                                 IOB_LOAD(op->buf->offset) != offset_prev);
                         sched_yield();
                 }
 
-                if (!feof(op->fp)) {
-                        op->buf->ri = offset & (IOB_SZ - 1);
-                        op->buf->used -= (offset - op->pos);
+                if (!__stream_eof(op)) {
+                        IOB_STORE(op->buf->ri, offset & (IOB_BUF_SZ(op->buf) - 1));
                         op->pos = offset;
 
                         /* Pull in rest of data if needed */
-                        if ((size_t)(op->buf->offset - offset) < size)
-                                (void)iob_write(op->buf, op->fp,
-                                                IOB_SAVE_HIST);
+                        if ((size_t)(IOB_LOAD(op->buf->offset) - offset) < size)
+                                __stream_fill(op, offset + size);
                 }
+                if (op->inproc)
+                        pthread_mutex_unlock(&op->xtr_mutex);
         }
 
         if (size) {
                 int off = offset - op->pos;
                 n += iob_read(buf, op->buf, size, off);
                 op->pos += (off + size);
-                if (__wake_thread(op, RD_ASYNC_READ))
+                /*
+                 * Errors detected only once all data is produced, typically
+                 * a CRC error, are reported by the read reaching the end of
+                 * the file rather than letting it look like a clean EOF.
+                 */
+                if ((off_t)(offset + size) >= op->entry_p->stat.st_size) {
+                        int res = __stream_result(op, 1);
+                        if (res) {
+                                printd(1, "%s: extraction failed (%d)\n",
+                                       __func__, res);
+                                __stream_poison(op);
+                                n = -EIO;
+                                goto out;
+                        }
+                }
+                /*
+                 * Only wake up the producer once there is a reasonable
+                 * amount of space to fill. Should the buffer run dry
+                 * before that, the synchronous path above takes over.
+                 */
+                if (iob_space(op->buf, IOB_SAVE_HIST) < IOB_WAKE_SZ(op->buf))
+                        goto out;
+                if (op->inproc)
+                        __inproc_kick(op);
+                else if (__wake_thread(op, RD_ASYNC_READ))
                         return -EIO;
         }
 
 out:
+        if (n > 0)
+                io->pos = start + n;
 
 #ifdef DEBUG_READ
         if (n > 0)
-                dump_buf(op->seq, op->dbg_fp, buf_saved, offset_saved, n);
+                dump_buf(io->seq, op->dbg_fp, buf_saved, offset_saved, n);
 #endif
 
         printd(3, "%s: RETURN %d\n", __func__, n);
         return n;
 }
 
+/*!
+ *****************************************************************************
+ * Reads are serialized per stream since it might be shared by several
+ * file handles.
+ ****************************************************************************/
+static int lread_rar(char *buf, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+        struct io_context *op = FH_TOCONTEXT(fi->fh);
+        int n;
+
+        pthread_mutex_lock(&op->read_mutex);
+        n = __lread_rar(buf, size, offset, fi);
+        pthread_mutex_unlock(&op->read_mutex);
+        return n;
+}
+
 /*!
  *****************************************************************************
  *
@@ -2020,6 +3113,40 @@ out:
         return first;
 }
 
+/*!
+ *****************************************************************************
+ * Collects the volume parts of multipart archive |arch| using the header-only
+ * scanner. This walks the block headers of all parts in parallel, on idle
+ * workers of the list pool, and avoids going through libunrar for each
+ * volume switch. Archives the scanner can not handle are reported as a
+ * failure and should be collected using libunrar.
+ *
+ * Returns 0 on success.
+ * Returns a negative ERAR_ error code in case of error.
+ ****************************************************************************/
+static int scan_volumes(const char *arch, unsigned int flags,
+                        struct dir_entry_list *list)
+{
+        struct RARVolumeDataEx *vols;
+        int format = IS_NNN(arch) ? 1 : VTYPE(flags);
+        int max_volumes = OPT_SET(OPT_KEY_MAX_VOLUME_COUNT) ?
+                          OPT_INT(OPT_KEY_MAX_VOLUME_COUNT, 0) : 1000;
+        int count;
+        int i;
+
+        int res = RARScanVolumesEx(arch, !format, max_volumes, &vols, &count,
+                                   NULL, NULL);
+        if (res != ERAR_SUCCESS) {
+                printd(3, "scan_volumes: %s: falling back to libunrar (%d)\n",
+                       arch, res);
+                return -res;
+        }
+        for (i = 0; i < count; i++)
+                (void)dir_entry_add(list, vols[i].ArcName, NULL, DIR_E_NRM);
+        RARFreeVolumesEx(&vols);
+        return 0;
+}
+
 /*!
  *****************************************************************************
  * Checks if archive file |arch| is part of a multipart archive.
@@ -2052,7 +3179,7 @@ static int collect_files(const char *arch)
         struct rar_open_args open_args = {.arc = &d};
         int timeout_sec = OPT_SET(OPT_KEY_OPERATION_TIMEOUT) ?
                           OPT_INT(OPT_KEY_OPERATION_TIMEOUT, 0) : 30;
-        if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+        if (__rar_open_timed(&open_args,
                                    timeout_sec, "collect_files:RAROpenArchiveEx") < 0) {
                 printd(1, "collect_files: archive open timed out: %s\n", arch);
                 free(arch_);
@@ -2063,7 +3190,7 @@ static int collect_files(const char *arch)
         /* Check for fault */
         if (d.OpenResult != ERAR_SUCCESS) {
                 if (h)
-                        RARCloseArchive(h);
+                        keycache_close(h, &d);
                 free(arch_);
                 return -d.OpenResult;
         }
@@ -2074,12 +3201,12 @@ static int collect_files(const char *arch)
                         free(arch_);
                         return -ERAR_EOPEN;
                 }
-                RARCloseArchive(h);
+                keycache_close(h, &d);
                 d.ArcName = (char *)arch_;
 
                 /* Wrap RAROpenArchiveEx with timeout */
                 open_args.arc = &d;
-                if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+                if (__rar_open_timed(&open_args,
                                            timeout_sec, "collect_files:RAROpenArchiveEx(vol)") < 0) {
                         printd(1, "collect_files: volume archive open timed out: %s\n", arch_);
                         free(arch_);
@@ -2090,7 +3217,7 @@ static int collect_files(const char *arch)
                 /* Check for fault */
                 if (d.OpenResult != ERAR_SUCCESS) {
                         if (h)
-                                RARCloseArchive(h);
+                                keycache_close(h, &d);
                         free(arch_);
                         return -d.OpenResult;
                 }
@@ -2106,7 +3233,7 @@ static int collect_files(const char *arch)
         }
         if (dll_result != ERAR_SUCCESS && dll_result != ERAR_END_ARCHIVE) {
                 RARFreeArchiveDataEx(&arc);
-                RARCloseArchive(h);
+                keycache_close(h, &d);
                 free(arch_);
                 return -dll_result;
         }
@@ -2119,7 +3246,7 @@ static int collect_files(const char *arch)
                 dll_result = extract_rar(arch_, arc->hdr.FileName, NULL);
                 if (dll_result != ERAR_SUCCESS && dll_result != ERAR_UNKNOWN) {
                         RARFreeArchiveDataEx(&arc);
-                        RARCloseArchive(h);
+                        keycache_close(h, &d);
                         free(arch_);
                         return -dll_result;
                 }
@@ -2127,16 +3254,19 @@ static int collect_files(const char *arch)
 
 skip_file_check:
         RARFreeArchiveDataEx(&arc);
-        RARCloseArchive(h);
+        keycache_close(h, &d);
 
         list = arch_list;
         dir_list_open(list);
 
-        /* Let libunrar deal with the collection of volume parts */
-        if (d.Flags & ROADF_VOLUME) {
+        if ((d.Flags & ROADF_VOLUME) && !(d.Flags & ROADF_ENCHEADERS) &&
+                        !scan_volumes(arch_, d.Flags, list)) {
+                dll_result = ERAR_SUCCESS;
+        } else if (d.Flags & ROADF_VOLUME) {
+                /* Let libunrar deal with the collection of volume parts */
                 /* Wrap RAROpenArchiveEx with timeout */
                 open_args.arc = &d;
-                if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+                if (__rar_open_timed(&open_args,
                                            timeout_sec, "collect_files:RAROpenArchiveEx(parts)") < 0) {
                         printd(1, "collect_files: volume parts open timed out\n");
                         free(arch_);
@@ -2147,7 +3277,7 @@ skip_file_check:
                 /* Check for fault */
                 if (d.OpenResult != ERAR_SUCCESS) {
                         if (h)
-                                RARCloseArchive(h);
+                                keycache_close(h, &d);
                         free(arch_);
                         return -d.OpenResult;
                 }
@@ -2178,10 +3308,10 @@ skip_file_check:
                                 dll_result = skip_res;
                                 break;
                         }
-                        list = dir_entry_add(list, header.ArcName, NULL,
-                                             DIR_E_NRM);
+                        (void)dir_entry_add(list, header.ArcName, NULL,
+                                            DIR_E_NRM);
                 }
-                RARCloseArchive(h);
+                keycache_close(h, &d);
         } else {
                 (void)dir_entry_add(list, arch_, NULL, DIR_E_NRM);
                 dll_result = ERAR_SUCCESS;
@@ -2352,8 +3482,8 @@ static int extract_index(const char *path, const struct filecache_entry *entry_p
                                 printd(1, "RARProcessFile test failed in index generation: %d\n", e);
                         }
                         if (!e) {
-                                head.offset = offset;
-                                head.size = eofd.size;
+                                head.offset = hton64(offset);
+                                head.size = hton64(eofd.size);
                                 lseek(eofd.fd, (off_t)0, SEEK_SET);
                                 /* Verify complete write of index header */
                                 ssize_t hdr_written = write(eofd.fd, (void*)&head,
@@ -2381,16 +3511,145 @@ index_error:
  ****************************************************************************
  *
  ****************************************************************************/
-static int CALLBACK extract_callback(UINT msg, LPARAM UserData,
+static int __has_index(const char *path)
+{
+        char *r2i;
+
+        ABS_ROOT(r2i, path);
+        strcpy(&r2i[strlen(r2i) - 3], "r2i");
+        return !access(r2i, F_OK);
+}
+
+/*!
+ ****************************************************************************
+ *
+ ****************************************************************************/
+static int CALLBACK idxgen_callback(UINT msg, LPARAM UserData,
                 LPARAM P1, LPARAM P2)
 {
-        struct extract_cb_arg *cb_arg = (struct extract_cb_arg *)(UserData);
+        struct idxgen_cb_arg *cb_arg = (struct idxgen_cb_arg *)(UserData);
 
-        if (msg == UCM_PROCESSDATA) {
+        if (msg == UCM_PROCESSDATA)
+                return idxgen_feed(cb_arg->g, (const void *)P1, P2) ? -1 : 1;
+        if (msg == UCM_CHANGEVOLUME)
+                return access((char *)P1, F_OK) == 0 ? 0 : -1;
+#if RARVER_MAJOR > 4 || ( RARVER_MAJOR == 4 && RARVER_MINOR >= 20 )
+        if (msg == UCM_NEEDPASSWORDW) {
+                if (P2 > MAX_PASSWORD_LEN)
+                        return -1;
+                if (!get_password(cb_arg->arch, (wchar_t *)P1, P2))
+                        return -1;
+        }
+#else
+        if (msg == UCM_NEEDPASSWORD) {
+                if (!get_password(cb_arg->arch, (char *)P1, P2))
+                        return -1;
+        }
+#endif
+
+        return 1;
+}
+
+/*!
+ ****************************************************************************
+ * Called by the index generator thread for every file queued by
+ * __idxgen_scan(). The file is decoded from start to end and its index
+ * written next to the archive, just like the one created by
+ * extract_index() on demand.
+ ****************************************************************************/
+static int __idxgen_build(const char *path)
+{
+        struct RAROpenArchiveDataEx d;
+        struct RARHeaderDataEx header;
+        struct idxgen_cb_arg cb_arg;
+        struct filecache_entry *entry_p = NULL;
+        struct filecache_entry *e_p;
+        HANDLE hdl;
+        char *r2i;
+        int res;
+
+        if (__has_index(path))
+                return -EEXIST;
+        ABS_ROOT(r2i, path);
+        strcpy(&r2i[strlen(r2i) - 3], "r2i");
+
+        shlock_rdlock_key(&file_access_lock, path);
+        e_p = filecache_get(path);
+        if (e_p && e_p != LOCAL_FS_ENTRY && !e_p->flags.raw &&
+            !e_p->nested_depth)
+                entry_p = filecache_clone(e_p);
+        shlock_unlock_key(&file_access_lock, path);
+        if (!entry_p)
+                return -ENOENT;
+
+        res = -ENOMEM;
+        cb_arg.arch = entry_p->rar_p;
+        cb_arg.g = idxgen_begin(entry_p->stat.st_size);
+        if (!cb_arg.g)
+                goto out;
+
+        memset(&d, 0, sizeof(RAROpenArchiveDataEx));
+        d.ArcName = entry_p->rar_p;
+        d.OpenMode = RAR_OM_EXTRACT;
+        d.Callback = idxgen_callback;
+        d.UserData = (LPARAM)&cb_arg;
+        hdl = RAROpenArchiveEx(&d);
+        if (!hdl || d.OpenResult) {
+                if (hdl)
+                        RARCloseArchive(hdl);
+                idxgen_abort(cb_arg.g);
+                res = -EIO;
+                goto out;
+        }
+
+        res = -ENOENT;
+        memset(&header, 0, sizeof(header));
+        header.CmtBufSize = 0;
+        while (!RARReadHeaderEx(hdl, &header)) {
+                if (!IS_RAR_DIR(&header) &&
+                    !strcmp(header.FileName, entry_p->file_p)) {
+                        if (RARProcessFile(hdl, RAR_TEST, NULL, NULL))
+                                res = -EIO;
+                        else
+                                res = 0;
+                        break;
+                }
+                if (RARProcessFile(hdl, RAR_SKIP, NULL, NULL)) {
+                        res = -EIO;
+                        break;
+                }
+        }
+        RARCloseArchive(hdl);
+
+        if (res)
+                idxgen_abort(cb_arg.g);
+        else
+                res = idxgen_commit(cb_arg.g, r2i);
+
+out:
+        filecache_freeclone(entry_p);
+        return res;
+}
+
+/*!
+ ****************************************************************************
+ *
+ ****************************************************************************/
+static int CALLBACK extract_callback(UINT msg, LPARAM UserData,
+                LPARAM P1, LPARAM P2)
+{
+        struct extract_cb_arg *cb_arg = (struct extract_cb_arg *)(UserData);
+
+        if (msg == UCM_PROCESSDATA) {
+                /* Sibling of the requested file in a solid archive */
+                if (cb_arg->sc) {
+                        solidcache_write(cb_arg->sc, (const void *)P1, P2);
+                        return 1;
+                }
                 /* Handle the special case when asking for a quick "dry run"
                  * to test archive integrity. If all is well this will result
                  * in an ERAR_UNKNOWN error. */
-                if (!cb_arg->arg) {
+                if (!cb_arg->arg && !cb_arg->op) {
                         if (!cb_arg->dry_run) {
                                 cb_arg->dry_run = 1;
                                 return 1;
@@ -2403,6 +3662,8 @@ static int CALLBACK extract_callback(UINT msg, LPARAM UserData,
                                (long)P2, (long)MAX_CHUNK_SIZE);
                         return -1;
                 }
+                if (cb_arg->op)
+                        return __inproc_push(cb_arg->op, (const uint8_t *)P1, P2);
                 /*
                  * We do not need to handle the case that not all data is
                  * written after return from write() since the pipe is not
@@ -2454,6 +3715,16 @@ static int CALLBACK extract_callback(UINT msg, LPARAM UserData,
  *
  ****************************************************************************/
 static int extract_rar(char *arch, const char *file, void *arg)
+{
+        return __extract_rar(arch, file, arg, NULL);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __extract_rar(char *arch, const char *file, void *arg,
+                struct io_context *op)
 {
         int ret = 0;
         struct RAROpenArchiveDataEx d;
@@ -2464,6 +3735,8 @@ static int extract_rar(char *arch, const char *file, void *arg)
         struct extract_cb_arg cb_arg;
         cb_arg.arch = arch;
         cb_arg.arg = arg;
+        cb_arg.op = op;
+        cb_arg.sc = NULL;
         cb_arg.dry_run = 0;
 
         d.Callback = extract_callback;
@@ -2475,7 +3748,7 @@ static int extract_rar(char *arch, const char *file, void *arg)
         struct rar_open_args open_args = {.arc = &d};
         int timeout_sec = OPT_SET(OPT_KEY_OPERATION_TIMEOUT) ?
                           OPT_INT(OPT_KEY_OPERATION_TIMEOUT, 0) : 30;
-        if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+        if (__rar_open_timed(&open_args,
                                    timeout_sec, "extract_rar:RAROpenArchiveEx") < 0) {
                 printd(1, "extract_rar: archive open timed out: %s\n", arch);
                 return -ETIMEDOUT;
@@ -2485,14 +3758,37 @@ static int extract_rar(char *arch, const char *file, void *arg)
         if (d.OpenResult)
                 goto extract_error;
 
+        /*
+         * Files preceding the requested one in a solid archive are decoded
+         * in any case, even when skipped. Keep them if there is a solid
+         * cache, since they are likely to be opened next. This is limited
+         * to in-process extraction where the cache can be updated.
+         */
+        int solid = op && (d.Flags & ROADF_SOLID) && solidcache_enabled();
+
         header.CmtBufSize = 0;
         while (1) {
                 if (RARReadHeaderEx(hdl, &header))
                         break;
                 /* We won't extract subdirs */
                 if (IS_RAR_DIR(&header) || strcmp(header.FileName, file)) {
+                        int skip_res;
+                        if (solid && !IS_RAR_DIR(&header) &&
+                            (cb_arg.sc = solidcache_begin(arch,
+                                        header.FileName,
+                                        GET_RAR_SZ(&header)))) {
+                                skip_res = RARProcessFile(hdl, RAR_TEST,
+                                                          NULL, NULL);
+                                if (skip_res == ERAR_SUCCESS)
+                                        solidcache_commit(cb_arg.sc);
+                                else
+                                        solidcache_abort(cb_arg.sc);
+                                cb_arg.sc = NULL;
+                        } else {
+                                skip_res = RARProcessFile(hdl, RAR_SKIP,
+                                                          NULL, NULL);
+                        }
                         /* Check for skip errors and distinguish from EOF */
-                        int skip_res = RARProcessFile(hdl, RAR_SKIP, NULL, NULL);
                         if (skip_res != ERAR_SUCCESS) {
                                 printd(1, "RARProcessFile skip failed in extraction: %d\n", skip_res);
                                 if (skip_res != ERAR_END_ARCHIVE)
@@ -2512,11 +3808,34 @@ static int extract_rar(char *arch, const char *file, void *arg)
 extract_error:
 
         if (hdl)
-                RARCloseArchive(hdl);
+                keycache_close(hdl, &d);
 
         return ret;
 }
 
+/*!
+ *****************************************************************************
+ * Extraction pool job, see ipopen_().
+ ****************************************************************************/
+static void extract_task(void *arg)
+{
+        struct extract_job *job = (struct extract_job *)arg;
+        struct io_context *op = job->op;
+
+        int ret = __extract_rar(job->rar_p, job->file_p, NULL, op);
+        if (ret)
+                printd(4, "extract_task: %s returned %d\n", job->file_p, ret);
+        free(job->rar_p);
+        free(job->file_p);
+        free(job);
+
+        pthread_mutex_lock(&op->xtr_mutex);
+        op->xtr_res = ret;
+        op->xtr_state |= XTR_DONE;
+        pthread_cond_broadcast(&op->xtr_cond);
+        pthread_mutex_unlock(&op->xtr_mutex);
+}
+
 /*!
  *****************************************************************************
  * For setting high-precision timestamp, used by set_rarstats()
@@ -2537,12 +3856,90 @@ void set_high_precision_ts(struct timespec *spec, uint64_t stamp)
 }
 #endif
 
+/*!
+ *****************************************************************************
+ * Accumulates the size of file header |h| into |size|.
+ * Returns 1 if the size is final, 0 if following parts should be added.
+ ****************************************************************************/
+static int __file_size_add(struct RARHeaderDataEx *h, uint64_t *size)
+{
+        /* Since some archives seems to have corrupt information
+         * in the uncompressed size, use the accumulated
+         * compressed size instead. It should anyway be the same
+         * for archives in store mode (-m0). For archives in
+         * compressed mode we must trust what is there as the
+         * uncompressed size. */
+        if (h->Method == FHD_STORING && !IS_RAR_DIR(h)) {
+                /* Validate packed size is within reasonable limits */
+                uint64_t pack_size = GET_RAR_PACK_SZ(h);
+                if (pack_size > MAX_REASONABLE_FILE_SIZE) {
+                        printd(1, "extract_file_size: suspicious pack size %llu (max %llu)\n",
+                               (unsigned long long)pack_size,
+                               (unsigned long long)MAX_REASONABLE_FILE_SIZE);
+                        return 1;
+                }
+                /* Prevent integer overflow when accumulating size */
+                if (*size > UINT64_MAX - pack_size) {
+                        printd(1, "extract_file_size: size overflow detected\n");
+                        *size = UINT64_MAX;
+                        return 1;
+                }
+                *size += pack_size;
+                return 0;
+        }
+
+        /* Validate uncompressed size is within reasonable limits */
+        uint64_t file_size = GET_RAR_SZ(h);
+        if (file_size > MAX_REASONABLE_FILE_SIZE) {
+                printd(1, "extract_file_size: suspicious file size %llu (max %llu)\n",
+                       (unsigned long long)file_size,
+                       (unsigned long long)MAX_REASONABLE_FILE_SIZE);
+                *size = 0;
+        } else {
+                *size = file_size;
+        }
+        return 1;
+}
+
+struct file_size_arg {
+        const char *file;
+        uint64_t size;
+};
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int file_size_callback(RARArchiveDataEx *arc, void *arg)
+{
+        struct file_size_arg *fsa = arg;
+
+        if (strcmp(arc->hdr.FileName, fsa->file))
+                return 0;
+        return __file_size_add(&arc->hdr, &fsa->size);
+}
+
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
 static uint64_t extract_file_size(char *arch, const char *file)
 {
+        struct file_size_arg fsa = {file, 0};
+        struct RARVolumeDataEx *vols;
+        int count;
+        int max_volumes = OPT_SET(OPT_KEY_MAX_VOLUME_COUNT) ?
+                          OPT_INT(OPT_KEY_MAX_VOLUME_COUNT, 0) : 1000;
+
+        /* The header-only scanner is a lot faster for large volume sets,
+         * fall back to libunrar for archives it does not support. */
+        if (RARScanVolumesEx(arch, IS_NNN(arch) ? 0 : -1, max_volumes,
+                             &vols, &count, file_size_callback,
+                             &fsa) == ERAR_SUCCESS) {
+                RARFreeVolumesEx(&vols);
+                return fsa.size;
+        }
+
         struct RAROpenArchiveDataEx d;
         memset(&d, 0, sizeof(RAROpenArchiveDataEx));
         d.ArcName = arch;
@@ -2561,44 +3958,9 @@ static uint64_t extract_file_size(char *arch, const char *file)
         while (1) {
                 if (RARReadHeaderEx(hdl, &header))
                         break;
-                if (!strcmp(header.FileName, file)) {
-                        /* Since some archives seems to have corrupt information
-                         * in the uncompressed size, use the accumulated
-                         * compressed size instead. It should anyway be the same
-                         * for archives in store mode (-m0). For archives in
-                         * compressed mode we must trust what is there as the
-                         * uncompressed size. */
-                        if (header.Method == FHD_STORING &&
-                                        !IS_RAR_DIR(&header)) {
-                                /* Validate packed size is within reasonable limits */
-                                uint64_t pack_size = GET_RAR_PACK_SZ(&header);
-                                if (pack_size > MAX_REASONABLE_FILE_SIZE) {
-                                        printd(1, "extract_file_size: suspicious pack size %llu (max %llu)\n",
-                                               (unsigned long long)pack_size,
-                                               (unsigned long long)MAX_REASONABLE_FILE_SIZE);
-                                        break;
-                                }
-                                /* Prevent integer overflow when accumulating size */
-                                if (size > UINT64_MAX - pack_size) {
-                                        printd(1, "extract_file_size: size overflow detected\n");
-                                        size = UINT64_MAX;
-                                        break;
-                                }
-                                size += pack_size;
-                        } else {
-                                /* Validate uncompressed size is within reasonable limits */
-                                uint64_t file_size = GET_RAR_SZ(&header);
-                                if (file_size > MAX_REASONABLE_FILE_SIZE) {
-                                        printd(1, "extract_file_size: suspicious file size %llu (max %llu)\n",
-                                               (unsigned long long)file_size,
-                                               (unsigned long long)MAX_REASONABLE_FILE_SIZE);
-                                        size = 0;
-                                } else {
-                                        size = file_size;
-                                }
-                                break;
-                        }
-                }
+                if (!strcmp(header.FileName, file) &&
+                                __file_size_add(&header, &size))
+                        break;
                 /* Check for skip errors and distinguish from EOF */
                 int skip_res = RARProcessFile(hdl, RAR_SKIP, NULL, NULL);
                 if (skip_res != ERAR_SUCCESS) {
@@ -2911,9 +4273,17 @@ void __add_filler(const char *path, struct dir_entry_list **buffer,
                         free(file_dup);
                         return;
                 }
-                *buffer = dir_entry_add(*buffer, basename(file_dup),
-                                                &entry_p->stat,
-                                                DIR_E_RAR);
+                if (!*buffer) {
+                        *buffer = malloc(sizeof(struct dir_entry_list));
+                        if (!*buffer) {
+                                free(safe_path);
+                                free(file_dup);
+                                return;
+                        }
+                        dir_list_open(*buffer);
+                }
+                (void)dir_entry_add(*buffer, basename(file_dup),
+                                    &entry_p->stat, DIR_E_RAR);
                 free(safe_path);
         }
         free(file_dup);
@@ -2988,7 +4358,7 @@ static struct filecache_entry *__listrar_tocache(char *file,
         printd(3, "Adding %s to cache (from archive: %s)\n", file, arch);
         entry_p = filecache_alloc(file);
 
-        entry_p->rar_p = strdup(first_arch);
+        entry_p->rar_p = filecache_strdup(first_arch);
         if (!entry_p->rar_p) {
                 printd(1, "__listrar_tocache: strdup failed for rar_p\n");
                 filecache_invalidate(file);
@@ -2998,7 +4368,7 @@ static struct filecache_entry *__listrar_tocache(char *file,
         if (!entry_p->file_p) {
                 printd(1, "__listrar_tocache: strdup failed for file_p\n");
                 /* Free previously allocated memory to prevent leak */
-                free(entry_p->rar_p);
+                filecache_strfree(entry_p->rar_p);
                 entry_p->rar_p = NULL;
                 filecache_invalidate(file);
                 return NULL;
@@ -3057,6 +4427,8 @@ static struct filecache_entry *__listrar_tocache(char *file,
                         entry_p->flags.save_eof = get_save_eof(entry_p->rar_p);
                         if (arc->hdr.Flags & RHDF_ENCRYPTED)
                                 entry_p->flags.encrypted = 1;
+                        if (d->Flags & ROADF_SOLID)
+                                entry_p->flags.solid = 1;
                 }
         }
         entry_p->method = arc->hdr.Method;
@@ -3073,7 +4445,7 @@ static int __listrar_tocache_forcedir(struct filecache_entry *entry_p,
                 RARArchiveDataEx *arc, const char *file, char *first_arch,
                 RAROpenArchiveDataEx *d)
 {
-        entry_p->rar_p = strdup(first_arch);
+        entry_p->rar_p = filecache_strdup(first_arch);
         if (!entry_p->rar_p) {
                 printd(1, "__listrar_tocache_forcedir: strdup failed for rar_p\n");
                 return -ENOMEM;
@@ -3104,10 +4476,10 @@ static int __listrar_tocache_forcedir(struct filecache_entry *entry_p,
  ****************************************************************************/
 static inline void __listrar_cachedir(const char *mp)
 {
-        pthread_rwlock_wrlock(&dir_access_lock);
+        shlock_wrlock_key(&dir_access_lock, mp);
         if (!dircache_get(mp))
 		(void)dircache_alloc(mp);
-        pthread_rwlock_unlock(&dir_access_lock);
+        shlock_unlock_key(&dir_access_lock, mp);
 }
 
 /*!
@@ -3120,7 +4492,7 @@ static void __listrar_cachedirentry(const char *mp)
         char *tmp = safe_path;
         safe_path = __gnu_dirname(safe_path);
         if (CHRCMP(safe_path, '/')) {
-                pthread_rwlock_wrlock(&dir_access_lock);
+                shlock_wrlock_key(&dir_access_lock, safe_path);
                 struct dircache_entry *dce = dircache_get(safe_path);
                 if (dce) {
                         char *tmp2 = strdup(mp);
@@ -3132,7 +4504,7 @@ static void __listrar_cachedirentry(const char *mp)
                                 free(tmp2);
                         }
                 }
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, safe_path);
         }
         free(tmp);
 }
@@ -3353,110 +4725,900 @@ static int extract_nested_rar_to_memory_impl(const char *archive_path,
         return 0;
 }
 
-/**
- * Process nested RAR file recursively.
- * Extracts nested RAR to memory, writes to tmpfile, recursively calls listrar().
- *
- * @param parent_archive_path Path to parent RAR archive file
- * @param nested_filename Filename of nested RAR within parent
- * @param parent_path Virtual path to parent directory
- * @param ctx Recursion context for security tracking
- * @return 0 on success, negative errno on error
+/*
+ * Stored (uncompressed, unencrypted) nested archives are not extracted.
+ * Instead a sparse image of the inner archive is created that holds only
+ * its block headers, which is all libunrar needs to produce a listing.
+ * Entries found in the image that can be read raw are then remapped to
+ * their real location in the outermost archive file.
  */
+struct nested_image {
+        const char *tmp;        /* sparse image handed to libunrar */
+        char *src;              /* real file holding the archive bytes,
+                                   or NULL if 'tmp' is a cached copy */
+        off_t base;             /* offset of the image within src */
+        char **paths;           /* entries listed from the image */
+        int n_paths;
+        int max_paths;
+        struct nested_image *prev;
+};
+
+static __thread struct nested_image *nested_images;
+
 /*!
  *****************************************************************************
- * Process a nested RAR file recursively
- *
- * This function extracts a nested RAR to a temporary file, recursively
- * processes its contents via listrar_internal(), and returns the buffer
- * containing entries from within the nested RAR.
- *
- * @param parent_archive_path   Path to the parent RAR archive
- * @param nested_filename       Name of the nested RAR file within parent
- * @param parent_path           Virtual path for the parent directory
- * @param ctx                   Recursion context for depth/cycle tracking
- * @return                      Buffer containing nested entries, or NULL on error
  *
- * The caller is responsible for merging the returned buffer into the parent
- * buffer and freeing it after use.
  ****************************************************************************/
-static struct dir_entry_list* process_nested_rar(const char *parent_archive_path,
-                               const char *nested_filename,
-                               const char *parent_path,
-                               struct recursion_context *ctx)
+static const char *__nested_image_src(const char *arch, off_t *offset)
 {
-        int ret = 0;
-        struct extract_buffer buf = {0};
-        char tmpfile_path[PATH_MAX];
-        char *first_arch = NULL;
-        int final = 0;
-
-        printd(2, "process_nested_rar: processing %s at depth %d from archive %s\n",
-               nested_filename, ctx->depth, parent_archive_path);
+        struct nested_image *img = nested_images;
 
-        /* Extract nested RAR to memory */
-        ret = extract_nested_rar_to_memory_impl(parent_archive_path, nested_filename,
-                                                 &buf, NULL);
-        printd(2, "process_nested_rar: extraction returned ret=%d, buffer.size=%zu\n",
-               ret, buf.size);
-        if (ret < 0) {
-                printd(2, "process_nested_rar: extraction failed: %d\n", ret);
-                return NULL;
+        while (img) {
+                if (!strcmp(img->tmp, arch)) {
+                        if (!img->src)
+                                break;  /* a copy, see __nested_copy_begin() */
+                        *offset += img->base;
+                        return img->src;
+                }
+                img = img->prev;
         }
+        return arch;
+}
 
-        /* Compute fingerprint for cycle detection */
-        struct archive_fingerprint fp = compute_archive_fingerprint(
-                buf.data, buf.size, time(NULL));
-
-        /* Check for cycles */
-        if (is_cycle_detected(ctx, &fp)) {
-                printd(1, "process_nested_rar: cycle detected for %s\n",
-                       nested_filename);
-                free_extract_buffer(&buf);
-                return NULL;
-        }
+/*!
+ *****************************************************************************
+ * Remember cache entry 'path' if it refers to one of the images of the
+ * calling thread, such that it can be remapped once listing is done.
+ * Must be called with file_access_lock held.
+ ****************************************************************************/
+static void __nested_image_track(const char *rar_p, const char *path)
+{
+        struct nested_image *img = nested_images;
 
-        /* Check size limits */
-        ret = check_unpack_size_limit(ctx, buf.size);
-        if (ret < 0) {
-                printd(1, "process_nested_rar: size limit exceeded\n");
-                free_extract_buffer(&buf);
-                return NULL;
+        while (img && rar_p && strcmp(img->tmp, rar_p))
+                img = img->prev;
+        if (!img || !rar_p)
+                return;
+        if (img->n_paths == img->max_paths) {
+                int max = img->max_paths ? img->max_paths * 2 : 64;
+                char **paths = realloc(img->paths, max * sizeof(char *));
+                if (!paths)
+                        return;
+                img->paths = paths;
+                img->max_paths = max;
         }
+        img->paths[img->n_paths] = strdup(path);
+        if (img->paths[img->n_paths])
+                ++img->n_paths;
+}
 
-        /* Write to tempfile for UnRAR processing */
-        ret = write_buffer_to_tempfile(&buf, tmpfile_path);
-        printd(2, "process_nested_rar: write_buffer_to_tempfile returned ret=%d, tmpfile=%s\n",
-               ret, tmpfile_path);
-        if (ret < 0) {
-                printd(1, "process_nested_rar: failed to write tempfile\n");
-                free_extract_buffer(&buf);
-                return NULL;
-        }
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __nested_image_copy(int src, off_t off, int dst, off_t pos,
+                off_t len)
+{
+        char buf[65536];
 
-        /* Check if tmpfile was actually created */
-        struct stat st;
-        if (stat(tmpfile_path, &st) == 0) {
-                printd(2, "process_nested_rar: tmpfile exists, size=%ld bytes\n", st.st_size);
-        } else {
-                printd(1, "process_nested_rar: WARNING - tmpfile does not exist!\n");
+        while (len > 0) {
+                size_t n = len > (off_t)sizeof(buf) ? sizeof(buf) : len;
+                ssize_t r = pread(src, buf, n, off + pos);
+                if (r <= 0)
+                        return -EIO;
+                if (pwrite(dst, buf, r, pos) != r)
+                        return -EIO;
+                pos += r;
+                len -= r;
         }
+        return 0;
+}
 
-        /* Free buffer - data now in tempfile */
-        free_extract_buffer(&buf);
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __nested_vint(const unsigned char *p, size_t n, size_t *i,
+                uint64_t *v)
+{
+        size_t j;
 
-        /* Push archive onto recursion stack */
-        ret = recursion_push_archive(ctx, &fp, nested_filename);
-        if (ret < 0) {
-                printd(1, "process_nested_rar: recursion_push_archive failed: %d\n",
-                       ret);
-                unlink(tmpfile_path);
-                return NULL;
+        *v = 0;
+        for (j = 0; *i + j < n && j < 10; j++) {
+                *v |= (uint64_t)(p[*i + j] & 0x7f) << (7 * j);
+                if (!(p[*i + j] & 0x80)) {
+                        *i += j + 1;
+                        return 1;
+                }
         }
+        return 0;
+}
 
-        /* Recursively process nested RAR */
-        printd(3, "process_nested_rar: recursively listing %s\n", tmpfile_path);
-        printd(2, "process_nested_rar: calling listrar_internal with parent_path='%s', depth=%d\n",
+/*!
+ *****************************************************************************
+ * Data of nested RAR files is kept in the image so that they in turn can
+ * be processed by the recursive unpacker.
+ ****************************************************************************/
+static int __nested_name_is_rar(const unsigned char *name, size_t len)
+{
+        const unsigned char *nul = memchr(name, 0, len);
+
+        if (nul)
+                len = nul - name;
+        return len >= 4 &&
+                !strncasecmp((const char *)name + len - 4, ".rar", 4);
+}
+
+/*!
+ *****************************************************************************
+ * Parse the block at 'pos' and return its header size and data size.
+ * Returns 1 for the end of archive block, 0 to continue, or negative
+ * errno if the block can not be handled.
+ ****************************************************************************/
+static int __nested_image_block(int fd, off_t off, off_t pos, int rar5,
+                off_t *hsize, off_t *dsize, int *keep)
+{
+        unsigned char b[32];
+        unsigned char *hdr;
+        size_t name_off = 0;
+        size_t name_len = 0;
+        uint64_t hs, type, flags, v;
+        size_t i;
+        ssize_t n;
+
+        *dsize = 0;
+        *keep = 1;
+        n = pread(fd, b, sizeof(b), off + pos);
+        if (n < 7)
+                return -EIO;
+
+        if (!rar5) {
+                type = b[2];
+                flags = b[3] | (b[4] << 8);
+                *hsize = b[5] | (b[6] << 8);
+                if (*hsize < 7)
+                        return -EINVAL;
+                /* MHD_PASSWORD; headers are encrypted */
+                if (type == 0x73 && (flags & 0x0080))
+                        return -ENOTSUP;
+                if (type == 0x7b)
+                        return 1;
+                if ((flags & 0x8000) && n >= 11)
+                        *dsize = (uint32_t)(b[7] | (b[8] << 8) |
+                                        (b[9] << 16) | ((uint32_t)b[10] << 24));
+                /* LHD_LARGE; high 32 bits of the packed size */
+                if ((type == 0x74 || type == 0x7a) && (flags & 0x0100)) {
+                        if (*hsize < 36 || n < 36)
+                                return -EINVAL;
+                        *dsize |= (off_t)(b[32] | (b[33] << 8) |
+                                        (b[34] << 16) |
+                                        ((uint32_t)b[35] << 24)) << 32;
+                }
+                if (type != 0x74)
+                        return 0;
+                if (*hsize < 32)
+                        return -EINVAL;
+                name_len = b[26] | (b[27] << 8);
+                name_off = (flags & 0x0100) ? 40 : 32;
+        } else {
+                i = 4;
+                if (!__nested_vint(b, n, &i, &hs) || hs > 0x200000)
+                        return -EINVAL;
+                *hsize = i + hs;
+                if (!__nested_vint(b, n, &i, &type) ||
+                    !__nested_vint(b, n, &i, &flags))
+                        return -EINVAL;
+                /* HFL_EXTRA */
+                if ((flags & 0x0001) && !__nested_vint(b, n, &i, &v))
+                        return -EINVAL;
+                /* HFL_DATA */
+                if (flags & 0x0002) {
+                        if (!__nested_vint(b, n, &i, &v))
+                                return -EINVAL;
+                        *dsize = v;
+                }
+                /* HEAD_CRYPT; headers are encrypted */
+                if (type == 4)
+                        return -ENOTSUP;
+                if (type == 5)
+                        return 1;
+                if (type != 2)
+                        return 0;
+                name_off = i;
+        }
+
+        /* File block, check the name */
+        *keep = 0;
+        hdr = malloc(*hsize);
+        if (!hdr)
+                return -ENOMEM;
+        if (pread(fd, hdr, *hsize, off + pos) != *hsize) {
+                free(hdr);
+                return -EIO;
+        }
+        if (rar5) {
+                size_t end = *hsize;
+                uint64_t file_flags;
+
+                i = name_off;
+                /* file flags, unpacked size and attributes */
+                if (__nested_vint(hdr, end, &i, &file_flags) &&
+                    __nested_vint(hdr, end, &i, &v) &&
+                    __nested_vint(hdr, end, &i, &v)) {
+                        if (file_flags & 0x0002)        /* mtime */
+                                i += 4;
+                        if (file_flags & 0x0004)        /* data crc */
+                                i += 4;
+                        /* compression, host os and name length */
+                        if (__nested_vint(hdr, end, &i, &v) &&
+                            __nested_vint(hdr, end, &i, &v) &&
+                            __nested_vint(hdr, end, &i, &v)) {
+                                name_off = i;
+                                name_len = v;
+                        }
+                }
+        }
+        if (name_len && name_off + name_len <= (size_t)*hsize)
+                *keep = __nested_name_is_rar(hdr + name_off, name_len);
+        free(hdr);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Copy all block headers of the archive at 'off' in 'src' into 'dst'.
+ * File data is left as holes, everything else (comments, service data
+ * like quick open and recovery records) is kept.
+ ****************************************************************************/
+static int __nested_image_fill(int src, off_t off, off_t size, int dst)
+{
+        unsigned char sig[8];
+        off_t pos;
+        int rar5;
+
+        if (pread(src, sig, sizeof(sig), off) != sizeof(sig))
+                return -EIO;
+        if (!memcmp(sig, "Rar!\x1a\x07\x01\x00", 8))
+                rar5 = 1;
+        else if (!memcmp(sig, "Rar!\x1a\x07\x00", 7))
+                rar5 = 0;
+        else
+                return -EINVAL;
+        pos = rar5 ? 8 : 7;
+        if (__nested_image_copy(src, off, dst, 0, pos))
+                return -EIO;
+
+        while (pos < size) {
+                off_t hsize;
+                off_t dsize;
+                int keep;
+                int ret = __nested_image_block(src, off, pos, rar5, &hsize,
+                                &dsize, &keep);
+                if (ret < 0)
+                        return ret;
+                if (pos + hsize > size)
+                        return -EINVAL;
+                if (__nested_image_copy(src, off, dst, pos, hsize))
+                        return -EIO;
+                if (ret)
+                        break;
+                pos += hsize;
+                if (dsize > size - pos)
+                        dsize = size - pos;
+                if (keep && __nested_image_copy(src, off, dst, pos, dsize))
+                        return -EIO;
+                pos += dsize;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Create a header-only image of a stored nested archive. On success the
+ * image is registered for the calling thread and must be released using
+ * __nested_image_release().
+ ****************************************************************************/
+static int __nested_image_create(const char *arch,
+                const struct filecache_entry *entry_p, char *tmp,
+                struct nested_image *img, struct archive_fingerprint *fp)
+{
+        off_t base = entry_p->offset;
+        off_t size = entry_p->stat.st_size;
+        const char *src;
+        int sfd;
+        int dfd;
+        int ret;
+
+        src = __nested_image_src(arch, &base);
+        sfd = open(src, O_RDONLY);
+        if (sfd < 0)
+                return -errno;
+
+        *fp = compute_archive_fingerprint_fd(sfd, base, size, time(NULL));
+        if (!fp->hash) {
+                close(sfd);
+                return -EIO;
+        }
+
+        snprintf(tmp, PATH_MAX, "/tmp/rar2fs_nested_XXXXXX");
+        dfd = mkstemp(tmp);
+        if (dfd < 0) {
+                ret = -errno;
+                close(sfd);
+                return ret;
+        }
+        ret = ftruncate(dfd, size) ? -errno : 0;
+        if (!ret)
+                ret = __nested_image_fill(sfd, base, size, dfd);
+        close(dfd);
+        close(sfd);
+        if (ret < 0) {
+                unlink(tmp);
+                return ret;
+        }
+
+        img->src = strdup(src);
+        if (!img->src) {
+                unlink(tmp);
+                return -ENOMEM;
+        }
+        img->tmp = tmp;
+        img->base = base;
+        img->paths = NULL;
+        img->n_paths = 0;
+        img->max_paths = 0;
+        img->prev = nested_images;
+        nested_images = img;
+
+        printd(3, "nested image %s for %s at %s+%lld\n", tmp,
+               entry_p->file_p ? entry_p->file_p : "?", src,
+               (long long)base);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Only raw single volume entries can be served from the real file, any
+ * other file listed from the image would still refer to it once it has
+ * been removed. Must be called with file_access_lock held.
+ ****************************************************************************/
+static int __nested_image_mappable(struct nested_image *img)
+{
+        int i;
+
+        for (i = 0; i < img->n_paths; i++) {
+                struct filecache_entry *e = filecache_get(img->paths[i]);
+                if (!e || !e->rar_p || strcmp(e->rar_p, img->tmp) ||
+                    S_ISDIR(e->stat.st_mode))
+                        continue;
+                if (!e->flags.raw || e->flags.multipart)
+                        return 0;
+        }
+        return 1;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_image_remap(struct filecache_entry *e,
+                struct nested_image *img)
+{
+        if (!e->rar_p || strcmp(e->rar_p, img->tmp))
+                return;
+        if (!e->flags.raw || e->flags.multipart)
+                return;
+        char *rar_p = filecache_strdup(img->src);
+        if (!rar_p)
+                return;
+        filecache_strfree(e->rar_p);
+        e->rar_p = rar_p;
+        e->offset += img->base;
+}
+
+/*!
+ *****************************************************************************
+ * Remap the entries listed from the image, or drop them all if 'remap'
+ * is not set. Must be called with file_access_lock held.
+ ****************************************************************************/
+static void __nested_image_release(struct nested_image *img, int remap)
+{
+        int i;
+
+        for (i = 0; i < img->n_paths; i++) {
+                if (remap) {
+                        struct filecache_entry *e =
+                                filecache_get(img->paths[i]);
+                        if (e)
+                                __nested_image_remap(e, img);
+                } else {
+                        filecache_invalidate(img->paths[i]);
+                }
+                free(img->paths[i]);
+        }
+        free(img->paths);
+        nested_images = img->prev;
+        unlink(img->tmp);
+        free(img->src);
+}
+
+/*!
+ *****************************************************************************
+ * Build the nested cache key of 'nested_filename' within 'arch'. The key
+ * refers to the real file holding the archive such that it stays valid
+ * across listings even if 'arch' is a header-only image.
+ ****************************************************************************/
+static int __nested_cache_key(char *key, size_t len, const char *arch,
+                const char *nested_filename)
+{
+        off_t base = 0;
+        const char *src = __nested_image_src(arch, &base);
+        struct stat st;
+
+        struct timespec mtim;
+
+        if (stat(src, &st) == -1)
+                return -errno;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+        mtim = st.st_mtim;
+#else
+        mtim.tv_sec = st.st_mtime;
+        mtim.tv_nsec = 0;
+#endif
+        if ((size_t)snprintf(key, len, "%s\n%lld\n%lld.%09ld\n%lld\n%s", src,
+                             (long long)base, (long long)mtim.tv_sec,
+                             mtim.tv_nsec, (long long)st.st_size,
+                             nested_filename) >= len)
+                return -ENAMETOOLONG;
+        return 0;
+}
+
+/*
+ * Entries listed from a cached copy are recorded per copy such that they
+ * can be dropped once the copy is evicted, without scanning the whole
+ * file cache. An entry refers to at most one copy, the one it was last
+ * listed from.
+ */
+struct nested_ref_head {
+        const char *copy;       /* owned by the hash table */
+        struct nested_ref *first;
+};
+
+struct nested_ref {
+        const char *path;       /* owned by the hash table */
+        struct nested_ref_head *head;
+        struct nested_ref *prev;
+        struct nested_ref *next;
+};
+
+#define NESTED_REF_SZ 1024
+
+static void *nested_refs = NULL;        /* entry path -> nested_ref */
+static void *nested_heads = NULL;       /* copy path -> nested_ref_head */
+static pthread_mutex_t nested_ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_ref_unlink(struct nested_ref *r)
+{
+        if (!r->head)
+                return;
+        if (r->prev)
+                r->prev->next = r->next;
+        else
+                r->head->first = r->next;
+        if (r->next)
+                r->next->prev = r->prev;
+        r->head = NULL;
+        r->prev = r->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__nested_ref_alloc()
+{
+        return calloc(1, sizeof(struct nested_ref));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_ref_free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        __nested_ref_unlink(data);
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__nested_head_alloc()
+{
+        return calloc(1, sizeof(struct nested_ref_head));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_head_free(const char *key, void *data)
+{
+        struct nested_ref_head *h = data;
+
+        (void)key;              /* touch */
+        while (h->first)
+                __nested_ref_unlink(h->first);
+        free(h);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_ref_init()
+{
+        struct hash_table_ops ref_ops = {
+                .alloc = __nested_ref_alloc,
+                .free = __nested_ref_free,
+        };
+        struct hash_table_ops head_ops = {
+                .alloc = __nested_head_alloc,
+                .free = __nested_head_free,
+        };
+
+        pthread_mutex_lock(&nested_ref_lock);
+        nested_refs = hashtable_init(NESTED_REF_SZ, &ref_ops);
+        nested_heads = hashtable_init(NESTED_REF_SZ, &head_ops);
+        pthread_mutex_unlock(&nested_ref_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __nested_ref_destroy()
+{
+        pthread_mutex_lock(&nested_ref_lock);
+        if (nested_refs)
+                hashtable_destroy(nested_refs);
+        if (nested_heads)
+                hashtable_destroy(nested_heads);
+        nested_refs = nested_heads = NULL;
+        pthread_mutex_unlock(&nested_ref_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Record that cache entry 'path' was listed from copy 'copy'.
+ ****************************************************************************/
+static void __nested_ref_add(const char *path, const char *copy)
+{
+        struct hash_table_entry *he;
+        struct nested_ref_head *h;
+        struct nested_ref *r;
+
+        pthread_mutex_lock(&nested_ref_lock);
+        if (!nested_refs || !nested_heads)
+                goto out;
+        he = hashtable_entry_alloc(nested_refs, path);
+        if (!he)
+                goto out;
+        r = he->user_data;
+        r->path = he->key;
+        if (r->head && !strcmp(r->head->copy, copy))
+                goto out;
+        __nested_ref_unlink(r);
+        he = hashtable_entry_alloc(nested_heads, copy);
+        if (!he) {
+                hashtable_entry_delete(nested_refs, path);
+                goto out;
+        }
+        h = he->user_data;
+        h->copy = he->key;
+        r->head = h;
+        r->next = h->first;
+        if (h->first)
+                h->first->prev = r;
+        h->first = r;
+out:
+        pthread_mutex_unlock(&nested_ref_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Entries listed from a cached copy are recorded once the listing is done.
+ * Must be called with file_access_lock held.
+ ****************************************************************************/
+static void __nested_copy_begin(struct nested_image *img, const char *copy)
+{
+        memset(img, 0, sizeof(*img));
+        img->tmp = copy;
+        img->prev = nested_images;
+        nested_images = img;
+}
+
+static void __nested_copy_end(struct nested_image *img)
+{
+        int i;
+
+        for (i = 0; i < img->n_paths; i++) {
+                __nested_ref_add(img->paths[i], img->tmp);
+                free(img->paths[i]);
+        }
+        free(img->paths);
+        nested_images = img->prev;
+}
+
+/*!
+ *****************************************************************************
+ * Entries listed from an evicted copy can no longer be read. They are
+ * dropped from the cache and picked up again by the next re-listing.
+ * Called from process_nested_rar() with file_access_lock held.
+ ****************************************************************************/
+static void __nested_evicted(const char *path)
+{
+        struct hash_table_entry *he;
+        struct nested_ref_head *h;
+        char **keys = NULL;
+        int max = 0;
+        int n = 0;
+        int i;
+
+        pthread_mutex_lock(&nested_ref_lock);
+        he = nested_heads ? hashtable_entry_get(nested_heads, path) : NULL;
+        if (!he) {
+                pthread_mutex_unlock(&nested_ref_lock);
+                return;
+        }
+        h = he->user_data;
+        while (h->first) {
+                char *key = strdup(h->first->path);
+                if (!key) {
+                        __nested_ref_unlink(h->first);
+                        continue;
+                }
+                if (n == max) {
+                        char **tmp;
+                        max = max ? max * 2 : 64;
+                        tmp = realloc(keys, max * sizeof(char *));
+                        if (!tmp) {
+                                free(key);
+                                __nested_ref_unlink(h->first);
+                                continue;
+                        }
+                        keys = tmp;
+                }
+                keys[n++] = key;
+                hashtable_entry_delete(nested_refs, key);
+        }
+        hashtable_entry_delete(nested_heads, path);
+        pthread_mutex_unlock(&nested_ref_lock);
+
+        for (i = 0; i < n; i++) {
+                struct filecache_entry *e = filecache_get(keys[i]);
+                /* Might have been listed from elsewhere since */
+                if (e && e->rar_p && !strcmp(e->rar_p, path))
+                        filecache_invalidate(keys[i]);
+                free(keys[i]);
+        }
+        free(keys);
+        printd(3, "nested copy %s evicted, %d entries dropped\n", path, n);
+}
+
+/*!
+ *****************************************************************************
+ * List a nested RAR through a copy or header-only image at 'arch'.
+ ****************************************************************************/
+static struct dir_entry_list *process_nested_copy(const char *arch,
+                const struct archive_fingerprint *fp, off_t size,
+                const char *nested_filename, const char *parent_path,
+                struct recursion_context *ctx, int copy)
+{
+        struct dir_entry_list *nested_buffer = NULL;
+        struct nested_image img;
+        char *first_arch = NULL;
+        int final = 0;
+        int ret;
+
+        if (is_cycle_detected(ctx, fp)) {
+                printd(1, "process_nested_copy: cycle detected for %s\n",
+                       nested_filename);
+                return NULL;
+        }
+        if (check_unpack_size_limit(ctx, size) < 0 ||
+            recursion_push_archive(ctx, fp, nested_filename) < 0) {
+                printd(1, "process_nested_copy: limits exceeded for %s\n",
+                       nested_filename);
+                return NULL;
+        }
+
+        if (copy)
+                __nested_copy_begin(&img, arch);
+        ret = listrar_internal(parent_path, &nested_buffer, arch,
+                               &first_arch, &final, ctx);
+        if (copy)
+                __nested_copy_end(&img);
+        recursion_pop_archive(ctx);
+        free(first_arch);
+        if (ret < 0) {
+                printd(2, "process_nested_copy: recursive listrar failed: %d\n",
+                       ret);
+                if (nested_buffer) {
+                        dir_list_free(nested_buffer);
+                        free(nested_buffer);
+                }
+                return NULL;
+        }
+        return nested_buffer;
+}
+
+/**
+ * Process nested RAR file recursively.
+ * Extracts nested RAR to memory, writes to tmpfile, recursively calls listrar().
+ *
+ * @param parent_archive_path Path to parent RAR archive file
+ * @param nested_filename Filename of nested RAR within parent
+ * @param parent_path Virtual path to parent directory
+ * @param ctx Recursion context for security tracking
+ * @return 0 on success, negative errno on error
+ */
+/*!
+ *****************************************************************************
+ * Process a nested RAR file recursively
+ *
+ * This function extracts a nested RAR to a temporary file, recursively
+ * processes its contents via listrar_internal(), and returns the buffer
+ * containing entries from within the nested RAR.
+ *
+ * @param parent_archive_path   Path to the parent RAR archive
+ * @param nested_filename       Name of the nested RAR file within parent
+ * @param parent_path           Virtual path for the parent directory
+ * @param entry_p               Cache entry of the nested RAR file
+ * @param ctx                   Recursion context for depth/cycle tracking
+ * @return                      Buffer containing nested entries, or NULL on error
+ *
+ * The caller is responsible for merging the returned buffer into the parent
+ * buffer and freeing it after use.
+ ****************************************************************************/
+static struct dir_entry_list* process_nested_rar(const char *parent_archive_path,
+                               const char *nested_filename,
+                               const char *parent_path,
+                               const struct filecache_entry *entry_p,
+                               struct recursion_context *ctx)
+{
+        int ret = 0;
+        struct extract_buffer buf = {0};
+        char tmpfile_path[PATH_MAX];
+        char key[PATH_MAX * 2 + 64];
+        char *first_arch = NULL;
+        int final = 0;
+        int cached = 0;
+
+        printd(2, "process_nested_rar: processing %s at depth %d from archive %s\n",
+               nested_filename, ctx->depth, parent_archive_path);
+
+        /* A stored nested RAR is listed in place, no need to extract it */
+        if (entry_p->flags.raw && !entry_p->flags.multipart &&
+            !entry_p->flags.encrypted) {
+                struct nested_image img;
+                struct archive_fingerprint fp;
+
+                ret = __nested_image_create(parent_archive_path, entry_p,
+                                tmpfile_path, &img, &fp);
+                if (!ret) {
+                        struct dir_entry_list *nested_buffer;
+                        nested_buffer = process_nested_copy(tmpfile_path, &fp,
+                                        entry_p->stat.st_size,
+                                        nested_filename, parent_path, ctx, 0);
+                        if (!nested_buffer || __nested_image_mappable(&img)) {
+                                __nested_image_release(&img, 1);
+                                return nested_buffer;
+                        }
+                        /* Compressed or multipart members need the
+                         * archive data, list an extracted copy instead */
+                        __nested_image_release(&img, 0);
+                        dir_list_free(nested_buffer);
+                        free(nested_buffer);
+                        ret = -ENOTSUP;
+                }
+                printd(2, "process_nested_rar: no in place listing (%d), "
+                          "extracting\n", ret);
+        }
+
+        /* A previously extracted copy can be reused as is */
+        if (nestcache_enabled() &&
+            !__nested_cache_key(key, sizeof(key), parent_archive_path,
+                                nested_filename)) {
+                struct archive_fingerprint fp;
+
+                cached = 1;
+                if (!nestcache_get(key, tmpfile_path, &fp)) {
+                        printd(3, "process_nested_rar: using cached copy %s\n",
+                               tmpfile_path);
+                        fp.mtime = time(NULL);
+                        return process_nested_copy(tmpfile_path, &fp, fp.size,
+                                        nested_filename, parent_path, ctx, 1);
+                }
+        }
+
+        /* Extract nested RAR to memory */
+        ret = extract_nested_rar_to_memory_impl(parent_archive_path, nested_filename,
+                                                 &buf, NULL);
+        printd(2, "process_nested_rar: extraction returned ret=%d, buffer.size=%zu\n",
+               ret, buf.size);
+        if (ret < 0) {
+                printd(2, "process_nested_rar: extraction failed: %d\n", ret);
+                return NULL;
+        }
+
+        /* Compute fingerprint for cycle detection */
+        struct archive_fingerprint fp = compute_archive_fingerprint(
+                buf.data, buf.size, time(NULL));
+
+        /* Keep the extracted copy for later listings */
+        if (cached && !nestcache_put(key, &fp, buf.data, buf.size,
+                                     tmpfile_path)) {
+                free_extract_buffer(&buf);
+                return process_nested_copy(tmpfile_path, &fp, fp.size,
+                                nested_filename, parent_path, ctx, 1);
+        }
+
+        /* Check for cycles */
+        if (is_cycle_detected(ctx, &fp)) {
+                printd(1, "process_nested_rar: cycle detected for %s\n",
+                       nested_filename);
+                free_extract_buffer(&buf);
+                return NULL;
+        }
+
+        /* Check size limits */
+        ret = check_unpack_size_limit(ctx, buf.size);
+        if (ret < 0) {
+                printd(1, "process_nested_rar: size limit exceeded\n");
+                free_extract_buffer(&buf);
+                return NULL;
+        }
+
+        /* Write to tempfile for UnRAR processing */
+        ret = write_buffer_to_tempfile(&buf, tmpfile_path);
+        printd(2, "process_nested_rar: write_buffer_to_tempfile returned ret=%d, tmpfile=%s\n",
+               ret, tmpfile_path);
+        if (ret < 0) {
+                printd(1, "process_nested_rar: failed to write tempfile\n");
+                free_extract_buffer(&buf);
+                return NULL;
+        }
+
+        /* Check if tmpfile was actually created */
+        struct stat st;
+        if (stat(tmpfile_path, &st) == 0) {
+                printd(2, "process_nested_rar: tmpfile exists, size=%ld bytes\n", st.st_size);
+        } else {
+                printd(1, "process_nested_rar: WARNING - tmpfile does not exist!\n");
+        }
+
+        /* Free buffer - data now in tempfile */
+        free_extract_buffer(&buf);
+
+        /* Push archive onto recursion stack */
+        ret = recursion_push_archive(ctx, &fp, nested_filename);
+        if (ret < 0) {
+                printd(1, "process_nested_rar: recursion_push_archive failed: %d\n",
+                       ret);
+                unlink(tmpfile_path);
+                return NULL;
+        }
+
+        /* Recursively process nested RAR */
+        printd(3, "process_nested_rar: recursively listing %s\n", tmpfile_path);
+        printd(2, "process_nested_rar: calling listrar_internal with parent_path='%s', depth=%d\n",
                parent_path, ctx->depth);
         struct dir_entry_list *nested_buffer = NULL;
         ret = listrar_internal(parent_path, &nested_buffer, tmpfile_path,
@@ -3552,7 +5714,7 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
         struct rar_open_args open_args = {.arc = &d};
         int timeout_sec = OPT_SET(OPT_KEY_OPERATION_TIMEOUT) ?
                           OPT_INT(OPT_KEY_OPERATION_TIMEOUT, 0) : 30;
-        if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+        if (__rar_open_timed(&open_args,
                                    timeout_sec, "listrar:RAROpenArchiveEx") < 0) {
                 printd(1, "listrar: archive open timed out: %s\n", arch);
                 return -ETIMEDOUT;
@@ -3562,17 +5724,17 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
         /* Check for fault */
         if (d.OpenResult) {
                 if (hdl)
-                        RARCloseArchive(hdl);
+                        keycache_close(hdl, &d);
                 return d.OpenResult;
         }
 
         if (d.Flags & ROADF_ENCHEADERS) {
-                RARCloseArchive(hdl);
+                keycache_close(hdl, &d);
                 d.Callback = list_callback;
 
                 /* Wrap RAROpenArchiveEx with timeout */
                 open_args.arc = &d;
-                if (__execute_with_timeout(__rar_open_wrapper, &open_args,
+                if (__rar_open_timed(&open_args,
                                            timeout_sec, "listrar:RAROpenArchiveEx(enc)") < 0) {
                         printd(1, "listrar: encrypted archive open timed out: %s\n", arch);
                         return -ETIMEDOUT;
@@ -3688,7 +5850,7 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
                                arc->hdr.FileName);
                 }
 
-                pthread_rwlock_wrlock(&file_access_lock);
+                shlock_wrlock(&file_access_lock);
 
                 /* Handle the case when the parent folders do not have
                  * their own entry in the file header or is located in
@@ -3703,7 +5865,7 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
                                 printd(1, "listrar: strdup failed for safe_path (forcedir)\n");
                                 ret = -ENOMEM;
                                 /* Release lock before jumping to cleanup */
-                                pthread_rwlock_unlock(&file_access_lock);
+                                shlock_unlock(&file_access_lock);
                                 goto out;
                         }
                         char *tmp = safe_path;
@@ -3726,7 +5888,7 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
                                                 filecache_invalidate(mp2);
                                                 free(mp2);
                                                 /* Release lock before jumping to cleanup */
-                                                pthread_rwlock_unlock(&file_access_lock);
+                                                shlock_unlock(&file_access_lock);
                                                 goto out;
                                         }
                                         __listrar_cachedir(mp2);
@@ -3743,7 +5905,7 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
                                         printd(1, "listrar: strdup failed for safe_path (cachedir)\n");
                                         ret = -ENOMEM;
                                         /* Release lock before jumping to cleanup */
-                                        pthread_rwlock_unlock(&file_access_lock);
+                                        shlock_unlock(&file_access_lock);
                                         goto out;
                                 }
                                 tmp = safe_path;
@@ -3785,14 +5947,14 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
                                 entry_p = filecache_alloc(mp);
                                 if (!entry_p) {
                                         printd(1, "listrar: filecache_alloc failed for filecopy\n");
-                                        pthread_rwlock_unlock(&file_access_lock);
+                                        shlock_unlock(&file_access_lock);
                                         free(mp);
                                         continue;
                                 }
                                 if (filecache_copy(e_p, entry_p) != 0) {
                                         printd(1, "listrar: filecache_copy failed for filecopy\n");
                                         filecache_invalidate(mp);
-                                        pthread_rwlock_unlock(&file_access_lock);
+                                        shlock_unlock(&file_access_lock);
                                         free(mp);
                                         continue;
                                 }
@@ -3804,12 +5966,14 @@ static int listrar_internal(const char *path, struct dir_entry_list **buffer,
 
                 entry_p = __listrar_tocache(mp, arc, arch, *first_arch, &d);
                 if (entry_p == NULL) {
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock(&file_access_lock);
                         free(mp);
                         continue;
                 }
 
 cache_hit:
+                __nested_image_track(entry_p->rar_p, mp);
+
                 /* Recursive unpacking: Process nested RAR files recursively */
                 if (ctx && !IS_RAR_DIR(&arc->hdr)) {
                         /* Check if file has .rar extension (fast-path) */
@@ -3827,7 +5991,7 @@ cache_hit:
                                        arc->hdr.FileName, arch);
                                 struct dir_entry_list *nested_buffer = process_nested_rar(arch,
                                                                      arc->hdr.FileName,
-                                                                     path, ctx);
+                                                                     path, entry_p, ctx);
                                 if (nested_buffer != NULL) {
                                         /* Success - hide the nested RAR file */
                                         entry_p->hide_from_listing = 1;
@@ -3836,18 +6000,16 @@ cache_hit:
                                                arc->hdr.FileName);
 
                                         /* Recursive unpacking: Merge nested buffer into parent buffer */
-                                        if (buffer && *buffer && nested_buffer->next) {
+                                        if (buffer && *buffer && dir_list_count(nested_buffer)) {
                                                 printd(2, "====> Merging nested buffer into parent buffer\n");
-                                                struct dir_entry_list *merge_result =
-                                                        dir_list_append(*buffer, nested_buffer);
-                                                if (merge_result == NULL) {
+                                                if (dir_list_append(*buffer, nested_buffer)) {
                                                         printd(1, "WARNING: dir_list_append failed for nested RAR %s\n",
                                                                arc->hdr.FileName);
                                                 } else {
                                                         printd(2, "====> Successfully merged nested entries "
                                                                   "from %s\n", arc->hdr.FileName);
                                                 }
-                                        } else if (nested_buffer->next) {
+                                        } else if (dir_list_count(nested_buffer)) {
                                                 printd(2, "====> Note: nested buffer has entries but parent "
                                                           "buffer not available for merge\n");
                                         } else {
@@ -3867,7 +6029,7 @@ cache_hit:
                         }
                 }
 
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock(&file_access_lock);
                 __add_filler(path, buffer, mp);
                 if (IS_RAR_DIR(&arc->hdr))
                         __listrar_cachedir(mp);
@@ -3877,7 +6039,7 @@ cache_hit:
 
 out:
         RARFreeArchiveDataEx(&arc);
-        RARCloseArchive(hdl);
+        keycache_close(hdl, &d);
         free(tmp1);
 
         /* Clean up recursion context if we own it */
@@ -3939,29 +6101,313 @@ static int f1(SCANDIR_ARG3 e)
                         IS_CBR(e->d_name);
 }
 
-static int f2(SCANDIR_ARG3 e)
+static int f2(SCANDIR_ARG3 e)
+{
+        /*
+         * We could maybe fallback to using lstat() here if
+         * _DIRENT_HAVE_D_TYPE is not defined. But it is probably
+         * way to slow to use in filters. That would also require
+         * calls to getcwd() etc. since the current path is not
+         * known in this context.
+         */
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (e->d_type != DT_UNKNOWN)
+                return IS_RXX(e->d_name) && e->d_type == DT_REG;
+#endif
+        return IS_RXX(e->d_name);
+}
+
+struct filter_ops {
+        int (*filter[3]) (SCANDIR_ARG3);
+        unsigned int f_end;
+        unsigned int f_nrm;
+        unsigned int f_rar;
+        unsigned int f_rxx;
+};
+
+#define LIST_THREADS_DEFAULT 4
+#define URING_DEPTH 256
+
+/*
+ * Archive sets found by __resolve_dir() are listed by the list pool,
+ * one job per set since the volumes of a set must be processed in
+ * order. Jobs are owned by their batch which is released by whoever
+ * drops the last reference, the waiter or a job that completes after
+ * the deadline passed.
+ */
+struct list_vol {
+        char *arch;
+        char *name;
+        int scan;
+};
+
+struct list_batch;
+
+struct list_job {
+        struct list_batch *batch;
+        struct list_vol *vols;
+        int n_vols;
+        int max_vols;
+        int nrm;
+        int errors;
+        int done;
+        struct dir_entry_list list;
+        struct dir_entry_list nrm_list;
+        struct list_job *next;
+};
+
+struct list_batch {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        char *dir;
+        int pending;
+        int limit;              /* jobs in flight, 0 = no limit */
+        int refs;
+        struct list_job *head;
+        struct list_job *tail;
+};
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static struct list_batch *__list_batch_new(const char *dir)
+{
+        struct list_batch *b = calloc(1, sizeof(struct list_batch));
+        if (!b)
+                return NULL;
+        b->dir = strdup(dir);
+        if (!b->dir) {
+                free(b);
+                return NULL;
+        }
+        pthread_mutex_init(&b->lock, NULL);
+        pthread_cond_init(&b->cond, NULL);
+        b->refs = 1;
+        return b;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __list_batch_free(struct list_batch *b)
+{
+        struct list_job *job = b->head;
+
+        while (job) {
+                struct list_job *tmp = job;
+                int i;
+                for (i = 0; i < job->n_vols; i++) {
+                        free(job->vols[i].arch);
+                        free(job->vols[i].name);
+                }
+                free(job->vols);
+                dir_list_free(&job->list);
+                dir_list_free(&job->nrm_list);
+                job = job->next;
+                free(tmp);
+        }
+        pthread_cond_destroy(&b->cond);
+        pthread_mutex_destroy(&b->lock);
+        free(b->dir);
+        free(b);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static struct list_job *__list_job_new(struct list_batch *b, int nrm)
+{
+        struct list_job *job = calloc(1, sizeof(struct list_job));
+        if (!job)
+                return NULL;
+        job->batch = b;
+        job->nrm = nrm;
+        dir_list_open(&job->list);
+        dir_list_open(&job->nrm_list);
+        if (b->tail)
+                b->tail->next = job;
+        else
+                b->head = job;
+        b->tail = job;
+        return job;
+}
+
+/*!
+ *****************************************************************************
+ * Add a volume to 'job'. On success ownership of 'arch' is transferred.
+ ****************************************************************************/
+static int __list_job_add(struct list_job *job, char *arch, const char *name,
+                int scan)
+{
+        struct list_vol *v;
+
+        if (job->n_vols == job->max_vols) {
+                int max = job->max_vols ? job->max_vols * 2 : 8;
+                v = realloc(job->vols, max * sizeof(struct list_vol));
+                if (!v)
+                        return -ENOMEM;
+                job->vols = v;
+                job->max_vols = max;
+        }
+        v = &job->vols[job->n_vols];
+        v->name = strdup(name);
+        if (!v->name)
+                return -ENOMEM;
+        v->arch = arch;
+        v->scan = scan;
+        ++job->n_vols;
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Same logic as applied by __resolve_dir() in the sequential case.
+ ****************************************************************************/
+static void __list_job_run(struct list_job *job)
+{
+        struct dir_entry_list *next = &job->list;
+        char *first_arch = NULL;
+        int error_cnt = 0;
+        int final = 0;
+        int i;
+
+        for (i = 0; i < job->n_vols; i++) {
+                if (job->vols[i].scan && !final && !error_cnt) {
+                        if (listrar(job->batch->dir, &next, job->vols[i].arch,
+                                    &first_arch, &final)) {
+                                ++job->errors;
+                                ++error_cnt;
+                        }
+                }
+                if (error_cnt && job->nrm)
+                        (void)dir_entry_add(&job->nrm_list, job->vols[i].name,
+                                            NULL, DIR_E_NRM);
+        }
+        free(first_arch);
+}
+
+/*!
+ *****************************************************************************
+ * Lets the header-only scanner use idle list workers, see
+ * RARSetScanSubmitEx().
+ ****************************************************************************/
+static int __scan_submit(void (*fn)(void *), void *arg)
+{
+        return threadpool_trysubmit(list_pool, fn, arg);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __list_task(void *data)
+{
+        struct list_job *job = data;
+        struct list_batch *b = job->batch;
+        int last;
+
+        __list_job_run(job);
+
+        pthread_mutex_lock(&b->lock);
+        job->done = 1;
+        --b->pending;
+        last = !--b->refs;
+        pthread_cond_signal(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+        if (last)
+                __list_batch_free(b);
+}
+
+/*!
+ *****************************************************************************
+ * Hand 'job' to the list pool, or run it right away if that fails.
+ ****************************************************************************/
+static void __list_job_submit(struct list_job *job)
+{
+        struct list_batch *b = job->batch;
+
+        pthread_mutex_lock(&b->lock);
+        while (b->limit && b->pending >= b->limit)
+                pthread_cond_wait(&b->cond, &b->lock);
+        ++b->pending;
+        ++b->refs;
+        pthread_mutex_unlock(&b->lock);
+        if (!threadpool_submit(list_pool, __list_task, job))
+                return;
+
+        pthread_mutex_lock(&b->lock);
+        --b->pending;
+        --b->refs;
+        pthread_mutex_unlock(&b->lock);
+        __list_job_run(job);
+        job->done = 1;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __list_splice(struct dir_entry_list **next,
+                struct dir_entry_list *list)
 {
-        /*
-         * We could maybe fallback to using lstat() here if
-         * _DIRENT_HAVE_D_TYPE is not defined. But it is probably
-         * way to slow to use in filters. That would also require
-         * calls to getcwd() etc. since the current path is not
-         * known in this context.
-         */
-#ifdef _DIRENT_HAVE_D_TYPE
-        if (e->d_type != DT_UNKNOWN)
-                return IS_RXX(e->d_name) && e->d_type == DT_REG;
-#endif
-        return IS_RXX(e->d_name);
+        if (!*next)
+                return;
+        (void)dir_list_append(*next, list);
+        dir_list_free(list);
 }
 
-struct filter_ops {
-        int (*filter[3]) (SCANDIR_ARG3);
-        unsigned int f_end;
-        unsigned int f_nrm;
-        unsigned int f_rar;
-        unsigned int f_rxx;
-};
+/*!
+ *****************************************************************************
+ * Wait for the jobs of 'b' to finish, or for the deadline to pass, and
+ * merge the result of all completed jobs. Every job that did not complete
+ * in time is accounted for as an error to prevent the partial result from
+ * being cached. The batch must not be accessed after this call.
+ ****************************************************************************/
+static int __list_batch_wait(struct list_batch *b,
+                struct dir_entry_list **next,
+                struct dir_entry_list **next2)
+{
+        struct list_job *job;
+        int timeout = OPT_SET(OPT_KEY_LIST_TIMEOUT)
+                ? OPT_INT(OPT_KEY_LIST_TIMEOUT, 0) : 0;
+        struct timespec ts;
+        int errors = 0;
+        int last;
+
+        pthread_mutex_lock(&b->lock);
+        if (timeout > 0) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += timeout;
+        }
+        while (b->pending) {
+                if (timeout <= 0) {
+                        pthread_cond_wait(&b->cond, &b->lock);
+                } else if (pthread_cond_timedwait(&b->cond, &b->lock,
+                                                  &ts) == ETIMEDOUT) {
+                        printd(2, "%s: listing deadline passed with %d jobs pending\n",
+                               b->dir, b->pending);
+                        break;
+                }
+        }
+        for (job = b->head; job; job = job->next) {
+                if (!job->done) {
+                        ++errors;
+                        continue;
+                }
+                errors += job->errors;
+                __list_splice(next2, &job->list);
+                if (next)
+                        __list_splice(next, &job->nrm_list);
+        }
+        last = !--b->refs;
+        pthread_mutex_unlock(&b->lock);
+        if (last)
+                __list_batch_free(b);
+        return errors;
+}
 
 /*!
  *****************************************************************************
@@ -3977,8 +6423,19 @@ static int __resolve_dir(const char *dir, const char *root,
         int error_tot = 0;
         int seek_len = 0;
         char *first_arch = NULL;
+        struct list_batch *batch = NULL;
+        struct list_job *job = NULL;
         int ret = 0;
 
+        if (list_pool && next2) {
+                /* A per-directory limit of 0 means sequential listing */
+                int limit = get_profile_prop(dir, RAR_LIST_THREADS_PROP);
+                if (limit)
+                        batch = __list_batch_new(dir);
+                if (batch && limit > 0)
+                        batch->limit = limit;
+        }
+
         for (f = 0; f < f_ops->f_end; f++) {
                 off_t prev_size = 0;
                 size_t prev_len = 0;
@@ -3997,11 +6454,12 @@ static int __resolve_dir(const char *dir, const char *root,
                 while (i < n) {
                         int pos = 0;
                         int pos2 = 0;
+                        int scan;
                         char *arch = NULL;
 
                         if (f == f_ops->f_nrm && next) {
-                                *next = dir_entry_add(*next, namelist[i]->d_name,
-                                                      NULL, DIR_E_NRM);
+                                (void)dir_entry_add(*next, namelist[i]->d_name,
+                                                    NULL, DIR_E_NRM);
                                 goto next_entry;
                         }
 
@@ -4059,21 +6517,37 @@ static int __resolve_dir(const char *dir, const char *root,
                                 free(first_arch);
                                 first_arch = NULL;
                                 vcnt = f == f_ops->f_rxx;
+                                ++listed_sets;
+                                if (job)
+                                        __list_job_submit(job);
+                                job = batch ? __list_job_new(batch,
+                                                             next != NULL)
+                                            : NULL;
                         }
 
-                        if (!seek_len || vcnt < seek_len) {
+                        scan = !seek_len || vcnt < seek_len;
+                        if (scan)
                                 ++vcnt;
-                                if (!final && !error_cnt) {
-                                        if (listrar(dir, next2, arch,
-                                                    &first_arch, &final)) {
-                                                ++error_tot;
-                                                ++error_cnt;
-                                        }
+                        if (job) {
+                                if (__list_job_add(job, arch,
+                                                   namelist[i]->d_name,
+                                                   scan)) {
+                                        free(arch);
+                                        ++error_tot;
+                                }
+                                goto next_entry;
+                        }
+
+                        if (scan && !final && !error_cnt) {
+                                if (listrar(dir, next2, arch,
+                                            &first_arch, &final)) {
+                                        ++error_tot;
+                                        ++error_cnt;
                                 }
                         }
                         if (error_cnt && next)
-                                *next = dir_entry_add(*next, namelist[i]->d_name,
-                                                      NULL, DIR_E_NRM);
+                                (void)dir_entry_add(*next, namelist[i]->d_name,
+                                                    NULL, DIR_E_NRM);
                         free(arch);
                         arch = NULL;
 
@@ -4082,6 +6556,10 @@ next_entry:
                 }
 
 next_type:
+                if (job) {
+                        __list_job_submit(job);
+                        job = NULL;
+                }
                 if (namelist) {
                         for (i = 0; i < n; i++)
                                 free(namelist[i]);
@@ -4093,6 +6571,8 @@ next_type:
                         break;
         }
 
+        if (batch)
+                error_tot += __list_batch_wait(batch, next, next2);
         free(first_arch);
 
         return ret < 0 ? ret : error_tot;
@@ -4170,9 +6650,9 @@ static int syncdir(const char *path)
         struct dir_entry_list *dir_list; /* internal list root */
         struct dir_entry_list *next;
 
-        pthread_rwlock_rdlock(&dir_access_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
         entry_p = dircache_get(path);
-        pthread_rwlock_unlock(&dir_access_lock);
+        shlock_unlock_key(&dir_access_lock, path);
         if (entry_p)
                 return 0;
 
@@ -4201,12 +6681,15 @@ static int syncdir(const char *path)
                         return res < 0 ? res : 0;
                 }
 
-                pthread_rwlock_wrlock(&dir_access_lock);
+                dir_list_close(dir_list);
+                shlock_wrlock_key(&dir_access_lock, path);
                 entry_p = dircache_alloc(path);
                 if (entry_p)
                         entry_p->dir_entry_list = *dir_list;
+                else
+                        dir_list_free(dir_list);
                 free(dir_list);
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, path);
         }
 
         return 0;
@@ -4225,9 +6708,9 @@ static int syncrar(const char *path)
         struct dir_entry_list *next;
         char *first_arch;
 
-        pthread_rwlock_rdlock(&dir_access_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
         entry_p = dircache_get(path);
-        pthread_rwlock_unlock(&dir_access_lock);
+        shlock_unlock_key(&dir_access_lock, path);
         if (entry_p)
                 return 0;
 
@@ -4241,28 +6724,30 @@ static int syncrar(const char *path)
                 return -ENOMEM;
         dir_list_open(next);
 
-        int c = 0;
+        unsigned int c = 0;
         int final = 0;
         /* We always need to scan at least two volume files */
         int c_end = get_seek_length(NULL);
         c_end = c_end ? c_end == 1 ? 2 : c_end : c_end;
-        struct dir_entry_list *arch_next = arch_list_root.next;
 
-        dir_list_open(dir_list);
-        first_arch = arch_next->entry.name;
-        while (arch_next) {
-                (void)listrar(path, &next, arch_next->entry.name,
+        first_arch = dir_list_count(arch_list) ?
+                dir_list_entry(arch_list, 0)->name : NULL;
+        while (c < dir_list_count(arch_list)) {
+                (void)listrar(path, &next, dir_list_entry(arch_list, c)->name,
                                         &first_arch, &final);
-                if ((++c == c_end) || final)
+                if ((++c == (unsigned int)c_end) || final)
                         break;
-                arch_next = arch_next->next;
         }
 
-        pthread_rwlock_wrlock(&dir_access_lock);
+        dir_list_close(dir_list);
+        shlock_wrlock_key(&dir_access_lock, path);
         entry_p = dircache_alloc(path);
         if (entry_p)
                 entry_p->dir_entry_list = *dir_list;
-        pthread_rwlock_unlock(&dir_access_lock);
+        else
+                dir_list_free(dir_list);
+        shlock_unlock_key(&dir_access_lock, path);
+        free(dir_list);
 
         return 0;
 }
@@ -4278,25 +6763,25 @@ static int rar2_getattr(const char *path, struct stat *stbuf, struct fuse_file_i
         struct filecache_entry *entry_p;
         (void)fi;               /* touch */
 
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         entry_p = path_lookup(path, stbuf);
         if (entry_p) {
                 if (entry_p != LOOP_FS_ENTRY) {
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, path);
                         dump_stat(stbuf);
                         return 0;
                 }
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 return -ENOENT;
         }
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, path);
 
         /*
          * There was a cache miss and the file could not be found locally!
          * This is bad! To make sure the files does not really exist all
          * rar archives need to be scanned for a matching file = slow!
          */
-        if (OPT_FILTER(path))
+        if (OPT_FILTER(path) || negcache_get(path))
                 return -ENOENT;
         char *safe_path = strdup(path);
         if (!safe_path) {
@@ -4312,14 +6797,14 @@ static int rar2_getattr(const char *path, struct stat *stbuf, struct fuse_file_i
         }
         free(tmp);
 
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         entry_p = path_lookup(path, stbuf);
         if (entry_p) {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 dump_stat(stbuf);
                 return 0;
         }
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, path);
 
 #if RARVER_MAJOR > 4
         int cmd = 0;
@@ -4351,6 +6836,7 @@ static int rar2_getattr(const char *path, struct stat *stbuf, struct fuse_file_i
         }
 #endif
 
+        negcache_add(path);
         return -ENOENT;
 }
 
@@ -4365,13 +6851,13 @@ static int rar2_getattr2(const char *path, struct stat *stbuf, struct fuse_file_
         int res;
         (void)fi;               /* touch */
 
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         if (path_lookup(path, stbuf)) {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 dump_stat(stbuf);
                 return 0;
         }
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, path);
 
         /*
          * There was a cache miss! To make sure the file does not really
@@ -4379,18 +6865,20 @@ static int rar2_getattr2(const char *path, struct stat *stbuf, struct fuse_file_
          * This should not happen very frequently unless the contents of
          * the rar archive was actually changed after it was mounted.
          */
+        if (negcache_get(path))
+                return -ENOENT;
         res = syncrar("/");
         if (res)
                 return res;
 
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         struct filecache_entry *entry_p = path_lookup(path, stbuf);
         if (entry_p) {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 dump_stat(stbuf);
                 return 0;
         }
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, path);
 
 #if RARVER_MAJOR > 4
         int cmd = 0;
@@ -4420,67 +6908,112 @@ static int rar2_getattr2(const char *path, struct stat *stbuf, struct fuse_file_
         }
 #endif
 
+        negcache_add(path);
         return -ENOENT;
 }
 
+/*!
+ *****************************************************************************
+ * Resolve the attributes of directory entry 'e' the same way getattr()
+ * would, but without falling back to a full scan on a cache miss.
+ * Returns 0 if 'st' is filled in, -1 if the attributes are unknown and 1 if
+ * the entry should not be listed at all.
+ ****************************************************************************/
+static int __readdir_attr(const char *path, struct dir_entry *e, int dfd,
+                struct stat *st)
+{
+        struct filecache_entry *entry_p;
+        char *mp;
+        int res = -1;
+
+        ABS_MP2(mp, path, e->name);
+        if (!mp)
+                return -1;
+        shlock_rdlock_key(&file_access_lock, mp);
+        entry_p = filecache_get(mp);
+        if (entry_p) {
+                /* Recursive unpacking: Filter hidden entries (nested RARs) */
+                if (entry_p->hide_from_listing && e->type == DIR_E_RAR) {
+                        res = 1;
+                } else if (!entry_p->flags.unresolved) {
+                        memcpy(st, &entry_p->stat, sizeof(struct stat));
+                        res = 0;
+                }
+        }
+        shlock_unlock_key(&file_access_lock, mp);
+        free(mp);
+
+        if (!entry_p && e->type == DIR_E_NRM && dfd != -1 &&
+            !fstatat(dfd, e->name, st, AT_SYMLINK_NOFOLLOW))
+                res = 0;
+        return res;
+}
+
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
 static void dump_dir_list(const char *path, void *buffer, fuse_fill_dir_t filler,
-                struct dir_entry_list *next, enum fuse_readdir_flags flags)
+                struct dir_entry_list *list, off_t offset, int dots,
+                enum fuse_readdir_flags flags)
 {
         ENTER_("%s", path);
 
-#if 0
-        struct filecache_entry *entry_p;
-        int do_inval_cache = 1;
-#endif
-        /*  path is now used for hide_from_listing checks */
-        (void)flags;            /* touch */
+        int plus = flags & FUSE_READDIR_PLUS;
+        int dfd = -1;
+        unsigned int i;
+
+        /*
+         * Offsets 1 and 2 are reserved for the dot entries and entry i of
+         * the (sorted) list is at offset i + 3. This makes it possible to
+         * resume a listing from any offset without scanning it again.
+         */
+        if (dots && offset < 1 && filler(buffer, ".", NULL, 1, 0))
+                return;
+        if (dots && offset < 2 && filler(buffer, "..", NULL, 2, 0))
+                return;
+
+        /* Regular files are not in the cache, stat them relative to here */
+        if (plus && mount_type == MOUNT_FOLDER) {
+                char *root;
+                ABS_ROOT(root, path);
+                dfd = open(root, O_RDONLY | O_DIRECTORY);
+        }
+
+        for (i = offset > 2 ? offset - 2 : 0; i < dir_list_count(list); i++) {
+                struct dir_entry *e = dir_list_entry(list, i);
+                struct stat st;
+                int res;
 
-        next = next->next;
-        while (next) {
                 /*
-                 * Purge invalid entries from the cache, display the rest.
+                 * Skip invalid entries, display the rest.
                  * Collisions are rare but might occur when a file inside
                  * a RAR archives share the same name with a file in the
                  * back-end fs. The latter will prevail in all cases unless
                  * the directory cache is currently in effect.
                  */
-                if (next->entry.valid) {
-                        /* Recursive unpacking: Filter hidden entries (nested RARs) */
-                        if (next->entry.type == DIR_E_RAR) {
-                                char *full_path;
-                                ABS_MP2(full_path, path, next->entry.name);
-                                struct filecache_entry *cache_entry = filecache_get(full_path);
-                                if (cache_entry && cache_entry->hide_from_listing) {
-                                        printd(4, "Filtering hidden entry: %s\n", next->entry.name);
-                                        free(full_path);
-                                        next = next->next;
-                                        continue;
-                                }
-                                free(full_path);
-                        }
-                        filler(buffer, next->entry.name, next->entry.st, 0, FUSE_FILL_DIR_PLUS);
-/* TODO: If/when folder cache becomes optional this needs to be revisted */
-#if 0
-                        if (next->entry.type == DIR_E_RAR)
-                                do_inval_cache = 0;
-                        else
-                                do_inval_cache = 1;
-                } else {
-                        if (do_inval_cache ||
-                            next->entry.type == DIR_E_NRM) { /* Oops! */
-                                char *tmp;
-                                ABS_MP2(tmp, path, next->entry.name);
-                                filecache_invalidate(tmp);
-                                free(tmp);
-                        }
-#endif
+                if (!e->valid)
+                        continue;
+
+                /*
+                 * Attributes are taken from the file cache rather than from
+                 * e->st since the latter is not guaranteed to be valid for
+                 * as long as the listing is. Entries for which the
+                 * attributes are not known are listed without them and
+                 * resolved through getattr() as usual.
+                 */
+                res = e->type == DIR_E_RAR || plus
+                        ? __readdir_attr(path, e, dfd, &st) : -1;
+                if (res > 0) {
+                        printd(4, "Filtering hidden entry: %s\n", e->name);
+                        continue;
                 }
-                next = next->next;
+                if (filler(buffer, e->name, res ? NULL : &st, i + 3,
+                           !res && plus ? FUSE_FILL_DIR_PLUS : 0))
+                        break;
         }
+        if (dfd != -1)
+                close(dfd);
 }
 
 /*!
@@ -4495,6 +7028,7 @@ static int rar2_opendir2(const char *path, struct fuse_file_info *fi)
         if (!FH_ISSET(fi->fh))
                 return -ENOMEM;
         FH_SETTYPE(fi->fh, IO_TYPE_DIR);
+        dir_list_open(&FH_TOIO(fi->fh)->dir);
         FH_SETPATH(fi->fh, strdup(path));
 
         /* Enable kernel readdir caching (archives are immutable) */
@@ -4539,6 +7073,7 @@ opendir_ok:
                 return -ENOMEM;
         }
         FH_SETTYPE(fi->fh, IO_TYPE_DIR);
+        dir_list_open(&FH_TOIO(fi->fh)->dir);
         FH_SETDP(fi->fh, dp);
         FH_SETPATH(fi->fh, strdup(path));
 
@@ -4558,7 +7093,6 @@ static int rar2_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
         ENTER_("%s", (path ? path : ""));
 
         int ret = 0;
-        (void)offset;           /* touch */
 
         if (!FH_ISSET(fi->fh)) {
                 printd(1, "readdir: bad I/O handle (fh is NULL)\n");
@@ -4569,6 +7103,13 @@ static int rar2_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
         if (io == NULL)
                 return -EIO;
 
+        /* Continue a listing already made through this handle */
+        if (offset && dir_list_count(&io->dir)) {
+                dump_dir_list(path ? path : FH_TOPATH(fi->fh), buffer, filler,
+                              &io->dir, offset, 1, flags);
+                return 0;
+        }
+
         struct dir_entry_list dir_list;               /* internal list root */
         struct dir_entry_list *next = &dir_list;
         struct dir_entry_list *dir_list2 = NULL;      /* internal list root */
@@ -4577,10 +7118,10 @@ static int rar2_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
         dir_list_open(next);
 
         path = path ? path : FH_TOPATH(fi->fh);
-        pthread_rwlock_rdlock(&dir_access_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
         struct dircache_entry *entry_p = dircache_get(path);
         if (!entry_p) {
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, path);
                 dir_list2 = malloc(sizeof(struct dir_entry_list));
                 if (!dir_list2)
                         return -ENOMEM;
@@ -4588,7 +7129,7 @@ static int rar2_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
                 dir_list_open(dir_list2);
         } else {
                 dir_list2 = dir_list_dup(&entry_p->dir_entry_list);
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, path);
         }
 
         DIR *dp = FH_TODP(fi->fh);
@@ -4629,38 +7170,40 @@ static int rar2_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
                 syncdir(safe_path);
         }
         free(tmp);
-        pthread_rwlock_rdlock(&dir_access_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
         entry_p = dircache_get(path);
         if (entry_p) {
                 free(dir_list2);
                 dir_list2 = dir_list_dup(&entry_p->dir_entry_list);
         }
-        pthread_rwlock_unlock(&dir_access_lock);
+        shlock_unlock_key(&dir_access_lock, path);
 
 dump_buff:
 
-        if (dp == NULL) {
-                filler(buffer, ".", NULL, 0, FUSE_FILL_DIR_PLUS);
-                filler(buffer, "..", NULL, 0, FUSE_FILL_DIR_PLUS);
-        }
-
+        /* Sort what goes into the cache first so that it can be shared */
+        if (!entry_p)
+                dir_list_close(dir_list2);
         (void)dir_list_append(&dir_list, dir_list2);
         dir_list_close(&dir_list);
 
         if (!entry_p) {
-                pthread_rwlock_wrlock(&dir_access_lock);
+                shlock_wrlock_key(&dir_access_lock, path);
                 entry_p = dircache_alloc(path);
                 if (entry_p)
                         entry_p->dir_entry_list = *dir_list2;
-                pthread_rwlock_unlock(&dir_access_lock);
+                else
+                        dir_list_free(dir_list2);
+                shlock_unlock_key(&dir_access_lock, path);
                 free(dir_list2);
         } else {
                 dir_list_free(dir_list2);
                 free(dir_list2);
         }
 
-        dump_dir_list(path, buffer, filler, &dir_list, flags);
-        dir_list_free(&dir_list);
+        dir_list_free(&io->dir);
+        io->dir = dir_list;
+        dump_dir_list(path, buffer, filler, &io->dir, offset, dp == NULL,
+                      flags);
 
         return ret;
 
@@ -4668,12 +7211,13 @@ dump_buff_nocache:
 
         (void)dir_list_append(&dir_list, dir_list2);
         dir_list_close(&dir_list);
-
-        dump_dir_list(path, buffer, filler, &dir_list, flags);
-        dir_list_free(&dir_list);
         dir_list_free(dir_list2);
         free(dir_list2);
 
+        dir_list_free(&io->dir);
+        io->dir = dir_list;
+        dump_dir_list(path, buffer, filler, &io->dir, offset, 0, flags);
+
         return ret < 0 ? ret : 0;
 }
 
@@ -4687,61 +7231,67 @@ static int rar2_readdir2(const char *path, void *buffer,
 {
         ENTER_("%s", (path ? path : ""));
 
-        (void)offset;           /* touch */
-        (void)flags;            /* touch */
-
         struct dir_entry_list *dir_list; /* internal list root */
+        struct io_handle *io = FH_TOIO(fi->fh);
+
+        /* Continue a listing already made through this handle */
+        if (offset && dir_list_count(&io->dir)) {
+                dump_dir_list(FH_TOPATH(fi->fh), buffer, filler, &io->dir,
+                              offset, 1, flags);
+                return 0;
+        }
 
         path = path ? path : FH_TOPATH(fi->fh);
-        pthread_rwlock_rdlock(&dir_access_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
         struct dircache_entry *entry_p = dircache_get(path);
         if (!entry_p) {
-                int c = 0;
+                unsigned int c = 0;
                 int final = 0;
                 char *first_arch;
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, path);
                 dir_list = malloc(sizeof(struct dir_entry_list));
                 if (!dir_list) {
                         printd(1, "rar2_readdir2: malloc failed for dir_list\n");
                         return -ENOMEM;
                 }
-                struct dir_entry_list *next = dir_list;
-                if (!next)
-                        return -ENOMEM;
 
                 /* We always need to scan at least two volume files */
                 int c_end = get_seek_length(NULL);
                 c_end = c_end ? c_end == 1 ? 2 : c_end : c_end;
-                struct dir_entry_list *arch_next = arch_list_root.next;
 
-                dir_list_open(next);
-                first_arch = arch_next->entry.name;
-                while (arch_next) {
-                        (void)listrar(FH_TOPATH(fi->fh), &next,
-                                                        arch_next->entry.name,
-                                                        &first_arch,
-                                                        &final);
-                        if ((++c == c_end) || final)
+                dir_list_open(dir_list);
+                first_arch = dir_list_count(arch_list) ?
+                        dir_list_entry(arch_list, 0)->name : NULL;
+                while (c < dir_list_count(arch_list)) {
+                        (void)listrar(FH_TOPATH(fi->fh), &dir_list,
+                                      dir_list_entry(arch_list, c)->name,
+                                      &first_arch, &final);
+                        if ((++c == (unsigned int)c_end) || final)
                                 break;
-                        arch_next = arch_next->next;
                 }
         } else {
                 dir_list = dir_list_dup(&entry_p->dir_entry_list);
-                pthread_rwlock_unlock(&dir_access_lock);
+                shlock_unlock_key(&dir_access_lock, path);
+                if (!dir_list)
+                        return -ENOMEM;
         }
 
-        filler(buffer, ".", NULL, 0, FUSE_FILL_DIR_PLUS);
-        filler(buffer, "..", NULL, 0, FUSE_FILL_DIR_PLUS);
-
         dir_list_close(dir_list);
-        dump_dir_list(FH_TOPATH(fi->fh), buffer, filler, dir_list, flags);
+
+        /* The handle keeps its own reference for later offsets */
+        dir_list_free(&io->dir);
+        (void)dir_list_append(&io->dir, dir_list);
+        dump_dir_list(FH_TOPATH(fi->fh), buffer, filler, &io->dir, offset,
+                      1, flags);
 
         if (!entry_p) {
-                pthread_rwlock_wrlock(&dir_access_lock);
+                shlock_wrlock_key(&dir_access_lock, path);
                 entry_p = dircache_alloc(path);
                 if (entry_p)
                         entry_p->dir_entry_list = *dir_list;
-                pthread_rwlock_unlock(&dir_access_lock);
+                else
+                        dir_list_free(dir_list);
+                shlock_unlock_key(&dir_access_lock, path);
                 free(dir_list);
         } else {
                 dir_list_free(dir_list);
@@ -4764,6 +7314,7 @@ static int rar2_releasedir2(const char *path, struct fuse_file_info *fi)
         struct io_handle *io = FH_TOIO(fi->fh);
         if (io == NULL)
                 return -EIO;
+        dir_list_free(&io->dir);
         free(FH_TOPATH(fi->fh));
         free(FH_TOIO(fi->fh));
         FH_ZERO(fi->fh);
@@ -4787,6 +7338,7 @@ static int rar2_releasedir(const char *path, struct fuse_file_info *fi)
         DIR *dp = FH_TODP(fi->fh);
         if (dp && dp != FS_LOOP_ROOT_DP)
                 closedir(dp);
+        dir_list_free(&io->dir);
         free(FH_TOPATH(fi->fh));
         free(FH_TOIO(fi->fh));
         FH_ZERO(fi->fh);
@@ -4805,22 +7357,10 @@ static void *reader_task(void *arg)
 
         for (;;) {
                 int req;
-                struct timespec ts;
                 pthread_mutex_lock(&op->rd_req_mutex);
-restart:
-                clock_gettime(CLOCK_REALTIME, &ts);
-                ts.tv_sec += 1;
-                while (op->rd_req == RD_IDLE) {
-                        if (pthread_cond_timedwait(&op->rd_req_cond,
-                                        &op->rd_req_mutex, &ts) == ETIMEDOUT) {
-                                if (fs_terminated) {
-                                        pthread_mutex_unlock(&op->rd_req_mutex);
-                                        goto out;
-                                }
-                                goto restart;
-                        }
-                        continue;
-                }
+                /* Sleep until there is something to do, see __wake_thread() */
+                while (op->rd_req == RD_IDLE)
+                        pthread_cond_wait(&op->rd_req_cond, &op->rd_req_mutex);
                 req = op->rd_req;
                 pthread_mutex_unlock(&op->rd_req_mutex);
 
@@ -4828,9 +7368,9 @@ restart:
                         goto out;
                 printd(4, "Reader thread wakeup (fp:%p)\n", op->fp);
                 if (req != RD_SYNC_NOREAD && !feof(op->fp))
-                        (void)iob_write(op->buf, op->fp, IOB_SAVE_HIST);
+                        __iob_fill(op);
                 pthread_mutex_lock(&op->rd_req_mutex);
-                op->rd_req = RD_IDLE;
+                __atomic_store_n(&op->rd_req, RD_IDLE, __ATOMIC_RELEASE);
                 pthread_cond_signal(&op->rd_req_cond); /* sync */
                 pthread_mutex_unlock(&op->rd_req_mutex);
         }
@@ -4840,6 +7380,70 @@ out:
         return NULL;
 }
 
+/*!
+ *****************************************************************************
+ * Read the range table of an index file into 'idx'. A version 1 index is
+ * treated as holding a single range directly following the header.
+ ****************************************************************************/
+static int load_index_ranges(struct idx_info *idx, int fd,
+                const struct idx_head *h, off_t file_size)
+{
+        uint64_t fsz = file_size;
+        struct idx_table t;
+        uint32_t i;
+
+        if (h->version == R2I_VERSION) {
+                idx->range = malloc(sizeof(struct idx_range));
+                if (!idx->range)
+                        return -1;
+                idx->range->offset = ntoh64(h->offset);
+                idx->range->size = ntoh64(h->size);
+                idx->range->data = sizeof(struct idx_head);
+                if (idx->range->size > fsz - sizeof(struct idx_head))
+                        idx->range->size = fsz - sizeof(struct idx_head);
+                idx->count = 1;
+                return 0;
+        }
+        if (h->version != R2I_VERSION_2) {
+                syslog(LOG_INFO, "preloaded index header version %u not supported",
+                       ntohs(h->version));
+                return -1;
+        }
+
+        if (pread(fd, &t, sizeof(t), sizeof(struct idx_head)) != sizeof(t))
+                return -1;
+        t.count = ntohl(t.count);
+        if (!t.count || t.count > (fsz / sizeof(struct idx_range)))
+                return -1;
+        idx->range = malloc(t.count * sizeof(struct idx_range));
+        if (!idx->range)
+                return -1;
+        if (pread(fd, idx->range, t.count * sizeof(struct idx_range),
+                  sizeof(struct idx_head) + sizeof(t)) !=
+                        (ssize_t)(t.count * sizeof(struct idx_range)))
+                goto error;
+        for (i = 0; i < t.count; i++) {
+                struct idx_range *r = &idx->range[i];
+                r->offset = ntoh64(r->offset);
+                r->size = ntoh64(r->size);
+                r->data = ntoh64(r->data);
+                /* Ranges must be sorted, disjoint and within the file */
+                if (!r->size || r->data > fsz || r->size > fsz - r->data)
+                        goto error;
+                if (i && r->offset < idx->range[i - 1].offset +
+                                        idx->range[i - 1].size)
+                        goto error;
+        }
+        idx->count = t.count;
+        return 0;
+
+error:
+        printd(1, "invalid index range table\n");
+        free(idx->range);
+        idx->range = NULL;
+        return -1;
+}
+
 /*!
  *****************************************************************************
  *
@@ -4848,8 +7452,8 @@ static int preload_index(struct iob *buf, const char *path)
 {
         ENTER_("%s", path);
 
-        /* check for .avi or .mkv */
-        if (!IS_AVI(path) && !IS_MKV(path))
+        /* check for .avi, .mkv or .mp4 */
+        if (!IS_AVI(path) && !IS_MKV(path) && !IS_MP4(path))
                 return -1;
 
         char *r2i;
@@ -4868,53 +7472,49 @@ static int preload_index(struct iob *buf, const char *path)
         if (fd == -1)
                 return -1;
 
-#ifdef HAVE_MMAP
-        /* Map the file into address space (1st pass) */
-        struct idx_head *h = (struct idx_head *)mmap(NULL,
-                        sizeof(struct idx_head), PROT_READ, MAP_SHARED, fd, 0);
-        if (h == MAP_FAILED || h->magic != R2I_MAGIC) {
+        struct idx_head h;
+        struct stat st;
+        if (fstat(fd, &st) == -1 ||
+            pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+            h.magic != R2I_MAGIC) {
                 close(fd);
                 return -1;
         }
-        if (ntohs(h->version) == 0) {
+        if (ntohs(h.version) == 0) {
                 syslog(LOG_INFO, "preloaded index header version 0 not supported");
-                munmap((void *)h, sizeof(struct idx_head));
+                close(fd);
+                return -1;
+        }
+        if (load_index_ranges(&buf->idx, fd, &h, st.st_size)) {
                 close(fd);
                 return -1;
         }
 
-        /* Map the file into address space (2nd pass) */
-        buf->idx.data_p = (void *)mmap(NULL, P_ALIGN_(ntoh64(h->size)),
-                                               PROT_READ, MAP_SHARED, fd, 0);
-        munmap((void *)h, sizeof(struct idx_head));
+#ifdef HAVE_MMAP
+        /* Map the file into address space */
+        buf->idx.data_p = (void *)mmap(NULL, st.st_size, PROT_READ,
+                                       MAP_SHARED, fd, 0);
         if (buf->idx.data_p == MAP_FAILED) {
+                free(buf->idx.range);
+                buf->idx.range = NULL;
+                buf->idx.count = 0;
                 close(fd);
                 return -1;
         }
+        buf->idx.map_size = st.st_size;
         buf->idx.mmap = 1;
 #else
         buf->idx.data_p = malloc(sizeof(struct idx_data));
         if (!buf->idx.data_p) {
                 printd(1, "preload_index: malloc failed\n");
+                free(buf->idx.range);
+                buf->idx.range = NULL;
+                buf->idx.count = 0;
                 close(fd);
                 buf->idx.data_p = MAP_FAILED;
                 return -1;
         }
-        /* Verify complete read of index header */
-        ssize_t bytes_read = read(fd, buf->idx.data_p, sizeof(struct idx_head));
-        if (bytes_read != sizeof(struct idx_head)) {
-                printd(1, "preload_index: short read of index header (%zd of %zu bytes)\n",
-                       bytes_read, sizeof(struct idx_head));
-                close(fd);
-                free(buf->idx.data_p);
-                buf->idx.data_p = MAP_FAILED;
-                return -1;
-        }
-        if (ntohs(buf->idx.data_p->head.version) == 0) {
-                syslog(LOG_INFO, "preloaded index header version 0 not supported");
-                close(fd);
-                return -1;
-        }
+        memcpy(&buf->idx.data_p->head, &h, sizeof(h));
         buf->idx.mmap = 0;
 #endif
         buf->idx.fd = fd;
@@ -5058,10 +7658,11 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
         fi->flags &= ~(O_CREAT | O_EXCL);
 #endif
         errno = 0;
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         entry_p = path_lookup(path, NULL);
 
         if (entry_p == NULL) {
+                char *info_path = (char *)path;
 #if RARVER_MAJOR > 4
                 int cmd = 0;
                 while (file_cmd[cmd]) {
@@ -5069,34 +7670,42 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
                                 char *tmp = strdup(path);
                                 if (!tmp) {
                                         printd(1, "rar2_open: strdup failed for tmp (#info)\n");
-                                        pthread_rwlock_unlock(&file_access_lock);
+                                        shlock_unlock_key(&file_access_lock, path);
                                         return -ENOMEM;
                                 }
                                 tmp[strlen(path) - 5] = 0;
+                                /* Most likely found in another shard */
+                                shlock_unlock_key(&file_access_lock, path);
+                                shlock_rdlock_key(&file_access_lock, tmp);
                                 entry_p = path_lookup(tmp, NULL);
-                                free(tmp);
                                 if (entry_p == NULL ||
                                     entry_p == LOCAL_FS_ENTRY) {
-                                        pthread_rwlock_unlock(&file_access_lock);
+                                        shlock_unlock_key(&file_access_lock, tmp);
+                                        free(tmp);
                                         return -EIO;
                                 }
+                                info_path = tmp;
                                 break;
                         }
                         ++cmd;
                 }
 #endif
                 if (entry_p == NULL) {
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, path);
                         return -ENOENT;
                 }
                 struct io_handle *io = malloc(sizeof(struct io_handle));
                 if (!io) {
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, info_path);
+                        if (info_path != path)
+                                free(info_path);
                         return -EIO;
                 }
 
                 struct filecache_entry *e_p = filecache_clone(entry_p);
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, info_path);
+                if (info_path != path)
+                        free(info_path);
                 struct RARWcb *wcb = malloc(sizeof(struct RARWcb));
                 if (!wcb) {
                         printd(1, "rar2_open: malloc failed for wcb\n");
@@ -5122,7 +7731,7 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
         }
         if (entry_p == LOCAL_FS_ENTRY) {
                 /* In case of O_TRUNC it will simply be passed to open() */
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 ABS_ROOT(root, path);
                 return lopen(root, fi);
         }
@@ -5133,9 +7742,10 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
          * check those.
          */
         if (fi->flags & (O_WRONLY | O_TRUNC)) {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 return -EPERM;
         }
+        __get_profile(entry_p);
 
         FILE *fp = NULL;
         struct iob *buf = NULL;
@@ -5145,25 +7755,25 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
 
         if (!FH_ISSET(fi->fh)) {
                 if (entry_p->flags.raw) {
-                        fp = fopen(entry_p->rar_p, "r");
-                        if (fp != NULL) {
-                                io = malloc(sizeof(struct io_handle));
-                                op = calloc(1, sizeof(struct io_context));
-                                if (!op || !io)
+                        io = malloc(sizeof(struct io_handle));
+                        op = calloc(1, sizeof(struct io_context));
+                        if (op && io) {
+                                op->vp = volpool_get(entry_p->rar_p);
+                                if (!op->vp)
                                         goto open_error;
-                                printd(3, "Opened %s\n", entry_p->rar_p);
                                 FH_SETIO(fi->fh, io);
                                 FH_SETTYPE(fi->fh, IO_TYPE_RAW);
                                 FH_SETCONTEXT(fi->fh, op);
                                 printd(3, "(%05d) %-8s%s [%-16p]\n", getpid(), "ALLOC", path, FH_TOCONTEXT(fi->fh));
-                                pthread_mutex_init(&op->raw_read_mutex, NULL);
-                                op->fp = fp;
+                                op->fp = NULL;
                                 op->pid = 0;
                                 op->seq = 0;
                                 op->buf = NULL;
                                 op->entry_p = NULL;
                                 op->pos = 0;
-                                op->vno = -1;   /* force a miss 1:st time */
+                                op->ra_win = entry_p->profile.raw_readahead >= 0
+                                        ? (size_t)entry_p->profile.raw_readahead << 20
+                                        : raw_readahead;
 
                                 /*
                                  * Disable flushing the kernel cache of the file contents on
@@ -5184,41 +7794,97 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
                                 op->entry_p = filecache_clone(entry_p);
                                 if (!op->entry_p)
                                         goto open_error;
+
+                                /* Fail early if the archive is unreadable */
+                                if (__raw_vol_fd(op, 0) < 0)
+                                        goto open_error;
                                 goto open_end;
                         }
 
                         goto open_error;
                 }
 
-                buf = iob_alloc(P_ALIGN_(sizeof(struct iob) + IOB_SZ));
+                io = malloc(sizeof(struct io_handle));
+                if (!io)
+                        goto open_error;
+
+                /* Served from a copy decoded along with a solid sibling? */
+                if (entry_p->flags.solid && solidcache_enabled()) {
+                        int fd = solidcache_open(entry_p->rar_p,
+                                                 entry_p->file_p);
+                        if (fd >= 0) {
+                                shlock_unlock_key(&file_access_lock, path);
+                                FH_SETIO(fi->fh, io);
+                                FH_SETTYPE(fi->fh, IO_TYPE_NRM);
+                                FH_SETFD(fi->fh, fd);
+                                printd(3, "(%05d) %-8s%s [%d]\n", getpid(),
+                                       "SOLID", path, fd);
+                                return 0;
+                        }
+                }
+
+                /* Share the stream of a concurrent open if possible */
+                op = __stream_attach(path, io);
+                if (op) {
+                        FH_SETIO(fi->fh, io);
+                        FH_SETTYPE(fi->fh, IO_TYPE_RAR);
+                        FH_SETCONTEXT(fi->fh, op);
+                        io->seq = 0;
+                        printd(3, "(%05d) %-8s%s [%-16p]\n", getpid(), "SHARE",
+                                                path, FH_TOCONTEXT(fi->fh));
+                        goto open_end;
+                }
+
+                buf = iob_alloc_tuned((size_t)entry_p->profile.iob_size << 20,
+                                      entry_p->profile.hist_size);
                 if (!buf)
                         goto open_error;
 
-                io = malloc(sizeof(struct io_handle));
                 op = calloc(1, sizeof(struct io_context));
-                if (!op || !io)
+                if (!op)
                         goto open_error;
                 op->buf = buf;
+                op->iob_max = entry_p->profile.iob_size
+                        ? (size_t)entry_p->profile.iob_size << 20 : IOB_SZ;
                 op->entry_p = NULL;
+                op->xtr_fd = -1;
+                if (blkcache_enabled() && entry_p->profile.block_cache) {
+                        op->bc_key = __block_cache_key(entry_p);
+                        op->bc_size = entry_p->stat.st_size;
+                }
 
-                /* Open PIPE(s) and create child process */
-                fp = popen_(entry_p, &pid);
-                if (fp != NULL) {
+                /*
+                 * Hand over extraction to an in-process worker if one is
+                 * available, otherwise open PIPE(s) and create child process.
+                 */
+                int res = ipopen_(entry_p, op);
+                if (res && res != -EBUSY && res != -ENOSYS)
+                        goto open_error;
+                if (res)
+                        fp = popen_(entry_p, &pid, &op->xtr_fd);
+                if (op->inproc || fp != NULL) {
                         FH_SETIO(fi->fh, io);
                         FH_SETTYPE(fi->fh, IO_TYPE_RAR);
                         FH_SETCONTEXT(fi->fh, op);
                         printd(3, "(%05d) %-8s%s [%-16p]\n", getpid(), "ALLOC",
                                                 path, FH_TOCONTEXT(fi->fh));
+                        io->seq = 0;
+                        io->pos = 0;
+                        io->next = NULL;
                         op->seq = 0;
                         op->pos = 0;
+                        op->refs = 1;
+                        op->handles = io;
+                        pthread_mutex_init(&op->read_mutex, NULL);
                         op->fp = fp;
                         op->pid = pid;
-                        printd(4, "PIPE %p created towards child %d\n",
+                        if (op->inproc) {
+                                printd(4, "Extraction of %s handed to worker\n",
+                                                path);
+                        } else {
+                                printd(4, "PIPE %p created towards child %d\n",
                                                 op->fp, pid);
-
-                        pthread_mutex_init(&op->rd_req_mutex, NULL);
-                        pthread_cond_init(&op->rd_req_cond, NULL);
-                        op->rd_req = RD_IDLE;
+                        }
 
                         /*
                          * The below will take precedence over keep_cache.
@@ -5236,18 +7902,25 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
 #endif
 
                         /* Create reader thread */
-                        if (pthread_create(&op->thread, &thread_attr, reader_task, (void *)op))
-                                goto open_error;
-                        if (sync_thread_noread(op))
-                                goto open_error;
+                        if (!op->inproc) {
+                                pthread_mutex_init(&op->rd_req_mutex, NULL);
+                                pthread_cond_init(&op->rd_req_cond, NULL);
+                                op->rd_req = RD_IDLE;
+                                if (pthread_create(&op->thread, &thread_attr, reader_task, (void *)op))
+                                        goto open_error;
+                                if (sync_thread_noread(op))
+                                        goto open_error;
+                        }
 
                         /* Promote to a write lock since we might need to
                          * change the cache entry below. */
-			pthread_rwlock_unlock(&file_access_lock);
-			pthread_rwlock_wrlock(&file_access_lock);
+			shlock_unlock_key(&file_access_lock, path);
+			shlock_wrlock_key(&file_access_lock, path);
 
                         buf->idx.data_p = MAP_FAILED;
                         buf->idx.fd = -1;
+                        buf->idx.count = 0;
+                        buf->idx.range = NULL;
                         if (!preload_index(buf, path)) {
                                 entry_p->flags.save_eof = 0;
                                 entry_p->flags.direct_io = 0;
@@ -5278,22 +7951,27 @@ static int rar2_open(const char *path, struct fuse_file_info *fi)
                         op->entry_p = filecache_clone(entry_p);
                         if (!op->entry_p)
                                 goto open_error;
+                        __stream_register(path, op);
                         goto open_end;
                 }
         }
 
 open_error:
-        pthread_rwlock_unlock(&file_access_lock);
-        if (fp) {
-                if (entry_p->flags.raw)
-                        fclose(fp);
-                else
-                        pclose_(fp, pid);
-        }
+        shlock_unlock_key(&file_access_lock, path);
+        if (fp)
+                pclose_(fp, pid);
 	free(io);
         if (op) {
+                if (op->vp)
+                        volpool_put(op->vp);
+                if (op->inproc)
+                        ipclose_(op);
+                if (op->buf && op->xtr_fd != -1)
+                        close(op->xtr_fd);
                 if (op->entry_p)
                         filecache_freeclone(op->entry_p);
+                free(op->bc_key);
+                free(op->bc_buf);
                 free(op);
         }
         iob_free(buf);
@@ -5309,7 +7987,9 @@ open_error:
 open_end:
         FH_SETPATH(fi->fh, strdup(path));
         op->entry_p->flags.check_atime = 1;
-        pthread_rwlock_unlock(&file_access_lock);
+        if (op->entry_p->profile.direct_io >= 0)
+                fi->direct_io = op->entry_p->profile.direct_io;
+        shlock_unlock_key(&file_access_lock, path);
         return 0;
 }
 
@@ -5353,146 +8033,120 @@ static inline int access_chk(const char *path, int new_file)
         return e && !e->flags.unresolved ? 1 : 0;
 }
 
+#define AUTO_INDEX_CPU_DEFAULT 25      /* percent */
+
 /*!
  *****************************************************************************
- *
+ * Queue the compressed media files listed in directory 'path' that have
+ * no index yet for background index generation.
  ****************************************************************************/
-static void *walkpath_task(void *data)
+static void __idxgen_scan(const char *path)
 {
-        pthread_detach(pthread_self());
+        struct dircache_entry *dc_p;
+        struct dir_entry_list *list = NULL;
+        unsigned int i;
 
-        syncdir(data);
-        free(data);
+        if (!idxgen_enabled())
+                return;
 
-        pthread_mutex_lock(&warmup_lock);
-        --warmup_threads;
-        pthread_cond_broadcast(&warmup_cond);
-        pthread_mutex_unlock(&warmup_lock);
+        shlock_rdlock_key(&dir_access_lock, path);
+        dc_p = dircache_get(path);
+        if (dc_p)
+                list = dir_list_dup(&dc_p->dir_entry_list);
+        shlock_unlock_key(&dir_access_lock, path);
+        if (!list)
+                return;
 
-        return NULL;
+        for (i = 0; i < dir_list_count(list); i++) {
+                struct dir_entry *de = dir_list_entry(list, i);
+                struct filecache_entry *e_p;
+                char *mp;
+                int queue;
+
+                if (de->type != DIR_E_RAR || strlen(de->name) < 4 ||
+                    !(IS_AVI(de->name) || IS_MKV(de->name) ||
+                      IS_MP4(de->name)))
+                        continue;
+                ABS_MP2(mp, path, de->name);
+                shlock_rdlock_key(&file_access_lock, mp);
+                e_p = filecache_get(mp);
+                queue = e_p && e_p != LOCAL_FS_ENTRY && !e_p->flags.raw &&
+                        !e_p->nested_depth && !e_p->flags.unresolved;
+                shlock_unlock_key(&file_access_lock, mp);
+                if (queue && !__has_index(mp))
+                        idxgen_queue(mp);
+                free(mp);
+        }
+        dir_list_free(list);
+        free(list);
 }
 
 /*!
  *****************************************************************************
  *
  ****************************************************************************/
-static void walkpath(const char *dname, size_t src_len)
+static int __watch_filter(const char *name)
 {
-        pthread_t t;
-        struct dirent *dent;
-        DIR *dir = NULL;
-        char *fn = NULL;
-        struct stat st;
-        int len;
-        const char *root = &dname[src_len];
-
-        if (*root == '\0')
-              root = "/";
-        root = strdup(root);
-        if (root == NULL)
-                goto out;
+        if (strlen(name) < 4)
+                return 0;
+        return IS_RAR(name) || IS_CBR(name) || IS_RXX(name) || IS_NNN(name);
+}
 
-        pthread_mutex_lock(&warmup_lock);
-        while (warmup_threads > (rar2fs_mount_opts.warmup - 1))
-                pthread_cond_wait(&warmup_cond, &warmup_lock);
-        ++warmup_threads;
-        pthread_mutex_unlock(&warmup_lock);
-        if (pthread_create(&t, NULL, walkpath_task, (void *)root)) {
-                free((void *)root);
-                goto out;
-        }
+/*!
+ *****************************************************************************
+ * Called by the watcher for every directory in the source folder that
+ * changed. Since regular files are always read from the source folder
+ * there is no need to drop a cached listing unless an archive changed.
+ * Archive changes invalidate the directory listing, along with the file
+ * cache entries it refers to, and the directory is listed right away if
+ * it was cached before.
+ ****************************************************************************/
+static void __watch_changed(const char *path, int relist)
+{
+        int cached;
 
-        len = strlen(dname);
-#ifdef PATH_MAX
-        if (len >= PATH_MAX - 1)
+        if (!path) {
+                __handle_sigusr1();
                 return;
-#endif
-
-        dir = opendir(dname);
-        if (dir == NULL)
-                goto out;
-
-        /* Allocate buffer for path construction: dname + '/' + filename
-         * Use NAME_MAX for max filename component size.
-         * From glibc docs: Don't use FILENAME_MAX for arrays - use dynamic allocation.
-         */
-#ifdef NAME_MAX
-        size_t fn_size = len + NAME_MAX + 2;
-#else
-        size_t fn_size = len + 256 + 2; /* Fallback if NAME_MAX not defined */
-#endif
-        fn = malloc(fn_size);
-        if (fn == NULL)
-                goto out;
-
-        memcpy(fn, dname, len);
-        fn[len++] = '/';
-
-        /* Do not use reentrant version of readdir(3) here.
-         * This needs to be revisted if other threads starts to use it. */
-        while ((dent = readdir(dir))) {
-                if (warmup_cancelled)
-                        break;
-                /* Skip '.' and '..' */
-                if (dent->d_name[0] == '.') {
-                        if (dent->d_name[1] == 0 ||
-                                        (dent->d_name[1] == '.' &&
-                                        dent->d_name[2] == 0))
-                                continue;
-                }
+        }
 
-                snprintf(fn + len, fn_size - len, "%s", dent->d_name);
-#ifdef _DIRENT_HAVE_D_TYPE
-                if (dent->d_type != DT_UNKNOWN) {
-                        if (dent->d_type == DT_DIR)
-                                walkpath(fn, src_len);
-                        continue;
-                }
-#endif
-                if (lstat(fn, &st) == -1)
-                        continue;
-                /* will be false for symlinked dirs */
-                if (S_ISDIR(st.st_mode))
-                        walkpath(fn, src_len);
+        printd(3, "watcher: %s changed%s\n", path, relist ? ", re-listing" : "");
+        negcache_invalidate(path);
+        shlock_wrlock_key(&dir_access_lock, path);
+        cached = dircache_refresh(path);
+        shlock_unlock_key(&dir_access_lock, path);
+        if (cached && relist)
+                dircache_invalidate_tree(path);
+        if ((cached || idxgen_enabled()) && relist) {
+                (void)syncdir(path);
+                __idxgen_scan(path);
         }
+}
 
-out:
-        if (fn)
-                free(fn);
-        if (dir)
-                closedir(dir);
+static struct watcher_ops watcher_ops = {
+        .filter = __watch_filter,
+        .changed = __watch_changed,
+};
+
+/*!
+ *****************************************************************************
+ * Called by the snapshot to name the volume following 'vol'.
+ ****************************************************************************/
+static void __snapshot_next_vol(char *vol, const struct filecache_entry *e)
+{
+        RARNextVolumeName(vol, !e->vtype);
 }
 
 /*!
  *****************************************************************************
- *
+ * Called by the warmup workers for every directory in the source folder.
  ****************************************************************************/
-static void *warmup_task(void *data)
+static int __warmup_visit(const char *path)
 {
-        (void)data;
-        const char *dir = OPT_STR(OPT_KEY_SRC, 0);
-        struct timeval t1;
-        struct timeval t2;
-
-        pthread_detach(pthread_self());
-
-        syslog(LOG_DEBUG, "cache warmup started");
-        gettimeofday(&t1, NULL);
-
-        walkpath(dir, strlen(dir));
-
-        pthread_mutex_lock(&warmup_lock);
-        while (warmup_threads)
-                pthread_cond_wait(&warmup_cond, &warmup_lock);
-        pthread_mutex_unlock(&warmup_lock);
-
-        if (!warmup_cancelled) {
-                gettimeofday(&t2, NULL);
-                syslog(LOG_DEBUG, "cache warmup completed after %d seconds",
-                       (int)(t2.tv_sec - t1.tv_sec));
-        }
-
-        return NULL;
+        listed_sets = 0;
+        (void)syncdir(path);
+        __idxgen_scan(path);
+        return listed_sets;
 }
 
 /*!
@@ -5501,21 +8155,22 @@ static void *warmup_task(void *data)
  ****************************************************************************/
 static int __dircache_free(const char *path, struct dir_entry_list *dir)
 {
-        struct dir_entry_list *next;
+        unsigned int i;
 
-        pthread_rwlock_wrlock(&file_access_lock);
         if (dir) {
-                next = dir->next;
-                while (next) {
+                for (i = 0; i < dir_list_count(dir); i++) {
                         char *mp;
-                        ABS_MP2(mp, path, next->entry.name);
+                        ABS_MP2(mp, path, dir_list_entry(dir, i)->name);
+                        shlock_wrlock_key(&file_access_lock, mp);
                         filecache_invalidate(mp);
-                        next = next->next;
+                        shlock_unlock_key(&file_access_lock, mp);
                         free(mp);
                 }
         }
+        shlock_wrlock_key(&file_access_lock, path);
         filecache_invalidate(path);
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, path);
+        negcache_invalidate(path);
 
         return 0;
 }
@@ -5526,10 +8181,11 @@ static int __dircache_free(const char *path, struct dir_entry_list *dir)
  ****************************************************************************/
 static int __dircache_stale(const char *path)
 {
-        /* Promote to a wrlock (might already be) */
-        pthread_rwlock_unlock(&dir_access_lock);
-        pthread_rwlock_wrlock(&dir_access_lock);
-        dircache_invalidate(path);
+        /* The sub-tree may span all shards. Return with a wrlock of the
+         * shard holding 'path' (might already have been). */
+        shlock_unlock_key(&dir_access_lock, path);
+        dircache_invalidate_tree(path);
+        shlock_wrlock_key(&dir_access_lock, path);
 
         return 0;
 }
@@ -5547,8 +8203,6 @@ static void *rar2_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 {
         ENTER_();
 
-        pthread_t t;
-
         /* Configure FUSE3 settings (FUSE tuning options) */
         if (cfg) {
                 /* Always enable nullpath_ok for FUSE3 */
@@ -5632,15 +8286,137 @@ static void *rar2_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 
                 if (!OPT_SET(OPT_KEY_FUSE_NO_PARALLEL_DIROPS))
                         conn->want |= FUSE_CAP_PARALLEL_DIROPS;  /* Parallel dir ops */
+
+                /*
+                 * Attributes of archive entries are already cached when a
+                 * directory is listed, so always hand them out inline
+                 * rather than letting the kernel guess when to ask for them.
+                 */
+                if (conn->capable & FUSE_CAP_READDIRPLUS) {
+                        conn->want |= FUSE_CAP_READDIRPLUS;
+                        conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+                }
         }
 
         /* Initialize rar2fs subsystems */
+        sighandler_timeout_init();
+        if (timer_init())
+                printd(1, "failed to start timer thread, operations run untimed\n");
         filecache_init();
         dircache_init(&dircache_cb);
+        negcache_init(cfg ? (unsigned int)cfg->negative_timeout : 0);
         iob_init();
+        struct hash_table_ops stream_ops = {
+                .alloc = __stream_alloc,
+                .free = __stream_free,
+        };
+        stream_ht = hashtable_init(STREAM_SZ, &stream_ops);
+        if (OPT_SET(OPT_KEY_IO_URING)) {
+                int res = uring_init(URING_DEPTH);
+                if (res)
+                        printd(1, "io_uring not available: %s\n",
+                               strerror(-res));
+        }
+        volpool_init();
+        if (OPT_SET(OPT_KEY_BLOCK_CACHE)) {
+                size_t mb = OPT_SET(OPT_KEY_BLOCK_CACHE_SIZE)
+                        ? (size_t)OPT_INT(OPT_KEY_BLOCK_CACHE_SIZE, 0) : 1024;
+                if (blkcache_init(OPT_STR(OPT_KEY_BLOCK_CACHE, 0),
+                                  mb * 1024 * 1024))
+                        printd(1, "failed to initialize block cache\n");
+        }
+        if (OPT_SET(OPT_KEY_RECURSIVE) && OPT_SET(OPT_KEY_NESTED_CACHE)) {
+                struct recursion_context ctx;
+                size_t mb = OPT_SET(OPT_KEY_NESTED_CACHE_SIZE)
+                        ? (size_t)OPT_INT(OPT_KEY_NESTED_CACHE_SIZE, 0) : 1024;
+                size_t budget = mb * 1024 * 1024;
+
+                /* Never keep more than a single listing may unpack */
+                recursion_context_init(&ctx);
+                if ((off_t)budget > ctx.max_unpacked_size)
+                        budget = ctx.max_unpacked_size;
+                recursion_context_cleanup(&ctx);
+                __nested_ref_init();
+                if (nestcache_init(OPT_STR(OPT_KEY_NESTED_CACHE, 0), budget,
+                                   __nested_evicted))
+                        printd(1, "failed to initialize nested archive cache\n");
+        }
+        if (OPT_SET(OPT_KEY_SOLID_CACHE)) {
+                size_t mb = OPT_SET(OPT_KEY_SOLID_CACHE_SIZE)
+                        ? (size_t)OPT_INT(OPT_KEY_SOLID_CACHE_SIZE, 0) : 1024;
+                if (solidcache_init(OPT_STR(OPT_KEY_SOLID_CACHE, 0),
+                                    mb * 1024 * 1024))
+                        printd(1, "failed to initialize solid archive cache\n");
+        }
+        keycache_init(OPT_SET(OPT_KEY_KEY_CACHE_TTL)
+                        ? (unsigned int)OPT_INT(OPT_KEY_KEY_CACHE_TTL, 0) : 0,
+                      __password_digest);
         sighandler_init();
-        if (mount_type == MOUNT_FOLDER && rar2fs_mount_opts.warmup > 0)
-                pthread_create(&t, NULL, warmup_task, NULL);
+        {
+                int n = OPT_SET(OPT_KEY_LIST_THREADS)
+                        ? OPT_INT(OPT_KEY_LIST_THREADS, 0)
+                        : LIST_THREADS_DEFAULT;
+                if (n > 0) {
+                        list_pool = threadpool_create(n);
+                        if (list_pool)
+                                RARSetScanSubmitEx(__scan_submit);
+                        else
+                                printd(1, "failed to create list pool\n");
+                }
+        }
+        raw_readahead = (size_t)(OPT_SET(OPT_KEY_RAW_READAHEAD)
+                ? OPT_INT(OPT_KEY_RAW_READAHEAD, 0)
+                : RAW_READAHEAD_DEFAULT) << 20;
+        if (raw_readahead) {
+                prefetch_pool = threadpool_create(PREFETCH_THREADS);
+                if (!prefetch_pool)
+                        printd(1, "failed to create prefetch pool\n");
+        }
+        if (OPT_INT(OPT_KEY_EXTRACT_THREADS, 0) > 0) {
+                extract_pool = threadpool_create(
+                                OPT_INT(OPT_KEY_EXTRACT_THREADS, 0));
+                if (!extract_pool)
+                        printd(1, "failed to create extraction pool, using fork()\n");
+        }
+        if (OPT_SET(OPT_KEY_SNAPSHOT)) {
+                snapshot_res = snapshot_init(OPT_STR(OPT_KEY_SNAPSHOT, 0),
+                                OPT_SET(OPT_KEY_SNAPSHOT_INTERVAL)
+                                ? OPT_INT(OPT_KEY_SNAPSHOT_INTERVAL, 0) : 0,
+                                __snapshot_next_vol);
+                if (snapshot_res < 0 && snapshot_res != -ENOENT)
+                        printd(1, "discarding snapshot: %s\n",
+                               strerror(-snapshot_res));
+        }
+        if (mount_type == MOUNT_FOLDER && OPT_SET(OPT_KEY_AUTO_INDEX)) {
+                int res = idxgen_init(OPT_SET(OPT_KEY_AUTO_INDEX_CPU)
+                                ? OPT_INT(OPT_KEY_AUTO_INDEX_CPU, 0)
+                                : AUTO_INDEX_CPU_DEFAULT,
+                                (size_t)(OPT_SET(OPT_KEY_AUTO_INDEX_RATE)
+                                ? OPT_INT(OPT_KEY_AUTO_INDEX_RATE, 0) : 0) << 20,
+                                __idxgen_build);
+                if (res)
+                        printd(1, "failed to start index generator: %s\n",
+                               strerror(-res));
+        }
+        if (mount_type == MOUNT_FOLDER && OPT_SET(OPT_KEY_WATCH)) {
+                int res = watcher_init(OPT_STR(OPT_KEY_SRC, 0), &watcher_ops);
+                if (res)
+                        printd(1, "failed to start watcher: %s\n", strerror(-res));
+        }
+        /*
+         * Nothing is left for the warmup to collect if every archive in
+         * the snapshot was restored. Otherwise it only lists what was not,
+         * since restored directories are skipped by syncdir().
+         */
+        if (mount_type == MOUNT_FOLDER && rar2fs_mount_opts.warmup > 0) {
+                if (!snapshot_res) {
+                        printd(3, "snapshot restored, skipping cache warmup\n");
+                } else if (warmup_start(OPT_STR(OPT_KEY_SRC, 0),
+                                        rar2fs_mount_opts.warmup,
+                                        __warmup_visit)) {
+                        printd(1, "failed to start cache warmup\n");
+                }
+        }
 
         return NULL;
 }
@@ -5655,18 +8431,40 @@ static void rar2_destroy(void *data)
 
         (void)data;             /* touch */
 
+        watcher_destroy();
         if (mount_type == MOUNT_FOLDER && rar2fs_mount_opts.warmup > 0) {
-                pthread_mutex_lock(&warmup_lock);
-                if (warmup_threads)
+                struct warmup_stats stats;
+                warmup_get_stats(&stats);
+                if (stats.running)
                         printf("shutting down...\n");
-                while (warmup_threads)
-                        pthread_cond_wait(&warmup_cond, &warmup_lock);
-                pthread_mutex_unlock(&warmup_lock);
-        }
-
+                warmup_stop();
+        }
+        idxgen_destroy();
+
+        snapshot_destroy();
+        RARSetScanSubmitEx(NULL);
+        threadpool_destroy(list_pool);
+        list_pool = NULL;
+        threadpool_destroy(extract_pool);
+        extract_pool = NULL;
+        threadpool_destroy(prefetch_pool);
+        prefetch_pool = NULL;
+        pthread_mutex_lock(&stream_lock);
+        hashtable_destroy(stream_ht);
+        stream_ht = NULL;
+        pthread_mutex_unlock(&stream_lock);
+        blkcache_destroy();
+        nestcache_destroy();
+        __nested_ref_destroy();
+        solidcache_destroy();
+        keycache_destroy();
+        volpool_destroy();
+        uring_destroy();
         iob_destroy();
+        negcache_destroy();
         dircache_destroy();
         filecache_destroy();
+        timer_destroy();
         sighandler_destroy();
 }
 
@@ -5698,18 +8496,18 @@ static int rar2_readlink(const char *path, char *buf, size_t buflen)
         if (!buflen)
                 return -EINVAL;
 
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, path);
         entry_p = path_lookup(path, NULL);
         if (entry_p && entry_p != LOCAL_FS_ENTRY) {
                 if (entry_p->link_target_p) {
                         strncpy(buf, entry_p->link_target_p, buflen - 1);
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, path);
                 } else {
-                        pthread_rwlock_unlock(&file_access_lock);
+                        shlock_unlock_key(&file_access_lock, path);
                         return -EIO;
                 }
         } else {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, path);
                 char *tmp;
                 ABS_ROOT(tmp, path);
                 buflen = readlink(tmp, buf, buflen - 1);
@@ -5731,8 +8529,11 @@ static int rar2_symlink(const char *from, const char *to)
         if (!access_chk(to, 1)) {
                 char *root;
                 ABS_ROOT(root, to);
-                if (!symlink(from, root))
+                if (!symlink(from, root)) {
+                        __dircache_invalidate_for_file(to);
+                        negcache_invalidate(to);
                         return 0;
+                }
                 return -errno;
         }
         return -EPERM;
@@ -5772,13 +8573,21 @@ static int rar2_release(const char *path, struct fuse_file_info *fi)
                         FH_TOIO(fi->fh)->type == IO_TYPE_RAW) {
                 struct io_context *op = FH_TOCONTEXT(fi->fh);
                 free(FH_TOPATH(fi->fh));
-                if (op->fp && op->entry_p->flags.raw) {
-                        printd(3, "Closing file handle %p\n", op->fp);
-                        fclose(op->fp);
-                        pthread_mutex_destroy(&op->raw_read_mutex);
+                if (FH_TOIO(fi->fh)->type == IO_TYPE_RAR &&
+                    !__stream_detach(op, FH_TOIO(fi->fh))) {
+                        printd(3, "(%05d) %s [0x%-16" PRIx64 "]\n", getpid(),
+                               "UNSHARE", fi->fh);
+                        free(FH_TOIO(fi->fh));
+                        FH_ZERO(fi->fh);
+                        return 0;
                 }
+                if (op->vp)
+                        volpool_put(op->vp);
                 printd(3, "(%05d) %s [0x%-16" PRIx64 "]\n", getpid(), "FREE", fi->fh);
-                if (op->buf) {
+                if (op->buf && op->inproc) {
+                        ipclose_(op);
+                        printd(4, "Extraction worker released\n");
+                } else if (op->buf) {
                         __wake_thread(op, RD_TERM);
                         pthread_join(op->thread, NULL);
                         pthread_cond_destroy(&op->rd_req_cond);
@@ -5786,8 +8595,12 @@ static int rar2_release(const char *path, struct fuse_file_info *fi)
 
                         if (pclose_(op->fp, op->pid))
                                 printd(4, "child closed abnormally\n");
+                        if (op->xtr_fd != -1)
+                                close(op->xtr_fd);
                         printd(4, "PIPE %p closed towards child %05d\n",
                                op->fp, op->pid);
+                }
+                if (op->buf) {
 #ifdef DEBUG_READ
                         fclose(op->dbg_fp);
 #endif
@@ -5796,14 +8609,18 @@ static int rar2_release(const char *path, struct fuse_file_info *fi)
                         if (op->buf->idx.data_p != MAP_FAILED &&
                                         op->buf->idx.mmap)
                                 munmap((void *)op->buf->idx.data_p,
-                                       P_ALIGN_(ntoh64(op->buf->idx.data_p->head.size)));
+                                       op->buf->idx.map_size);
 #endif
                         if (op->buf->idx.data_p != MAP_FAILED &&
                                         !op->buf->idx.mmap)
                                 free(op->buf->idx.data_p);
+                        free(op->buf->idx.range);
                         if (op->buf->idx.fd != -1)
                                 close(op->buf->idx.fd);
                         iob_free(op->buf);
+                        pthread_mutex_destroy(&op->read_mutex);
+                        free(op->bc_key);
+                        free(op->bc_buf);
                 }
                 filecache_freeclone(op->entry_p);
                 free(op);
@@ -5852,6 +8669,198 @@ static int rar2_read(const char *path, char *buffer, size_t size, off_t offset,
         return res;
 }
 
+/*!
+ *****************************************************************************
+ * Map a read of a raw entry onto (fd, offset) segments of its volume files.
+ * Returns 0 and a NULL vector if the request can not be mapped, in which
+ * case the caller should fall back to a copying read.
+ ****************************************************************************/
+static int lread_raw_buf(struct fuse_bufvec **bufp, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+        struct io_context *op = FH_TOCONTEXT(fi->fh);
+        struct fuse_bufvec *bv;
+        size_t left;
+        off_t off;
+        int cnt;
+        int i;
+
+        *bufp = NULL;
+
+        if ((off_t)(offset + size) >= op->entry_p->stat.st_size) {
+                if (offset > op->entry_p->stat.st_size)
+                        size = 0;       /* EOF */
+                else
+                        size = op->entry_p->stat.st_size - offset;
+        }
+
+        if (op->entry_p->flags.check_atime)
+                check_atime(FH_TOPATH(fi->fh), op->entry_p);
+
+        if (!op->entry_p->flags.vsize_resolved)
+                return -EIO;
+
+        if (size)
+                __raw_ra_track(op, offset, size);
+
+        /* Count the number of volumes touched by the request */
+        cnt = 1;
+        if (op->entry_p->flags.multipart) {
+                for (left = size, off = offset; left; ) {
+                        int vol;
+                        size_t chunk;
+                        __get_vol_and_chunk_raw(op, off, &vol, &chunk);
+                        if (chunk >= left)
+                                break;
+                        left -= chunk;
+                        off += chunk;
+                        ++cnt;
+                }
+        }
+
+        bv = malloc(sizeof(struct fuse_bufvec) +
+                    (cnt - 1) * sizeof(struct fuse_buf));
+        if (!bv)
+                return 0;
+        *bv = FUSE_BUFVEC_INIT(size);
+        if (!size) {
+                *bufp = bv;
+                return 0;
+        }
+        bv->count = cnt;
+
+        for (i = 0, left = size, off = offset; i < cnt; i++) {
+                int vol = 0;
+                size_t chunk = left;
+                size_t vol_left = op->entry_p->stat.st_size - off;
+                off_t src_off = off + op->entry_p->offset;
+                int fd;
+
+                if (op->entry_p->flags.multipart) {
+                        __get_vol_and_chunk_raw(op, off, &vol, &chunk);
+                        vol_left = chunk;
+                        src_off = VOL_REAL_SZ(vol) - chunk;
+                        chunk = left < chunk ? left : chunk;
+                }
+                fd = __raw_vol_fd(op, vol);
+                if (fd < 0) {
+                        free(bv);
+                        return 0;
+                }
+                bv->buf[i].size = chunk;
+                bv->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK |
+                                   FUSE_BUF_FD_RETRY;
+                bv->buf[i].mem = NULL;
+                bv->buf[i].fd = fd;
+                bv->buf[i].pos = src_off;
+                left -= chunk;
+                off += chunk;
+                /* The data is read later on by FUSE, hint what follows */
+                __raw_readahead(op, fd, vol, src_off + chunk,
+                                vol_left - chunk, off);
+        }
+        *bufp = bv;
+        return 0;
+}
+
+#ifndef __CYGWIN__
+/*!
+ *****************************************************************************
+ * Regular files are passed on as a reference to the already open file.
+ ****************************************************************************/
+static int lread_buf(struct fuse_bufvec **bufp, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+        struct fuse_bufvec *bv;
+
+        bv = malloc(sizeof(struct fuse_bufvec));
+        if (!bv)
+                return -ENOMEM;
+        *bv = FUSE_BUFVEC_INIT(size);
+        bv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK |
+                           FUSE_BUF_FD_RETRY;
+        bv->buf[0].fd = FH_TOFD(fi->fh);
+        bv->buf[0].pos = offset;
+        *bufp = bv;
+        return 0;
+}
+#endif
+
+/*!
+ *****************************************************************************
+ * For raw entries and regular files the data is passed on as references to
+ * the files holding it, allowing the kernel to splice it without a copy
+ * through user space. Everything else, and raw reads that can not be
+ * mapped, are read into a memory buffer. That buffer is released by FUSE
+ * once the reply has been sent and therefore can not be kept per handle.
+ * Time spent here is accounted as METRICS_OP_READ by __timed_read_buf().
+ ****************************************************************************/
+static int rar2_read_buf(const char *path, struct fuse_bufvec **bufp,
+                size_t size, off_t offset, struct fuse_file_info *fi)
+{
+        struct fuse_bufvec *bv;
+        struct io_handle *io;
+        void *mem;
+        int res;
+
+        (void)path;             /* touch */
+
+        if (!FH_ISSET(fi->fh)) {
+                printd(1, "read: bad I/O handle (fh is NULL)\n");
+                return -EIO;
+        }
+
+        io = FH_TOIO(fi->fh);
+        if (!io)
+               return -EIO;
+
+        ENTER_("size=%zu, offset=%" PRIu64 ", fh=%" PRIu64, size, offset, fi->fh);
+
+        /* FUSE would pread(2) the file itself, bypassing the workaround
+         * for its behaviour at EOF on Cygwin in lread() */
+#ifndef __CYGWIN__
+        if (io->type == IO_TYPE_NRM)
+                return lread_buf(bufp, size, offset, fi);
+#endif
+        /* With --io-uring stored files are read through the ring by
+         * lread_raw() instead, see uring_read() */
+        if (io->type == IO_TYPE_RAW && !uring_enabled()) {
+                res = lread_raw_buf(bufp, size, offset, fi);
+                if (res < 0 || *bufp)
+                        return res;
+        }
+
+        bv = malloc(sizeof(struct fuse_bufvec));
+        if (!bv)
+                return -ENOMEM;
+        mem = malloc(size ? size : 1);
+        if (!mem) {
+                free(bv);
+                return -ENOMEM;
+        }
+        if (io->type == IO_TYPE_RAW) {
+                res = lread_raw(mem, size, offset, fi);
+#ifdef __CYGWIN__
+        } else if (io->type == IO_TYPE_NRM) {
+                res = lread(mem, size, offset, fi);
+#endif
+        } else if (io->type == IO_TYPE_INFO) {
+                res = lread_info(mem, size, offset, fi);
+        } else if (io->type == IO_TYPE_RAR) {
+                res = lread_rar(mem, size, offset, fi);
+        } else
+                res = -EIO;
+        if (res < 0) {
+                free(mem);
+                free(bv);
+                return res;
+        }
+        *bv = FUSE_BUFVEC_INIT(res);
+        bv->buf[0].mem = mem;
+        *bufp = bv;
+        return 0;
+}
+
 /*!
  *****************************************************************************
  * lseek() handler for FUSE3
@@ -5887,16 +8896,16 @@ static off_t rar2_lseek(const char *path, off_t off, int whence,
                 return -EBADF;
 
         /* Get file entry to determine file size */
-        pthread_rwlock_rdlock(&file_access_lock);
+        shlock_rdlock_key(&file_access_lock, file_path);
         struct filecache_entry *entry_p = filecache_get(file_path);
         if (!entry_p) {
-                pthread_rwlock_unlock(&file_access_lock);
+                shlock_unlock_key(&file_access_lock, file_path);
                 return -EBADF;
         }
 
         off_t file_size = entry_p->stat.st_size;
         int is_compressed = (entry_p->method != 0x30); /* 0x30 = Store (uncompressed) */
-        pthread_rwlock_unlock(&file_access_lock);
+        shlock_unlock_key(&file_access_lock, file_path);
 
         off_t new_offset = 0;
 
@@ -6060,6 +9069,9 @@ static int rar2_rename(const char *oldpath, const char *newpath, unsigned int fl
                 ABS_ROOT(newroot, newpath);
                 if (!rename(oldroot, newroot)) {
                         __dircache_invalidate_for_file(oldpath);
+                        __dircache_invalidate_for_file(newpath);
+                        /* Names looked up below a moved folder */
+                        negcache_invalidate(newpath);
                         return 0;
                 }
                 return -errno;
@@ -6115,8 +9127,11 @@ static int rar2_mkdir(const char *path, mode_t mode)
         if (!access_chk(path, 1)) {
                 char *root;
                 ABS_ROOT(root, path);
-                if (!mkdir(root, mode))
+                if (!mkdir(root, mode)) {
+                        __dircache_invalidate_for_file(path);
+                        negcache_invalidate(path);
                         return 0;
+                }
                 return -errno;
         }
         return -EPERM;
@@ -6183,6 +9198,31 @@ static const char *xattr[4] = {
 #define XATTR_CACHE_METHOD 0
 #define XATTR_CACHE_FLAGS 1
 
+/* Only available on the mount root */
+#define XATTR_METRICS "user.rar2fs.metrics"
+
+/*!
+*****************************************************************************
+*
+****************************************************************************/
+static int __getxattr_metrics(char *value, size_t size)
+{
+        size_t len;
+        char *s = metrics_format(&len);
+
+        if (!s)
+                return -ENOMEM;
+        if (size) {
+                if (size < len) {
+                        free(s);
+                        return -ERANGE;
+                }
+                memcpy(value, s, len);
+        }
+        free(s);
+        return len;
+}
+
 /*!
 *****************************************************************************
 *
@@ -6201,6 +9241,9 @@ static int rar2_getxattr(const char *path, const char *name, char *value,
 
         ENTER_("%s", path);
 
+        if (!strcmp(path, "/") && !strcmp(name, XATTR_METRICS))
+                return __getxattr_metrics(value, size);
+
         if (!access_chk(path, 0)) {
                 char *tmp;
                 ABS_ROOT(tmp, path);
@@ -6637,6 +9680,7 @@ static struct fuse_operations rar2_operations = {
         .open = rar2_open,
         .release = rar2_release,
         .read = rar2_read,
+        .read_buf = rar2_read_buf,
         .lseek = rar2_lseek,
         .flush = rar2_flush,
         .readlink = rar2_readlink,
@@ -6648,6 +9692,114 @@ static struct fuse_operations rar2_operations = {
 #endif
 };
 
+/*
+ * Latency of the most relevant operations is recorded by wrapping the
+ * final set of callbacks. The originals are kept in 'timed_operations'.
+ */
+static struct fuse_operations timed_operations;
+
+#define TIMED_OP_(op, call) \
+        do { \
+                struct timespec t0_; \
+                clock_gettime(CLOCK_MONOTONIC, &t0_); \
+                __typeof__(call) res_ = call; \
+                metrics_op_done(METRICS_OP_##op, &t0_); \
+                return res_; \
+        } while (0)
+
+static int __timed_getattr(const char *path, struct stat *stbuf,
+                struct fuse_file_info *fi)
+{
+        TIMED_OP_(GETATTR, timed_operations.getattr(path, stbuf, fi));
+}
+
+static int __timed_opendir(const char *path, struct fuse_file_info *fi)
+{
+        TIMED_OP_(OPENDIR, timed_operations.opendir(path, fi));
+}
+
+static int __timed_readdir(const char *path, void *buffer,
+                fuse_fill_dir_t filler, off_t offset,
+                struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+        TIMED_OP_(READDIR, timed_operations.readdir(path, buffer, filler,
+                                offset, fi, flags));
+}
+
+static int __timed_releasedir(const char *path, struct fuse_file_info *fi)
+{
+        TIMED_OP_(RELEASEDIR, timed_operations.releasedir(path, fi));
+}
+
+static int __timed_open(const char *path, struct fuse_file_info *fi)
+{
+        struct timespec t0;
+        int res;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        res = timed_operations.open(path, fi);
+        metrics_op_done(METRICS_OP_OPEN, &t0);
+        if (!res)
+                METRICS_INC(METRICS_OPEN_HANDLES);
+        return res;
+}
+
+static int __timed_release(const char *path, struct fuse_file_info *fi)
+{
+        METRICS_DEC(METRICS_OPEN_HANDLES);
+        TIMED_OP_(RELEASE, timed_operations.release(path, fi));
+}
+
+static int __timed_read(const char *path, char *buffer, size_t size,
+                off_t offset, struct fuse_file_info *fi)
+{
+        TIMED_OP_(READ, timed_operations.read(path, buffer, size, offset,
+                                fi));
+}
+
+static int __timed_read_buf(const char *path, struct fuse_bufvec **bufp,
+                size_t size, off_t offset, struct fuse_file_info *fi)
+{
+        TIMED_OP_(READ, timed_operations.read_buf(path, bufp, size, offset,
+                                fi));
+}
+
+static int __timed_readlink(const char *path, char *buf, size_t buflen)
+{
+        TIMED_OP_(READLINK, timed_operations.readlink(path, buf, buflen));
+}
+
+static int __timed_statfs(const char *path, struct statvfs *vfs)
+{
+        TIMED_OP_(STATFS, timed_operations.statfs(path, vfs));
+}
+
+static off_t __timed_lseek(const char *path, off_t off, int whence,
+                struct fuse_file_info *fi)
+{
+        TIMED_OP_(LSEEK, timed_operations.lseek(path, off, whence, fi));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __time_operations(struct fuse_operations *ops)
+{
+        timed_operations = *ops;
+        ops->getattr = __timed_getattr;
+        ops->opendir = __timed_opendir;
+        ops->readdir = __timed_readdir;
+        ops->releasedir = __timed_releasedir;
+        ops->open = __timed_open;
+        ops->release = __timed_release;
+        ops->read = __timed_read;
+        ops->read_buf = __timed_read_buf;
+        ops->readlink = __timed_readlink;
+        ops->statfs = __timed_statfs;
+        ops->lseek = __timed_lseek;
+}
+
 struct work_task_data {
         struct fuse *fuse;
         int mt;
@@ -6800,6 +9952,7 @@ static int work(struct fuse_args *args)
                 rar2_operations.chown           = (void *)rar2_eperm;
                 rar2_operations.symlink         = (void *)rar2_eperm;
         }
+        __time_operations(&rar2_operations);
 
         struct fuse *f = NULL;
         pthread_t t;
@@ -6914,8 +10067,7 @@ static int work(struct fuse_args *args)
         if (!wdt.work_task_exited)
                 pthread_kill(t, SIGINT);        /* terminate nicely */
 
-        fs_terminated = 1;
-        warmup_cancelled = 1;
+        warmup_stop();
         pthread_join(t, NULL);
 
         /* FUSE3: Teardown */
@@ -6971,6 +10123,7 @@ static void print_help()
 #ifndef USE_STATIC_IOB_
         printf("    --iob-size=n\t    I/O buffer size in 'power of 2' MiB (1,2,4,8, etc.) [4]\n");
         printf("    --hist-size=n\t    I/O buffer history size as a percentage (0-75) of total buffer size [50]\n");
+        printf("    --iob-budget=n\t    total I/O buffer memory budget in MiB [0=unlimited]\n");
 #endif
         printf("    --save-eof\t\t    force creation of .r2i files (end-of-file chunk)\n");
         printf("    --no-lib-check\t    disable validation of library version(s)\n");
@@ -6985,6 +10138,24 @@ static void print_help()
         printf("    --date-rar\t\t    use file date from main archive file(s)\n");
         printf("    --config=file\t    config file name [source/.rarconfig]\n");
         printf("    --no-inherit-perm\t    do not inherit file permission mode from archive\n");
+        printf("    --extract-threads=n\t    extract compressed files using n in-process worker threads [0=fork]\n");
+        printf("    --block-cache=dir\t    cache decompressed blocks in dir for random access\n");
+        printf("    --block-cache-size=n    size budget of block cache in MiB [1024]\n");
+        printf("    --snapshot=file\t    save cache metadata to file at unmount and load it at mount\n");
+        printf("    --snapshot-interval=n   also save the snapshot every n seconds [0=never]\n");
+        printf("    --list-threads=n\t    list archives of a directory using n worker threads [4, 0=sequential]\n");
+        printf("    --list-timeout=n\t    return a partial directory listing after n seconds [0=never]\n");
+        printf("    --watch\t\t    watch source folder and update caches on changes\n");
+        printf("    --nested-cache=dir\t    keep extracted nested archives in dir (requires --recursive)\n");
+        printf("    --nested-cache-size=n   size budget of nested archive cache in MiB [1024]\n");
+        printf("    --raw-readahead=n\t    readahead window of sequential reads of stored files in MiB [8, 0=off]\n");
+        printf("    --io-uring\t\t    use io_uring for reads from archive volumes\n");
+        printf("    --solid-cache=dir\t    keep decoded files of solid archives in dir\n");
+        printf("    --solid-cache-size=n    size budget of solid archive cache in MiB [1024]\n");
+        printf("    --key-cache-ttl=n\t    keep keys of encrypted archives for n seconds [0=off]\n");
+        printf("    --auto-index\t    create missing .r2i files of compressed media files in background\n");
+        printf("    --auto-index-cpu=n\t    CPU budget of index generation in percent of one CPU [25]\n");
+        printf("    --auto-index-rate=n\t    limit index generation to n MiB/s of decoded data [0=unlimited]\n");
         printf("\n");
 #ifdef HAVE_SETLOCALE
         printf("    -o locale=LOCALE        set the locale for file names (default: according to LC_*/LC_CTYPE)\n");
@@ -7167,6 +10338,142 @@ static int validate_fuse_option(int opt_key, const char *arg)
                 return 0;
         }
 
+        case OPT_KEY_EXTRACT_THREADS: {
+                long val = strtol(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val < 0 || val > 256) {
+                        fprintf(stderr, "Error: Invalid --extract-threads: %s\n", arg);
+                        fprintf(stderr, "       Valid range: 0-256 (0=fork a child per open)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_BLOCK_CACHE_SIZE: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val == 0 ||
+                    val > (SIZE_MAX >> 20)) {
+                        fprintf(stderr, "Error: Invalid --block-cache-size: %s\n", arg);
+                        fprintf(stderr, "       Must be a positive integer (MiB)\n");
+                        fprintf(stderr, "       Default: 1024 (1 GiB)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_NESTED_CACHE_SIZE: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val == 0 ||
+                    val > (SIZE_MAX >> 20)) {
+                        fprintf(stderr, "Error: Invalid --nested-cache-size: %s\n", arg);
+                        fprintf(stderr, "       Must be a positive integer (MiB)\n");
+                        fprintf(stderr, "       Default: 1024 (1 GiB)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_SOLID_CACHE_SIZE: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val == 0 ||
+                    val > (SIZE_MAX >> 20)) {
+                        fprintf(stderr, "Error: Invalid --solid-cache-size: %s\n", arg);
+                        fprintf(stderr, "       Must be a positive integer (MiB)\n");
+                        fprintf(stderr, "       Default: 1024 (1 GiB)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_KEY_CACHE_TTL: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val > 86400) {
+                        fprintf(stderr, "Error: Invalid --key-cache-ttl: %s\n", arg);
+                        fprintf(stderr, "       Must be an integer in range 0-86400 (seconds)\n");
+                        fprintf(stderr, "       Default: 0 (disabled)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_AUTO_INDEX_CPU: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val == 0 || val > 100) {
+                        fprintf(stderr, "Error: Invalid --auto-index-cpu: %s\n", arg);
+                        fprintf(stderr, "       Must be an integer in range 1-100 (percent)\n");
+                        fprintf(stderr, "       Default: 25\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_AUTO_INDEX_RATE: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val > 65536) {
+                        fprintf(stderr, "Error: Invalid --auto-index-rate: %s\n", arg);
+                        fprintf(stderr, "       Must be an integer in range 0-65536 (MiB/s)\n");
+                        fprintf(stderr, "       Default: 0 (unlimited)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_RAW_READAHEAD: {
+                unsigned long val = strtoul(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val > 1024) {
+                        fprintf(stderr, "Error: Invalid --raw-readahead: %s\n", arg);
+                        fprintf(stderr, "       Must be an integer in range 0-1024 (MiB)\n");
+                        fprintf(stderr, "       Default: 8\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_IOB_BUDGET: {
+                long val = strtol(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val < 0 ||
+                    val > INT_MAX) {
+                        fprintf(stderr, "Error: Invalid --iob-budget: %s\n", arg);
+                        fprintf(stderr, "       Must be a non-negative integer (MiB)\n");
+                        fprintf(stderr, "       Default: 0 (unlimited)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_SNAPSHOT_INTERVAL: {
+                long val = strtol(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val < 0 ||
+                    val > INT_MAX) {
+                        fprintf(stderr, "Error: Invalid --snapshot-interval: %s\n", arg);
+                        fprintf(stderr, "       Must be a non-negative integer (seconds)\n");
+                        fprintf(stderr, "       Default: 0 (only at unmount)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_LIST_THREADS: {
+                long val = strtol(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val < 0 || val > 256) {
+                        fprintf(stderr, "Error: Invalid --list-threads: %s\n", arg);
+                        fprintf(stderr, "       Valid range: 0-256 (0=list archives sequentially)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
+        case OPT_KEY_LIST_TIMEOUT: {
+                long val = strtol(arg, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' || val < 0 ||
+                    val > INT_MAX) {
+                        fprintf(stderr, "Error: Invalid --list-timeout: %s\n", arg);
+                        fprintf(stderr, "       Must be a non-negative integer (seconds)\n");
+                        fprintf(stderr, "       Default: 0 (wait for all archives)\n");
+                        return -1;
+                }
+                return 0;
+        }
+
         default:
                 return 0;  /* Not a FUSE option, no validation needed */
         }
@@ -7200,6 +10507,7 @@ static struct option longopts[] = {
 #ifndef USE_STATIC_IOB_
         {"hist-size",   required_argument, NULL, OPT_ADDR(OPT_KEY_HIST_SIZE)},
         {"iob-size",    required_argument, NULL, OPT_ADDR(OPT_KEY_BUF_SIZE)},
+        {"iob-budget",  required_argument, NULL, OPT_ADDR(OPT_KEY_IOB_BUDGET)},
 #endif
         {"save-eof",          no_argument, NULL, OPT_ADDR(OPT_KEY_SAVE_EOF)},
         {"no-expand-cbr",     no_argument, NULL, OPT_ADDR(OPT_KEY_NO_EXPAND_CBR)},
@@ -7229,6 +10537,24 @@ static struct option longopts[] = {
         {"recursive", no_argument, NULL, OPT_ADDR(OPT_KEY_RECURSIVE)},
         {"recursion-depth", required_argument, NULL, OPT_ADDR(OPT_KEY_RECURSION_DEPTH)},
         {"max-unpack-size", required_argument, NULL, OPT_ADDR(OPT_KEY_MAX_UNPACK_SIZE)},
+        {"extract-threads", required_argument, NULL, OPT_ADDR(OPT_KEY_EXTRACT_THREADS)},
+        {"block-cache", required_argument, NULL, OPT_ADDR(OPT_KEY_BLOCK_CACHE)},
+        {"block-cache-size", required_argument, NULL, OPT_ADDR(OPT_KEY_BLOCK_CACHE_SIZE)},
+        {"snapshot", required_argument, NULL, OPT_ADDR(OPT_KEY_SNAPSHOT)},
+        {"snapshot-interval", required_argument, NULL, OPT_ADDR(OPT_KEY_SNAPSHOT_INTERVAL)},
+        {"list-threads", required_argument, NULL, OPT_ADDR(OPT_KEY_LIST_THREADS)},
+        {"list-timeout", required_argument, NULL, OPT_ADDR(OPT_KEY_LIST_TIMEOUT)},
+        {"watch", no_argument, NULL, OPT_ADDR(OPT_KEY_WATCH)},
+        {"nested-cache", required_argument, NULL, OPT_ADDR(OPT_KEY_NESTED_CACHE)},
+        {"nested-cache-size", required_argument, NULL, OPT_ADDR(OPT_KEY_NESTED_CACHE_SIZE)},
+        {"raw-readahead", required_argument, NULL, OPT_ADDR(OPT_KEY_RAW_READAHEAD)},
+        {"io-uring", no_argument, NULL, OPT_ADDR(OPT_KEY_IO_URING)},
+        {"solid-cache", required_argument, NULL, OPT_ADDR(OPT_KEY_SOLID_CACHE)},
+        {"solid-cache-size", required_argument, NULL, OPT_ADDR(OPT_KEY_SOLID_CACHE_SIZE)},
+        {"key-cache-ttl", required_argument, NULL, OPT_ADDR(OPT_KEY_KEY_CACHE_TTL)},
+        {"auto-index", no_argument, NULL, OPT_ADDR(OPT_KEY_AUTO_INDEX)},
+        {"auto-index-cpu", required_argument, NULL, OPT_ADDR(OPT_KEY_AUTO_INDEX_CPU)},
+        {"auto-index-rate", required_argument, NULL, OPT_ADDR(OPT_KEY_AUTO_INDEX_RATE)},
         {NULL,                          0, NULL, 0}
 };
 
@@ -7270,7 +10596,7 @@ static int rar2fs_opt_proc(void *data, const char *arg, int key,
                         /* Validate FUSE options before saving (FUSE tuning options) */
                         /* Validate recursive unpacking options */
                         if ((opt_id >= OPT_KEY_FUSE_MAX_WRITE && opt_id <= OPT_KEY_FUSE_NO_PARALLEL_DIROPS) ||
-                            (opt_id >= OPT_KEY_RECURSIVE && opt_id <= OPT_KEY_MAX_UNPACK_SIZE)) {
+                            (opt_id >= OPT_KEY_RECURSIVE && opt_id <= OPT_KEY_AUTO_INDEX_RATE)) {
                                 if (validate_fuse_option(opt_id, optarg ? optarg : "1") < 0)
                                         return -1;
                         }
@@ -7360,7 +10686,11 @@ int main(int argc, char *argv[])
 
         /* Check file collection at archive mount */
         if (mount_type == MOUNT_ARCHIVE) {
+                /* The timer thread would not survive daemonizing */
+                sighandler_timeout_init();
+                (void)timer_init();
                 const int ret = collect_files(src_path_full);
+                timer_destroy();
                 if (ret < 0) {
                         const int err = -ret;
                         printf("%s: cannot open '%s': %s\n", argv[0],
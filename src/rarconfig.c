@@ -60,6 +60,12 @@ struct alias_entry {
 struct config_entry {
         int seek_length;
         int save_eof;
+        int iob_size;
+        int hist_size;
+        int raw_readahead;
+        int block_cache;
+        int direct_io;
+        int list_threads;
         wchar_t *password_w;
         char *password;
         struct alias_entry *aliases;
@@ -92,6 +98,30 @@ int rarconfig_getprop_int(const char *path, int prop)
                         pthread_mutex_unlock(&config_mutex);
                         return e->mask & RAR_SAVE_EOF_PROP
                                         ? e->save_eof : -1;
+                case RAR_IOB_SIZE_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_IOB_SIZE_PROP
+                                        ? e->iob_size : -1;
+                case RAR_HIST_SIZE_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_HIST_SIZE_PROP
+                                        ? e->hist_size : -1;
+                case RAR_RAW_READAHEAD_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_RAW_READAHEAD_PROP
+                                        ? e->raw_readahead : -1;
+                case RAR_BLOCK_CACHE_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_BLOCK_CACHE_PROP
+                                        ? e->block_cache : -1;
+                case RAR_DIRECT_IO_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_DIRECT_IO_PROP
+                                        ? e->direct_io : -1;
+                case RAR_LIST_THREADS_PROP:
+                        pthread_mutex_unlock(&config_mutex);
+                        return e->mask & RAR_LIST_THREADS_PROP
+                                        ? e->list_threads : -1;
                 }
         }
         pthread_mutex_unlock(&config_mutex);
@@ -498,6 +528,44 @@ static void __entry_set_save_eof(struct config_entry *e,
         }
 }
 
+/*!
+ *****************************************************************************
+ * Set integer property 'prop' unless the value is not a plain number.
+ ****************************************************************************/
+static void __entry_set_uint(struct config_entry *e, struct child_node *cnode,
+                        int *val, uint32_t prop)
+{
+        char *end;
+        unsigned long v = strtoul(cnode->value, &end, 0);
+
+        while (*end == ' ' || *end == '\t')
+                ++end;
+        if (end == cnode->value || *end || v > INT_MAX)
+                return;
+        *val = v;
+        e->mask |= prop;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __entry_set_bool(struct config_entry *e, struct child_node *cnode,
+                        int *val, uint32_t prop)
+{
+        char s[8];
+
+        if (sscanf(cnode->value, " %7s", s) != 1)
+                return;
+        if (!strcasecmp(s, "true")) {
+                *val = 1;
+                e->mask |= prop;
+        } else if (!strcasecmp(s, "false")) {
+                *val = 0;
+                e->mask |= prop;
+        }
+}
+
 /*!
  *****************************************************************************
  *
@@ -645,6 +713,24 @@ void rarconfig_init(const char *source, const char *cfg)
                                 __entry_set_password(e, cnode);
                         if (!strcasecmp(cnode->name, "alias"))
                                 __entry_set_alias(e, cnode);
+                        if (!strcasecmp(cnode->name, "iob-size"))
+                                __entry_set_uint(e, cnode, &e->iob_size,
+                                                 RAR_IOB_SIZE_PROP);
+                        if (!strcasecmp(cnode->name, "hist-size"))
+                                __entry_set_uint(e, cnode, &e->hist_size,
+                                                 RAR_HIST_SIZE_PROP);
+                        if (!strcasecmp(cnode->name, "raw-readahead"))
+                                __entry_set_uint(e, cnode, &e->raw_readahead,
+                                                 RAR_RAW_READAHEAD_PROP);
+                        if (!strcasecmp(cnode->name, "block-cache"))
+                                __entry_set_bool(e, cnode, &e->block_cache,
+                                                 RAR_BLOCK_CACHE_PROP);
+                        if (!strcasecmp(cnode->name, "direct-io"))
+                                __entry_set_bool(e, cnode, &e->direct_io,
+                                                 RAR_DIRECT_IO_PROP);
+                        if (!strcasecmp(cnode->name, "list-threads"))
+                                __entry_set_uint(e, cnode, &e->list_threads,
+                                                 RAR_LIST_THREADS_PROP);
                         free_child(cnode_next);
                         cnode_next = cnode;
                 }
@@ -34,6 +34,12 @@
 #define RAR_SEEK_LENGTH_PROP 0x01
 #define RAR_SAVE_EOF_PROP 0x02
 #define RAR_PASSWORD_PROP 0x04
+#define RAR_IOB_SIZE_PROP 0x08
+#define RAR_HIST_SIZE_PROP 0x10
+#define RAR_RAW_READAHEAD_PROP 0x20
+#define RAR_BLOCK_CACHE_PROP 0x40
+#define RAR_DIRECT_IO_PROP 0x80
+#define RAR_LIST_THREADS_PROP 0x100
 
 void rarconfig_init(const char *source, const char *cfg);
 void rarconfig_destroy();
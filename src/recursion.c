@@ -197,6 +197,75 @@ struct archive_fingerprint compute_archive_fingerprint(
         return fp;
 }
 
+/**
+ * Compute archive fingerprint from a byte range of an open file.
+ * Produces the same value as compute_archive_fingerprint() would for the
+ * range loaded into memory, but only reads the two hashed chunks.
+ *
+ * @param fd Open file descriptor
+ * @param offset Offset of the archive within the file
+ * @param rar_size Size of archive in bytes
+ * @param mtime Modification time of archive (TOCTOU mitigation)
+ * @return Archive fingerprint structure (hash 0 on read error)
+ */
+struct archive_fingerprint compute_archive_fingerprint_fd(
+        int fd,
+        off_t offset,
+        size_t rar_size,
+        time_t mtime)
+{
+        struct archive_fingerprint fp = {0};
+        unsigned char chunk[FINGERPRINT_CHUNK_SIZE];
+
+        if (fd < 0 || rar_size == 0) {
+                printd(3, "compute_archive_fingerprint_fd: invalid input "
+                          "(fd=%d, size=%zu)\n", fd, rar_size);
+                return fp;
+        }
+
+        /* Hash first chunk (up to 4KB) */
+        size_t first_chunk_size = (rar_size < FINGERPRINT_CHUNK_SIZE)
+                                  ? rar_size : FINGERPRINT_CHUNK_SIZE;
+        if (pread(fd, chunk, first_chunk_size, offset) !=
+                        (ssize_t)first_chunk_size)
+                return fp;
+        uint64_t hash1 = fnv1a_hash_64(chunk, first_chunk_size);
+
+        /* Hash last chunk (up to 4KB) if file is larger */
+        uint64_t hash2 = 0;
+        if (rar_size > FINGERPRINT_CHUNK_SIZE) {
+                if (pread(fd, chunk, FINGERPRINT_CHUNK_SIZE,
+                          offset + rar_size - FINGERPRINT_CHUNK_SIZE) !=
+                                FINGERPRINT_CHUNK_SIZE)
+                        return fp;
+                hash2 = fnv1a_hash_64(chunk, FINGERPRINT_CHUNK_SIZE);
+        }
+
+        fp.size = rar_size;
+        fp.mtime = mtime;
+
+        /* Combine hashes: XOR first and last, then hash the combination */
+        uint64_t combined = hash1 ^ hash2;
+        fp.hash = fnv1a_hash_64(&combined, sizeof(combined));
+
+        printd(4, "compute_archive_fingerprint_fd: size=%zu, hash=0x%016llx\n",
+               rar_size, (unsigned long long)fp.hash);
+
+        return fp;
+}
+
+/**
+ * Compute FNV-1a 64-bit hash over a complete buffer.
+ *
+ * @param data Pointer to data buffer
+ * @param len Length of data in bytes
+ * @return 64-bit hash value
+ */
+uint64_t compute_content_hash(const void *data, size_t len)
+{
+        return fnv1a_hash_64(data, len);
+}
+
 /**
  * Check if archive creates a cycle (already visited in current chain).
  * Compares fingerprint against all entries in visited array.
@@ -101,6 +101,32 @@ struct archive_fingerprint compute_archive_fingerprint(
         size_t rar_size,
         time_t mtime);
 
+/**
+ * Compute archive fingerprint from a byte range of an open file.
+ * Same result as compute_archive_fingerprint() on the loaded range.
+ *
+ * @param fd Open file descriptor
+ * @param offset Offset of the archive within the file
+ * @param rar_size Size of archive in bytes
+ * @param mtime Modification time of archive
+ * @return Archive fingerprint structure (hash 0 on read error)
+ */
+struct archive_fingerprint compute_archive_fingerprint_fd(
+        int fd,
+        off_t offset,
+        size_t rar_size,
+        time_t mtime);
+
+/**
+ * Compute FNV-1a 64-bit hash over a complete buffer.
+ * Unlike the fingerprint this covers every byte, for content dedup.
+ *
+ * @param data Pointer to data buffer
+ * @param len Length of data in bytes
+ * @return 64-bit hash value
+ */
+uint64_t compute_content_hash(const void *data, size_t len);
+
 /**
  * Check if archive creates a cycle (already visited in current chain).
  * Returns true if fingerprint matches any entry in visited array.
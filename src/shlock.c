@@ -0,0 +1,180 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <pthread.h>
+#include "shlock.h"
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_init(struct shlock *l)
+{
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                pthread_rwlock_init(&l->shard[i].lock, NULL);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_destroy(struct shlock *l)
+{
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                pthread_rwlock_destroy(&l->shard[i].lock);
+}
+
+/*!
+ *****************************************************************************
+ * Lock all shards for reading.
+ ****************************************************************************/
+void shlock_rdlock(struct shlock *l)
+{
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                pthread_rwlock_rdlock(&l->shard[i].lock);
+}
+
+/*!
+ *****************************************************************************
+ * Lock all shards for writing.
+ ****************************************************************************/
+void shlock_wrlock(struct shlock *l)
+{
+        int i;
+
+        for (i = 0; i < SHLOCK_SHARDS; i++)
+                pthread_rwlock_wrlock(&l->shard[i].lock);
+}
+
+/*!
+ *****************************************************************************
+ * Release all shards taken by shlock_rdlock() or shlock_wrlock().
+ ****************************************************************************/
+void shlock_unlock(struct shlock *l)
+{
+        int i;
+
+        for (i = SHLOCK_SHARDS - 1; i >= 0; i--)
+                pthread_rwlock_unlock(&l->shard[i].lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_rdlock_shard(struct shlock *l, unsigned int shard)
+{
+        pthread_rwlock_rdlock(&l->shard[shard].lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_wrlock_shard(struct shlock *l, unsigned int shard)
+{
+        pthread_rwlock_wrlock(&l->shard[shard].lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_unlock_shard(struct shlock *l, unsigned int shard)
+{
+        pthread_rwlock_unlock(&l->shard[shard].lock);
+}
+
+/*!
+ *****************************************************************************
+ * Lock the shard holding 'key' for reading.
+ ****************************************************************************/
+void shlock_rdlock_key(struct shlock *l, const char *key)
+{
+        shlock_rdlock_shard(l, shlock_shard(key));
+}
+
+/*!
+ *****************************************************************************
+ * Lock the shard holding 'key' for writing.
+ ****************************************************************************/
+void shlock_wrlock_key(struct shlock *l, const char *key)
+{
+        shlock_wrlock_shard(l, shlock_shard(key));
+}
+
+/*!
+ *****************************************************************************
+ * Release the shard taken by shlock_rdlock_key() or shlock_wrlock_key().
+ ****************************************************************************/
+void shlock_unlock_key(struct shlock *l, const char *key)
+{
+        shlock_unlock_shard(l, shlock_shard(key));
+}
+
+/*!
+ *****************************************************************************
+ * Lock the shards holding 'key1' and 'key2' for writing.
+ ****************************************************************************/
+void shlock_wrlock_key2(struct shlock *l, const char *key1,
+                const char *key2)
+{
+        unsigned int s1 = shlock_shard(key1);
+        unsigned int s2 = shlock_shard(key2);
+
+        if (s1 > s2) {
+                unsigned int t = s1;
+                s1 = s2;
+                s2 = t;
+        }
+        shlock_wrlock_shard(l, s1);
+        if (s2 != s1)
+                shlock_wrlock_shard(l, s2);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void shlock_unlock_key2(struct shlock *l, const char *key1,
+                const char *key2)
+{
+        unsigned int s1 = shlock_shard(key1);
+        unsigned int s2 = shlock_shard(key2);
+
+        shlock_unlock_shard(l, s1);
+        if (s2 != s1)
+                shlock_unlock_shard(l, s2);
+}
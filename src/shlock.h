@@ -0,0 +1,84 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#ifndef SHLOCK_H_
+#define SHLOCK_H_
+
+#include <platform.h>
+#include <pthread.h>
+#include "hash.h"
+
+#define SHLOCK_SHARD_BITS 4
+#define SHLOCK_SHARDS (1 << SHLOCK_SHARD_BITS)
+
+/*
+ * Reader/writer lock striped by key. The caches protected by such a lock
+ * keep one hash table per shard, selected by shlock_shard() of the key,
+ * such that an operation on a single path only needs the lock of the
+ * shard holding it. A writer on one path therefore only stalls readers
+ * of paths in the same shard. Operations spanning several paths, e.g.
+ * listing an archive or flushing the cache, take the lock of all shards
+ * using shlock_rdlock()/shlock_wrlock().
+ *
+ * Shards are always taken in ascending order. A thread holding the lock
+ * of a single shard must not take the lock of another shard of the same
+ * shlock, use shlock_wrlock_key2() to lock two keys at once.
+ */
+struct shlock {
+        struct {
+                pthread_rwlock_t lock;
+        } __attribute__((aligned(64))) shard[SHLOCK_SHARDS];
+};
+
+/*!
+ *****************************************************************************
+ * The low order bits of the hash select the hash table bucket, use the
+ * high order bits for the shard to keep the tables evenly filled.
+ ****************************************************************************/
+static inline unsigned int shlock_shard(const char *key)
+{
+        return get_hash(key, 0) >> (32 - SHLOCK_SHARD_BITS);
+}
+
+void shlock_init(struct shlock *l);
+void shlock_destroy(struct shlock *l);
+void shlock_rdlock(struct shlock *l);
+void shlock_wrlock(struct shlock *l);
+void shlock_unlock(struct shlock *l);
+void shlock_rdlock_key(struct shlock *l, const char *key);
+void shlock_wrlock_key(struct shlock *l, const char *key);
+void shlock_unlock_key(struct shlock *l, const char *key);
+void shlock_wrlock_key2(struct shlock *l, const char *key1,
+                const char *key2);
+void shlock_unlock_key2(struct shlock *l, const char *key1,
+                const char *key2);
+void shlock_rdlock_shard(struct shlock *l, unsigned int shard);
+void shlock_wrlock_shard(struct shlock *l, unsigned int shard);
+void shlock_unlock_shard(struct shlock *l, unsigned int shard);
+
+#endif
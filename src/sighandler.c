@@ -32,9 +32,11 @@
 #include <pthread.h>
 #include <sys/wait.h>
 #include "debug.h"
+#include "sighandler.h"
 
 extern void __handle_sigusr1();
 extern void __handle_sighup();
+extern void __handle_sigtimeout();
 
 #ifdef HAVE_STRUCT_SIGACTION_SA_SIGACTION
 #if !defined ( HAVE_EXECINFO_H ) || !defined ( HAVE_UCONTEXT_H )
@@ -140,6 +142,9 @@ static RETSIGTYPE sig_handler(int signum)
         case SIGCHLD:
                 printd(4, "Caught signal SIGCHLD\n");
                 break;
+        case SIG_TIMEOUT:
+                __handle_sigtimeout();
+                break;
         }
 #if RETSIGTYPE != void
         return (RETSIGTYPE)0;
@@ -193,6 +198,28 @@ void sighandler_init()
         sigaction(SIGSEGV, &act, NULL);
 }
 
+/*!
+ *****************************************************************************
+ * Must be called before the timer thread is started, since SIG_TIMEOUT
+ * would otherwise terminate the process.
+ ****************************************************************************/
+void sighandler_timeout_init()
+{
+        struct sigaction act;
+
+        sigaction(SIG_TIMEOUT, NULL, &act);
+        sigemptyset(&act.sa_mask);
+#ifdef HAVE_STRUCT_SIGACTION_SA_SIGACTION
+        act.sa_sigaction = sig_handler;
+        act.sa_flags = SA_SIGINFO;
+#else
+        act.sa_handler = sig_handler;
+        act.sa_flags = 0;
+#endif
+        /* no SA_RESTART; blocking system calls should fail with EINTR */
+        sigaction(SIG_TIMEOUT, &act, NULL);
+}
+
 /*!
  *****************************************************************************
  *
@@ -31,9 +31,15 @@
 
 extern int glibc_test;
 
+/* Sent to a thread to interrupt an UnRAR operation that timed out */
+#define SIG_TIMEOUT SIGUSR2
+
 void
 sighandler_init();
 
+void
+sighandler_timeout_init();
+
 void 
 sighandler_destroy();
 
@@ -0,0 +1,806 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "dirlist.h"
+#include "dircache.h"
+#include "filecache.h"
+#include "common.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "R2FSSNP"
+#define SNAPSHOT_VERSION 2
+
+/*
+ * A snapshot is a plain dump of the file and directory caches in native
+ * byte order. It is only meant to survive a remount on the same host using
+ * the same binary, so the header records the size of the structures that
+ * are written as-is and any mismatch simply discards the file.
+ *
+ * Every cached file refers to the archive it was listed from. Archives are
+ * written once, together with the size and modification time of each of
+ * their volumes and the name of the first volume that did not exist, and
+ * the entries of an archive that no longer matches are dropped at load.
+ * Directories are validated by the directory cache itself using the
+ * modification time recorded in the snapshot.
+ */
+struct snapshot_hdr {
+        char magic[8];
+        uint32_t version;
+        uint32_t stat_sz;
+        uint32_t entry_sz;
+        uint32_t reserved;
+};
+
+#define REC_ARCHIVE 'A'
+#define REC_FILE 'F'
+#define REC_DIR 'D'
+#define REC_END 'E'
+
+#define NO_ARCHIVE UINT32_MAX
+
+struct save_ctx {
+        FILE *fp;
+        void *archives;
+        uint32_t n_archives;
+        int err;
+};
+
+struct load_archive {
+        const char *path;
+        int valid;
+};
+
+struct cursor {
+        const char *p;
+        const char *end;
+};
+
+static pthread_t snapshot_thread;
+static int snapshot_thread_running = 0;
+static int snapshot_stop = 0;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+static char *snapshot_file = NULL;
+static int snapshot_interval = 0;
+static void (*snapshot_next_vol)(char *, const struct filecache_entry *);
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __get_mtim(const struct stat *st, int64_t *sec, int64_t *nsec)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+        *sec = st->st_mtim.tv_sec;
+        *nsec = st->st_mtim.tv_nsec;
+#else
+        *sec = st->st_mtime;
+        *nsec = 0;
+#endif
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __put(struct save_ctx *ctx, const void *p, size_t n)
+{
+        if (!ctx->err && n && fwrite(p, 1, n, ctx->fp) != n)
+                ctx->err = errno ? -errno : -EIO;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __put_u8(struct save_ctx *ctx, uint8_t v)
+{
+        __put(ctx, &v, sizeof(v));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __put_u32(struct save_ctx *ctx, uint32_t v)
+{
+        __put(ctx, &v, sizeof(v));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __put_i64(struct save_ctx *ctx, int64_t v)
+{
+        __put(ctx, &v, sizeof(v));
+}
+
+/*!
+ *****************************************************************************
+ * Strings are stored including the terminating NUL so that they can be
+ * used directly from the mapped file at load. NULL is stored as length 0.
+ ****************************************************************************/
+static void __put_str(struct save_ctx *ctx, const char *s)
+{
+        uint32_t len = s ? strlen(s) + 1 : 0;
+        __put_u32(ctx, len);
+        __put(ctx, s, len);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__archive_alloc()
+{
+        return calloc(1, sizeof(uint32_t));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __archive_free(const char *key, void *data)
+{
+        (void)key;
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __put_vol(struct save_ctx *ctx, const char *vol,
+                      const struct stat *st)
+{
+        int64_t sec = 0;
+        int64_t nsec = 0;
+
+        if (st)
+                __get_mtim(st, &sec, &nsec);
+        __put_str(ctx, vol);
+        __put_i64(ctx, st ? (int64_t)st->st_size : -1);
+        __put_i64(ctx, sec);
+        __put_i64(ctx, nsec);
+}
+
+/*!
+ *****************************************************************************
+ * Write every volume of the archive of 'e', starting with 'rar_p'. The
+ * list ends with the first volume name that does not exist, or only holds
+ * 'rar_p' if no way to name the next volume was given to snapshot_init().
+ ****************************************************************************/
+static void __save_volumes(struct save_ctx *ctx, const char *rar_p,
+                           const struct filecache_entry *e,
+                           const struct stat *first)
+{
+        struct stat st;
+        char *vol;
+
+        __put_vol(ctx, rar_p, first);
+        if (snapshot_next_vol) {
+                vol = strdup(rar_p);
+                if (!vol) {
+                        ctx->err = -ENOMEM;
+                        return;
+                }
+                for (;;) {
+                        snapshot_next_vol(vol, e);
+                        if (stat(vol, &st)) {
+                                __put_vol(ctx, vol, NULL);
+                                break;
+                        }
+                        __put_vol(ctx, vol, &st);
+                }
+                free(vol);
+        }
+        __put_str(ctx, NULL);
+}
+
+/*!
+ *****************************************************************************
+ * Return the index of the archive of 'e' in the snapshot, writing its
+ * record the first time it is seen.
+ ****************************************************************************/
+static uint32_t __save_archive(struct save_ctx *ctx,
+                               const struct filecache_entry *e)
+{
+        const char *rar_p = e->rar_p;
+        struct hash_table_entry *hte;
+        uint32_t *idx;
+        struct stat st;
+
+        hte = hashtable_entry_get(ctx->archives, rar_p);
+        if (hte)
+                return *(uint32_t *)hte->user_data;
+        hte = hashtable_entry_alloc(ctx->archives, rar_p);
+        if (!hte) {
+                ctx->err = -ENOMEM;
+                return NO_ARCHIVE;
+        }
+        idx = hte->user_data;
+        if (stat(rar_p, &st)) {
+                *idx = NO_ARCHIVE;
+                return NO_ARCHIVE;
+        }
+        *idx = ctx->n_archives++;
+        __put_u8(ctx, REC_ARCHIVE);
+        __save_volumes(ctx, rar_p, e, &st);
+        return *idx;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __save_file(const char *key, struct filecache_entry *e, void *arg)
+{
+        struct save_ctx *ctx = arg;
+        struct filecache_entry tmp;
+        uint32_t idx;
+
+        if (ctx->err || !e->rar_p)
+                return;
+        idx = __save_archive(ctx, e);
+        if (idx == NO_ARCHIVE)
+                return;
+
+        memcpy(&tmp, e, sizeof(tmp));
+        tmp.rar_p = NULL;
+        tmp.file_p = NULL;
+        tmp.link_target_p = NULL;
+        tmp.parent_rar_p = NULL;
+        tmp.profile_uint64 = 0;         /* config may change until loaded */
+
+        __put_u8(ctx, REC_FILE);
+        __put_u32(ctx, idx);
+        __put_str(ctx, key);
+        __put_str(ctx, e->file_p);
+        __put_str(ctx, e->link_target_p);
+        __put_str(ctx, e->parent_rar_p);
+        __put(ctx, &tmp, sizeof(tmp));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __save_dir(const char *key, struct dircache_entry *e, void *arg)
+{
+        struct save_ctx *ctx = arg;
+        uint32_t n = dir_list_count(&e->dir_entry_list);
+        uint32_t i;
+
+        if (ctx->err)
+                return;
+
+        __put_u8(ctx, REC_DIR);
+        __put_str(ctx, key);
+        __put_i64(ctx, e->mtim.tv_sec);
+        __put_i64(ctx, e->mtim.tv_nsec);
+        __put_u32(ctx, e->ts_valid);
+        __put_u32(ctx, n);
+        for (i = 0; i < n; i++) {
+                struct dir_entry *next = dir_list_entry(&e->dir_entry_list, i);
+                __put_str(ctx, next->name);
+                __put_u8(ctx, next->type);
+                __put_u8(ctx, next->valid);
+                __put_u8(ctx, next->st != NULL);
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Write the current cache contents to 'file'. The snapshot is written to
+ * a temporary file first and then renamed to never leave a partial one.
+ ****************************************************************************/
+int snapshot_save(const char *file)
+{
+        struct save_ctx ctx;
+        struct snapshot_hdr hdr;
+        struct hash_table_ops ops = {
+                .alloc = __archive_alloc,
+                .free = __archive_free,
+        };
+        size_t len = strlen(file) + sizeof(".tmp");
+        char *tmp;
+        int fd;
+
+        tmp = malloc(len);
+        if (!tmp)
+                return -ENOMEM;
+        snprintf(tmp, len, "%s.tmp", file);
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+                int err = -errno;
+                free(tmp);
+                return err;
+        }
+        ctx.fp = fdopen(fd, "w");
+        if (!ctx.fp) {
+                int err = -errno;
+                close(fd);
+                unlink(tmp);
+                free(tmp);
+                return err;
+        }
+        ctx.archives = hashtable_init(256, &ops);
+        ctx.n_archives = 0;
+        ctx.err = ctx.archives ? 0 : -ENOMEM;
+        (void)setvbuf(ctx.fp, NULL, _IOFBF, 1024 * 1024);
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        hdr.version = SNAPSHOT_VERSION;
+        hdr.stat_sz = sizeof(struct stat);
+        hdr.entry_sz = sizeof(struct filecache_entry);
+        __put(&ctx, &hdr, sizeof(hdr));
+
+        if (!ctx.err) {
+                shlock_rdlock(&dir_access_lock);
+                shlock_rdlock(&file_access_lock);
+                filecache_foreach(__save_file, &ctx);
+                dircache_foreach(__save_dir, &ctx);
+                shlock_unlock(&file_access_lock);
+                shlock_unlock(&dir_access_lock);
+                __put_u8(&ctx, REC_END);
+                printd(3, "snapshot: saved %u archives to %s\n",
+                       ctx.n_archives, file);
+        }
+        if (ctx.archives)
+                hashtable_destroy(ctx.archives);
+
+        if (fflush(ctx.fp) || fsync(fileno(ctx.fp))) {
+                if (!ctx.err)
+                        ctx.err = -errno;
+        }
+        if (fclose(ctx.fp) && !ctx.err)
+                ctx.err = -errno;
+        if (!ctx.err && rename(tmp, file))
+                ctx.err = -errno;
+        if (ctx.err)
+                unlink(tmp);
+        free(tmp);
+        return ctx.err;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __get(struct cursor *c, void *p, size_t n)
+{
+        if ((size_t)(c->end - c->p) < n)
+                return -1;
+        memcpy(p, c->p, n);
+        c->p += n;
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __get_str(struct cursor *c, const char **s)
+{
+        uint32_t len;
+
+        if (__get(c, &len, sizeof(len)))
+                return -1;
+        if (!len) {
+                *s = NULL;
+                return 0;
+        }
+        if ((size_t)(c->end - c->p) < len || c->p[len - 1] != '\0')
+                return -1;
+        *s = c->p;
+        c->p += len;
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Returns non-zero if volume 'vol' still matches what was recorded. A
+ * negative 'size' records a volume that must not exist.
+ ****************************************************************************/
+static int __vol_valid(const char *vol, int64_t size, int64_t sec,
+                       int64_t nsec)
+{
+        int64_t cur_sec;
+        int64_t cur_nsec;
+        struct stat st;
+
+        if (stat(vol, &st))
+                return size < 0;
+        __get_mtim(&st, &cur_sec, &cur_nsec);
+        return st.st_size == size && cur_sec == sec && cur_nsec == nsec;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __load_archive(struct cursor *c, struct load_archive **archives,
+                          uint32_t *n, uint32_t *dropped)
+{
+        struct load_archive *a;
+        const char *path;
+        const char *vol;
+        int64_t size;
+        int64_t sec;
+        int64_t nsec;
+        int valid = 1;
+
+        if (__get_str(c, &path) || !path)
+                return -EINVAL;
+        for (vol = path; vol; ) {
+                if (__get(c, &size, sizeof(size)) ||
+                    __get(c, &sec, sizeof(sec)) ||
+                    __get(c, &nsec, sizeof(nsec)))
+                        return -EINVAL;
+                if (valid && !__vol_valid(vol, size, sec, nsec)) {
+                        printd(3, "snapshot: %s changed, dropping entries\n",
+                               vol);
+                        valid = 0;
+                }
+                if (__get_str(c, &vol))
+                        return -EINVAL;
+        }
+        a = realloc(*archives, (*n + 1) * sizeof(struct load_archive));
+        if (!a)
+                return -ENOMEM;
+        *archives = a;
+        a += (*n)++;
+        a->path = path;
+        a->valid = valid;
+        if (!valid)
+                ++*dropped;
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __load_file(struct cursor *c, struct load_archive *archives,
+                       uint32_t n)
+{
+        struct filecache_entry tmp;
+        struct filecache_entry *e;
+        uint32_t idx;
+        const char *key;
+        const char *file_p;
+        const char *link_target_p;
+        const char *parent_rar_p;
+
+        if (__get(c, &idx, sizeof(idx)) || idx >= n ||
+            __get_str(c, &key) || !key ||
+            __get_str(c, &file_p) ||
+            __get_str(c, &link_target_p) ||
+            __get_str(c, &parent_rar_p) ||
+            __get(c, &tmp, sizeof(tmp)))
+                return -EINVAL;
+        if (!archives[idx].valid || filecache_get(key))
+                return 0;
+
+        e = filecache_alloc(key);
+        if (!e)
+                return -ENOMEM;
+        tmp.rar_p = filecache_strdup(archives[idx].path);
+        tmp.file_p = file_p ? strdup(file_p) : NULL;
+        tmp.link_target_p = link_target_p ? strdup(link_target_p) : NULL;
+        tmp.parent_rar_p = parent_rar_p ? filecache_strdup(parent_rar_p) : NULL;
+        memcpy(e, &tmp, sizeof(struct filecache_entry));
+        if (!e->rar_p || (file_p && !e->file_p) ||
+            (link_target_p && !e->link_target_p) ||
+            (parent_rar_p && !e->parent_rar_p)) {
+                filecache_invalidate(key);
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * A directory listing is only restored if every archive entry it refers
+ * to was restored as well. Listings not backed by a real directory are
+ * only restored if the entry of the directory itself is present.
+ ****************************************************************************/
+static int __load_dir(struct cursor *c)
+{
+        struct dir_entry_list root;
+        struct dir_entry *next;
+        struct dircache_entry *dce;
+        const char *key;
+        int64_t sec;
+        int64_t nsec;
+        uint32_t ts_valid;
+        uint32_t n;
+        uint32_t i;
+        int keep;
+
+        if (__get_str(c, &key) || !key ||
+            __get(c, &sec, sizeof(sec)) ||
+            __get(c, &nsec, sizeof(nsec)) ||
+            __get(c, &ts_valid, sizeof(ts_valid)) ||
+            __get(c, &n, sizeof(n)))
+                return -EINVAL;
+
+        keep = ts_valid || filecache_get(key);
+        dir_list_open(&root);
+        for (i = 0; i < n; i++) {
+                const char *name;
+                uint8_t type;
+                uint8_t valid;
+                uint8_t has_st;
+                struct stat *st = NULL;
+
+                if (__get_str(c, &name) || !name ||
+                    __get(c, &type, sizeof(type)) ||
+                    __get(c, &valid, sizeof(valid)) ||
+                    __get(c, &has_st, sizeof(has_st))) {
+                        dir_list_free(&root);
+                        return -EINVAL;
+                }
+                if (!keep)
+                        continue;
+                if (type == DIR_E_RAR && has_st) {
+                        struct filecache_entry *e = NULL;
+                        char *mp;
+                        ABS_MP2(mp, key, name);
+                        if (mp) {
+                                e = filecache_get(mp);
+                                free(mp);
+                        }
+                        if (!e) {
+                                keep = 0;
+                                continue;
+                        }
+                        st = &e->stat;
+                }
+                next = dir_entry_add(&root, name, st, type);
+                if (!next) {
+                        keep = 0;
+                        continue;
+                }
+                next->valid = valid;
+        }
+
+        dce = keep ? dircache_alloc(key) : NULL;
+        if (dce) {
+                dir_list_free(&dce->dir_entry_list);
+                dce->dir_entry_list = root;
+                dce->mtim.tv_sec = sec;
+                dce->mtim.tv_nsec = nsec;
+                dce->ts_valid = ts_valid;
+        } else {
+                dir_list_free(&root);
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Populate the caches from 'file'. Should be called before the file
+ * system is accessed. Returns the number of archives that were dropped
+ * since they changed, or a negative error.
+ ****************************************************************************/
+int snapshot_load(const char *file)
+{
+        struct snapshot_hdr hdr;
+        struct load_archive *archives = NULL;
+        uint32_t n_archives = 0;
+        uint32_t dropped = 0;
+        struct cursor c;
+        struct stat st;
+        void *map;
+        int fd;
+        int res = 0;
+
+        fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+                return -errno;
+        if (fstat(fd, &st)) {
+                res = -errno;
+                close(fd);
+                return res;
+        }
+        if ((size_t)st.st_size < sizeof(hdr)) {
+                close(fd);
+                return -EINVAL;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return -errno;
+        c.p = map;
+        c.end = c.p + st.st_size;
+
+        (void)__get(&c, &hdr, sizeof(hdr));
+        if (memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+            hdr.version != SNAPSHOT_VERSION ||
+            hdr.stat_sz != sizeof(struct stat) ||
+            hdr.entry_sz != sizeof(struct filecache_entry)) {
+                munmap(map, st.st_size);
+                return -EINVAL;
+        }
+
+        shlock_wrlock(&dir_access_lock);
+        shlock_wrlock(&file_access_lock);
+        while (!res) {
+                uint8_t type;
+                if (__get(&c, &type, sizeof(type))) {
+                        res = -EINVAL;
+                        break;
+                }
+                if (type == REC_END)
+                        break;
+                switch (type) {
+                case REC_ARCHIVE:
+                        res = __load_archive(&c, &archives, &n_archives,
+                                             &dropped);
+                        break;
+                case REC_FILE:
+                        res = __load_file(&c, archives, n_archives);
+                        break;
+                case REC_DIR:
+                        res = __load_dir(&c);
+                        break;
+                default:
+                        res = -EINVAL;
+                        break;
+                }
+        }
+        shlock_unlock(&file_access_lock);
+
+        /*
+         * A damaged snapshot is not trusted at all. Since this is called
+         * before anything else populated the caches they can simply be
+         * flushed. Note that flushing the directory cache will take the
+         * file cache lock on its own.
+         */
+        if (res) {
+                dircache_invalidate(NULL);
+                shlock_wrlock(&file_access_lock);
+                filecache_invalidate(NULL);
+                shlock_unlock(&file_access_lock);
+        }
+        shlock_unlock(&dir_access_lock);
+
+        printd(3, "snapshot: loaded %u archives from %s, %u dropped (%d)\n",
+               n_archives, file, dropped, res);
+        free(archives);
+        munmap(map, st.st_size);
+        return res ? res : (int)dropped;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__snapshot_task(void *data)
+{
+        struct timespec ts;
+        int res;
+
+        (void)data;
+
+        pthread_mutex_lock(&snapshot_lock);
+        while (!snapshot_stop) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += snapshot_interval;
+                res = 0;
+                while (!snapshot_stop && res != ETIMEDOUT)
+                        res = pthread_cond_timedwait(&snapshot_cond,
+                                                     &snapshot_lock, &ts);
+                if (snapshot_stop)
+                        break;
+                pthread_mutex_unlock(&snapshot_lock);
+                res = snapshot_save(snapshot_file);
+                if (res) {
+                        printd(1, "snapshot: failed to save %s: %s\n",
+                               snapshot_file, strerror(-res));
+                }
+                pthread_mutex_lock(&snapshot_lock);
+        }
+        pthread_mutex_unlock(&snapshot_lock);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Load the snapshot 'file' and, if 'interval' is non-zero, save it again
+ * every 'interval' seconds. The snapshot is always saved at destroy.
+ * 'next_vol' turns the name of a volume of the archive of an entry into
+ * the name of the next one. Returns as snapshot_load().
+ ****************************************************************************/
+int snapshot_init(const char *file, int interval,
+                  void (*next_vol)(char *, const struct filecache_entry *))
+{
+        int res;
+
+        snapshot_next_vol = next_vol;
+        snapshot_file = strdup(file);
+        if (!snapshot_file)
+                return -ENOMEM;
+        res = snapshot_load(file);
+
+        snapshot_stop = 0;
+        snapshot_interval = interval;
+        if (interval > 0) {
+                if (!pthread_create(&snapshot_thread, NULL, __snapshot_task,
+                                    NULL))
+                        snapshot_thread_running = 1;
+                else
+                        printd(1, "snapshot: failed to start thread\n");
+        }
+        return res;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void snapshot_destroy()
+{
+        int res;
+
+        if (!snapshot_file)
+                return;
+        if (snapshot_thread_running) {
+                pthread_mutex_lock(&snapshot_lock);
+                snapshot_stop = 1;
+                pthread_cond_signal(&snapshot_cond);
+                pthread_mutex_unlock(&snapshot_lock);
+                pthread_join(snapshot_thread, NULL);
+                snapshot_thread_running = 0;
+        }
+        res = snapshot_save(snapshot_file);
+        if (res) {
+                printd(1, "snapshot: failed to save %s: %s\n", snapshot_file,
+                       strerror(-res));
+        }
+        free(snapshot_file);
+        snapshot_file = NULL;
+}
@@ -0,0 +1,460 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "solidcache.h"
+
+#define SOLIDCACHE_SZ 1024
+
+/*
+ * Files of a solid archive can only be decoded after everything that
+ * precedes them in the solid stream. Files passed on the way to the one
+ * actually requested are therefore kept below 'cache_dir' so that a later
+ * open of any of them can be served without decoding the stream again.
+ * Entries are keyed on the archive path, its size and mtime, and the name
+ * within the archive, such that a replaced archive is never matched.
+ */
+struct solidcache_entry {
+        const char *key;        /* owned by the hash table */
+        char name[16];
+        size_t size;
+        struct solidcache_entry *prev;
+        struct solidcache_entry *next;
+};
+
+struct solidcache_writer {
+        char *key;
+        char name[16];
+        int fd;
+        int failed;
+        size_t size;
+        size_t written;
+};
+
+static void *entries = NULL;
+static pthread_mutex_t solidcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+static size_t cache_budget = 0;
+static size_t cache_used = 0;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+static unsigned long evictions = 0;
+
+/* LRU list, most recently used first */
+static struct solidcache_entry *lru_head = NULL;
+static struct solidcache_entry *lru_tail = NULL;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__alloc()
+{
+        return calloc(1, sizeof(struct solidcache_entry));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __free(const char *key, void *data)
+{
+        (void)key;              /* touch */
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_unlink(struct solidcache_entry *e)
+{
+        if (e->prev)
+                e->prev->next = e->next;
+        else
+                lru_head = e->next;
+        if (e->next)
+                e->next->prev = e->prev;
+        else
+                lru_tail = e->prev;
+        e->prev = e->next = NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __lru_push(struct solidcache_entry *e)
+{
+        e->prev = NULL;
+        e->next = lru_head;
+        if (lru_head)
+                lru_head->prev = e;
+        lru_head = e;
+        if (!lru_tail)
+                lru_tail = e;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __path(char *path, size_t len, const char *name)
+{
+        snprintf(path, len, "%s/%s", cache_dir, name);
+}
+
+/*!
+ *****************************************************************************
+ * Returns a newly allocated key for 'file' in archive 'arch', or NULL if
+ * the archive cannot be accessed.
+ ****************************************************************************/
+static char *__key(const char *arch, const char *file)
+{
+        struct stat st;
+        size_t len;
+        char *key;
+
+        if (stat(arch, &st) == -1)
+                return NULL;
+        len = strlen(arch) + strlen(file) + 64;
+        key = malloc(len);
+        if (key)
+                snprintf(key, len, "%jd:%jd:%zu:%s:%s",
+                         (intmax_t)st.st_mtime, (intmax_t)st.st_size,
+                         strlen(arch), arch, file);
+        return key;
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with solidcache_lock held.
+ ****************************************************************************/
+static void __evict(size_t needed)
+{
+        char path[PATH_MAX];
+
+        while (lru_tail && cache_used + needed > cache_budget) {
+                struct solidcache_entry *e = lru_tail;
+                __lru_unlink(e);
+                cache_used -= e->size;
+                __path(path, sizeof(path), e->name);
+                (void)unlink(path);
+                printd(3, "solidcache: evicted %s\n", e->key);
+                hashtable_entry_delete(entries, e->key);
+                ++evictions;
+        }
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __purge_dir()
+{
+        char name[PATH_MAX];
+        DIR *dp = opendir(cache_dir);
+        struct dirent *ep;
+
+        if (!dp)
+                return;
+        while ((ep = readdir(dp))) {
+                if (!strncmp(ep->d_name, ".sld", 4)) {
+                        __path(name, sizeof(name), ep->d_name);
+                        (void)unlink(name);
+                }
+        }
+        closedir(dp);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int solidcache_enabled()
+{
+        return entries != NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Open the cached copy of 'file' in archive 'arch'. Returns a read-only
+ * file descriptor on a hit and -ENOENT on a miss. The descriptor stays
+ * valid even if the copy is evicted while it is open.
+ ****************************************************************************/
+int solidcache_open(const char *arch, const char *file)
+{
+        char path[PATH_MAX];
+        struct hash_table_entry *he;
+        struct solidcache_entry *e;
+        char *key;
+        int fd = -ENOENT;
+
+        if (!entries)
+                return -ENOENT;
+        key = __key(arch, file);
+        if (!key)
+                return -ENOENT;
+
+        pthread_mutex_lock(&solidcache_lock);
+        he = entries ? hashtable_entry_get(entries, key) : NULL;
+        if (he) {
+                e = he->user_data;
+                __path(path, sizeof(path), e->name);
+                fd = open(path, O_RDONLY);
+                if (fd == -1) {
+                        fd = -ENOENT;
+                } else {
+                        __lru_unlink(e);
+                        __lru_push(e);
+                }
+        }
+        if (fd < 0)
+                ++misses;
+        else
+                ++hits;
+        pthread_mutex_unlock(&solidcache_lock);
+        free(key);
+        return fd;
+}
+
+/*!
+ *****************************************************************************
+ * Start storing 'file' of archive 'arch', which is 'size' bytes once
+ * decoded. Returns NULL if the file is already cached or cannot be
+ * stored, in which case the caller should simply not decode it.
+ ****************************************************************************/
+struct solidcache_writer *solidcache_begin(const char *arch,
+                const char *file, size_t size)
+{
+        char path[PATH_MAX];
+        struct solidcache_writer *w;
+        int cached;
+
+        if (!entries || !size || size > cache_budget)
+                return NULL;
+
+        w = calloc(1, sizeof(struct solidcache_writer));
+        if (!w)
+                return NULL;
+        w->key = __key(arch, file);
+        if (!w->key)
+                goto error;
+
+        pthread_mutex_lock(&solidcache_lock);
+        cached = entries && hashtable_entry_get(entries, w->key);
+        pthread_mutex_unlock(&solidcache_lock);
+        if (cached)
+                goto error;
+
+        snprintf(w->name, sizeof(w->name), ".sldXXXXXX");
+        __path(path, sizeof(path), w->name);
+        w->fd = mkstemp(path);
+        if (w->fd == -1) {
+                printd(1, "solidcache: failed to create %s: %s\n", path,
+                       strerror(errno));
+                goto error;
+        }
+        memcpy(w->name, path + strlen(path) - 10, 10);
+        w->size = size;
+        return w;
+
+error:
+        free(w->key);
+        free(w);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void solidcache_write(struct solidcache_writer *w, const void *data,
+                size_t size)
+{
+        const char *p = data;
+
+        if (w->failed)
+                return;
+        if (w->written + size > w->size) {
+                w->failed = 1;
+                return;
+        }
+        while (size) {
+                ssize_t n = write(w->fd, p, size);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        printd(1, "solidcache: write failed: %s\n",
+                               strerror(errno));
+                        w->failed = 1;
+                        return;
+                }
+                p += n;
+                size -= n;
+                w->written += n;
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Make a completely written file available to solidcache_open(). The
+ * writer is released in any case.
+ ****************************************************************************/
+void solidcache_commit(struct solidcache_writer *w)
+{
+        struct hash_table_entry *he;
+        struct solidcache_entry *e;
+
+        if (w->failed || w->written != w->size) {
+                solidcache_abort(w);
+                return;
+        }
+        close(w->fd);
+        w->fd = -1;
+
+        pthread_mutex_lock(&solidcache_lock);
+        if (!entries || hashtable_entry_get(entries, w->key)) {
+                /* Cache destroyed or lost a race */
+                pthread_mutex_unlock(&solidcache_lock);
+                solidcache_abort(w);
+                return;
+        }
+        __evict(w->size);
+        he = hashtable_entry_alloc(entries, w->key);
+        if (!he) {
+                pthread_mutex_unlock(&solidcache_lock);
+                solidcache_abort(w);
+                return;
+        }
+        e = he->user_data;
+        e->key = he->key;
+        memcpy(e->name, w->name, sizeof(e->name));
+        e->size = w->size;
+        __lru_push(e);
+        cache_used += w->size;
+        printd(4, "solidcache: stored %s\n", e->key);
+        pthread_mutex_unlock(&solidcache_lock);
+
+        free(w->key);
+        free(w);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void solidcache_abort(struct solidcache_writer *w)
+{
+        char path[PATH_MAX];
+
+        if (w->fd != -1)
+                close(w->fd);
+        pthread_mutex_lock(&solidcache_lock);
+        if (cache_dir) {
+                __path(path, sizeof(path), w->name);
+                (void)unlink(path);
+        }
+        pthread_mutex_unlock(&solidcache_lock);
+        free(w->key);
+        free(w);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int solidcache_init(const char *dir, size_t budget)
+{
+        struct hash_table_ops ops = {
+                .alloc = __alloc,
+                .free = __free,
+        };
+
+        if (!dir || !budget)
+                return 0;
+
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+                printd(1, "solidcache: cannot create %s: %s\n", dir,
+                       strerror(errno));
+                return -errno;
+        }
+        cache_dir = strdup(dir);
+        if (!cache_dir)
+                return -ENOMEM;
+        __purge_dir();
+
+        pthread_mutex_lock(&solidcache_lock);
+        cache_budget = budget;
+        cache_used = 0;
+        hits = misses = evictions = 0;
+        entries = hashtable_init(SOLIDCACHE_SZ, &ops);
+        if (!entries) {
+                pthread_mutex_unlock(&solidcache_lock);
+                free(cache_dir);
+                cache_dir = NULL;
+                return -ENOMEM;
+        }
+        pthread_mutex_unlock(&solidcache_lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void solidcache_destroy()
+{
+        pthread_mutex_lock(&solidcache_lock);
+        if (entries) {
+                printd(3, "solidcache: %lu hits, %lu misses, %lu evictions\n",
+                       hits, misses, evictions);
+                hashtable_destroy(entries);
+                entries = NULL;
+                lru_head = lru_tail = NULL;
+                cache_used = 0;
+                __purge_dir();
+        }
+        free(cache_dir);
+        cache_dir = NULL;
+        pthread_mutex_unlock(&solidcache_lock);
+}
@@ -0,0 +1,216 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "debug.h"
+#include "threadpool.h"
+
+struct threadpool_job {
+        void (*fn)(void *);
+        void *arg;
+        struct threadpool_job *next;
+};
+
+struct threadpool {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct threadpool_job *head;
+        struct threadpool_job *tail;
+        int nthreads;
+        int idle;
+        int queued;
+        int shutdown;
+        pthread_t *threads;
+};
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *threadpool_worker(void *data)
+{
+        struct threadpool *pool = data;
+        struct threadpool_job *job;
+
+        pthread_mutex_lock(&pool->lock);
+        for (;;) {
+                while (!pool->head && !pool->shutdown)
+                        pthread_cond_wait(&pool->cond, &pool->lock);
+                if (!pool->head)
+                        break;          /* shutdown and queue drained */
+                job = pool->head;
+                pool->head = job->next;
+                if (!pool->head)
+                        pool->tail = NULL;
+                --pool->queued;
+                --pool->idle;
+                pthread_mutex_unlock(&pool->lock);
+
+                job->fn(job->arg);
+                free(job);
+
+                pthread_mutex_lock(&pool->lock);
+                ++pool->idle;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __submit(struct threadpool *pool, void (*fn)(void *), void *arg,
+                int try)
+{
+        struct threadpool_job *job;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->shutdown) {
+                pthread_mutex_unlock(&pool->lock);
+                return -ESHUTDOWN;
+        }
+        /* Queued jobs will occupy idle workers as soon as they wake up */
+        if (try && pool->idle <= pool->queued) {
+                pthread_mutex_unlock(&pool->lock);
+                return -EBUSY;
+        }
+        job = malloc(sizeof(struct threadpool_job));
+        if (!job) {
+                pthread_mutex_unlock(&pool->lock);
+                return -ENOMEM;
+        }
+        job->fn = fn;
+        job->arg = arg;
+        job->next = NULL;
+        if (pool->tail)
+                pool->tail->next = job;
+        else
+                pool->head = job;
+        pool->tail = job;
+        ++pool->queued;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Queue a job for execution by the next available worker.
+ ****************************************************************************/
+int threadpool_submit(struct threadpool *pool, void (*fn)(void *), void *arg)
+{
+        return __submit(pool, fn, arg, 0);
+}
+
+/*!
+ *****************************************************************************
+ * Like threadpool_submit() but fails with -EBUSY rather than queueing if
+ * no worker is idle. Intended for long running jobs for which the caller
+ * has a fall-back when the pool is saturated.
+ ****************************************************************************/
+int threadpool_trysubmit(struct threadpool *pool, void (*fn)(void *), void *arg)
+{
+        return __submit(pool, fn, arg, 1);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int threadpool_size(struct threadpool *pool)
+{
+        return pool ? pool->nthreads : 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+struct threadpool *threadpool_create(int nthreads)
+{
+        struct threadpool *pool;
+        int i;
+
+        if (nthreads <= 0)
+                return NULL;
+
+        pool = calloc(1, sizeof(struct threadpool));
+        if (!pool)
+                return NULL;
+        pool->threads = calloc(nthreads, sizeof(pthread_t));
+        if (!pool->threads) {
+                free(pool);
+                return NULL;
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->cond, NULL);
+
+        for (i = 0; i < nthreads; i++) {
+                if (pthread_create(&pool->threads[i], NULL,
+                                   threadpool_worker, pool)) {
+                        printd(1, "threadpool_create: failed to create worker %d\n", i);
+                        break;
+                }
+        }
+        pool->nthreads = i;
+        pool->idle = i;
+        if (!i) {
+                threadpool_destroy(pool);
+                return NULL;
+        }
+        return pool;
+}
+
+/*!
+ *****************************************************************************
+ * Wait for all queued and running jobs to complete and release the pool.
+ ****************************************************************************/
+void threadpool_destroy(struct threadpool *pool)
+{
+        int i;
+
+        if (!pool)
+                return;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < pool->nthreads; i++)
+                pthread_join(pool->threads[i], NULL);
+
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool);
+}
@@ -0,0 +1,298 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "debug.h"
+#include "timer.h"
+
+#define TIMER_HEAP_MIN 64
+
+/*
+ * A single thread serves all deadlines from a binary min-heap ordered on
+ * expiry. Callbacks are invoked from that thread without the lock held
+ * and should be short. timer_cancel() does not return while the callback
+ * of the timer being cancelled is still running, so that the timer may be
+ * released as soon as it returns.
+ */
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static pthread_cond_t timer_done;
+static pthread_t timer_thread;
+static struct timer **heap = NULL;
+static int heap_count = 0;
+static int heap_size = 0;
+static struct timer *running = NULL;
+static int stopping = 0;
+static pid_t owner = 0;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __before(const struct timer *a, const struct timer *b)
+{
+        if (a->deadline.tv_sec != b->deadline.tv_sec)
+                return a->deadline.tv_sec < b->deadline.tv_sec;
+        return a->deadline.tv_nsec < b->deadline.tv_nsec;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __set(int pos, struct timer *t)
+{
+        heap[pos] = t;
+        t->pos = pos;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __sift_up(int pos)
+{
+        struct timer *t = heap[pos];
+
+        while (pos > 0) {
+                int parent = (pos - 1) / 2;
+                if (!__before(t, heap[parent]))
+                        break;
+                __set(pos, heap[parent]);
+                pos = parent;
+        }
+        __set(pos, t);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __sift_down(int pos)
+{
+        struct timer *t = heap[pos];
+
+        while (1) {
+                int child = 2 * pos + 1;
+                if (child >= heap_count)
+                        break;
+                if (child + 1 < heap_count &&
+                    __before(heap[child + 1], heap[child]))
+                        ++child;
+                if (!__before(heap[child], t))
+                        break;
+                __set(pos, heap[child]);
+                pos = child;
+        }
+        __set(pos, t);
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with timer_lock held.
+ ****************************************************************************/
+static void __remove(struct timer *t)
+{
+        int pos = t->pos;
+
+        t->pos = -1;
+        if (--heap_count == pos)
+                return;
+        __set(pos, heap[heap_count]);
+        if (pos > 0 && __before(heap[pos], heap[(pos - 1) / 2]))
+                __sift_up(pos);
+        else
+                __sift_down(pos);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__timer_task(void *data)
+{
+        struct timespec now;
+        struct timer *t;
+
+        (void)data;             /* touch */
+
+        pthread_mutex_lock(&timer_lock);
+        while (!stopping) {
+                if (!heap_count) {
+                        pthread_cond_wait(&timer_cond, &timer_lock);
+                        continue;
+                }
+                t = heap[0];
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (now.tv_sec < t->deadline.tv_sec ||
+                    (now.tv_sec == t->deadline.tv_sec &&
+                     now.tv_nsec < t->deadline.tv_nsec)) {
+                        pthread_cond_timedwait(&timer_cond, &timer_lock,
+                                               &t->deadline);
+                        continue;
+                }
+                __remove(t);
+                running = t;
+                pthread_mutex_unlock(&timer_lock);
+                t->fn(t->arg);
+                pthread_mutex_lock(&timer_lock);
+                running = NULL;
+                pthread_cond_broadcast(&timer_done);
+        }
+        pthread_mutex_unlock(&timer_lock);
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Arm 't' to call 'fn' once 'msec' milliseconds from now. Returns 0 on
+ * success. Fails in processes forked after timer_init() since the timer
+ * thread is not running there.
+ ****************************************************************************/
+int timer_arm(struct timer *t, unsigned int msec, void (*fn)(void *),
+                void *arg)
+{
+        t->pos = -1;
+        if (!owner || getpid() != owner)
+                return -ESRCH;
+
+        clock_gettime(CLOCK_MONOTONIC, &t->deadline);
+        t->deadline.tv_sec += msec / 1000;
+        t->deadline.tv_nsec += (long)(msec % 1000) * 1000000;
+        if (t->deadline.tv_nsec >= 1000000000) {
+                t->deadline.tv_nsec -= 1000000000;
+                ++t->deadline.tv_sec;
+        }
+        t->fn = fn;
+        t->arg = arg;
+
+        pthread_mutex_lock(&timer_lock);
+        if (stopping) {
+                pthread_mutex_unlock(&timer_lock);
+                return -ESRCH;
+        }
+        if (heap_count == heap_size) {
+                int size = heap_size ? heap_size * 2 : TIMER_HEAP_MIN;
+                struct timer **h = realloc(heap, size * sizeof(*h));
+                if (!h) {
+                        pthread_mutex_unlock(&timer_lock);
+                        return -ENOMEM;
+                }
+                heap = h;
+                heap_size = size;
+        }
+        __set(heap_count, t);
+        __sift_up(heap_count++);
+        if (t->pos == 0)
+                pthread_cond_signal(&timer_cond);
+        pthread_mutex_unlock(&timer_lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Disarm 't'. Returns 1 if the timer already fired, 0 otherwise.
+ ****************************************************************************/
+int timer_cancel(struct timer *t)
+{
+        int fired;
+
+        if (!owner || getpid() != owner)
+                return 0;
+
+        pthread_mutex_lock(&timer_lock);
+        while (running == t)
+                pthread_cond_wait(&timer_done, &timer_lock);
+        fired = t->pos == -1;
+        if (!fired)
+                __remove(t);
+        pthread_mutex_unlock(&timer_lock);
+        return fired;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int timer_init()
+{
+        pthread_condattr_t attr;
+        int err;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&timer_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_cond_init(&timer_done, NULL);
+
+        stopping = 0;
+        err = pthread_create(&timer_thread, NULL, __timer_task, NULL);
+        if (err) {
+                printd(1, "timer: failed to start timer thread: %s\n",
+                       strerror(err));
+                pthread_cond_destroy(&timer_cond);
+                pthread_cond_destroy(&timer_done);
+                return -err;
+        }
+        owner = getpid();
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void timer_destroy()
+{
+        if (!owner)
+                return;
+
+        pthread_mutex_lock(&timer_lock);
+        stopping = 1;
+        pthread_cond_signal(&timer_cond);
+        pthread_mutex_unlock(&timer_lock);
+        pthread_join(timer_thread, NULL);
+
+        /* Anything still armed will never fire */
+        pthread_mutex_lock(&timer_lock);
+        while (heap_count)
+                heap[--heap_count]->pos = -1;
+        free(heap);
+        heap = NULL;
+        heap_size = 0;
+        owner = 0;
+        pthread_mutex_unlock(&timer_lock);
+        pthread_cond_destroy(&timer_cond);
+        pthread_cond_destroy(&timer_done);
+}
@@ -0,0 +1,362 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "debug.h"
+#include "uring.h"
+
+#define URING_FILES 4096
+#define URING_MAX_BATCH 16
+
+/*
+ * A single ring is shared by all readers. Submissions are serialized by a
+ * mutex while completions are reaped by a dedicated thread and handed back
+ * to the waiting submitter. All reads issued for one FUSE request are
+ * queued together, which lets the device work on them in parallel, e.g.
+ * when a read crosses volume boundaries. Volume descriptors are registered
+ * with the ring when opened to save the per-request file lookup.
+ * Without liburing, or if the ring could not be set up, reads are served
+ * using plain pread(2).
+ */
+
+#ifdef HAVE_LIBURING
+struct uring_wait {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        int pending;
+};
+
+struct uring_req {
+        struct uring_io *io;
+        struct uring_wait *w;
+};
+
+static struct io_uring ring;
+static int ring_ok = 0;
+static pthread_t reaper;
+static pthread_mutex_t sq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int *slots = NULL;
+static int slot_hint = 0;
+#endif
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __pread(struct uring_io *io)
+{
+        ssize_t n;
+
+        do {
+                n = pread(io->fd, io->buf, io->len, io->offset);
+        } while (n == -1 && errno == EINTR);
+        io->res = n == -1 ? -errno : n;
+}
+
+#ifdef HAVE_LIBURING
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__reaper(void *arg)
+{
+        (void)arg;              /* touch */
+
+        for (;;) {
+                struct io_uring_cqe *cqe;
+                struct uring_req *req;
+                int res = io_uring_wait_cqe(&ring, &cqe);
+
+                if (res == -EINTR || res == -EAGAIN)
+                        continue;
+                if (res < 0) {
+                        printd(1, "io_uring_wait_cqe: %s\n", strerror(-res));
+                        continue;
+                }
+                req = io_uring_cqe_get_data(cqe);
+                if (!req) {
+                        io_uring_cqe_seen(&ring, cqe);
+                        break;          /* shutdown */
+                }
+                req->io->res = cqe->res;
+                io_uring_cqe_seen(&ring, cqe);
+
+                pthread_mutex_lock(&req->w->lock);
+                if (!--req->w->pending)
+                        pthread_cond_signal(&req->w->cond);
+                pthread_mutex_unlock(&req->w->lock);
+        }
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __uring_read(struct uring_io *io, int n)
+{
+        struct uring_req req[URING_MAX_BATCH];
+        struct uring_wait w;
+        int queued = 0;
+        int i;
+
+        pthread_mutex_init(&w.lock, NULL);
+        pthread_cond_init(&w.cond, NULL);
+        w.pending = 0;
+
+        pthread_mutex_lock(&sq_lock);
+        for (i = 0; i < n; i++) {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                if (!sqe)
+                        break;
+                req[i].io = &io[i];
+                req[i].w = &w;
+                if (io[i].slot >= 0) {
+                        io_uring_prep_read(sqe, io[i].slot, io[i].buf,
+                                           io[i].len, io[i].offset);
+                        sqe->flags |= IOSQE_FIXED_FILE;
+                } else {
+                        io_uring_prep_read(sqe, io[i].fd, io[i].buf,
+                                           io[i].len, io[i].offset);
+                }
+                io_uring_sqe_set_data(sqe, &req[i]);
+        }
+        queued = i;
+        /* Completions may arrive before io_uring_submit() returns */
+        w.pending = queued;
+        while (i > 0) {
+                /* Entries left in the queue refer to this stack frame and
+                 * must be consumed by the kernel before returning. Failures
+                 * are transient, e.g. while the reaper catches up. */
+                int res = io_uring_submit(&ring);
+                if (res > 0) {
+                        i -= res;
+                        continue;
+                }
+                if (res != -EBUSY && res != -EAGAIN && res != -EINTR)
+                        printd(1, "io_uring_submit: %s\n", strerror(-res));
+                sched_yield();
+        }
+        pthread_mutex_unlock(&sq_lock);
+
+        /* Whatever did not fit in the submission queue */
+        for (i = queued; i < n; i++)
+                __pread(&io[i]);
+
+        pthread_mutex_lock(&w.lock);
+        while (w.pending)
+                pthread_cond_wait(&w.cond, &w.lock);
+        pthread_mutex_unlock(&w.lock);
+        pthread_cond_destroy(&w.cond);
+        pthread_mutex_destroy(&w.lock);
+
+        /* Transient failures are retried synchronously */
+        for (i = 0; i < queued; i++) {
+                if (io[i].res == -EAGAIN || io[i].res == -EINTR)
+                        __pread(&io[i]);
+        }
+}
+#endif
+
+/*!
+ *****************************************************************************
+ * Read all of |io| and wait for the result. Each request is completed with
+ * either the number of bytes read or -errno in |res|.
+ ****************************************************************************/
+void uring_read(struct uring_io *io, int n)
+{
+        int i;
+
+#ifdef HAVE_LIBURING
+        if (ring_ok && n > 0) {
+                while (n > URING_MAX_BATCH) {
+                        __uring_read(io, URING_MAX_BATCH);
+                        io += URING_MAX_BATCH;
+                        n -= URING_MAX_BATCH;
+                }
+                __uring_read(io, n);
+                return;
+        }
+#endif
+        for (i = 0; i < n; i++)
+                __pread(&io[i]);
+}
+
+/*!
+ *****************************************************************************
+ * Register |fd| with the ring. Returns the file index to use in
+ * struct uring_io or -1 if not registered.
+ ****************************************************************************/
+int uring_register(int fd)
+{
+#ifdef HAVE_LIBURING
+        int slot = -1;
+        int i;
+
+        if (!ring_ok)
+                return -1;
+        pthread_mutex_lock(&slot_lock);
+        for (i = 0; i < URING_FILES; i++) {
+                int s = (slot_hint + i) % URING_FILES;
+                if (slots[s] == -1) {
+                        if (io_uring_register_files_update(&ring, s, &fd, 1) == 1) {
+                                slots[s] = fd;
+                                slot = s;
+                                slot_hint = s + 1;
+                        }
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&slot_lock);
+        return slot;
+#else
+        (void)fd;               /* touch */
+        return -1;
+#endif
+}
+
+/*!
+ *****************************************************************************
+ * Drop a registration made by uring_register(). Must be called before the
+ * descriptor is closed.
+ ****************************************************************************/
+void uring_unregister(int slot)
+{
+#ifdef HAVE_LIBURING
+        int fd = -1;
+
+        if (!ring_ok || slot < 0 || slot >= URING_FILES)
+                return;
+        pthread_mutex_lock(&slot_lock);
+        (void)io_uring_register_files_update(&ring, slot, &fd, 1);
+        slots[slot] = -1;
+        if (slot < slot_hint)
+                slot_hint = slot;
+        pthread_mutex_unlock(&slot_lock);
+#else
+        (void)slot;             /* touch */
+#endif
+}
+
+/*!
+ *****************************************************************************
+ * Set up the shared ring with |depth| submission queue entries.
+ * Returns 0 on success or -errno if io_uring is not available, in which
+ * case all reads fall back to pread(2).
+ ****************************************************************************/
+int uring_init(unsigned int depth)
+{
+#ifdef HAVE_LIBURING
+        int res;
+        int i;
+
+        if (ring_ok)
+                return 0;
+        res = io_uring_queue_init(depth, &ring, 0);
+        if (res < 0)
+                return res;
+        slots = malloc(URING_FILES * sizeof(int));
+        if (!slots) {
+                io_uring_queue_exit(&ring);
+                return -ENOMEM;
+        }
+        for (i = 0; i < URING_FILES; i++)
+                slots[i] = -1;
+        /* Sparse table, entries are filled in by uring_register(). Without
+         * a table all registrations simply fail and plain descriptors are
+         * used instead. */
+        res = io_uring_register_files(&ring, slots, URING_FILES);
+        if (res < 0)
+                printd(1, "io_uring_register_files: %s\n", strerror(-res));
+        if (pthread_create(&reaper, NULL, __reaper, NULL)) {
+                io_uring_queue_exit(&ring);
+                free(slots);
+                slots = NULL;
+                return -EAGAIN;
+        }
+        ring_ok = 1;
+        return 0;
+#else
+        (void)depth;            /* touch */
+        return -ENOSYS;
+#endif
+}
+
+/*!
+ *****************************************************************************
+ * Returns non-zero if reads are served by the ring.
+ ****************************************************************************/
+int uring_enabled()
+{
+#ifdef HAVE_LIBURING
+        return ring_ok;
+#else
+        return 0;
+#endif
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void uring_destroy()
+{
+#ifdef HAVE_LIBURING
+        struct io_uring_sqe *sqe;
+
+        if (!ring_ok)
+                return;
+        pthread_mutex_lock(&sq_lock);
+        sqe = io_uring_get_sqe(&ring);
+        while (!sqe) {
+                (void)io_uring_submit(&ring);
+                sqe = io_uring_get_sqe(&ring);
+        }
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, NULL);
+        (void)io_uring_submit(&ring);
+        pthread_mutex_unlock(&sq_lock);
+        pthread_join(reaper, NULL);
+
+        ring_ok = 0;
+        io_uring_queue_exit(&ring);
+        free(slots);
+        slots = NULL;
+        slot_hint = 0;
+#endif
+}
@@ -0,0 +1,51 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <platform.h>
+#include <sys/types.h>
+
+struct uring_io {
+        int fd;
+        int slot;               /* registered file index or -1 */
+        void *buf;
+        size_t len;
+        off_t offset;
+        ssize_t res;            /* bytes read or -errno */
+};
+
+int uring_init(unsigned int depth);
+int uring_enabled();
+void uring_destroy();
+int uring_register(int fd);
+void uring_unregister(int slot);
+void uring_read(struct uring_io *io, int n);
+
+#endif
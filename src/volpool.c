@@ -0,0 +1,254 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "debug.h"
+#include "hashtable.h"
+#include "volpool.h"
+#include "uring.h"
+
+#define VOLPOOL_SZ 1024
+
+/*
+ * A pool holds the read-only file descriptors of all volumes of an archive
+ * opened so far. Descriptors are used with positional I/O only and thus
+ * carry no state, so they can be shared freely between any number of
+ * concurrent readers. The pool, and the descriptors in it, live for as
+ * long as there is at least one reference to it.
+ */
+struct volpool {
+        const char *key;        /* owned by the hash table */
+        int refs;
+        int nfd;
+        int *fd;
+        int *slot;              /* io_uring file index, see uring_register() */
+        pthread_mutex_t lock;
+};
+
+static void *ht = NULL;
+static pthread_mutex_t volpool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__alloc()
+{
+        return calloc(1, sizeof(struct volpool));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __free(const char *key, void *data)
+{
+        struct volpool *vp = data;
+        int i;
+
+        (void)key;              /* touch */
+        for (i = 0; i < vp->nfd; i++) {
+                uring_unregister(vp->slot[i]);
+                if (vp->fd[i] != -1)
+                        close(vp->fd[i]);
+        }
+        free(vp->fd);
+        free(vp->slot);
+        pthread_mutex_destroy(&vp->lock);
+        free(vp);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void volpool_init()
+{
+        static struct hash_table_ops ops = {
+                .alloc = __alloc,
+                .free = __free,
+        };
+
+        pthread_mutex_lock(&volpool_lock);
+        if (!ht)
+                ht = hashtable_init(VOLPOOL_SZ, &ops);
+        pthread_mutex_unlock(&volpool_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void volpool_destroy()
+{
+        pthread_mutex_lock(&volpool_lock);
+        if (ht) {
+                hashtable_destroy(ht);
+                ht = NULL;
+        }
+        pthread_mutex_unlock(&volpool_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Get a reference to the volume pool of archive 'key'.
+ ****************************************************************************/
+struct volpool *volpool_get(const char *key)
+{
+        struct hash_table_entry *he;
+        struct volpool *vp = NULL;
+
+        pthread_mutex_lock(&volpool_lock);
+        if (!ht)
+                goto out;
+        he = hashtable_entry_get(ht, key);
+        if (!he) {
+                he = hashtable_entry_alloc(ht, key);
+                if (!he)
+                        goto out;
+                vp = he->user_data;
+                vp->key = he->key;
+                pthread_mutex_init(&vp->lock, NULL);
+        }
+        vp = he->user_data;
+        ++vp->refs;
+out:
+        pthread_mutex_unlock(&volpool_lock);
+        return vp;
+}
+
+/*!
+ *****************************************************************************
+ * Take another reference to an already referenced pool.
+ ****************************************************************************/
+struct volpool *volpool_dup(struct volpool *vp)
+{
+        pthread_mutex_lock(&volpool_lock);
+        ++vp->refs;
+        pthread_mutex_unlock(&volpool_lock);
+        return vp;
+}
+
+/*!
+ *****************************************************************************
+ * Drop a reference. Descriptors are closed along with the last reference.
+ ****************************************************************************/
+void volpool_put(struct volpool *vp)
+{
+        pthread_mutex_lock(&volpool_lock);
+        if (!--vp->refs) {
+                printd(3, "Closing %d volume(s) of %s\n", vp->nfd, vp->key);
+                if (ht)
+                        hashtable_entry_delete(ht, vp->key);
+        }
+        pthread_mutex_unlock(&volpool_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Return descriptor of volume 'vol' or -1 if it is not yet opened.
+ ****************************************************************************/
+int volpool_fd(struct volpool *vp, int vol)
+{
+        int fd = -1;
+
+        pthread_mutex_lock(&vp->lock);
+        if (vol >= 0 && vol < vp->nfd)
+                fd = vp->fd[vol];
+        pthread_mutex_unlock(&vp->lock);
+        return fd;
+}
+
+/*!
+ *****************************************************************************
+ * Return io_uring file index of volume 'vol' or -1 if not registered.
+ ****************************************************************************/
+int volpool_slot(struct volpool *vp, int vol)
+{
+        int slot = -1;
+
+        pthread_mutex_lock(&vp->lock);
+        if (vol >= 0 && vol < vp->nfd)
+                slot = vp->slot[vol];
+        pthread_mutex_unlock(&vp->lock);
+        return slot;
+}
+
+/*!
+ *****************************************************************************
+ * Open 'path' as volume 'vol' unless already opened by someone else.
+ * Returns the descriptor or -errno on failure.
+ ****************************************************************************/
+int volpool_open(struct volpool *vp, int vol, const char *path)
+{
+        int fd;
+
+        if (vol < 0)
+                return -EINVAL;
+
+        /* Do not hold the lock across a potentially slow open() */
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+                return -errno;
+
+        pthread_mutex_lock(&vp->lock);
+        if (vol >= vp->nfd) {
+                int n = vol + 1;
+                int *tmp = realloc(vp->fd, n * sizeof(int));
+                int *tmp2 = tmp ? realloc(vp->slot, n * sizeof(int)) : NULL;
+                if (!tmp2) {
+                        if (tmp)
+                                vp->fd = tmp;
+                        pthread_mutex_unlock(&vp->lock);
+                        close(fd);
+                        return -ENOMEM;
+                }
+                vp->fd = tmp;
+                vp->slot = tmp2;
+                while (vp->nfd < n) {
+                        tmp[vp->nfd] = -1;
+                        tmp2[vp->nfd++] = -1;
+                }
+        }
+        if (vp->fd[vol] != -1) {
+                /* Lost the race */
+                close(fd);
+                fd = vp->fd[vol];
+        } else {
+                vp->fd[vol] = fd;
+                vp->slot[vol] = uring_register(fd);
+        }
+        pthread_mutex_unlock(&vp->lock);
+        return fd;
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#ifndef VOLPOOL_H_
+#define VOLPOOL_H_
+
+#include <platform.h>
+
+struct volpool;
+
+void volpool_init();
+void volpool_destroy();
+struct volpool *volpool_get(const char *key);
+struct volpool *volpool_dup(struct volpool *vp);
+void volpool_put(struct volpool *vp);
+int volpool_fd(struct volpool *vp, int vol);
+int volpool_slot(struct volpool *vp, int vol);
+int volpool_open(struct volpool *vp, int vol, const char *path);
+
+#endif
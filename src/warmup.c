@@ -0,0 +1,563 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "warmup.h"
+
+/*
+ * The warmup crawls the source folder using a fixed set of workers. Each
+ * worker owns a deque of directories still to be visited. Sub-directories
+ * found by a worker are pushed to its own deque and popped in LIFO order
+ * to keep locality, while idle workers steal the oldest, and typically
+ * largest, subtrees from the other deques.
+ *
+ * Visiting a directory (listing its archives) is I/O bound. The number of
+ * workers allowed to do so concurrently is adjusted by a simple hill
+ * climber on the observed visit rate, so that spinning disks are not
+ * thrashed by seeks while fast storage still gets a deep queue.
+ */
+
+#define WQ_INIT_SZ 64
+#define ADAPT_WINDOW 16         /* visits per adaption step */
+#define REPORT_INTERVAL 10      /* seconds between progress reports */
+
+struct wq {
+        pthread_mutex_t lock;
+        char **task;
+        size_t size;            /* always a power of 2 */
+        size_t top;             /* next task to steal */
+        size_t bottom;          /* next free slot */
+};
+
+struct worker {
+        struct wq q;
+        pthread_t t;
+        unsigned int seed;
+} __attribute__((aligned(64)));
+
+static pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct worker *workers = NULL;
+static int n_workers = 0;
+static int n_threads = 0;
+static int (*visit_cb)(const char *) = NULL;
+static size_t src_len = 0;
+static int cancelled = 0;
+static long pending = 0;        /* tasks queued or in progress */
+
+/* Protected by sched_lock */
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long work_gen = 0;
+static int idle = 0;
+static int io_active = 0;
+static int io_limit = 1;
+static int io_step = 1;
+static double io_rate = 0;
+static unsigned int win_cnt = 0;
+static double win_start = 0;
+static double t_start = 0;
+static double t_end = 0;
+static double next_report = 0;
+static unsigned long dirs_found = 0;
+static unsigned long dirs_scanned = 0;
+static unsigned long archives = 0;
+static int running = 0;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static double __now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __wq_push(struct wq *q, char *task)
+{
+        pthread_mutex_lock(&q->lock);
+        if (q->bottom - q->top == q->size) {
+                size_t size = q->size ? q->size * 2 : WQ_INIT_SZ;
+                char **t = malloc(size * sizeof(char *));
+                size_t i;
+                if (!t) {
+                        pthread_mutex_unlock(&q->lock);
+                        return -ENOMEM;
+                }
+                for (i = q->top; i != q->bottom; i++)
+                        t[i & (size - 1)] = q->task[i & (q->size - 1)];
+                free(q->task);
+                q->task = t;
+                q->size = size;
+        }
+        q->task[q->bottom++ & (q->size - 1)] = task;
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static char *__wq_pop(struct wq *q)
+{
+        char *task = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->bottom != q->top)
+                task = q->task[--q->bottom & (q->size - 1)];
+        pthread_mutex_unlock(&q->lock);
+        return task;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static char *__wq_steal(struct wq *q)
+{
+        char *task = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->bottom != q->top)
+                task = q->task[q->top++ & (q->size - 1)];
+        pthread_mutex_unlock(&q->lock);
+        return task;
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with sched_lock held.
+ ****************************************************************************/
+static void __report(double now)
+{
+        long eta = -1;
+
+        if (dirs_scanned)
+                eta = (now - t_start) * (dirs_found - dirs_scanned) /
+                        dirs_scanned;
+        syslog(LOG_DEBUG, "cache warmup: %lu of %lu directories scanned, "
+               "%lu archives listed, ETA %lds", dirs_scanned, dirs_found,
+               archives, eta);
+        printd(3, "cache warmup: %lu/%lu dirs, %lu archives, limit %d, ETA %lds\n",
+               dirs_scanned, dirs_found, archives, io_limit, eta);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __done()
+{
+        if (__atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL))
+                return;
+
+        pthread_mutex_lock(&sched_lock);
+        if (running) {
+                t_end = __now();
+                syslog(LOG_DEBUG, "cache warmup completed after %d seconds",
+                       (int)(t_end - t_start));
+        }
+        running = 0;
+        pthread_cond_broadcast(&sched_cond);
+        pthread_mutex_unlock(&sched_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __submit(struct worker *w, char *path)
+{
+        __atomic_add_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+        if (__wq_push(&w->q, path)) {
+                free(path);
+                __done();
+                return;
+        }
+        pthread_mutex_lock(&sched_lock);
+        ++dirs_found;
+        ++work_gen;
+        if (idle)
+                pthread_cond_signal(&sched_cond);
+        pthread_mutex_unlock(&sched_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Return the next directory to visit, from the own deque or else stolen
+ * from another worker. Returns NULL when all work is done or cancelled.
+ ****************************************************************************/
+static char *__get_task(struct worker *w)
+{
+        unsigned long gen;
+        char *task;
+        int victim;
+        int i;
+
+        for (;;) {
+                pthread_mutex_lock(&sched_lock);
+                gen = work_gen;
+                pthread_mutex_unlock(&sched_lock);
+
+                if (__atomic_load_n(&cancelled, __ATOMIC_RELAXED))
+                        return NULL;
+                task = __wq_pop(&w->q);
+                if (task)
+                        return task;
+                victim = rand_r(&w->seed) % n_workers;
+                for (i = 0; i < n_workers; i++) {
+                        struct worker *v = &workers[(victim + i) % n_workers];
+                        if (v != w && (task = __wq_steal(&v->q)))
+                                return task;
+                }
+
+                pthread_mutex_lock(&sched_lock);
+                if (cancelled || !__atomic_load_n(&pending, __ATOMIC_ACQUIRE)) {
+                        pthread_mutex_unlock(&sched_lock);
+                        return NULL;
+                }
+                /* Only sleep if nothing was pushed while searching */
+                if (gen == work_gen) {
+                        ++idle;
+                        pthread_cond_wait(&sched_cond, &sched_lock);
+                        --idle;
+                }
+                pthread_mutex_unlock(&sched_lock);
+        }
+}
+
+/*!
+ *****************************************************************************
+ * Must be called with sched_lock held.
+ ****************************************************************************/
+static void __adapt(double now)
+{
+        double rate = win_cnt / (now - win_start > 0 ? now - win_start : 1e-9);
+
+        /* Keep going in the same direction as long as the rate improves */
+        if (rate < io_rate)
+                io_step = -io_step;
+        io_rate = rate;
+        io_limit += io_step;
+        if (io_limit < 1)
+                io_limit = 1;
+        if (io_limit > n_threads)
+                io_limit = n_threads;
+        win_cnt = 0;
+        win_start = now;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __io_enter()
+{
+        pthread_mutex_lock(&sched_lock);
+        while (!cancelled && io_active >= io_limit)
+                pthread_cond_wait(&io_cond, &sched_lock);
+        if (cancelled) {
+                pthread_mutex_unlock(&sched_lock);
+                return 0;
+        }
+        ++io_active;
+        pthread_mutex_unlock(&sched_lock);
+        return 1;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __io_leave(int n)
+{
+        double now = __now();
+
+        pthread_mutex_lock(&sched_lock);
+        --io_active;
+        ++dirs_scanned;
+        archives += n > 0 ? n : 0;
+        if (++win_cnt == ADAPT_WINDOW)
+                __adapt(now);
+        if (now >= next_report) {
+                next_report = now + REPORT_INTERVAL;
+                __report(now);
+        }
+        pthread_cond_broadcast(&io_cond);
+        pthread_mutex_unlock(&sched_lock);
+}
+
+/*!
+ *****************************************************************************
+ * Push all sub-directories of 'dname', not following symbolic links.
+ ****************************************************************************/
+static void __scan(struct worker *w, const char *dname)
+{
+        struct dirent *dent;
+        DIR *dir = NULL;
+        char *fn = NULL;
+        struct stat st;
+        int len;
+
+        len = strlen(dname);
+#ifdef PATH_MAX
+        if (len >= PATH_MAX - 1)
+                return;
+#endif
+
+        dir = opendir(dname);
+        if (dir == NULL)
+                return;
+
+#ifdef NAME_MAX
+        size_t fn_size = len + NAME_MAX + 2;
+#else
+        size_t fn_size = len + 256 + 2; /* Fallback if NAME_MAX not defined */
+#endif
+        fn = malloc(fn_size);
+        if (fn == NULL)
+                goto out;
+
+        memcpy(fn, dname, len);
+        fn[len++] = '/';
+
+        /* Every worker has its own DIR stream so readdir(3) is safe here */
+        while ((dent = readdir(dir))) {
+                if (__atomic_load_n(&cancelled, __ATOMIC_RELAXED))
+                        break;
+                /* Skip '.' and '..' */
+                if (dent->d_name[0] == '.') {
+                        if (dent->d_name[1] == 0 ||
+                                        (dent->d_name[1] == '.' &&
+                                        dent->d_name[2] == 0))
+                                continue;
+                }
+
+                snprintf(fn + len, fn_size - len, "%s", dent->d_name);
+#ifdef _DIRENT_HAVE_D_TYPE
+                if (dent->d_type != DT_UNKNOWN) {
+                        if (dent->d_type == DT_DIR) {
+                                char *s = strdup(fn);
+                                if (s)
+                                        __submit(w, s);
+                        }
+                        continue;
+                }
+#endif
+                if (lstat(fn, &st) == -1)
+                        continue;
+                /* will be false for symlinked dirs */
+                if (S_ISDIR(st.st_mode)) {
+                        char *s = strdup(fn);
+                        if (s)
+                                __submit(w, s);
+                }
+        }
+
+out:
+        free(fn);
+        closedir(dir);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__worker(void *data)
+{
+        struct worker *w = data;
+        char *dname;
+
+        while ((dname = __get_task(w))) {
+                const char *root = &dname[src_len];
+
+                if (*root == '\0')
+                        root = "/";
+                /* Publish sub-directories first to keep other workers busy */
+                __scan(w, dname);
+                if (__io_enter())
+                        __io_leave(visit_cb(root));
+                free(dname);
+                __done();
+        }
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Start crawling 'root' using 'nthreads' workers, calling 'visit' for every
+ * directory found with its path relative to 'root'. 'visit' should return
+ * the number of archives listed.
+ ****************************************************************************/
+int warmup_start(const char *root, int nthreads, int (*visit)(const char *))
+{
+        char *s;
+        int i;
+
+        if (nthreads <= 0)
+                return -EINVAL;
+
+        pthread_mutex_lock(&ctl_lock);
+        if (workers) {
+                pthread_mutex_unlock(&ctl_lock);
+                return -EBUSY;
+        }
+        if (posix_memalign((void **)&workers, 64,
+                           nthreads * sizeof(struct worker))) {
+                workers = NULL;
+                pthread_mutex_unlock(&ctl_lock);
+                return -ENOMEM;
+        }
+        memset(workers, 0, nthreads * sizeof(struct worker));
+        for (i = 0; i < nthreads; i++) {
+                pthread_mutex_init(&workers[i].q.lock, NULL);
+                workers[i].seed = i + 1;
+        }
+        n_workers = nthreads;
+        n_threads = 0;
+        visit_cb = visit;
+        src_len = strlen(root);
+        cancelled = 0;
+        pending = 0;
+
+        pthread_mutex_lock(&sched_lock);
+        dirs_found = 0;
+        dirs_scanned = 0;
+        archives = 0;
+        io_active = 0;
+        io_limit = nthreads > 1 ? nthreads / 2 : 1;
+        io_step = 1;
+        io_rate = 0;
+        win_cnt = 0;
+        t_start = win_start = __now();
+        t_end = 0;
+        next_report = t_start + REPORT_INTERVAL;
+        running = 1;
+        pthread_mutex_unlock(&sched_lock);
+
+        syslog(LOG_DEBUG, "cache warmup started");
+        s = strdup(root);
+        if (s)
+                __submit(&workers[0], s);
+        for (i = 0; i < nthreads; i++) {
+                if (pthread_create(&workers[i].t, NULL, __worker, &workers[i])) {
+                        printd(1, "warmup_start: failed to create worker %d\n", i);
+                        break;
+                }
+                ++n_threads;
+        }
+        pthread_mutex_unlock(&ctl_lock);
+        if (!n_threads) {
+                warmup_stop();
+                return -EAGAIN;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Cancel a running warmup, if any, and wait for all workers to exit.
+ ****************************************************************************/
+void warmup_stop()
+{
+        int i;
+
+        pthread_mutex_lock(&ctl_lock);
+        if (!workers) {
+                pthread_mutex_unlock(&ctl_lock);
+                return;
+        }
+        pthread_mutex_lock(&sched_lock);
+        __atomic_store_n(&cancelled, 1, __ATOMIC_RELAXED);
+        if (running)
+                t_end = __now();
+        running = 0;
+        pthread_cond_broadcast(&sched_cond);
+        pthread_cond_broadcast(&io_cond);
+        pthread_mutex_unlock(&sched_lock);
+
+        for (i = 0; i < n_threads; i++)
+                pthread_join(workers[i].t, NULL);
+        for (i = 0; i < n_workers; i++) {
+                struct wq *q = &workers[i].q;
+                while (q->bottom != q->top)
+                        free(q->task[q->top++ & (q->size - 1)]);
+                free(q->task);
+                pthread_mutex_destroy(&q->lock);
+        }
+        free(workers);
+        workers = NULL;
+        n_workers = 0;
+        n_threads = 0;
+        pthread_mutex_unlock(&ctl_lock);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void warmup_get_stats(struct warmup_stats *stats)
+{
+        double now = __now();
+
+        pthread_mutex_lock(&sched_lock);
+        stats->dirs_found = dirs_found;
+        stats->dirs_scanned = dirs_scanned;
+        stats->archives = archives;
+        stats->workers = n_threads;
+        stats->limit = io_limit;
+        stats->running = running;
+        if (t_start)
+                stats->elapsed = (long)((running ? now : t_end) - t_start);
+        else
+                stats->elapsed = 0;
+        stats->eta = -1;
+        if (running && dirs_scanned)
+                stats->eta = (now - t_start) * (dirs_found - dirs_scanned) /
+                        dirs_scanned;
+        pthread_mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,551 @@
+/*
+    Copyright (C) 2009 Hans Beckerus (hans.beckerus@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    This program take use of the freeware "Unrar C++ Library" (libunrar)
+    by Alexander Roshal and some extensions to it.
+
+    Unrar source may be used in any software to handle RAR archives
+    without limitations free of charge, but cannot be used to re-create
+    the RAR compression algorithm, which is proprietary. Distribution
+    of modified Unrar source in separate form or as a part of other
+    software is permitted, provided that it is clearly stated in
+    the documentation and source comments that the code may not be used
+    to develop a RAR (WinRAR) compatible archiver.
+*/
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#include "debug.h"
+#include "hashtable.h"
+#include "common.h"
+#include "watcher.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/*
+ * Every directory below the root is watched individually. Changes are
+ * collected per directory and handed to the user once no new event has
+ * arrived for WATCH_DELAY ms, or at the latest after WATCH_MAX_DELAY
+ * seconds, such that e.g. a volume set being copied does not cause one
+ * re-list per volume.
+ */
+#define WATCH_SZ 1024
+#define WATCH_DELAY 1000
+#define WATCH_MAX_DELAY 10
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM |\
+                    IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+#define CHANGE_TOUCHED 1
+#define CHANGE_RELIST 2
+
+struct watch {
+        char *path;
+        int wd;
+};
+
+struct rm_arg {
+        const char *path;
+        size_t len;
+        int *wd;
+        int n;
+        int max;
+};
+
+static pthread_t watch_thread;
+static int watch_thread_running = 0;
+static int ifd = -1;
+static int stop_pipe[2] = {-1, -1};
+static char *watch_root = NULL;
+static struct watcher_ops watch_ops;
+static void *watches = NULL;            /* wd -> struct watch */
+static void *changes = NULL;            /* path -> CHANGE_xxx */
+static int n_changes = 0;
+static time_t first_change = 0;
+static int overflow = 0;
+static int watch_limit_hit = 0;
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__watch_alloc()
+{
+        return calloc(1, sizeof(struct watch));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __watch_free(const char *key, void *data)
+{
+        struct watch *w = data;
+
+        (void)key;
+        if (w)
+                free(w->path);
+        free(w);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__change_alloc()
+{
+        return calloc(1, sizeof(int));
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __change_free(const char *key, void *data)
+{
+        (void)key;
+        free(data);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static int __add_watch(const char *path)
+{
+        struct hash_table_entry *hte;
+        struct watch *w;
+        char key[16];
+        char *abs;
+        size_t len;
+        int wd;
+
+        len = strlen(watch_root) + strlen(path) + 1;
+        abs = malloc(len);
+        if (!abs)
+                return -ENOMEM;
+        snprintf(abs, len, "%s%s", watch_root, path);
+        wd = inotify_add_watch(ifd, abs, WATCH_MASK);
+        free(abs);
+        if (wd < 0) {
+                if (errno == ENOSPC && !watch_limit_hit) {
+                        watch_limit_hit = 1;
+                        syslog(LOG_WARNING, "inotify watch limit reached, "
+                               "not all directories are watched");
+                }
+                return -errno;
+        }
+
+        snprintf(key, sizeof(key), "%d", wd);
+        hte = hashtable_entry_alloc(watches, key);
+        if (!hte) {
+                inotify_rm_watch(ifd, wd);
+                return -ENOMEM;
+        }
+        w = hte->user_data;
+        free(w->path);
+        w->path = strdup(path);
+        w->wd = wd;
+        if (!w->path) {
+                inotify_rm_watch(ifd, wd);
+                hashtable_entry_delete(watches, key);
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+/*!
+ *****************************************************************************
+ * Watch 'path' and all directories below it.
+ ****************************************************************************/
+static void __add_tree(const char *path)
+{
+        struct dirent *dent;
+        struct stat st;
+        char *abs;
+        size_t len;
+        DIR *dir;
+
+        if (__add_watch(path))
+                return;
+
+        len = strlen(watch_root) + strlen(path) + 1;
+        abs = malloc(len);
+        if (!abs)
+                return;
+        snprintf(abs, len, "%s%s", watch_root, path);
+        dir = opendir(abs);
+        if (!dir) {
+                free(abs);
+                return;
+        }
+        while ((dent = readdir(dir))) {
+                char *tmp;
+                int is_dir = 0;
+
+                if (dent->d_name[0] == '.') {
+                        if (dent->d_name[1] == 0 ||
+                                        (dent->d_name[1] == '.' &&
+                                        dent->d_name[2] == 0))
+                                continue;
+                }
+#ifdef _DIRENT_HAVE_D_TYPE
+                if (dent->d_type != DT_UNKNOWN) {
+                        is_dir = dent->d_type == DT_DIR;
+                } else
+#endif
+                {
+                        ABS_MP2(tmp, abs, dent->d_name);
+                        if (tmp && !lstat(tmp, &st))
+                                is_dir = S_ISDIR(st.st_mode);
+                        free(tmp);
+                }
+                if (!is_dir)
+                        continue;
+                ABS_MP2(tmp, path, dent->d_name);
+                if (tmp)
+                        __add_tree(tmp);
+                free(tmp);
+        }
+        closedir(dir);
+        free(abs);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __rm_cb(const char *key, void *data, void *arg)
+{
+        struct watch *w = data;
+        struct rm_arg *a = arg;
+
+        (void)key;
+        if (strncmp(w->path, a->path, a->len) ||
+            (w->path[a->len] && w->path[a->len] != '/'))
+                return;
+        if (a->n == a->max) {
+                int max = a->max ? a->max * 2 : 16;
+                int *wd = realloc(a->wd, max * sizeof(int));
+                if (!wd)
+                        return;
+                a->wd = wd;
+                a->max = max;
+        }
+        a->wd[a->n++] = w->wd;
+}
+
+/*!
+ *****************************************************************************
+ * Stop watching 'path' and all directories below it.
+ ****************************************************************************/
+static void __rm_tree(const char *path)
+{
+        struct rm_arg a = { path, strlen(path), NULL, 0, 0 };
+        char key[16];
+        int i;
+
+        hashtable_foreach(watches, __rm_cb, &a);
+        for (i = 0; i < a.n; i++) {
+                inotify_rm_watch(ifd, a.wd[i]);
+                snprintf(key, sizeof(key), "%d", a.wd[i]);
+                hashtable_entry_delete(watches, key);
+        }
+        free(a.wd);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __note(const char *path, int flags)
+{
+        struct hash_table_entry *hte;
+        int *f;
+
+        hte = hashtable_entry_alloc(changes, path);
+        if (!hte) {
+                /* Better lose everything than losing something */
+                overflow = 1;
+                return;
+        }
+        f = hte->user_data;
+        if (!*f && !n_changes++)
+                first_change = time(NULL);
+        *f |= flags;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __flush_cb(const char *key, void *data, void *arg)
+{
+        (void)arg;
+        watch_ops.changed(key, *(int *)data & CHANGE_RELIST);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __flush()
+{
+        if (overflow) {
+                printd(3, "watcher: events lost, invalidating everything\n");
+                watch_ops.changed(NULL, 1);
+                overflow = 0;
+        } else {
+                hashtable_foreach(changes, __flush_cb, NULL);
+        }
+        hashtable_entry_delete(changes, NULL);
+        n_changes = 0;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __event(const struct inotify_event *ev)
+{
+        struct hash_table_entry *hte;
+        struct watch *w;
+        char key[16];
+        char *path;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+                return;
+        }
+        snprintf(key, sizeof(key), "%d", ev->wd);
+        hte = hashtable_entry_get(watches, key);
+        if (!hte)
+                return;
+        if (ev->mask & IN_IGNORED) {
+                hashtable_entry_delete(watches, key);
+                return;
+        }
+        if (!ev->len)
+                return;
+        w = hte->user_data;
+
+        if (ev->mask & IN_ISDIR) {
+                ABS_MP2(path, w->path, ev->name);
+                if (path) {
+                        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                                __add_tree(path);
+                        else if (ev->mask & IN_MOVED_FROM)
+                                __rm_tree(path);
+                        free(path);
+                }
+                __note(w->path, CHANGE_TOUCHED);
+                return;
+        }
+        /*
+         * Archives may appear without ever being written, eg. as links to
+         * volumes stored elsewhere. A created file that is still being
+         * written is simply listed once more on IN_CLOSE_WRITE.
+         */
+        if (watch_ops.filter(ev->name))
+                __note(w->path, CHANGE_RELIST);
+        else
+                __note(w->path, CHANGE_TOUCHED);
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void *__watch_task(void *data)
+{
+        char buf[4096]
+                __attribute__((aligned(__alignof__(struct inotify_event))));
+
+        (void)data;
+
+        __add_tree("/");
+        for (;;) {
+                struct pollfd pfd[2];
+                int timeout = -1;
+                ssize_t len;
+                char *p;
+                int res;
+
+                if (n_changes || overflow) {
+                        if (overflow ||
+                            time(NULL) - first_change >= WATCH_MAX_DELAY) {
+                                __flush();
+                                continue;
+                        }
+                        timeout = WATCH_DELAY;
+                }
+                pfd[0].fd = ifd;
+                pfd[0].events = POLLIN;
+                pfd[1].fd = stop_pipe[0];
+                pfd[1].events = POLLIN;
+                res = poll(pfd, 2, timeout);
+                if (res < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        break;
+                }
+                if (pfd[1].revents)
+                        break;
+                if (!res) {
+                        __flush();
+                        continue;
+                }
+                len = read(ifd, buf, sizeof(buf));
+                if (len <= 0) {
+                        if (len < 0 && (errno == EINTR || errno == EAGAIN))
+                                continue;
+                        break;
+                }
+                for (p = buf; p < buf + len; ) {
+                        const struct inotify_event *ev =
+                                (const struct inotify_event *)p;
+                        __event(ev);
+                        p += sizeof(struct inotify_event) + ev->len;
+                }
+        }
+        return NULL;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+static void __cleanup()
+{
+        if (watches)
+                hashtable_destroy(watches);
+        if (changes)
+                hashtable_destroy(changes);
+        watches = NULL;
+        changes = NULL;
+        n_changes = 0;
+        overflow = 0;
+        if (stop_pipe[0] != -1) {
+                close(stop_pipe[0]);
+                close(stop_pipe[1]);
+        }
+        stop_pipe[0] = stop_pipe[1] = -1;
+        if (ifd != -1)
+                close(ifd);
+        ifd = -1;
+        free(watch_root);
+        watch_root = NULL;
+}
+
+/*!
+ *****************************************************************************
+ * Start watching the directory tree below 'root'. The callbacks in 'ops'
+ * are invoked from a dedicated thread.
+ ****************************************************************************/
+int watcher_init(const char *root, struct watcher_ops *ops)
+{
+        struct hash_table_ops w_ops = {
+                .alloc = __watch_alloc,
+                .free = __watch_free,
+        };
+        struct hash_table_ops c_ops = {
+                .alloc = __change_alloc,
+                .free = __change_free,
+        };
+        int res;
+
+        if (watch_thread_running)
+                return -EBUSY;
+
+        ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (ifd == -1)
+                return -errno;
+        if (pipe(stop_pipe)) {
+                res = -errno;
+                stop_pipe[0] = stop_pipe[1] = -1;
+                goto error;
+        }
+        watch_root = strdup(root);
+        watches = hashtable_init(WATCH_SZ, &w_ops);
+        changes = hashtable_init(64, &c_ops);
+        if (!watch_root || !watches || !changes) {
+                res = -ENOMEM;
+                goto error;
+        }
+        watch_ops = *ops;
+        watch_limit_hit = 0;
+        res = pthread_create(&watch_thread, NULL, __watch_task, NULL);
+        if (res) {
+                res = -res;
+                goto error;
+        }
+        watch_thread_running = 1;
+        return 0;
+
+error:
+        __cleanup();
+        return res;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void watcher_destroy()
+{
+        if (!watch_thread_running)
+                return;
+        NO_UNUSED_RESULT write(stop_pipe[1], "", 1);
+        pthread_join(watch_thread, NULL);
+        watch_thread_running = 0;
+        __cleanup();
+}
+
+#else
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+int watcher_init(const char *root, struct watcher_ops *ops)
+{
+        (void)root;
+        (void)ops;
+        return -ENOSYS;
+}
+
+/*!
+ *****************************************************************************
+ *
+ ****************************************************************************/
+void watcher_destroy()
+{
+}
+
+#endif